@@ -56,6 +56,9 @@ int main(void)
 	BLANK();
 
 	DEFINE(OFFSET_TCB_CPU_REGS, offsetof(tcb_t, cpu_regs));
+#ifdef CONFIG_SCHED_SMP
+	DEFINE(OFFSET_TCB_ON_CPU, offsetof(tcb_t, on_cpu));
+#endif
 
 	BLANK();
 
@@ -17,7 +17,9 @@
  */
 
 #include <common.h>
+#include <process.h>
 #include <schedule.h>
+#include <signal.h>
 
 #include <generated/asm-offsets.h>
 
@@ -38,8 +40,53 @@ void __prefetch_abort(uint32_t ifar, uint32_t ifsr, uint32_t lr)
 	kernel_panic();
 }
 
-void __data_abort(uint32_t far, uint32_t fsr, uint32_t lr)
+/* Fault status of translation faults (section or page) */
+#define FSR_TRANSLATION_SECT	0x5
+#define FSR_TRANSLATION_PAGE	0x7
+
+/* Fault status of permission faults (section or page) */
+#define FSR_PERMISSION_SECT	0xd
+#define FSR_PERMISSION_PAGE	0xf
+
+/* The abort was caused by a write access */
+#define FSR_WNR			(1 << 11)
+
+static inline uint32_t fsr_status(uint32_t fsr)
+{
+	return (fsr & 0xf) | ((fsr >> 6) & 0x10);
+}
+
+/*
+ * Data abort handler. A translation fault on a user space address may be due to a
+ * page of the stack or the heap which has not been mapped yet, and a permission fault
+ * on write to a page shared with another process since a fork (copy-on-write).
+ * If the fault can be resolved, the handler returns so that the faulting instruction
+ * is restarted.
+ */
+void __data_abort(uint32_t far, uint32_t fsr, uint32_t lr, cpu_regs_t *regs)
 {
+	uint32_t status = fsr_status(fsr);
+	int ret = -1;
+
+	if (far < CONFIG_KERNEL_VADDR) {
+		if ((status == FSR_TRANSLATION_SECT) || (status == FSR_TRANSLATION_PAGE))
+			ret = do_page_fault(far);
+		else if (((status == FSR_PERMISSION_SECT) || (status == FSR_PERMISSION_PAGE)) && (fsr & FSR_WNR))
+			ret = do_cow_fault(far);
+
+		if (!ret)
+			return;
+
+		/* The process is terminated if the access was performed in user mode */
+		if ((regs->psr & PSR_MODE_MASK) == PSR_USR_MODE) {
+			printk("### Segmentation fault at 0x%x (pc: 0x%x) in process %d ###\n", far, lr - 8,
+			       current()->pcb->pid);
+
+			local_irq_enable();
+			do_exit(SIGSEGV);
+		}
+	}
+
 	lprintk("### On CPU %d abort exception far: %x fsr: %x lr(r14)-8: %x cr: %x current thread: %s ###\n",
 		smp_processor_id(), far, fsr, lr - 8, get_cr(), current()->name);
 
@@ -137,6 +137,9 @@
 /* R/W in kernel and user mode */
 #define TTB_L2_AP (3 << 4)
 
+/* Read-only in kernel and user mode (combined with TTB_L2_AP) */
+#define TTB_L2_APX (1 << 9)
+
 /* TTBR0 bits */
 #define TTBR0_BASE_ADDR_MASK 0xFFFFC000
 #define TTBR0_RGN_NC (0 << 3)
@@ -169,6 +172,25 @@ static inline bool l1pte_is_pt(uint32_t l1pte)
 	return ((l1pte & TTB_L1_L2) && !(l1pte & TTB_L1_SECT));
 }
 
+/*
+ * Check if a user space virtual address is currently mapped (in the current page table)
+ * by means of an address translation operation (ATS1CUR).
+ */
+static inline bool user_page_mapped(addr_t vaddr)
+{
+	uint32_t par;
+
+	asm volatile("mcr p15, 0, %1, c7, c8, 2\n\t"
+		     "isb\n\t"
+		     "mrc p15, 0, %0, c7, c4, 0"
+		     : "=r"(par)
+		     : "r"(vaddr)
+		     : "memory");
+
+	/* Bit 0 of PAR is set if the translation failed */
+	return !(par & 1);
+}
+
 /* Options available for data cache related to section */
 enum ttb_l1_sect_dcache_option {
 	L1_SECT_DCACHE_OFF = TTB_DOMAIN(0) | TTB_L1_SECT,
@@ -198,12 +220,7 @@ extern void *__sys_root_pgtable;
 
 void *current_pgtable(void);
 
-extern void *__current_pgtable;
-
-static inline void set_pgtable(addr_t *pgtable)
-{
-	__current_pgtable = pgtable;
-}
+void set_pgtable(addr_t *pgtable);
 
 extern void __mmu_switch_ttbr0(void *root_pgtable_phys);
 
@@ -227,7 +244,7 @@ void mmu_get_current_pgtable(addr_t *pgtable_paddr);
 
 void clear_l1pte(void *l1pgtable, addr_t vaddr);
 
-void mmu_switch(void *l1pgtable);
+void mmu_switch(struct pcb *pcb);
 
 void ramdev_create_mapping(void *root_pgtable, addr_t ramdev_start, addr_t ramdev_end);
 
@@ -286,12 +286,13 @@ tbl     .req    r8              @ syscall table pointer
 #include <compiler.h>
 #include <common.h>
 
+/* Start a secondary CPU (PSCI or spin table) */
+void cpu_on(unsigned long cpuid, addr_t entry_point);
+
 #ifdef CONFIG_AVZ
 
 extern char hypercall_entry[];
 
-void cpu_on(unsigned long cpuid, addr_t entry_point);
-
 struct vcpu_guest_context;
 struct domain;
 
@@ -539,6 +540,14 @@ static inline void cpu_standby(void) {
 	__asm("wfi");
 }
 
+/*
+ * Publish the ID of the running thread in the user read-only thread ID register.
+ */
+static inline void set_user_tid(unsigned long tid)
+{
+	asm volatile("mcr p15, 0, %0, c13, c0, 3	@ set TPIDRURO" : : "r" (tid));
+}
+
 #endif /* __ASSEMBLY__ */
 
 #endif /* __ASM_ARM_PROCESSOR_H */
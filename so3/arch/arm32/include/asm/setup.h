@@ -26,6 +26,7 @@
 extern struct meminfo meminfo;
 
 extern addr_t __cpu1_stack[];
+extern addr_t __cpu2_stack[];
 extern addr_t __cpu3_stack[];
 
 void setup_arch(void);
@@ -28,16 +28,24 @@
 
 #include <device/ramdev.h>
 
+#include <schedule.h>
+
 #include <asm/mmu.h>
 #include <asm/cacheflush.h>
 
-void *__current_pgtable = NULL;
+/* Page table currently in use by each CPU */
+static void *__current_pgtable[CONFIG_NR_CPUS];
 
 void *__sys_root_pgtable;
 
 void *current_pgtable(void)
 {
-	return __current_pgtable;
+	return __current_pgtable[sched_cpu()];
+}
+
+void set_pgtable(addr_t *pgtable)
+{
+	__current_pgtable[sched_cpu()] = pgtable;
 }
 
 unsigned int get_ttbr0(void)
@@ -87,10 +95,10 @@ void mmu_get_current_pgtable(addr_t *pgtable_paddr)
 }
 
 /* Reference to the system 1st-level page table */
-static void alloc_init_pte(uint32_t *l1pte, addr_t addr, addr_t end, addr_t pfn, bool nocache)
+static void alloc_init_pte(uint32_t *l1pte, addr_t addr, addr_t end, addr_t pfn, bool nocache, bool readonly)
 {
 	uint32_t *l2pte, *l2pgtable;
-	uint32_t size;
+	uint32_t size, pte;
 
 	size = TTB_L2_ENTRIES * sizeof(uint32_t);
 
@@ -113,9 +121,15 @@ static void alloc_init_pte(uint32_t *l1pte, addr_t addr, addr_t end, addr_t pfn,
 	l2pte = l2pte_offset(l1pte, addr);
 
 	do {
-		*l2pte = pfn << PAGE_SHIFT;
+		pte = pfn << PAGE_SHIFT;
+
+		set_l2_pte_dcache(&pte, (nocache ? L2_DCACHE_OFF : L2_DCACHE_WRITEALLOC));
 
-		set_l2_pte_dcache(l2pte, (nocache ? L2_DCACHE_OFF : L2_DCACHE_WRITEALLOC));
+		if (readonly)
+			pte |= TTB_L2_APX;
+
+		/* The PTE is written at once, so that the page is never accessible with other permissions */
+		*l2pte = pte;
 
 		LOG_DEBUG("Setting l2pte %p with contents: %x\n", l2pte, *l2pte);
 
@@ -129,8 +143,9 @@ static void alloc_init_pte(uint32_t *l1pte, addr_t addr, addr_t end, addr_t pfn,
 /*
  * Allocate a section (only L1 PTE) or page table (L1 & L2 page tables)
  * @nocache indicates if the page can be cache or not (true means no support for cached page)
+ * @readonly makes the pages read-only (sections are not concerned)
  */
-static void alloc_init_section(uint32_t *l1pte, addr_t addr, addr_t end, addr_t phys, bool nocache)
+static void alloc_init_section(uint32_t *l1pte, addr_t addr, addr_t end, addr_t phys, bool nocache, bool readonly)
 {
 	/*
 	 * Try a section mapping - end, addr and phys must all be aligned
@@ -155,7 +170,7 @@ static void alloc_init_section(uint32_t *l1pte, addr_t addr, addr_t end, addr_t
 		 * individual L1 entries.
 		 */
 
-		alloc_init_pte(l1pte, addr, end, phys >> PAGE_SHIFT, nocache);
+		alloc_init_pte(l1pte, addr, end, phys >> PAGE_SHIFT, nocache, readonly);
 	}
 }
 
@@ -167,8 +182,9 @@ static void alloc_init_section(uint32_t *l1pte, addr_t addr, addr_t end, addr_t
  * @phys_base is the physical address to be mapped
  * @size is the number of bytes to be mapped
  * @nocache is true if no cache (TLB) must be used (typically for I/O)
+ * @readonly is true if the pages must be read-only
  */
-void create_mapping(void *l1pgtable, addr_t virt_base, addr_t phys_base, uint32_t size, bool nocache)
+static void __create_mapping(void *l1pgtable, addr_t virt_base, addr_t phys_base, uint32_t size, bool nocache, bool readonly)
 {
 	addr_t addr, end, length, next;
 	uint32_t *l1pte;
@@ -187,7 +203,7 @@ void create_mapping(void *l1pgtable, addr_t virt_base, addr_t phys_base, uint32_
 	do {
 		next = l1sect_addr_end(addr, end);
 
-		alloc_init_section(l1pte, addr, next, phys_base, nocache);
+		alloc_init_section(l1pte, addr, next, phys_base, nocache, readonly);
 
 		phys_base += next - addr;
 		addr = next;
@@ -201,6 +217,21 @@ void create_mapping(void *l1pgtable, addr_t virt_base, addr_t phys_base, uint32_
 		__asm_invalidate_tlb_all();
 }
 
+void create_mapping(void *l1pgtable, addr_t virt_base, addr_t phys_base, uint32_t size, bool nocache)
+{
+	__create_mapping(l1pgtable, virt_base, phys_base, size, nocache, false);
+}
+
+/*
+ * Map a page read-only in a user address space. The PTE gets its final
+ * permissions when it is written, so that the page is never writable from
+ * the user space, even transiently.
+ */
+void create_user_page_readonly(void *pgtable, addr_t vaddr, addr_t paddr)
+{
+	__create_mapping(pgtable, vaddr, paddr, PAGE_SIZE, false, true);
+}
+
 /* Empty the corresponding l2 entries */
 static void free_l2_mapping(uint32_t *l1pte, addr_t addr, addr_t end)
 {
@@ -489,11 +520,11 @@ void mmu_switch_kernel(void *pgtable_paddr)
 /**
  * Switch memory context in the user space
  *
- * @param pgtable
+ * @param pcb	Process owning the memory context
  */
-void mmu_switch(void *pgtable_paddr)
+void mmu_switch(struct pcb *pcb)
 {
-	mmu_switch_kernel(pgtable_paddr);
+	mmu_switch_kernel((void *) __pa(pcb->pgtable));
 }
 
 /*
@@ -514,6 +545,7 @@ void duplicate_user_space(struct pcb *from, struct pcb *to)
 	uint32_t *l1pte_dst, *l2pte_dst, *l2pgtable_dst;
 	addr_t paddr;
 	void *vaddr;
+	page_t *page;
 
 	l2pgtable_size = TTB_L2_ENTRIES * sizeof(uint32_t);
 
@@ -542,26 +574,63 @@ void duplicate_user_space(struct pcb *from, struct pcb *to)
 				if (*l2pte) {
 					l2pte_dst = l2pgtable_dst + j;
 
+					vaddr = (void *) pte_index_to_vaddr(i, j);
+
+					paddr = *l2pte & TTB_L2_ADDR_MASK;
+
+					/*
+					 * Pages belonging to the parent are shared read-only and will be
+					 * copied on the first write (copy-on-write). Device memory is mapped
+					 * as it is. Other pages (like the code of the root process which is
+					 * part of the kernel image) are copied.
+					 */
+					if (pfn_valid(phys_to_pfn(paddr)) && phys_to_page(paddr)->refcount) {
+						page = phys_to_page(paddr);
+
+						*l2pte |= TTB_L2_APX;
+						*l2pte_dst = *l2pte;
+
+						add_page_to_proc(to, page, (addr_t) vaddr);
+						continue;
+					}
+
+					if (!phys_in_ram(paddr)) {
+						*l2pte_dst = *l2pte;
+						continue;
+					}
+
 					/* Get a new free page */
 					paddr = get_free_page();
 					BUG_ON(!paddr);
 
 					/* Add the new page to the process list */
-					add_page_to_proc(to, (page_t *) phys_to_page(paddr));
-
-					create_mapping(current_pgtable(), FIXMAP_MAPPING, paddr, PAGE_SIZE, false);
+					add_page_to_proc(to, (page_t *) phys_to_page(paddr), (addr_t) vaddr);
 
 					*l2pte_dst = paddr;
 
 					set_l2_pte_dcache(l2pte_dst, L2_DCACHE_WRITEALLOC);
 
-					vaddr = (void *) pte_index_to_vaddr(i, j);
-
-					memcpy((void *) FIXMAP_MAPPING, vaddr, PAGE_SIZE);
+					copy_user_page(paddr, (addr_t) vaddr);
 				}
 			}
+
+			mmu_page_table_flush((addr_t) l2pgtable, (addr_t) (l2pgtable + TTB_L2_ENTRIES));
+			mmu_page_table_flush((addr_t) l2pgtable_dst, (addr_t) (l2pgtable_dst + TTB_L2_ENTRIES));
 		}
 	}
+}
+
+/*
+ * Copy the contents of a page mapped in the current address space
+ * (user page or kernel buffer) into a physical page, through the fixmap area.
+ * The caller is responsible for serializing the use of the fixmap area.
+ */
+void copy_user_page(addr_t paddr, addr_t vaddr)
+{
+	create_mapping(current_pgtable(), FIXMAP_MAPPING, paddr, PAGE_SIZE, false);
+
+	memcpy((void *) FIXMAP_MAPPING, (void *) vaddr, PAGE_SIZE);
+
 	release_mapping(current_pgtable(), FIXMAP_MAPPING, PAGE_SIZE);
 }
 
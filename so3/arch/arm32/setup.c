@@ -104,11 +104,12 @@ void arm_init_domains(void)
 	reg = get_dacr();
 
 	/*
-	* Set DOMAIN to manager access so that all access are permitted.
+	* Set DOMAIN to client access so that the access permissions of the
+	* page tables are checked (read-only pages shared after a fork).
 	*/
 
 	reg &= ~DOMAIN_MASK;
-	reg |= DOMAIN_MANAGER;
+	reg |= DOMAIN_CLIENT;
 	set_dacr(reg);
 }
 
@@ -41,7 +41,7 @@ void mmu_setup(void *pgtable)
 {
 	u64 attr, tcr;
 
-	tcr = TCR_CACHE_FLAGS | TCR_SMP_FLAGS | TCR_TG_FLAGS | TCR_ASID16 | TCR_A1;
+	tcr = TCR_CACHE_FLAGS | TCR_SMP_FLAGS | TCR_TG_FLAGS | TCR_ASID16;
 
 #ifdef CONFIG_VA_BITS_48
 	tcr |= TCR_TxSZ(48) | (TCR_PS_BITS_256TB << TCR_IPS_SHIFT);
@@ -17,7 +17,9 @@
  */
 
 #include <common.h>
+#include <process.h>
 
+#include <asm/mmu.h>
 #include <asm/processor.h>
 
 void __check(void)
@@ -47,6 +49,38 @@ void __sync_el2_fault(addr_t lr, addr_t sp)
 	kernel_panic();
 }
 
+#ifndef CONFIG_AVZ
+
+/*
+ * Data abort on a user space address, from the user space or from the kernel
+ * accessing a user buffer. A translation fault may be due to a page of the stack
+ * or the heap which has not been mapped yet, and a permission fault on write to
+ * a page shared with another process since a fork (copy-on-write).
+ *
+ * Return 0 if the faulting access can be restarted, -1 otherwise.
+ */
+int user_dabt_handle(unsigned long esr)
+{
+	addr_t far = read_sysreg(far_el1);
+
+	if (!user_space_vaddr(far))
+		return -1;
+
+	switch (esr & ESR_ELx_FSC_TYPE) {
+	case ESR_ELx_FSC_FAULT:
+		return do_page_fault(far);
+
+	case ESR_ELx_FSC_PERM:
+		if (esr & ESR_ELx_WNR)
+			return do_cow_fault(far);
+		break;
+	}
+
+	return -1;
+}
+
+#endif /* !CONFIG_AVZ */
+
 #if 0
 
 void __prefetch_abort(uint32_t ifar, uint32_t ifsr, uint32_t lr) {
@@ -614,6 +614,25 @@ static inline bool user_space_vaddr(addr_t addr)
 		return true;
 }
 
+/**
+ * Check if a user space virtual address is currently mapped (in the current page table)
+ * by means of an address translation instruction.
+ *
+ * @param vaddr	User space virtual address
+ * @return	true if the translation succeeds, false otherwise
+ */
+static inline bool user_page_mapped(addr_t vaddr)
+{
+	u64 par;
+
+	va2pa_at(VA2PA_STAGE1, VA2PA_EL0, VA2PA_RD, vaddr);
+	asm volatile("isb");
+	asm volatile("mrs %0, par_el1" : "=r"(par) : : "cc");
+
+	/* The F bit is set if the translation failed */
+	return !(par & 1);
+}
+
 #ifdef CONFIG_ARM64VT
 
 static inline unsigned int get_sctlr(void)
@@ -654,12 +673,7 @@ extern addr_t __sys_root_pgtable[], __sys_idmap_l1pgtable[], __sys_linearmap_l1p
 
 void *current_pgtable(void);
 
-extern void *__current_pgtable;
-
-static inline void set_pgtable(void *pgtable)
-{
-	__current_pgtable = pgtable;
-}
+void set_pgtable(void *pgtable);
 extern void __mmu_switch_ttbr1(void *root_pgtable_phys);
 extern void __mmu_switch_ttbr0(void *root_pgtable_phys);
 
@@ -702,7 +716,8 @@ void __mmu_switch_kernel(void *pgtable, bool vttbr);
 
 void create_mapping(void *pgtable, addr_t virt_base, addr_t phys_base, size_t size, bool nocache);
 
-void mmu_switch(void *pgtable_paddr);
+struct pcb;
+void mmu_switch(struct pcb *pcb);
 void mmu_switch_kernel(void *pgtable);
 
 void mmu_get_current_pgtable(addr_t *pgtable_paddr);
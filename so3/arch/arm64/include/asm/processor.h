@@ -162,6 +162,15 @@
 #define ESR_ELx_EC_MASK		(UL(0x3F) << ESR_ELx_EC_SHIFT)
 #define ESR_ELx_EC(esr)		(((esr) & ESR_ELx_EC_MASK) >> ESR_ELx_EC_SHIFT)
 
+/* Fault status code of instruction/data aborts */
+#define ESR_ELx_FSC		(0x3F)
+#define ESR_ELx_FSC_TYPE	(0x3C)
+#define ESR_ELx_FSC_FAULT	(0x04)	/* Translation fault (level 0 to 3) */
+#define ESR_ELx_FSC_PERM	(0x0C)	/* Permission fault (level 0 to 3) */
+
+/* Write not Read bit of data aborts */
+#define ESR_ELx_WNR		(UL(1) << 6)
+
 /* exception level in SPSR_ELx */
 #define SPSR_EL(spsr)		(((spsr) & 0xc) >> 2)
 /* instruction length */
@@ -1241,6 +1250,17 @@ static inline void cpu_standby(void) {
 	wfi();
 }
 
+/*
+ * Publish the ID of the running thread in the user read-only thread ID register.
+ */
+static inline void set_user_tid(unsigned long tid)
+{
+	asm volatile("msr tpidrro_el0, %0" : : "r"(tid));
+}
+
+/* Start a secondary CPU (PSCI or spin table) */
+void cpu_on(unsigned long cpuid, addr_t entry_point);
+
 #ifdef CONFIG_AVZ
 
 extern char hypercall_entry[];
@@ -1250,8 +1270,6 @@ typedef struct cpu_sys_regs {
 	u64   vusp;
 } cpu_sys_regs_t;
 
-void cpu_on(unsigned long cpuid, addr_t entry_point);
-
 struct domain;
 
 void __switch_domain_to(struct domain *prev, struct domain *next);
@@ -1267,6 +1285,9 @@ struct tcb;
 void __switch_to(struct tcb *prev, struct tcb *next);
 
 void trap_handle(cpu_regs_t *regs);
+void trap_handle_cur(cpu_regs_t *regs);
+
+int user_dabt_handle(unsigned long esr);
 
 void cpu_do_idle(void);
 
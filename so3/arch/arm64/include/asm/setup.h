@@ -22,6 +22,7 @@
 #define L_TEXT_OFFSET 0x80000
 
 extern addr_t __cpu1_stack[];
+extern addr_t __cpu2_stack[];
 extern addr_t __cpu3_stack[];
 
 void setup_arch(void);
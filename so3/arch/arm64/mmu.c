@@ -26,14 +26,47 @@
 #include <device/ramdev.h>
 #include <device/fdt.h>
 
+#include <schedule.h>
+
 #include <asm/mmu.h>
 #include <asm/cacheflush.h>
 
-void *__current_pgtable = NULL;
+/* Page table currently in use by each CPU */
+static void *__current_pgtable[CONFIG_NR_CPUS];
+
+/*
+ * Address space identifiers (ASID)
+ *
+ * Each process gets an ASID which tags its (non-global) user mappings in the TLBs,
+ * so that switching between processes does not require any TLB invalidation.
+ * The ASID of a process is only valid within a generation (upper bits of pcb->asid).
+ * When all ASIDs have been allocated, a new generation starts and the TLBs are
+ * invalidated; the ASIDs in use on the CPUs at this time are kept (reserved).
+ */
+#define ASID_MAX_BITS		16
+#define ASID_MASK		((UL(1) << ASID_MAX_BITS) - 1)
+#define ASID_FIRST_VERSION	(UL(1) << ASID_MAX_BITS)
+
+#define asid_generation_of(asid)	((asid) & ~ASID_MASK)
+
+static unsigned int nr_asids;
+static u64 asid_generation = ASID_FIRST_VERSION;
+static u64 asid_map[(UL(1) << ASID_MAX_BITS) / 64];
+static unsigned int asid_next = 1;
+
+static u64 active_asids[CONFIG_NR_CPUS];
+static u64 reserved_asids[CONFIG_NR_CPUS];
+
+static DEFINE_SPINLOCK(asid_lock);
 
 void *current_pgtable(void)
 {
-	return __current_pgtable;
+	return __current_pgtable[sched_cpu()];
+}
+
+void set_pgtable(void *pgtable)
+{
+	__current_pgtable[sched_cpu()] = pgtable;
 }
 
 /**
@@ -50,10 +83,11 @@ void mmu_get_current_pgtable(addr_t *pgtable_paddr)
 	*pgtable_paddr = cpu_get_ttbr1();
 }
 
-static void alloc_init_l3(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys, bool nocache, mmu_stage_t stage)
+static void alloc_init_l3(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys, bool nocache, bool readonly, mmu_stage_t stage)
 {
 	u64 *l1pte, *l2pte, *l3pte;
 	u64 *l3pgtable;
+	u64 pte;
 
 #ifdef CONFIG_VA_BITS_48
 	u64 *l0pte;
@@ -100,20 +134,28 @@ static void alloc_init_l3(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys,
 
 		l3pte = l3pte_offset(l2pte, addr);
 
-		*l3pte = phys & TTB_L3_PAGE_ADDR_MASK;
+		pte = phys & TTB_L3_PAGE_ADDR_MASK;
 
 #ifdef CONFIG_ARM64VT
 		if (stage == S1)
-			set_pte_page(l3pte, (nocache ? DCACHE_OFF : DCACHE_WRITEALLOC));
+			set_pte_page(&pte, (nocache ? DCACHE_OFF : DCACHE_WRITEALLOC));
 		else
-			set_pte_page_S2(l3pte, (nocache ? DCACHE_OFF : DCACHE_WRITEALLOC));
+			set_pte_page_S2(&pte, (nocache ? DCACHE_OFF : DCACHE_WRITEALLOC));
 #else
-		set_pte_page(l3pte, (nocache ? DCACHE_OFF : DCACHE_WRITEALLOC));
+		set_pte_page(&pte, (nocache ? DCACHE_OFF : DCACHE_WRITEALLOC));
 
-		/* Set AP[1] bit 6 to 1 to make R/W/Executable the pages in user space */
+		/* Set AP[1] bit 6 to 1 to make R/W/Executable the pages in user space.
+		 * User pages are not global so that they are tagged with the ASID of the process.
+		 */
 		if ((addr != phys) && user_space_vaddr(addr))
-			*l3pte |= PTE_BLOCK_AP1;
+			pte |= PTE_BLOCK_AP1 | PTE_BLOCK_NG;
 #endif
+		/* AP[2] makes the page read-only */
+		if (readonly)
+			pte |= PTE_BLOCK_AP2;
+
+		/* The PTE is written at once, so that the page is never accessible with other permissions */
+		*l3pte = pte;
 
 		LOG_DEBUG("Allocating a 4 KB page at l2pte: %p content: %lx\n", l3pte,
 		   	*l3pte);
@@ -126,7 +168,7 @@ static void alloc_init_l3(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys,
 	} while (addr != end);
 }
 
-static void alloc_init_l2(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys, bool nocache, mmu_stage_t stage)
+static void alloc_init_l2(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys, bool nocache, bool readonly, mmu_stage_t stage)
 {
 	u64 *l1pte, *l2pte;
 	u64 *l2pgtable;
@@ -189,7 +231,7 @@ static void alloc_init_l2(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys,
 #else
 			set_pte_block(l2pte, (nocache ? DCACHE_OFF : DCACHE_WRITEALLOC));
 
-			/* Set AP[1] bit 6 to 1 to make R/W/Executable the pages in user space */
+			/* Set AP[1] bit 6 to 1 to make R/W/Executable the pages in user space (not global) */
 
 			/* Warning! For an identity mapping, the RAM addresses are low compared
 			 * to the kernel space. It has to be managed differently.
@@ -198,7 +240,7 @@ static void alloc_init_l2(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys,
 			 */
 
 			if ((addr != phys) && user_space_vaddr(addr))
-				*l2pte |= PTE_BLOCK_AP1;
+				*l2pte |= PTE_BLOCK_AP1 | PTE_BLOCK_NG;
 #endif
 			LOG_DEBUG("Allocating a 2 MB block at l2pte: %p content: %lx\n", l2pte, *l2pte);
 
@@ -208,7 +250,7 @@ static void alloc_init_l2(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys,
 			addr += SZ_2M;
 
 		} else {
-			alloc_init_l3(l0pgtable, addr, next, phys, nocache, stage);
+			alloc_init_l3(l0pgtable, addr, next, phys, nocache, readonly, stage);
 			phys += next - addr;
 			addr = next;
 		}
@@ -218,7 +260,7 @@ static void alloc_init_l2(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys,
 
 #ifdef CONFIG_VA_BITS_48
 
-static void alloc_init_l1(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys, bool nocache, mmu_stage_t stage)
+static void alloc_init_l1(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys, bool nocache, bool readonly, mmu_stage_t stage)
 {
 	u64 *l0pte, *l1pte;
 	u64 *l1pgtable;
@@ -266,9 +308,9 @@ static void alloc_init_l1(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys,
 #else
 			set_pte_block(l1pte, (nocache ? DCACHE_OFF : DCACHE_WRITEALLOC));
 
-			/* Set AP[1] bit 6 to 1 to make R/W/Executable the pages in user space */
+			/* Set AP[1] bit 6 to 1 to make R/W/Executable the pages in user space (not global) */
 			if ((addr != phys) && user_space_vaddr(addr))
-				*l1pte |= PTE_BLOCK_AP1;
+				*l1pte |= PTE_BLOCK_AP1 | PTE_BLOCK_NG;
 #endif
 
 			LOG_DEBUG("Allocating a 1 GB block at l1pte: %p content: %lx\n",
@@ -280,7 +322,7 @@ static void alloc_init_l1(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys,
 			addr += SZ_1G;
 
 		} else {
-			alloc_init_l2(l0pgtable, addr, next, phys, nocache, stage);
+			alloc_init_l2(l0pgtable, addr, next, phys, nocache, readonly, stage);
 			phys += next - addr;
 			addr = next;
 		}
@@ -301,7 +343,7 @@ static void alloc_init_l1(u64 *l0pgtable, addr_t addr, addr_t end, addr_t phys,
  * Mapping of blocks at L0 level is not allowed with 4 KB granule (AArch64).
  *
  */
-void __create_mapping(void *pgtable, addr_t virt_base, addr_t phys_base, size_t size, bool nocache, mmu_stage_t stage)
+static void do_create_mapping(void *pgtable, addr_t virt_base, addr_t phys_base, size_t size, bool nocache, bool readonly, mmu_stage_t stage)
 {
 	addr_t addr, end, length, next;
 
@@ -321,7 +363,7 @@ void __create_mapping(void *pgtable, addr_t virt_base, addr_t phys_base, size_t
 	do {
 		next = l0_addr_end(addr, end);
 
-		alloc_init_l1(pgtable, addr, next, phys_base, nocache, stage);
+		alloc_init_l1(pgtable, addr, next, phys_base, nocache, readonly, stage);
 
 		phys_base += next - addr;
 		addr = next;
@@ -331,6 +373,11 @@ void __create_mapping(void *pgtable, addr_t virt_base, addr_t phys_base, size_t
 	mmu_page_table_flush((addr_t) pgtable, (addr_t) (pgtable + TTB_L0_SIZE));
 }
 
+void __create_mapping(void *pgtable, addr_t virt_base, addr_t phys_base, size_t size, bool nocache, mmu_stage_t stage)
+{
+	do_create_mapping(pgtable, virt_base, phys_base, size, nocache, false, stage);
+}
+
 #elif CONFIG_VA_BITS_39
 
 /**
@@ -342,8 +389,9 @@ void __create_mapping(void *pgtable, addr_t virt_base, addr_t phys_base, size_t
  * @param phys_base
  * @param size
  * @param nocache	true for I/O access typically
+ * @param readonly	true to map the 4 KB pages read-only
  */
-static void __create_mapping(void *l1pgtable, addr_t virt_base, addr_t phys_base, size_t size, bool nocache, mmu_stage_t stage)
+static void do_create_mapping(void *l1pgtable, addr_t virt_base, addr_t phys_base, size_t size, bool nocache, bool readonly, mmu_stage_t stage)
 {
 	addr_t addr, end, length, next, phys;
 	u64 *l1pte;
@@ -369,9 +417,9 @@ static void __create_mapping(void *l1pgtable, addr_t virt_base, addr_t phys_base
 
 			set_pte_block(l1pte, (nocache ? DCACHE_OFF : DCACHE_WRITEALLOC));
 
-			/* Set AP[1] bit 6 to 1 to make R/W/Executable the pages in user space */
+			/* Set AP[1] bit 6 to 1 to make R/W/Executable the pages in user space (not global) */
 			if ((addr != phys) && user_space_vaddr(addr))
-				*l1pte |= PTE_BLOCK_AP1;
+				*l1pte |= PTE_BLOCK_AP1 | PTE_BLOCK_NG;
 
 			LOG_DEBUG("Allocating a 1 GB block at l1pte: %p content: %lx\n",
 			    l1pte, *l1pte);
@@ -382,7 +430,7 @@ static void __create_mapping(void *l1pgtable, addr_t virt_base, addr_t phys_base
 			addr += SZ_1G;
 
 		} else {
-			alloc_init_l2(l1pgtable, addr, next, phys, nocache, stage);
+			alloc_init_l2(l1pgtable, addr, next, phys, nocache, readonly, stage);
 			phys += next - addr;
 			addr = next;
 		}
@@ -392,6 +440,11 @@ static void __create_mapping(void *l1pgtable, addr_t virt_base, addr_t phys_base
 	mmu_page_table_flush((addr_t) l1pgtable, (addr_t) (l1pgtable + TTB_L1_ENTRIES));
 }
 
+static void __create_mapping(void *l1pgtable, addr_t virt_base, addr_t phys_base, size_t size, bool nocache, mmu_stage_t stage)
+{
+	do_create_mapping(l1pgtable, virt_base, phys_base, size, nocache, false, stage);
+}
+
 #else
 #error "Wrong VA_BITS configuration."
 #endif
@@ -401,6 +454,16 @@ void create_mapping(void *pgtable, addr_t virt_base, addr_t phys_base, size_t si
 	__create_mapping(pgtable, virt_base, phys_base, size, nocache, S1);
 }
 
+/*
+ * Map a page read-only in a user address space. The PTE gets its final
+ * permissions when it is written, so that the page is never writable from
+ * the user space, even transiently.
+ */
+void create_user_page_readonly(void *pgtable, addr_t vaddr, addr_t paddr)
+{
+	do_create_mapping(pgtable, vaddr, paddr, PAGE_SIZE, false, true, S1);
+}
+
 static bool empty_table(void *pgtable)
 {
 	int i;
@@ -727,19 +790,141 @@ void mmu_switch_kernel(void *pgtable)
 	__mmu_switch_kernel(pgtable, false);
 }
 
+static inline bool asid_test_and_set(unsigned int asid)
+{
+	if (asid_map[asid / 64] & (UL(1) << (asid % 64)))
+		return true;
+
+	asid_map[asid / 64] |= UL(1) << (asid % 64);
+
+	return false;
+}
+
+/*
+ * Start a new ASID generation. asid_lock must be held.
+ */
+static void flush_context(void)
+{
+	u64 asid;
+	int cpu;
+
+	memset(asid_map, 0, sizeof(asid_map));
+
+	/* ASID 0 is used by the kernel (system page table) */
+	asid_test_and_set(0);
+
+	for (cpu = 0; cpu < CONFIG_NR_CPUS; cpu++) {
+		asid = active_asids[cpu];
+
+		/* If the CPU did not switch since the last rollover, it still uses its reserved ASID */
+		if (!asid)
+			asid = reserved_asids[cpu];
+
+		asid_test_and_set(asid & ASID_MASK);
+
+		reserved_asids[cpu] = asid;
+		active_asids[cpu] = 0;
+	}
+
+	/* Broadcast to all CPUs */
+	__asm_invalidate_tlb_all();
+}
+
+/*
+ * Check if an ASID is reserved by a CPU and update its generation.
+ */
+static bool check_update_reserved_asid(u64 asid, u64 newasid)
+{
+	bool hit = false;
+	int cpu;
+
+	for (cpu = 0; cpu < CONFIG_NR_CPUS; cpu++)
+		if (reserved_asids[cpu] == asid) {
+			reserved_asids[cpu] = newasid;
+			hit = true;
+		}
+
+	return hit;
+}
+
+/*
+ * Allocate an ASID in the current generation, re-using the previous one
+ * of the process if possible. asid_lock must be held.
+ */
+static u64 new_asid(u64 asid)
+{
+	u64 newasid;
+	unsigned int i;
+
+	if (!nr_asids) {
+		/* ASIDBits field of ID_AA64MMFR0_EL1: 8 or 16 bits */
+		if (((read_sysreg(id_aa64mmfr0_el1) >> ID_AA64MMFR0_ASID_SHIFT) & 0xf) == 2)
+			nr_asids = 1 << 16;
+		else
+			nr_asids = 1 << 8;
+
+		asid_test_and_set(0);
+	}
+
+	if (asid) {
+		newasid = asid_generation | (asid & ASID_MASK);
+
+		/* The process was running during the rollover */
+		if (check_update_reserved_asid(asid, newasid))
+			return newasid;
+
+		/* Keep the same ASID if it is still free */
+		if (!asid_test_and_set(asid & ASID_MASK))
+			return newasid;
+	}
+
+	for (i = asid_next; i < nr_asids; i++)
+		if (!asid_test_and_set(i))
+			goto found;
+
+	/* All ASIDs are used; start a new generation */
+	asid_generation += ASID_FIRST_VERSION;
+	flush_context();
+
+	for (i = 1; i < nr_asids; i++)
+		if (!asid_test_and_set(i))
+			goto found;
+
+	/* At least the ASIDs reserved by the CPUs are not available */
+	BUG();
+
+found:
+	asid_next = i + 1;
+
+	return asid_generation | i;
+}
+
 /**
  * Switch memory context in the user space range of EL1.
+ * The TTBR0 gets the ASID of the process; the TLB entries of the other processes
+ * remain valid since the user mappings are not global. As the data cache is
+ * physically tagged, it does not need to be flushed.
  *
- * @param pgtable
+ * @param pcb	Process owning the memory context
  */
-void mmu_switch(void *pgtable_paddr)
+void mmu_switch(pcb_t *pcb)
 {
-	flush_dcache_all();
+	unsigned long flags;
+	u64 asid;
 
-	__mmu_switch_ttbr0(pgtable_paddr);
+	flags = spin_lock_irqsave(&asid_lock);
 
-	invalidate_icache_all();
-	__asm_invalidate_tlb_all();
+	asid = pcb->asid;
+	if (!asid || (asid_generation_of(asid) != asid_generation)) {
+		asid = new_asid(asid);
+		pcb->asid = asid;
+	}
+
+	active_asids[smp_processor_id()] = asid;
+
+	spin_unlock_irqrestore(&asid_lock, flags);
+
+	__mmu_switch_ttbr0((void *) (__pa(pcb->pgtable) | ((asid & ASID_MASK) << 48)));
 }
 
 /*
@@ -832,7 +1017,8 @@ void duplicate_pgtable_entry(u64 *from, u64 *to, int level, u64 vaddr, pcb_t *pc
 	u64 mask;
 	u64 i;
 	int ttb_entries, size;
-	u64 paddr_to, __vaddr;
+	u64 paddr, paddr_to, __vaddr;
+	page_t *page;
 
 	if (level < 3) {
 		switch (level) {
@@ -886,6 +1072,29 @@ void duplicate_pgtable_entry(u64 *from, u64 *to, int level, u64 vaddr, pcb_t *pc
 			if (from[i]) {
 				__vaddr = vaddr + (i << TTB_I3_SHIFT);
 
+				paddr = from[i] & TTB_L3_PAGE_ADDR_MASK;
+
+				/*
+				 * Pages belonging to the parent are shared read-only and will be
+				 * copied on the first write (copy-on-write). Device memory is mapped
+				 * as it is. Other pages (like the code of the root process which is part
+				 * of the kernel image) are copied.
+				 */
+				if (pfn_valid(phys_to_pfn(paddr)) && phys_to_page(paddr)->refcount) {
+					page = phys_to_page(paddr);
+
+					from[i] |= PTE_BLOCK_AP2;
+					to[i] = from[i];
+
+					add_page_to_proc(pcb_to, page, __vaddr);
+					continue;
+				}
+
+				if (!phys_in_ram(paddr)) {
+					to[i] = from[i];
+					continue;
+				}
+
 				/* Get a new free page */
 				paddr_to = get_free_page();
 				BUG_ON(!paddr_to);
@@ -893,20 +1102,37 @@ void duplicate_pgtable_entry(u64 *from, u64 *to, int level, u64 vaddr, pcb_t *pc
 				to[i] = (from[i] & ~TTB_L3_PAGE_ADDR_MASK) | (paddr_to & TTB_L3_PAGE_ADDR_MASK);
 
 				/* Add the new page to the process list */
-				add_page_to_proc(pcb_to, (page_t *) phys_to_page(paddr_to));
-
-				create_mapping(NULL, FIXMAP_MAPPING, paddr_to, PAGE_SIZE, false);
+				add_page_to_proc(pcb_to, (page_t *) phys_to_page(paddr_to), __vaddr);
 
-				memcpy((void *) FIXMAP_MAPPING, (void *) __vaddr, PAGE_SIZE);
+				copy_user_page(paddr_to, __vaddr);
 			}
 		}
-		release_mapping(current_pgtable(), FIXMAP_MAPPING, PAGE_SIZE);
+
+		mmu_page_table_flush((addr_t) from, (addr_t) (from + TTB_L3_ENTRIES));
 	}
 }
 
+/*
+ * Copy the contents of a page mapped in the current address space
+ * (user page or kernel buffer) into a physical page, through the fixmap area.
+ * The caller is responsible for serializing the use of the fixmap area.
+ */
+void copy_user_page(addr_t paddr, addr_t vaddr)
+{
+	create_mapping(NULL, FIXMAP_MAPPING, paddr, PAGE_SIZE, false);
+
+	memcpy((void *) FIXMAP_MAPPING, (void *) vaddr, PAGE_SIZE);
+
+	/* The page may contain code */
+	__asm_flush_dcache_range(FIXMAP_MAPPING, FIXMAP_MAPPING + PAGE_SIZE);
+
+	release_mapping(NULL, FIXMAP_MAPPING, PAGE_SIZE);
+}
+
 /**
  * Duplicate the user space along a fork syscall.
  * User space is mapped with 4 KB page only.
+ * The pages are shared between both processes until one of them writes to it.
  *
  *
  * @param from	Origin L0 pagetable
@@ -922,6 +1148,12 @@ void duplicate_user_space(pcb_t *from, pcb_t *to)
 #else
 #error "Wrong VA_BITS configuration."
 #endif
+
+	/* The pages of the parent are now read-only */
+	__asm_invalidate_tlb_all();
+
+	/* Some code pages may have been copied */
+	invalidate_icache_all();
 }
 
 #ifdef CONFIG_RAMDEV
@@ -36,6 +36,8 @@
 
 #else /* CONFIG_AVZ */
 #include <syscall.h>
+#include <process.h>
+#include <signal.h>
 #endif /* !CONFIG_AVZ */
 
 #include <asm/processor.h>
@@ -102,10 +104,40 @@ int dabt_handle(cpu_regs_t *regs, unsigned long esr)
 #ifdef CONFIG_AVZ
 	return mmio_dabt_decode(regs, esr);
 #else
+	if (!user_dabt_handle(esr))
+		return 0;
+
+	printk("### Segmentation fault at 0x%lx (pc: 0x%lx) in process %d ###\n", read_sysreg(far_el1), regs->pc,
+	       current()->pcb->pid);
+
+	local_irq_enable();
+	do_exit(SIGSEGV);
+
 	return -1;
 #endif
 }
 
+#ifndef CONFIG_AVZ
+
+/**
+ * Synchronous exception taken at the current EL. The only expected
+ * exceptions are data aborts due to the kernel accessing a user buffer
+ * whose page is not mapped yet.
+ *
+ * @param regs	Pointer to the stack frame
+ */
+void trap_handle_cur(cpu_regs_t *regs)
+{
+	unsigned long esr = read_sysreg(esr_el1);
+
+	if ((ESR_ELx_EC(esr) == ESR_ELx_EC_DABT_CUR) && !user_dabt_handle(esr))
+		return;
+
+	trap_handle_error(regs->pc);
+}
+
+#endif /* !CONFIG_AVZ */
+
 /**
  * This is the entry point for all exceptions currently managed by SO3.
  * 
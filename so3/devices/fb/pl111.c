@@ -94,7 +94,7 @@
 #define LCDBPP (5 << 1) /* 5: 24bpp, 6: 16bpp565 */
 #define LCDEN (1 << 0) /* enable display */
 
-void *fb_mmap(int fd, addr_t virt_addr, uint32_t page_count, off_t offset)
+void *fb_mmap(int fd, addr_t virt_addr, uint32_t page_count, off_t offset, int prot)
 {
 	uint32_t i;
 	addr_t page;
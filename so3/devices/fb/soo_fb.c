@@ -31,7 +31,7 @@
 #include <device/driver.h>
 #include <device/fb/soo_fb_fb.h>
 
-void *fb_mmap(int fd, uint32_t virt_addr, uint32_t page_count, off_t offset);
+void *fb_mmap(int fd, uint32_t virt_addr, uint32_t page_count, off_t offset, int prot);
 int fb_ioctl(int fd, unsigned long cmd, unsigned long args);
 
 struct file_operations vfb_fops = { .mmap = fb_mmap, .ioctl = fb_ioctl };
@@ -56,7 +56,7 @@ int fb_init(dev_t *dev)
 	return 0;
 }
 
-void *fb_mmap(int fd, uint32_t virt_addr, uint32_t page_count, off_t offset)
+void *fb_mmap(int fd, uint32_t virt_addr, uint32_t page_count, off_t offset, int prot)
 {
 	uint32_t i;
 	pcb_t *pcb = current()->pcb;
@@ -26,7 +26,11 @@
 #include <device/irq.h>
 
 static irqdesc_t irqdesc[NR_IRQS];
+#ifdef CONFIG_SCHED_SMP
+volatile bool __in_interrupt_cpu[CONFIG_NR_CPUS];
+#else
 volatile bool __in_interrupt = false;
+#endif
 
 /* By default IRQ chip operations */
 irq_ops_t irq_ops;
@@ -26,7 +26,7 @@
 
 #define DEV_CLASS_MEM "mem"
 
-static void *mem_mmap(int fd, addr_t virt_addr, uint32_t page_count, off_t offset)
+static void *mem_mmap(int fd, addr_t virt_addr, uint32_t page_count, off_t offset, int prot)
 {
 	const size_t MEM_START = mem_info.phys_base;
 	const size_t MEM_END = mem_info.phys_base + mem_info.size;
@@ -24,6 +24,7 @@
 #include <bitops.h>
 #include <heap.h>
 #include <memory.h>
+#include <completion.h>
 
 #include "arm_pl180_mmci.h"
 
@@ -46,7 +47,7 @@ static int wait_for_command_end(struct mmc *dev, struct mmc_cmd *cmd)
 
 	iowrite32(&host->base->status_clear, statusmask);
 	if (hoststatus & SDI_STA_CTIMEOUT) {
-		DBG("CMD%d time out\n", cmd->cmdidx);
+		LOG_DEBUG("CMD%d time out\n", cmd->cmdidx);
 		return TIMEOUT;
 	} else if ((hoststatus & SDI_STA_CCRCFAIL) && (cmd->resp_type & MMC_RSP_CRC)) {
 		printk("CMD%d CRC error\n", cmd->cmdidx);
@@ -58,7 +59,7 @@ static int wait_for_command_end(struct mmc *dev, struct mmc_cmd *cmd)
 		cmd->response[1] = ioread32(&host->base->response1);
 		cmd->response[2] = ioread32(&host->base->response2);
 		cmd->response[3] = ioread32(&host->base->response3);
-		DBG("CMD%d response[0]:0x%08X, response[1]:0x%08X, "
+		LOG_DEBUG("CMD%d response[0]:0x%08X, response[1]:0x%08X, "
 		    "response[2]:0x%08X, response[3]:0x%08X\n",
 		    cmd->cmdidx, cmd->response[0], cmd->response[1], cmd->response[2], cmd->response[3]);
 	}
@@ -106,7 +107,7 @@ static int read_bytes(struct mmc *dev, u32 *dest, u32 blkcount, u32 blksize)
 	struct pl180_mmc_host *host = dev->priv;
 	u32 status, status_err;
 
-	DBG("read_bytes: blkcount=%u blksize=%u\n", blkcount, blksize);
+	LOG_DEBUG("read_bytes: blkcount=%u blksize=%u\n", blkcount, blksize);
 
 	status = ioread32(&host->base->status);
 	status_err = status & (SDI_STA_DCRCFAIL | SDI_STA_DTIMEOUT | SDI_STA_RXOVERR);
@@ -155,7 +156,7 @@ static int write_bytes(struct mmc *dev, u32 *src, u32 blkcount, u32 blksize)
 	struct pl180_mmc_host *host = dev->priv;
 	u32 status, status_err;
 
-	DBG("write_bytes: blkcount=%u blksize=%u\n", blkcount, blksize);
+	LOG_DEBUG("write_bytes: blkcount=%u blksize=%u\n", blkcount, blksize);
 
 	status = ioread32(&host->base->status);
 	status_err = status & (SDI_STA_DCRCFAIL | SDI_STA_DTIMEOUT);
@@ -203,6 +204,111 @@ static int write_bytes(struct mmc *dev, u32 *src, u32 blkcount, u32 blksize)
 	return 0;
 }
 
+static int data_error(u32 status)
+{
+	if (status & SDI_STA_DTIMEOUT) {
+		printk("Data timed out, status: 0x%08X\n", status);
+		return -ETIMEDOUT;
+	} else if (status & SDI_STA_DCRCFAIL) {
+		printk("Data CRC error: 0x%x\n", status);
+		return -EILSEQ;
+	}
+
+	printk("Data FIFO overflow/underrun: 0x%x\n", status);
+	return -EIO;
+}
+
+/*
+ * Move data between the FIFO and the buffer of the current transfer.
+ * Called from the interrupt handler.
+ */
+static void xfer_fifo(struct pl180_mmc_host *host)
+{
+	int i;
+
+	if (host->xfer_read) {
+		while (host->xfer_left && (ioread32(&host->base->status) & SDI_STA_RXDAVL)) {
+			*(host->xfer_buf++) = ioread32(&host->base->fifo);
+			host->xfer_left -= sizeof(u32);
+		}
+		return;
+	}
+
+	while (host->xfer_left && (ioread32(&host->base->status) & SDI_STA_TXFIFOBW)) {
+		for (i = 0; (i < SDI_FIFO_BURST_SIZE) && host->xfer_left; i++) {
+			iowrite32(&host->base->fifo, *(host->xfer_buf++));
+			host->xfer_left -= sizeof(u32);
+		}
+	}
+
+	/* All data is in the FIFO, only the end of the transfer is still awaited */
+	if (!host->xfer_left)
+		iowrite32(&host->base->mask0, ioread32(&host->base->mask0) & ~SDI_STA_TXFIFOBW);
+}
+
+/*
+ * The FIFO half-full (read) or half-empty (write) interrupt moves a burst of data;
+ * the data end or an error completes the transfer and wakes up the waiting thread.
+ */
+static irq_return_t pl180_mmci_isr(int irq, void *data)
+{
+	struct pl180_mmc_host *host = (struct pl180_mmc_host *) data;
+	u32 status;
+
+	status = ioread32(&host->base->status);
+
+	if (status & SDI_STA_DATA_ERR) {
+		host->xfer_error = data_error(status);
+	} else {
+		xfer_fifo(host);
+
+		/* DBCKEND is raised (and stays set) at the end of each block, only DATAEND ends the transfer */
+		if (!(status & SDI_STA_DATAEND))
+			return IRQ_COMPLETED;
+
+		if (host->xfer_left) {
+			printk("Data transfer error, xfercount: %u\n", host->xfer_left);
+			host->xfer_error = -ENOBUFS;
+		}
+	}
+
+	iowrite32(&host->base->mask0, 0);
+	iowrite32(&host->base->status_clear, SDI_ICR_MASK);
+
+	complete(&host->xfer_done);
+
+	return IRQ_COMPLETED;
+}
+
+/*
+ * The polling path is used as long as the system is booting and whenever
+ * the caller is not allowed to sleep.
+ */
+static bool can_use_irq(struct pl180_mmc_host *host)
+{
+	return host->use_irq && (boot_stage == BOOT_STAGE_COMPLETED) && local_irq_is_enabled() && !__in_interrupt;
+}
+
+/* Let the interrupt handler move the data while the calling thread sleeps */
+static int irq_transfer(struct mmc *dev, u32 *buf, u32 blkcount, u32 blksize, bool read)
+{
+	struct pl180_mmc_host *host = dev->priv;
+
+	LOG_DEBUG("irq_transfer: blkcount=%u blksize=%u read=%d\n", blkcount, blksize, read);
+
+	host->xfer_buf = buf;
+	host->xfer_left = blkcount * blksize;
+	host->xfer_read = read;
+	host->xfer_error = 0;
+
+	iowrite32(&host->base->mask0,
+		  SDI_STA_DATAEND | SDI_STA_DATA_ERR | (read ? SDI_STA_RXFIFOBR : SDI_STA_TXFIFOBW));
+
+	wait_for_completion(&host->xfer_done);
+
+	return host->xfer_error;
+}
+
 static int do_data_transfer(struct mmc *dev, struct mmc_cmd *cmd, struct mmc_data *data)
 {
 	int error = -ETIMEDOUT;
@@ -232,14 +338,20 @@ static int do_data_transfer(struct mmc *dev, struct mmc_cmd *cmd, struct mmc_dat
 		if (error)
 			return error;
 
-		error = read_bytes(dev, (u32 *) data->dest, (u32) data->blocks, (u32) data->blocksize);
+		if (can_use_irq(host))
+			error = irq_transfer(dev, (u32 *) data->dest, (u32) data->blocks, (u32) data->blocksize, true);
+		else
+			error = read_bytes(dev, (u32 *) data->dest, (u32) data->blocks, (u32) data->blocksize);
 	} else if (data->flags & MMC_DATA_WRITE) {
 		error = do_command(dev, cmd);
 		if (error)
 			return error;
 
 		iowrite32(&host->base->datactrl, data_ctrl);
-		error = write_bytes(dev, (u32 *) data->src, (u32) data->blocks, (u32) data->blocksize);
+		if (can_use_irq(host))
+			error = irq_transfer(dev, (u32 *) data->src, (u32) data->blocks, (u32) data->blocksize, false);
+		else
+			error = write_bytes(dev, (u32 *) data->src, (u32) data->blocks, (u32) data->blocksize);
 	}
 
 	return error;
@@ -374,6 +486,15 @@ static int arm_pl180_mmci_init(dev_t *dev, int fdt_offset)
 	sdi_u32 = ioread32(&mmc_host.base->mask0) & ~SDI_MASK0_MASK;
 	iowrite32(&mmc_host.base->mask0, sdi_u32);
 
+	/* Data transfers are interrupt-driven once booted if the interrupt is described */
+	if (fdt_get_property(__fdt_addr, fdt_offset, "interrupts", &prop_len)) {
+		fdt_interrupt_node(fdt_offset, &mmc_host.irq_def);
+		init_completion(&mmc_host.xfer_done);
+
+		irq_bind(mmc_host.irq_def.irqnr, pl180_mmci_isr, NULL, &mmc_host);
+		mmc_host.use_irq = true;
+	}
+
 	mmc_host.cfg.name = "mmc-pl180";
 
 	mmc_host.cfg.ops = &arm_pl180_mmci_ops;
@@ -395,9 +516,9 @@ static int arm_pl180_mmci_init(dev_t *dev, int fdt_offset)
 	/* Ready to initialize the mmc subsystem */
 	mmc_initialize();
 
-	DBG("registered mmc interface number is:%d\n", mmc->block_dev.dev);
+	LOG_DEBUG("registered mmc interface number is:%d\n", mmc->block_dev.dev);
 
 	return 0;
 }
 
-REGISTER_DRIVER_POSTCORE("virt32,mmc-pl180", arm_pl180_mmci_init);
+REGISTER_DRIVER_POSTCORE("vexpress,mmc-pl180", arm_pl180_mmci_init);
@@ -15,6 +15,9 @@
 
 /* need definition of struct mmc_config */
 #include <mmc.h>
+#include <completion.h>
+
+#include <device/irq.h>
 
 #define COMMAND_REG_DELAY 300
 #define DATA_REG_DELAY 1000
@@ -142,6 +145,9 @@
 
 #define SDI_FIFO_BURST_SIZE 8
 
+/* Status bits terminating a data transfer with an error */
+#define SDI_STA_DATA_ERR (SDI_STA_DCRCFAIL | SDI_STA_DTIMEOUT | SDI_STA_RXOVERR | SDI_STA_TXUNDERR)
+
 struct sdi_registers {
 	u32 power; /* 0x00*/
 	u32 clock; /* 0x04*/
@@ -188,6 +194,17 @@ struct pl180_mmc_host {
 	unsigned int pwr_init;
 	int version2;
 	struct mmc_config cfg;
+
+	/* Interrupt-driven data transfers (if the node has an interrupt) */
+	bool use_irq;
+	irq_def_t irq_def;
+
+	/* Transfer in progress, updated by the interrupt handler */
+	u32 *xfer_buf;
+	u32 xfer_left;
+	bool xfer_read;
+	int xfer_error;
+	completion_t xfer_done;
 };
 
 #endif
@@ -1187,7 +1187,7 @@ void mmc_init(struct mmc *mmc)
 	mmc_start_init(mmc);
 
 	mmc_complete_init(mmc);
-	DBG("%s: %d\n", __func__, err);
+	LOG_DEBUG("%s: done\n", __func__);
 }
 
 int mmc_set_dsr(struct mmc *mmc, u16 val)
@@ -29,6 +29,7 @@
 #include <device/arch/arm_timer.h>
 
 #include <asm/arm_timer.h>
+#include <asm/div64.h>
 
 #ifdef CONFIG_AVZ
 #include <avz/physdev.h>
@@ -80,13 +81,30 @@ static irq_return_t timer_isr(int irq, void *dev)
 		arch_timer_reg_write_cp15(ARCH_TIMER_VIRT_ACCESS, ARCH_TIMER_REG_CTRL, ctrl);
 #endif
 
+#ifndef CONFIG_NO_HZ
 		/* Periodic timer */
 		next_event(arm_timer->reload);
+#endif
 
 #ifdef CONFIG_AVZ
 		timer_interrupt((smp_processor_id() == ME_CPU) ? true : false);
 #else
-		jiffies++;
+
+#ifdef CONFIG_SCHED_SMP
+		/* All CPUs tick, but the system time is kept by CPU #0 */
+		if (smp_processor_id() == 0)
+#endif
+		{
+#ifdef CONFIG_NO_HZ
+			/* Ticks may be skipped, so jiffies is derived from the system time. */
+			u64 now = NOW();
+
+			do_div(now, (u32) periodic_timer.period);
+			jiffies = now;
+#else
+			jiffies++;
+#endif
+		}
 
 		raise_softirq(TIMER_SOFTIRQ);
 #endif
@@ -103,6 +121,27 @@ void periodic_timer_start(void)
 	next_event(arm_timer->reload);
 }
 
+#ifdef CONFIG_NO_HZ
+/*
+ * One-shot mode: the timer fires once after @delay_ns.
+ * Called with IRQs off from the timer softirq (see timer_dev_set_deadline()).
+ */
+static void oneshot_timer_set_delay(u64 delay_ns)
+{
+	u64 cycles;
+
+	delay_ns = min(delay_ns, oneshot_timer.max_delta_ns);
+	delay_ns = max(delay_ns, oneshot_timer.min_delta_ns);
+
+	cycles = (delay_ns * oneshot_timer.mult) >> oneshot_timer.shift;
+
+	if (!cycles)
+		cycles = 1;
+
+	next_event((u32) cycles);
+}
+#endif /* CONFIG_NO_HZ */
+
 /*
  * Read the clocksource timer value taking into account a time reference.
  *
@@ -165,6 +204,18 @@ static int periodic_timer_init(dev_t *dev, int fdt_offset)
 
 	arm_timer->reload = (uint32_t) (periodic_timer.period / (NSECS / clocksource_timer.rate));
 
+#ifdef CONFIG_NO_HZ
+	/* The same per-CPU timer is used in one-shot mode once started */
+	oneshot_timer.dev = dev;
+	oneshot_timer.set_delay = oneshot_timer_set_delay;
+
+	/* TVAL is a signed 32-bit down-counter */
+	clocks_calc_mult_shift(&oneshot_timer.mult, &oneshot_timer.shift, NSECS, clocksource_timer.rate, 60);
+
+	oneshot_timer.max_delta_ns = cyc2ns(0x7fffffff);
+	oneshot_timer.min_delta_ns = MICROSECS(1);
+#endif
+
 	/* Shutdown the timer */
 
 #ifdef CONFIG_ARM64VT
@@ -89,6 +89,7 @@ struct dirent *devfs_readdir(int fd)
 
 	/* For now we only support char devices inside /dev */
 	dent->d_type = DT_CHR;
+	dent->d_size = 0;
 
 	// check if this was the last entry id
 	if (is_single_entry || priv->current_devclass_entry_id == priv->current_devclass->id_end) {
@@ -26,214 +26,88 @@
 #include <types.h>
 #include <string.h>
 
-/* Load the file in a buffer allocated in the kernel heap */
-uint8_t *elf_load_buffer(const char *filename)
-{
-	int fd;
-	uint8_t *buffer;
-	struct stat st;
-
-	/* open and read file */
-	fd = do_open(filename, O_RDONLY);
+#ifdef CONFIG_ARCH_ARM32
+typedef Elf32_Ehdr elf_hdr_t;
+typedef Elf32_Phdr elf_phdr_t;
+#else
+typedef Elf64_Ehdr elf_hdr_t;
+typedef Elf64_Phdr elf_phdr_t;
+#endif
 
-	if (fd < 0)
-		return NULL;
+/*
+ * Read <size> bytes at offset <off> of the ELF file.
+ * Returns 0 on success, -1 if the file is too short or cannot be read.
+ */
+static int elf_read(int fd, unsigned long off, void *buffer, size_t size)
+{
+	int ret;
 
-	if (do_stat(filename, &st))
-		return NULL;
+	if (do_lseek(fd, off, SEEK_SET) != off)
+		return -1;
 
-	if (!st.st_size)
-		return NULL;
+	while (size) {
+		ret = do_read(fd, buffer, size);
+		if (ret <= 0)
+			return -1;
 
-	buffer = malloc(st.st_size);
-	if (!buffer) {
-		printk("%s: failed to allocate memory\n", __func__);
-		return NULL;
+		buffer += ret;
+		size -= ret;
 	}
 
-	do_read(fd, buffer, st.st_size);
-
-	do_close(fd);
-
-	return buffer;
+	return 0;
 }
 
 /*
- * Clean all allocated data related to the ELF image.
+ * Open an ELF executable and read its header and program header table.
+ * Only these are kept in the kernel heap; the contents of the segments are
+ * read afterwards directly into the process pages by elf_load_segment().
  */
-void elf_clean_image(elf_img_info_t *elf_img_info)
+int elf_open(const char *filename, elf_img_info_t *elf_img_info)
 {
-	int i;
-
-	free(elf_img_info->file_buffer);
+	struct stat st;
+	unsigned long end;
+	size_t i;
 
-	/* Release the heap allocated to store the binary image components */
-	for (i = 0; i < elf_img_info->header->e_shnum; i++)
-		free(elf_img_info->section_names[i]);
+	memset(elf_img_info, 0, sizeof(elf_img_info_t));
 
-	free(elf_img_info->section_names);
-	free(elf_img_info->sections);
-	free(elf_img_info->header);
-	free(elf_img_info->segments);
-}
+	if (do_stat(filename, &st) || !st.st_size)
+		return -1;
 
-void elf_load_sections(elf_img_info_t *elf_img_info)
-{
-	size_t i;
-	size_t section_name_len;
-	size_t section_name_offset;
+	elf_img_info->fd = do_open(filename, O_RDONLY);
+	if (elf_img_info->fd < 0)
+		return -1;
 
-	/* header */
-#ifdef CONFIG_ARCH_ARM32
-	elf_img_info->header =
-		(struct elf32_hdr *)malloc(sizeof(struct elf32_hdr));
-#else
-	elf_img_info->header =
-		(struct elf64_hdr *)malloc(sizeof(struct elf64_hdr));
-#endif
+	elf_img_info->header = malloc(sizeof(elf_hdr_t));
 	if (!elf_img_info->header) {
 		printk("%s: failed to allocate memory\n", __func__);
-		kernel_panic();
+		goto err;
 	}
 
-#ifdef CONFIG_ARCH_ARM32
-	memcpy(elf_img_info->header, elf_img_info->file_buffer,
-	       sizeof(struct elf32_hdr));
-#else
-	memcpy(elf_img_info->header, elf_img_info->file_buffer,
-	       sizeof(struct elf64_hdr));
-#endif
-
-	LOG_DEBUG("Magic: 0x%02x%c%c%c\n", elf_img_info->header->e_ident[EI_MAG0],
-	    elf_img_info->header->e_ident[EI_MAG1],
-	    elf_img_info->header->e_ident[EI_MAG2],
-	    elf_img_info->header->e_ident[EI_MAG3]);
-	LOG_DEBUG("%d sections\n", elf_img_info->header->e_shnum);
-	LOG_DEBUG("section table is at offset 0x%08x (%d bytes/section)\n",
-	    elf_img_info->header->e_shoff, elf_img_info->header->e_shentsize);
-
-#ifdef CONFIG_ARCH_ARM32
-	LOG_DEBUG("sizeof(struct elf32_shdr): %d bytes\n", sizeof(struct elf32_shdr));
-#else
-	LOG_DEBUG("sizeof(struct elf64_shdr): %d bytes\n", sizeof(struct elf64_shdr));
-#endif
-
-	/* sections */
-#ifdef CONFIG_ARCH_ARM32
-	elf_img_info->sections = (struct elf32_shdr *)malloc(
-		elf_img_info->header->e_shnum * sizeof(struct elf32_shdr));
-#else
-	elf_img_info->sections = (struct elf64_shdr *)malloc(
-		elf_img_info->header->e_shnum * sizeof(struct elf64_shdr));
-#endif
+	if (elf_read(elf_img_info->fd, 0, elf_img_info->header, sizeof(elf_hdr_t)))
+		goto err;
 
-	if (!elf_img_info->sections) {
-		LOG_CRITICAL("%s: failed to allocate memory\n", __func__);
-		kernel_panic();
+	if (memcmp(elf_img_info->header->e_ident, ELFMAG, SELFMAG) ||
+	    (elf_img_info->header->e_phentsize != sizeof(elf_phdr_t)) || !elf_img_info->header->e_phnum) {
+		LOG_ERROR("%s: %s is not a valid executable\n", __func__, filename);
+		goto err;
 	}
 
-	elf_img_info->section_names =
-		(char **)malloc(elf_img_info->header->e_shnum * sizeof(char *));
-	if (!elf_img_info->section_names) {
-		LOG_CRITICAL("%s: failed to allocate memory\n", __func__);
-		kernel_panic();
-	}
-
-	for (i = 0; i < elf_img_info->header->e_shnum; i++)
-		memcpy(elf_img_info->sections + i,
-		       elf_img_info->file_buffer +
-			       elf_img_info->header->e_shoff +
-			       i * elf_img_info->header->e_shentsize,
-		       sizeof(struct elf32_shdr));
-
-	/* Section names */
-	for (i = 0; i < elf_img_info->header->e_shnum; i++) {
-		section_name_offset =
-			elf_img_info->sections[elf_img_info->header->e_shstrndx]
-				.sh_offset +
-			elf_img_info->sections[i].sh_name;
-		section_name_len =
-			strlen((const char *)(elf_img_info->file_buffer +
-					      section_name_offset));
-
-		elf_img_info->section_names[i] =
-			(char *)malloc(section_name_len + 1);
-		if (!elf_img_info->section_names[i]) {
-			printk("%s: failed to allocate memory\n", __func__);
-			kernel_panic();
-		}
-
-		strcpy(elf_img_info->section_names[i],
-		       (char *)(elf_img_info->file_buffer +
-				section_name_offset));
-
-		LOG_DEBUG("[0x%08x] section name: %s\t(%d bytes)\n",
-		    section_name_offset, elf_img_info->section_names[i],
-		    section_name_len);
-	}
-
-	for (i = 0; i < elf_img_info->header->e_shnum; i++) {
-		LOG_DEBUG("\t[0x%08x] %s loads at 0x%08x (%d bytes) - flags: 0x%08x\n",
-		    elf_img_info->sections[i].sh_offset,
-		    elf_img_info->section_names[i],
-		    elf_img_info->sections[i].sh_addr,
-		    elf_img_info->sections[i].sh_size,
-		    elf_img_info->sections[i].sh_flags);
-	}
-}
-
-void elf_load_segments(elf_img_info_t *elf_img_info)
-{
-	size_t i;
+	LOG_DEBUG("%d segments\n", elf_img_info->header->e_phnum);
+	LOG_DEBUG("segment table is at offset 0x%08x (%d bytes/section)\n",
+	    elf_img_info->header->e_phoff, elf_img_info->header->e_phentsize);
 
 	/* Segments */
-#ifdef CONFIG_ARCH_ARM32
-	elf_img_info->segments = (struct elf32_phdr *)malloc(
-		sizeof(struct elf32_phdr) * elf_img_info->header->e_phnum);
-#else
-	elf_img_info->segments = (struct elf64_phdr *)malloc(
-		sizeof(struct elf64_phdr) * elf_img_info->header->e_phnum);
-#endif
-
+	elf_img_info->segments = malloc(sizeof(elf_phdr_t) * elf_img_info->header->e_phnum);
 	if (!elf_img_info->segments) {
-		LOG_CRITICAL("%s: failed to allocate memory\n", __func__);
-		kernel_panic();
+		printk("%s: failed to allocate memory\n", __func__);
+		goto err;
 	}
 
-	LOG_DEBUG("%d segments\n", elf_img_info->header->e_phnum);
-	LOG_DEBUG("segment table is at offset 0x%08x (%d bytes/section)\n",
-	    elf_img_info->header->e_phoff, elf_img_info->header->e_phentsize);
-#ifdef CONFIG_ARCH_ARM32
-	LOG_DEBUG("sizeof(struct elf32_phdr): %d bytes\n", sizeof(struct elf32_phdr));
-#else
-	LOG_DEBUG("sizeof(struct elf64_phdr): %d bytes\n", sizeof(struct elf64_phdr));
-#endif
+	if (elf_read(elf_img_info->fd, elf_img_info->header->e_phoff, elf_img_info->segments,
+		     sizeof(elf_phdr_t) * elf_img_info->header->e_phnum))
+		goto err;
 
 	elf_img_info->segment_page_count = 0;
-	for (i = 0; i < elf_img_info->header->e_phnum; i++) {
-#ifdef CONFIG_ARCH_ARM32
-		memcpy(elf_img_info->segments + i,
-		       elf_img_info->file_buffer +
-			       elf_img_info->header->e_phoff +
-			       i * elf_img_info->header->e_phentsize,
-		       sizeof(struct elf32_phdr));
-#else
-		memcpy(elf_img_info->segments + i,
-		       elf_img_info->file_buffer +
-			       elf_img_info->header->e_phoff +
-			       i * elf_img_info->header->e_phentsize,
-		       sizeof(struct elf64_phdr));
-#endif
-
-		if (elf_img_info->segments[i].p_type == PT_LOAD)
-			elf_img_info->segment_page_count +=
-				(elf_img_info->segments[i].p_memsz >>
-				 PAGE_SHIFT) +
-				1;
-	}
-	LOG_DEBUG("segments use %d virtual pages\n",
-	    elf_img_info->segment_page_count);
-
 	for (i = 0; i < elf_img_info->header->e_phnum; i++) {
 		LOG_DEBUG("[0x%08x] vaddr: 0x%08x; paddr: 0x%08x; filesize: 0x%08x; memsize: 0x%08x flags: 0x%08x\n",
 		    elf_img_info->segments[i].p_offset,
@@ -242,5 +116,63 @@ void elf_load_segments(elf_img_info_t *elf_img_info)
 		    elf_img_info->segments[i].p_filesz,
 		    elf_img_info->segments[i].p_memsz,
 		    elf_img_info->segments[i].p_flags);
+
+		if (elf_img_info->segments[i].p_type != PT_LOAD)
+			continue;
+
+		/* The contents of the segment must be in the file since it is read
+		 * once the current image of the process has been released. */
+		end = elf_img_info->segments[i].p_offset + elf_img_info->segments[i].p_filesz;
+		if ((end > st.st_size) || (elf_img_info->segments[i].p_filesz > elf_img_info->segments[i].p_memsz)) {
+			LOG_ERROR("%s: %s has an invalid segment\n", __func__, filename);
+			goto err;
+		}
+
+		elf_img_info->segment_page_count += (elf_img_info->segments[i].p_memsz >> PAGE_SHIFT) + 1;
 	}
+
+	LOG_DEBUG("segments use %d virtual pages\n", elf_img_info->segment_page_count);
+
+	return 0;
+
+err:
+	elf_clean_image(elf_img_info);
+
+	return -1;
+}
+
+/*
+ * Read the contents of a PT_LOAD segment into the virtual pages of the running
+ * process, which must already be mapped, and zero the part of the segment which
+ * is not stored in the file (.bss).
+ */
+int elf_load_segment(elf_img_info_t *elf_img_info, int i)
+{
+	void *vaddr = (void *) elf_img_info->segments[i].p_vaddr;
+
+	if (elf_read(elf_img_info->fd, elf_img_info->segments[i].p_offset, vaddr,
+		     elf_img_info->segments[i].p_filesz))
+		return -1;
+
+	memset(vaddr + elf_img_info->segments[i].p_filesz, 0,
+	       elf_img_info->segments[i].p_memsz - elf_img_info->segments[i].p_filesz);
+
+	return 0;
+}
+
+/*
+ * Close the ELF file and release the headers.
+ */
+void elf_clean_image(elf_img_info_t *elf_img_info)
+{
+	if (elf_img_info->fd >= 0)
+		do_close(elf_img_info->fd);
+
+	elf_img_info->fd = -1;
+
+	free(elf_img_info->header);
+	free(elf_img_info->segments);
+
+	elf_img_info->header = NULL;
+	elf_img_info->segments = NULL;
 }
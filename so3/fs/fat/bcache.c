@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2025 Daniel Rossier <daniel.rossier@heig-vd.ch>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Block buffer cache
+ *
+ * The sectors read and written by FatFs are kept in a fixed set of buffers
+ * managed in LRU order. A miss which follows the previous miss on the device
+ * is considered as a sequential access and more sectors are read at once,
+ * up to BCACHE_RA_MAX. Written sectors are only marked dirty; they are
+ * written back when they are evicted or when FatFs syncs the volume.
+ */
+
+#include <common.h>
+#include <heap.h>
+#include <list.h>
+#include <mutex.h>
+#include <string.h>
+
+#include <fat/bcache.h>
+
+#define BCACHE_HASH_SIZE 64
+
+/* Read-ahead window on the first sequential miss and at most */
+#define BCACHE_RA_MIN 4
+#define BCACHE_RA_MAX 32
+
+/* Requests of at least this number of sectors go straight to the device */
+#define BCACHE_BYPASS BCACHE_RA_MAX
+
+/* A read-ahead window must fit in the cache */
+#if CONFIG_FAT_BCACHE_BLOCKS < BCACHE_RA_MAX
+#error "CONFIG_FAT_BCACHE_BLOCKS must be at least BCACHE_RA_MAX"
+#endif
+
+struct bcache_block {
+	block_dev_desc_t *dev;
+	lbaint_t sector;
+
+	bool valid;
+	bool dirty;
+
+	void *data;
+
+	struct list_head hash;
+	struct list_head lru;
+};
+
+static struct bcache_block *blocks;
+
+static struct list_head bcache_hash[BCACHE_HASH_SIZE];
+
+/* Most recently used blocks first */
+static LIST_HEAD(bcache_lru);
+
+static struct mutex bcache_lock;
+
+/* Sector size of the cached device */
+static unsigned long bcache_blksz;
+
+/* Bounce buffer used to read several sectors at once */
+static void *ra_buffer;
+
+/* Sector following the last miss and current read-ahead window */
+static lbaint_t ra_next;
+static unsigned int ra_window;
+
+/* Statistics */
+static unsigned long bcache_hits, bcache_misses, bcache_readahead, bcache_writebacks;
+
+static struct list_head *bcache_bucket(lbaint_t sector)
+{
+	return &bcache_hash[sector % BCACHE_HASH_SIZE];
+}
+
+static struct bcache_block *bcache_lookup(block_dev_desc_t *dev, lbaint_t sector)
+{
+	struct bcache_block *b;
+
+	list_for_each_entry(b, bcache_bucket(sector), hash)
+		if ((b->sector == sector) && (b->dev == dev))
+			return b;
+
+	return NULL;
+}
+
+static int bcache_writeback(struct bcache_block *b)
+{
+	if (!b->dev->block_write(b->dev->dev, b->sector, 1, b->data)) {
+		LOG_ERROR("%s: failed to write sector %lu\n", __func__, (unsigned long) b->sector);
+		return -1;
+	}
+
+	b->dirty = false;
+	bcache_writebacks++;
+
+	return 0;
+}
+
+/*
+ * Take the least recently used block, writing it back if needed.
+ */
+static struct bcache_block *bcache_evict(void)
+{
+	struct bcache_block *b;
+
+	b = list_entry(bcache_lru.prev, struct bcache_block, lru);
+
+	if (b->dirty && bcache_writeback(b))
+		return NULL;
+
+	if (b->valid) {
+		list_del(&b->hash);
+		b->valid = false;
+	}
+
+	return b;
+}
+
+static void bcache_insert(struct bcache_block *b, block_dev_desc_t *dev, lbaint_t sector)
+{
+	b->dev = dev;
+	b->sector = sector;
+	b->valid = true;
+
+	list_add(&b->hash, bcache_bucket(sector));
+	list_move(&b->lru, &bcache_lru);
+}
+
+/*
+ * Allocate the buffers. The cache is set up once for the first device.
+ */
+int bcache_init(block_dev_desc_t *dev)
+{
+	int i;
+
+	if (blocks)
+		return 0;
+
+	bcache_blksz = dev->blksz;
+
+	blocks = malloc(CONFIG_FAT_BCACHE_BLOCKS * sizeof(struct bcache_block));
+	ra_buffer = malloc(BCACHE_RA_MAX * bcache_blksz);
+
+	if (!blocks || !ra_buffer) {
+		LOG_ERROR("%s: failed to allocate the block cache\n", __func__);
+		return -1;
+	}
+
+	mutex_init(&bcache_lock);
+
+	for (i = 0; i < BCACHE_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&bcache_hash[i]);
+
+	for (i = 0; i < CONFIG_FAT_BCACHE_BLOCKS; i++) {
+		blocks[i].data = malloc(bcache_blksz);
+		if (!blocks[i].data) {
+			LOG_ERROR("%s: failed to allocate the block cache\n", __func__);
+			return -1;
+		}
+
+		blocks[i].valid = false;
+		blocks[i].dirty = false;
+
+		list_add_tail(&blocks[i].lru, &bcache_lru);
+	}
+
+	return 0;
+}
+
+/*
+ * Bring the cached copies of [start, start + blkcnt) in line with a transfer
+ * which bypassed the cache. After a read, the buffer gets the dirty sectors;
+ * after a write, the cached sectors get the new contents.
+ */
+static void bcache_bypass(block_dev_desc_t *dev, void *buffer, lbaint_t start, lbaint_t blkcnt, bool write)
+{
+	struct bcache_block *b;
+	int i;
+
+	for (i = 0; i < CONFIG_FAT_BCACHE_BLOCKS; i++) {
+		b = &blocks[i];
+
+		if (!b->valid || (b->dev != dev) || (b->sector < start) || (b->sector >= start + blkcnt))
+			continue;
+
+		if (write) {
+			memcpy(b->data, buffer + (b->sector - start) * bcache_blksz, bcache_blksz);
+			b->dirty = false;
+		} else if (b->dirty) {
+			memcpy(buffer + (b->sector - start) * bcache_blksz, b->data, bcache_blksz);
+		}
+	}
+}
+
+int bcache_read(block_dev_desc_t *dev, void *buffer, lbaint_t start, lbaint_t blkcnt)
+{
+	struct bcache_block *b;
+	lbaint_t i, j, n, total;
+	int ret = 0;
+
+	mutex_lock(&bcache_lock);
+
+	if (blkcnt >= BCACHE_BYPASS) {
+		if (!dev->block_read(dev->dev, start, blkcnt, buffer))
+			ret = -1;
+		else
+			bcache_bypass(dev, buffer, start, blkcnt, false);
+
+		goto out;
+	}
+
+	for (i = 0; i < blkcnt;) {
+		b = bcache_lookup(dev, start + i);
+		if (b) {
+			memcpy(buffer + i * bcache_blksz, b->data, bcache_blksz);
+			list_move(&b->lru, &bcache_lru);
+
+			bcache_hits++;
+			i++;
+			continue;
+		}
+
+		/* Number of consecutive missing sectors in the request */
+		for (n = 1; (i + n < blkcnt) && !bcache_lookup(dev, start + i + n); n++)
+			;
+
+		bcache_misses += n;
+
+		/* Grow the read-ahead window as long as the accesses are sequential */
+		if (start + i == ra_next)
+			ra_window = (ra_window ? min(2 * ra_window, (unsigned int) BCACHE_RA_MAX) : BCACHE_RA_MIN);
+		else
+			ra_window = 0;
+
+		total = n;
+		while ((total < ra_window) && (start + i + total < dev->lba) && !bcache_lookup(dev, start + i + total))
+			total++;
+
+		if (!dev->block_read(dev->dev, start + i, total, ra_buffer)) {
+			ret = -1;
+			goto out;
+		}
+
+		for (j = 0; j < total; j++) {
+			b = bcache_evict();
+			if (!b) {
+				ret = -1;
+				goto out;
+			}
+
+			memcpy(b->data, ra_buffer + j * bcache_blksz, bcache_blksz);
+			bcache_insert(b, dev, start + i + j);
+
+			if (j < n)
+				memcpy(buffer + (i + j) * bcache_blksz, b->data, bcache_blksz);
+		}
+
+		bcache_readahead += total - n;
+		ra_next = start + i + total;
+
+		i += n;
+	}
+
+out:
+	mutex_unlock(&bcache_lock);
+
+	return ret;
+}
+
+int bcache_write(block_dev_desc_t *dev, const void *buffer, lbaint_t start, lbaint_t blkcnt)
+{
+	struct bcache_block *b;
+	lbaint_t i;
+	int ret = 0;
+
+	mutex_lock(&bcache_lock);
+
+	if (blkcnt >= BCACHE_BYPASS) {
+		if (!dev->block_write(dev->dev, start, blkcnt, buffer))
+			ret = -1;
+		else
+			bcache_bypass(dev, (void *) buffer, start, blkcnt, true);
+
+		goto out;
+	}
+
+	for (i = 0; i < blkcnt; i++) {
+		b = bcache_lookup(dev, start + i);
+		if (!b) {
+			b = bcache_evict();
+			if (!b) {
+				ret = -1;
+				goto out;
+			}
+			bcache_insert(b, dev, start + i);
+		} else {
+			list_move(&b->lru, &bcache_lru);
+		}
+
+		memcpy(b->data, buffer + i * bcache_blksz, bcache_blksz);
+		b->dirty = true;
+	}
+
+out:
+	mutex_unlock(&bcache_lock);
+
+	return ret;
+}
+
+/*
+ * Write back all dirty sectors of the device.
+ */
+int bcache_sync(block_dev_desc_t *dev)
+{
+	int i, ret = 0;
+
+	mutex_lock(&bcache_lock);
+
+	for (i = 0; i < CONFIG_FAT_BCACHE_BLOCKS; i++)
+		if (blocks[i].dirty && (blocks[i].dev == dev) && bcache_writeback(&blocks[i]))
+			ret = -1;
+
+	mutex_unlock(&bcache_lock);
+
+	return ret;
+}
+
+void dump_bcache(void)
+{
+	int i, dirty = 0, valid = 0;
+
+	if (!blocks)
+		return;
+
+	mutex_lock(&bcache_lock);
+
+	for (i = 0; i < CONFIG_FAT_BCACHE_BLOCKS; i++) {
+		valid += blocks[i].valid;
+		dirty += blocks[i].dirty;
+	}
+
+	mutex_unlock(&bcache_lock);
+
+	printk("Block cache: %d/%d sectors of %lu bytes, %d dirty\n", valid, CONFIG_FAT_BCACHE_BLOCKS, bcache_blksz,
+	       dirty);
+	printk("  hits: %lu  misses: %lu  read ahead: %lu  written back: %lu\n", bcache_hits, bcache_misses,
+	       bcache_readahead, bcache_writebacks);
+}
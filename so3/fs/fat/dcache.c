@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2025 Daniel Rossier <daniel.rossier@heig-vd.ch>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Directory entry cache
+ *
+ * The metadata of the entries looked up by path (stat, open) are kept in a fixed
+ * set of entries managed in LRU order, so that FatFs does not have to follow the
+ * path and read the directory sectors again. A path which does not exist gets a
+ * negative entry. The paths are normalized (no redundant '/', no '.' component,
+ * upper case since FAT names are case-insensitive); paths which cannot be
+ * normalized this way are not cached.
+ *
+ * An entry is dropped when the file is created or removed, along with the entries
+ * below it if it is a directory, and when a write changes its size or cluster chain.
+ */
+
+#include <common.h>
+#include <list.h>
+#include <spinlock.h>
+#include <string.h>
+
+#include <fat/dcache.h>
+
+#define DCACHE_HASH_SIZE 32
+
+/* Longest normalized path which can be cached */
+#define DCACHE_PATH_LEN 64
+
+struct dcache_entry {
+	char path[DCACHE_PATH_LEN];
+	unsigned int hash;
+
+	bool valid;
+
+	/* The path does not exist */
+	bool negative;
+
+	struct dcache_info info;
+
+	struct list_head hash_list;
+	struct list_head lru;
+};
+
+static struct dcache_entry entries[CONFIG_FAT_DCACHE_ENTRIES];
+
+static struct list_head dcache_hash[DCACHE_HASH_SIZE];
+
+/* Most recently used entries first */
+static LIST_HEAD(dcache_lru);
+
+static DEFINE_SPINLOCK(dcache_lock);
+
+/* Incremented on each invalidation */
+static unsigned long dcache_gen;
+
+/* Statistics */
+static unsigned long dcache_hits, dcache_negative_hits, dcache_misses, dcache_invalidations;
+
+/*
+ * Normalize a path into <buf>. Returns the length of the normalized path, or -1
+ * if it cannot be cached.
+ */
+static int dcache_normalize(const char *path, char *buf)
+{
+	int len = 0, start;
+
+	while (*path) {
+		/* Skip the separators */
+		while (*path == '/')
+			path++;
+
+		if (!*path)
+			break;
+
+		/* Skip "." */
+		if ((path[0] == '.') && ((path[1] == '/') || !path[1])) {
+			path++;
+			continue;
+		}
+
+		/* ".." would require to resolve the path */
+		if ((path[0] == '.') && (path[1] == '.') && ((path[2] == '/') || !path[2]))
+			return -1;
+
+		if (len)
+			buf[len++] = '/';
+
+		start = len;
+
+		for (; *path && (*path != '/'); path++) {
+			/* Drive prefix or characters which FatFs may fold differently */
+			if ((*path == ':') || (*path & 0x80))
+				return -1;
+
+			if (len == DCACHE_PATH_LEN - 1)
+				return -1;
+
+			buf[len++] = ((*path >= 'a') && (*path <= 'z')) ? *path - 'a' + 'A' : *path;
+		}
+
+		if (len == start)
+			return -1;
+	}
+
+	/* The root directory has no entry */
+	if (!len)
+		return -1;
+
+	buf[len] = '\0';
+
+	return len;
+}
+
+static unsigned int dcache_hash_path(const char *path)
+{
+	unsigned int hash = 5381;
+
+	while (*path)
+		hash = hash * 33 + *path++;
+
+	return hash;
+}
+
+/* dcache_lock must be held */
+static struct dcache_entry *__dcache_lookup(const char *path, unsigned int hash)
+{
+	struct dcache_entry *e;
+
+	list_for_each_entry(e, &dcache_hash[hash % DCACHE_HASH_SIZE], hash_list)
+		if ((e->hash == hash) && !strcmp(e->path, path))
+			return e;
+
+	return NULL;
+}
+
+/* dcache_lock must be held */
+static void __dcache_drop(struct dcache_entry *e)
+{
+	list_del(&e->hash_list);
+	e->valid = false;
+
+	list_move_tail(&e->lru, &dcache_lru);
+}
+
+void dcache_init(void)
+{
+	int i;
+
+	for (i = 0; i < DCACHE_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&dcache_hash[i]);
+
+	for (i = 0; i < CONFIG_FAT_DCACHE_ENTRIES; i++) {
+		entries[i].valid = false;
+		list_add_tail(&entries[i].lru, &dcache_lru);
+	}
+}
+
+/*
+ * Look up the metadata of a path. <info> is filled on DCACHE_HIT.
+ * Returns DCACHE_HIT, DCACHE_NEGATIVE if the path is known not to exist, or DCACHE_MISS.
+ */
+int dcache_lookup(const char *path, struct dcache_info *info)
+{
+	char buf[DCACHE_PATH_LEN];
+	struct dcache_entry *e;
+	unsigned long flags;
+	unsigned int hash;
+	int ret = DCACHE_MISS;
+
+	if (dcache_normalize(path, buf) < 0)
+		return DCACHE_MISS;
+
+	hash = dcache_hash_path(buf);
+
+	flags = spin_lock_irqsave(&dcache_lock);
+
+	e = __dcache_lookup(buf, hash);
+	if (!e) {
+		dcache_misses++;
+	} else {
+		list_move(&e->lru, &dcache_lru);
+
+		if (e->negative) {
+			dcache_negative_hits++;
+			ret = DCACHE_NEGATIVE;
+		} else {
+			dcache_hits++;
+			*info = e->info;
+			ret = DCACHE_HIT;
+		}
+	}
+
+	spin_unlock_irqrestore(&dcache_lock, flags);
+
+	return ret;
+}
+
+/*
+ * Current generation of the cache, to be taken before reading an entry from the file system.
+ */
+unsigned long dcache_generation(void)
+{
+	return dcache_gen;
+}
+
+/*
+ * Add the metadata of a path, or a negative entry if <info> is NULL. Nothing is added if
+ * the cache has been invalidated since <gen> was taken, since the entry may be outdated.
+ */
+void dcache_insert(const char *path, struct dcache_info *info, unsigned long gen)
+{
+	char buf[DCACHE_PATH_LEN];
+	struct dcache_entry *e;
+	unsigned long flags;
+	unsigned int hash;
+	int len;
+
+	len = dcache_normalize(path, buf);
+	if (len < 0)
+		return;
+
+	hash = dcache_hash_path(buf);
+
+	flags = spin_lock_irqsave(&dcache_lock);
+
+	if (gen != dcache_gen) {
+		spin_unlock_irqrestore(&dcache_lock, flags);
+		return;
+	}
+
+	e = __dcache_lookup(buf, hash);
+	if (!e) {
+		/* Take the least recently used entry */
+		e = list_entry(dcache_lru.prev, struct dcache_entry, lru);
+		if (e->valid)
+			list_del(&e->hash_list);
+
+		memcpy(e->path, buf, len + 1);
+		e->hash = hash;
+		e->valid = true;
+
+		list_add(&e->hash_list, &dcache_hash[hash % DCACHE_HASH_SIZE]);
+	}
+
+	e->negative = !info;
+	if (info)
+		e->info = *info;
+
+	list_move(&e->lru, &dcache_lru);
+
+	spin_unlock_irqrestore(&dcache_lock, flags);
+}
+
+/*
+ * Drop the entry of a path which is created, modified or removed, and the entries
+ * below it. A path which cannot be normalized invalidates the whole cache.
+ */
+void dcache_invalidate(const char *path)
+{
+	char buf[DCACHE_PATH_LEN];
+	unsigned long flags;
+	int i, len;
+
+	len = dcache_normalize(path, buf);
+
+	flags = spin_lock_irqsave(&dcache_lock);
+
+	dcache_gen++;
+
+	for (i = 0; i < CONFIG_FAT_DCACHE_ENTRIES; i++) {
+		if (!entries[i].valid)
+			continue;
+
+		if ((len < 0) ||
+		    (!strncmp(entries[i].path, buf, len) && (!entries[i].path[len] || (entries[i].path[len] == '/')))) {
+			__dcache_drop(&entries[i]);
+			dcache_invalidations++;
+		}
+	}
+
+	spin_unlock_irqrestore(&dcache_lock, flags);
+}
+
+/*
+ * Drop the entry of a regular file whose size or cluster chain has changed.
+ * There are no entries below it, so that only this entry is looked up.
+ */
+void dcache_invalidate_file(const char *path)
+{
+	char buf[DCACHE_PATH_LEN];
+	struct dcache_entry *e;
+	unsigned long flags;
+	unsigned int hash;
+
+	if (dcache_normalize(path, buf) < 0) {
+		dcache_invalidate(path);
+		return;
+	}
+
+	hash = dcache_hash_path(buf);
+
+	flags = spin_lock_irqsave(&dcache_lock);
+
+	/* A lookup in progress may have read the former metadata */
+	dcache_gen++;
+
+	e = __dcache_lookup(buf, hash);
+	if (e) {
+		__dcache_drop(e);
+		dcache_invalidations++;
+	}
+
+	spin_unlock_irqrestore(&dcache_lock, flags);
+}
+
+void dump_dcache(void)
+{
+	int i, valid = 0, negative = 0;
+	unsigned long flags;
+
+	flags = spin_lock_irqsave(&dcache_lock);
+
+	for (i = 0; i < CONFIG_FAT_DCACHE_ENTRIES; i++) {
+		valid += entries[i].valid;
+		negative += entries[i].valid && entries[i].negative;
+	}
+
+	spin_unlock_irqrestore(&dcache_lock, flags);
+
+	printk("Directory entry cache: %d/%d entries, %d negative\n", valid, CONFIG_FAT_DCACHE_ENTRIES, negative);
+	printk("  hits: %lu  negative hits: %lu  misses: %lu  invalidated: %lu\n", dcache_hits, dcache_negative_hits,
+	       dcache_misses, dcache_invalidations);
+}
@@ -11,6 +11,7 @@
 #include <part.h>
 
 #include <fat/diskio.h> /* FatFs lower layer API */
+#include <fat/bcache.h>
 
 /* Definitions of physical drive number for each drive */
 #define DEV_RAM 0 /* Example: Map Ramdisk to physical drive 0 */
@@ -73,6 +74,11 @@ disk_initialize(BYTE pdrv /* Physical drive nmuber to identify the drive */
 		return STA_NOINIT;
 	}
 
+#ifdef CONFIG_FAT_BCACHE
+	if (bcache_init(block_drvr[pdrv].dev_desc))
+		return STA_NOINIT;
+#endif
+
 	return 0;
 }
 
@@ -99,9 +105,14 @@ DRESULT disk_read(BYTE pdrv, /* Physical drive nmuber to identify the drive */
 
 	drvr = block_drvr[pdrv].dev_desc;
 
+#ifdef CONFIG_FAT_BCACHE
+	if (bcache_read(drvr, buff, sector, count))
+		return RES_ERROR;
+#else
 	if (!drvr->block_read(drvr->dev, sector, count, buff)) {
 		return -1;
 	}
+#endif
 
 	return 0;
 }
@@ -129,9 +140,14 @@ DRESULT disk_write(BYTE pdrv, /* Physical drive nmuber to identify the drive */
 
 	drvr = block_drvr[pdrv].dev_desc;
 
+#ifdef CONFIG_FAT_BCACHE
+	if (bcache_write(drvr, buff, sector, count))
+		return RES_ERROR;
+#else
 	if (!drvr->block_write(drvr->dev, sector, count, buff)) {
 		return -1;
 	}
+#endif
 
 	return 0;
 }
@@ -147,6 +163,11 @@ DRESULT disk_ioctl(BYTE pdrv, /* Physical drive nmuber (0..) */
 {
 	LOG_DEBUG("IOCLT %d %p\n", cmd, buff);
 
-	/* As for now, this is not in use */
+#ifdef CONFIG_FAT_BCACHE
+	/* Write back the dirty sectors kept in the block cache */
+	if ((cmd == CTRL_SYNC) && (pdrv < ARRAY_SIZE(block_drvr)) && block_drvr[pdrv].dev_desc)
+		return (bcache_sync(block_drvr[pdrv].dev_desc) ? RES_ERROR : RES_OK);
+#endif
+
 	return 0;
 }
@@ -22,8 +22,12 @@
 
 #include <fat/fat.h>
 #include <fat/ff.h>
+#include <fat/dcache.h>
 #include <dirent.h>
 #include <heap.h>
+#include <pagecache.h>
+#include <process.h>
+#include <slab.h>
 
 #include <device/timer.h>
 #include <device/serial.h>
@@ -34,6 +38,9 @@
 #define MOUNT_LATER 0
 #define MOUNT_NOW 1
 
+/* Initial number of items of a cluster link map table (grown if the file is fragmented) */
+#define CLMT_INITIAL_SIZE 32
+
 /*
  * The epoch of FAT timestamp is 1980.
  *     :  bits :     value
@@ -71,6 +78,12 @@ struct fat_entry {
 		FIL file;
 		struct stream dir;
 	} entry;
+
+	/* Cluster link map table used by the fast seek of FatFs, built on the first seek */
+	DWORD *clmt;
+
+	/* Set once the map has been built or cannot be; the regular seek is used without it */
+	bool clmt_tried;
 };
 
 struct fat_mount {
@@ -80,6 +93,10 @@ struct fat_mount {
 
 static struct fat_mount volumes[4];
 
+static kmem_cache_t *fat_entry_cache;
+
+static struct file_operations fatops;
+
 static int open_fat_file(int fd, const char *path, struct fat_entry *ptrent)
 {
 	uint32_t flags = vfs_get_open_mode(fd);
@@ -168,6 +185,46 @@ static void time_fat_fat2so3(unsigned short date, unsigned short time, struct ti
 	ts->tv_nsec = 0;
 }
 
+/*
+ * Build the cluster link map table of a file so that the next seeks do not walk the FAT chain.
+ * The map describes the clusters allocated at the time it is built, so a file opened
+ * for writing (which may grow) keeps the regular seek.
+ */
+static void fat_build_clmt(struct fat_entry *ptrent)
+{
+	FIL *fp = &ptrent->entry.file;
+	DWORD size = CLMT_INITIAL_SIZE;
+	FRESULT res;
+
+	ptrent->clmt_tried = true;
+
+	if ((fp->flag & FA_WRITE) || !fp->obj.sclust)
+		return;
+
+	while (1) {
+		ptrent->clmt = (DWORD *) malloc(size * sizeof(DWORD));
+		if (!ptrent->clmt)
+			return;
+
+		ptrent->clmt[0] = size;
+		fp->cltbl = ptrent->clmt;
+
+		res = f_lseek(fp, CREATE_LINKMAP);
+		if (res == FR_OK)
+			return;
+
+		/* On FR_NOT_ENOUGH_CORE, the first item holds the required size */
+		size = ptrent->clmt[0];
+
+		fp->cltbl = NULL;
+		free(ptrent->clmt);
+		ptrent->clmt = NULL;
+
+		if (res != FR_NOT_ENOUGH_CORE)
+			return;
+	}
+}
+
 int fat_read(int fd, void *buffer, int count)
 {
 	struct fat_entry *ptrent = (struct fat_entry *) vfs_get_priv(fd);
@@ -195,6 +252,10 @@ int fat_write(int fd, const void *buffer, int count)
 	struct fat_entry *ptrent = (struct fat_entry *) vfs_get_priv(fd);
 	int rc = 0;
 	int bwritten = 0;
+#ifdef CONFIG_FAT_DCACHE
+	FSIZE_t size;
+	DWORD sclust;
+#endif
 
 	if (!ptrent) {
 		LOG_ERROR("Error while writing fd %d\n", fd);
@@ -205,12 +266,31 @@ int fat_write(int fd, const void *buffer, int count)
 		return -EINVAL;
 	}
 
+#ifdef CONFIG_FAT_DCACHE
+	size = ptrent->entry.file.obj.objsize;
+	sclust = ptrent->entry.file.obj.sclust;
+#endif
+
 	if ((rc = f_write(&ptrent->entry.file, buffer, count, (unsigned *) &bwritten))) {
 		return -rc;
 	}
 
+#ifdef CONFIG_FILE_MMAP
+	/* New mappings of the file must see the new contents */
+	pagecache_invalidate(&fatops, ptrent->entry.file.obj.sclust);
+#endif
+
 	rc = f_sync(&ptrent->entry.file);
 
+#ifdef CONFIG_FAT_DCACHE
+	/*
+	 * Writing inside the file keeps the entry; only a new size or cluster chain drops it.
+	 * This is done once the directory entry is synced, so that a lookup cannot cache the old one again.
+	 */
+	if ((ptrent->entry.file.obj.objsize != size) || (ptrent->entry.file.obj.sclust != sclust))
+		dcache_invalidate_file(vfs_get_filename(fd));
+#endif
+
 	return bwritten;
 }
 
@@ -223,8 +303,19 @@ int fat_open(int fd, const char *path)
 	struct fat_entry *ptrent;
 	int rc;
 	uint32_t open_flags = vfs_get_open_mode(fd);
+#ifdef CONFIG_FAT_DCACHE
+	bool create = !!(open_flags & (O_CREAT | O_TRUNC | O_EXCL));
+	struct dcache_info info;
+	unsigned long gen;
+
+	/* Do not look for a path which is known not to exist */
+	if (!create && (dcache_lookup(path, &info) == DCACHE_NEGATIVE))
+		return -FR_NO_FILE;
 
-	ptrent = (struct fat_entry *) malloc(sizeof(struct fat_entry));
+	gen = dcache_generation();
+#endif
+
+	ptrent = (struct fat_entry *) kmem_cache_alloc(fat_entry_cache);
 	if (!ptrent) {
 		LOG_CRITICAL("%s: heap overflow...\n", __func__);
 		kernel_panic();
@@ -250,11 +341,25 @@ int fat_open(int fd, const char *path)
 		break;
 	}
 
+	ptrent->clmt = NULL;
+	ptrent->clmt_tried = false;
+
+#ifdef CONFIG_FAT_DCACHE
+	/* The file may have been created or truncated */
+	if (create)
+		dcache_invalidate(path);
+#endif
+
 	vfs_set_priv(fd, (void *) ptrent);
 	return 0;
 
 open_fail:
-	free(ptrent);
+#ifdef CONFIG_FAT_DCACHE
+	if (!create && ((rc == FR_NO_FILE) || (rc == FR_NO_PATH)))
+		dcache_insert(path, NULL, gen);
+#endif
+
+	kmem_cache_free(fat_entry_cache, ptrent);
 	return -rc;
 }
 
@@ -278,7 +383,10 @@ int fat_close(int fd)
 		return -EBADFD;
 	}
 
-	free(ptrent);
+	if (ptrent->clmt)
+		free(ptrent->clmt);
+
+	kmem_cache_free(fat_entry_cache, ptrent);
 	return 0;
 }
 
@@ -341,22 +449,90 @@ struct dirent *fat_readdir(int fd)
 
 	if (fno.fattrib & AM_DIR)
 		dent->d_type = DT_DIR;
-	else
+	else {
 		dent->d_type = DT_REG;
+		dent->d_size = fno.fsize;
+	}
 
 	strcpy(dent->d_name, fn);
 
 	return (void *) dent;
 }
 
-int fat_unlink(int fd, const char *path)
+int fat_unlink(const char *path)
 {
-	return 0;
+	FRESULT res;
+
+	res = f_unlink(path);
+
+#ifdef CONFIG_FAT_DCACHE
+	/* The entry (or a directory and the entries below it) must not survive the removal */
+	if (res == FR_OK)
+		dcache_invalidate(path);
+#endif
+
+	switch (res) {
+	case FR_OK:
+		return 0;
+
+	case FR_NO_FILE:
+	case FR_NO_PATH:
+		set_errno(ENOENT);
+		break;
+
+	case FR_DENIED:
+		/* Not empty directory or read-only entry */
+		set_errno(EACCES);
+		break;
+
+	default:
+		set_errno(EIO);
+	}
+
+	return -1;
 }
 
-int fat_stat(const char *path, struct stat *st)
+/*
+ * Get the metadata of a path, from the directory entry cache if possible.
+ */
+static FRESULT fat_lookup(const char *path, struct dcache_info *info)
 {
 	FILINFO finfo;
+	FRESULT res;
+#ifdef CONFIG_FAT_DCACHE
+	unsigned long gen;
+
+	switch (dcache_lookup(path, info)) {
+	case DCACHE_HIT:
+		return FR_OK;
+	case DCACHE_NEGATIVE:
+		return FR_NO_FILE;
+	}
+
+	gen = dcache_generation();
+#endif
+
+	res = f_stat(path, &finfo);
+	if (res == FR_OK) {
+		info->size = finfo.fsize;
+		info->fdate = finfo.fdate;
+		info->ftime = finfo.ftime;
+		info->fattrib = finfo.fattrib;
+	}
+
+#ifdef CONFIG_FAT_DCACHE
+	if (res == FR_OK)
+		dcache_insert(path, info, gen);
+	else if ((res == FR_NO_FILE) || (res == FR_NO_PATH))
+		dcache_insert(path, NULL, gen);
+#endif
+
+	return res;
+}
+
+int fat_stat(const char *path, struct stat *st)
+{
+	struct dcache_info info;
 	struct timespec tm;
 	int res;
 
@@ -367,14 +543,15 @@ int fat_stat(const char *path, struct stat *st)
 
 	memset(st, 0, sizeof(struct stat));
 
-	if ((res = f_stat(path, &finfo))) {
+	if ((res = fat_lookup(path, &info))) {
 		set_errno(EEXIST);
+		return res;
 	}
 
-	time_fat_fat2so3(finfo.fdate, finfo.ftime, &tm);
+	time_fat_fat2so3(info.fdate, info.ftime, &tm);
 	st->st_mtim = tm.tv_sec;
 	strcpy(st->st_name, path);
-	st->st_size = finfo.fsize;
+	st->st_size = info.size;
 
 	return res;
 }
@@ -412,10 +589,16 @@ static int fat_ioctl(int fd, unsigned long cmd, unsigned long args)
  */
 static off_t fat_lseek(int fd, off_t off, int whence)
 {
-	struct fat_entry *ptrent = (struct fat_entry *) vfs_get_priv(fd);
+	/* lseek() is called with the local fd */
+	struct fat_entry *ptrent = (struct fat_entry *) vfs_get_priv(vfs_get_gfd(fd));
 	off_t ret;
 	uint32_t eof, cur;
 
+	if (ptrent->tentry != TYPE_FILE) {
+		set_errno(EINVAL);
+		return -1;
+	}
+
 	/* Get the size of the file (eof) */
 	eof = ptrent->entry.file.obj.objsize;
 
@@ -460,6 +643,9 @@ static off_t fat_lseek(int fd, off_t off, int whence)
 		break;
 	}
 
+	if (!ptrent->clmt_tried)
+		fat_build_clmt(ptrent);
+
 	ret = f_lseek(&ptrent->entry.file, off);
 	if (ret) {
 		set_errno(EINVAL);
@@ -469,6 +655,95 @@ static off_t fat_lseek(int fd, off_t off, int whence)
 	return off;
 }
 
+#ifdef CONFIG_FILE_MMAP
+
+/*
+ * A mapped file is read through its own file object, since the fd used to map it
+ * may be closed or used for other accesses meanwhile.
+ */
+static int fat_readpage(void *priv, unsigned long index, void *buf)
+{
+	FIL *fp = (FIL *) priv;
+	unsigned bread;
+
+	if (f_lseek(fp, (FSIZE_t) index << PAGE_SHIFT))
+		return -1;
+
+	if (f_read(fp, buf, PAGE_SIZE, &bread))
+		return -1;
+
+	return 0;
+}
+
+static void fat_release_mapping(void *priv)
+{
+	f_close((FIL *) priv);
+	free(priv);
+}
+
+static struct pagecache_ops fat_pagecache_ops = { .readpage = fat_readpage, .release = fat_release_mapping };
+
+/*
+ * Get the page cache of a regular file, with a reference. The pages of the file are
+ * shared by all processes mapping it. The files are identified by their first cluster.
+ */
+static struct mapped_file *fat_get_mapping(int fd)
+{
+	int gfd = vfs_get_gfd(fd);
+	struct fat_entry *ptrent = (struct fat_entry *) vfs_get_priv(gfd);
+	struct mapped_file *file;
+	DWORD ino;
+	FIL *fp;
+
+	if ((ptrent->tentry != TYPE_FILE) || !ptrent->entry.file.obj.sclust) {
+		set_errno(EINVAL);
+		return NULL;
+	}
+
+	ino = ptrent->entry.file.obj.sclust;
+
+	file = pagecache_find(&fatops, ino);
+	if (file)
+		return file;
+
+	fp = (FIL *) malloc(sizeof(FIL));
+	if (!fp) {
+		set_errno(ENOMEM);
+		return NULL;
+	}
+
+	if (f_open(fp, vfs_get_filename(gfd), FA_READ)) {
+		free(fp);
+		set_errno(EACCES);
+		return NULL;
+	}
+
+	file = pagecache_create(&fatops, ino, fp->obj.objsize, &fat_pagecache_ops, fp);
+	if (!file) {
+		fat_release_mapping(fp);
+		set_errno(ENOMEM);
+		return NULL;
+	}
+
+	return file;
+}
+
+/*
+ * Map a regular file. The pages are read on the first access.
+ */
+static void *fat_mmap(int fd, addr_t virt_addr, uint32_t page_count, off_t offset, int prot)
+{
+	struct mapped_file *file;
+
+	file = fat_get_mapping(fd);
+	if (!file)
+		return MAP_FAILED;
+
+	return do_mmap_file(file, virt_addr, page_count, offset, prot);
+}
+
+#endif /* CONFIG_FILE_MMAP */
+
 static struct file_operations fatops = { .open = fat_open,
 					 .close = fat_close,
 					 .read = fat_read,
@@ -476,10 +751,23 @@ static struct file_operations fatops = { .open = fat_open,
 					 .mount = fat_mount,
 					 .readdir = fat_readdir,
 					 .stat = fat_stat,
+					 .unlink = fat_unlink,
 					 .ioctl = fat_ioctl,
-					 .lseek = fat_lseek };
+					 .lseek = fat_lseek,
+#ifdef CONFIG_FILE_MMAP
+					 .mmap = fat_mmap,
+					 .get_mapping = fat_get_mapping,
+#endif
+};
 
 struct file_operations *register_fat(void)
 {
+	fat_entry_cache = kmem_cache_create("fat_entry", sizeof(struct fat_entry), 0);
+	BUG_ON(!fat_entry_cache);
+
+#ifdef CONFIG_FAT_DCACHE
+	dcache_init();
+#endif
+
 	return &fatops;
 }
@@ -6,6 +6,7 @@
 #include <fat/ff.h>
 #include <heap.h>
 #include <common.h>
+#include <mutex.h>
 
 #if FF_USE_LFN == 3 /* Dynamic memory allocation */
 
@@ -54,9 +55,13 @@ int ff_cre_syncobj(/* 1:Function succeeded, 0:Could not create the sync object *
 		   FF_SYNC_t *sobj /* Pointer to return the created sync object */
 )
 {
-	/* Win32 */
-	*sobj = CreateMutex(NULL, FALSE, NULL);
-	return (int) (*sobj != INVALID_HANDLE_VALUE);
+	*sobj = (struct mutex *) malloc(sizeof(struct mutex));
+	if (!*sobj)
+		return 0;
+
+	mutex_init(*sobj);
+
+	return 1;
 }
 
 /*------------------------------------------------------------------------*/
@@ -71,8 +76,9 @@ int ff_del_syncobj(/* 1:Function succeeded, 0:Could not delete due to an error *
 		   FF_SYNC_t sobj /* Sync object tied to the logical drive to be deleted */
 )
 {
-	/* Win32 */
-	return (int) CloseHandle(sobj);
+	free(sobj);
+
+	return 1;
 }
 
 /*------------------------------------------------------------------------*/
@@ -86,8 +92,10 @@ int ff_req_grant(/* 1:Got a grant to access the volume, 0:Could not get a grant
 		 FF_SYNC_t sobj /* Sync object to wait */
 )
 {
-	/* Win32 */
-	return (int) (WaitForSingleObject(sobj, FF_FS_TIMEOUT) == WAIT_OBJECT_0);
+	/* SO3 mutexes have no timeout, FF_FS_TIMEOUT is therefore not used. */
+	mutex_lock(sobj);
+
+	return 1;
 }
 
 /*------------------------------------------------------------------------*/
@@ -99,8 +107,7 @@ int ff_req_grant(/* 1:Got a grant to access the volume, 0:Could not get a grant
 void ff_rel_grant(FF_SYNC_t sobj /* Sync object to be signaled */
 )
 {
-	/* Win32 */
-	ReleaseMutex(sobj);
+	mutex_unlock(sobj);
 }
 
 #endif
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2025 Daniel Rossier <daniel.rossier@heig-vd.ch>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Page cache of mapped files
+ *
+ * A file mapped with mmap() gets a mapped_file object which holds the pages of
+ * the file read so far. The pages are read on the first fault and are then mapped
+ * read-only in all processes mapping the same file. The cache keeps a reference on
+ * its pages until the last mapping of the file disappears, or longer for the files
+ * kept with pagecache_keep() (executables).
+ */
+
+#include <common.h>
+#include <heap.h>
+#include <pagecache.h>
+#include <process.h>
+#include <spinlock.h>
+#include <string.h>
+#include <vfs.h>
+
+/* Files currently mapped */
+static LIST_HEAD(mapped_files);
+
+/* Protect the list of mapped files and their refcount */
+static DEFINE_SPINLOCK(pagecache_lock);
+
+/* Number of files kept in the cache after their last mapping has disappeared */
+#define PAGECACHE_KEEP_NR 8
+
+/* Files kept by pagecache_keep(), the most recently used first */
+static struct mapped_file *kept_files[PAGECACHE_KEEP_NR];
+
+/*
+ * Look for a mapped file and take a reference on it. Returns NULL if the file is not mapped yet.
+ */
+struct mapped_file *pagecache_find(struct file_operations *fops, unsigned long ino)
+{
+	struct mapped_file *file;
+	unsigned long flags;
+
+	flags = spin_lock_irqsave(&pagecache_lock);
+
+	list_for_each_entry(file, &mapped_files, list) {
+		if ((file->fops == fops) && (file->ino == ino) && !file->stale) {
+			file->refcount++;
+			spin_unlock_irqrestore(&pagecache_lock, flags);
+
+			return file;
+		}
+	}
+
+	spin_unlock_irqrestore(&pagecache_lock, flags);
+
+	return NULL;
+}
+
+/*
+ * Create the cache of a file about to be mapped, with a first reference.
+ * <priv> is given back to the operations of the file system.
+ */
+struct mapped_file *pagecache_create(struct file_operations *fops, unsigned long ino, size_t size,
+				     struct pagecache_ops *ops, void *priv)
+{
+	struct mapped_file *file;
+	unsigned long flags;
+
+	file = malloc(sizeof(struct mapped_file));
+	if (!file)
+		return NULL;
+
+	memset(file, 0, sizeof(struct mapped_file));
+
+	file->nr_pages = ALIGN_UP(size, PAGE_SIZE) >> PAGE_SHIFT;
+
+	file->pages = malloc(file->nr_pages * sizeof(page_t *));
+	if (!file->pages) {
+		free(file);
+		return NULL;
+	}
+
+	memset(file->pages, 0, file->nr_pages * sizeof(page_t *));
+
+	file->fops = fops;
+	file->ino = ino;
+	file->size = size;
+	file->ops = ops;
+	file->priv = priv;
+	file->refcount = 1;
+
+	mutex_init(&file->lock);
+
+	flags = spin_lock_irqsave(&pagecache_lock);
+	list_add(&file->list, &mapped_files);
+	spin_unlock_irqrestore(&pagecache_lock, flags);
+
+	return file;
+}
+
+void pagecache_get(struct mapped_file *file)
+{
+	unsigned long flags;
+
+	flags = spin_lock_irqsave(&pagecache_lock);
+	file->refcount++;
+	spin_unlock_irqrestore(&pagecache_lock, flags);
+}
+
+/*
+ * Drop a reference to a mapped file. The cached pages are released with the last reference;
+ * they remain allocated as long as they are mapped in a process.
+ * The release() operation of the file system may suspend.
+ */
+void pagecache_put(struct mapped_file *file)
+{
+	unsigned long flags;
+	unsigned long i;
+	bool last;
+
+	flags = spin_lock_irqsave(&pagecache_lock);
+
+	last = !--file->refcount;
+	if (last)
+		list_del(&file->list);
+
+	spin_unlock_irqrestore(&pagecache_lock, flags);
+
+	if (!last)
+		return;
+
+	for (i = 0; i < file->nr_pages; i++)
+		if (file->pages[i])
+			put_user_page(file->pages[i]);
+
+	if (file->ops->release)
+		file->ops->release(file->priv);
+
+	free(file->pages);
+	free(file);
+}
+
+/*
+ * Keep a reference on the cache of a file so that its pages survive its mappings,
+ * typically an executable which is run again and again. The least recently used
+ * file is dropped when the table is full.
+ */
+void pagecache_keep(struct mapped_file *file)
+{
+	struct mapped_file *evicted = NULL;
+	unsigned long flags;
+	int i;
+
+	flags = spin_lock_irqsave(&pagecache_lock);
+
+	for (i = 0; i < PAGECACHE_KEEP_NR; i++)
+		if (kept_files[i] == file)
+			break;
+
+	if (i == PAGECACHE_KEEP_NR) {
+		/* Take the place of a modified file or of the least recently used one */
+		for (i = 0; i < PAGECACHE_KEEP_NR - 1; i++)
+			if (!kept_files[i] || kept_files[i]->stale)
+				break;
+
+		evicted = kept_files[i];
+		file->refcount++;
+	}
+
+	memmove(&kept_files[1], &kept_files[0], i * sizeof(struct mapped_file *));
+	kept_files[0] = file;
+
+	spin_unlock_irqrestore(&pagecache_lock, flags);
+
+	if (evicted)
+		pagecache_put(evicted);
+}
+
+/*
+ * The contents of a file has been modified. The mappings which already exist keep
+ * their pages, but new mappings will read the file again.
+ */
+void pagecache_invalidate(struct file_operations *fops, unsigned long ino)
+{
+	struct mapped_file *file;
+	unsigned long flags;
+
+	flags = spin_lock_irqsave(&pagecache_lock);
+
+	list_for_each_entry(file, &mapped_files, list)
+		if ((file->fops == fops) && (file->ino == ino))
+			file->stale = true;
+
+	spin_unlock_irqrestore(&pagecache_lock, flags);
+}
+
+/*
+ * Get the page <index> of a mapped file, read from the file system if it is not cached yet.
+ * The reference on the page belongs to the cache. Returns NULL on error.
+ */
+page_t *pagecache_get_page(struct mapped_file *file, unsigned long index)
+{
+	page_t *page;
+	addr_t paddr;
+	void *buf;
+
+	if (index >= file->nr_pages)
+		return NULL;
+
+	mutex_lock(&file->lock);
+
+	page = file->pages[index];
+	if (page)
+		goto out;
+
+	buf = malloc(PAGE_SIZE);
+	if (!buf)
+		goto out;
+
+	/* The end of the last page is filled with zeros */
+	memset(buf, 0, PAGE_SIZE);
+
+	if (file->ops->readpage(file->priv, index, buf)) {
+		LOG_ERROR("%s: failed to read page %lu of a mapped file\n", __func__, index);
+		goto out_free;
+	}
+
+	paddr = get_free_page();
+	if (!paddr)
+		goto out_free;
+
+	fill_user_page(paddr, buf);
+
+	page = phys_to_page(paddr);
+	page->refcount = 1;
+
+	file->pages[index] = page;
+
+out_free:
+	free(buf);
+out:
+	mutex_unlock(&file->lock);
+
+	return page;
+}
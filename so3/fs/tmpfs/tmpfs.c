@@ -0,0 +1,708 @@
+/*
+ * Copyright (C) 2025 Daniel Rossier <daniel.rossier@heig-vd.ch>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * tmpfs - file system in memory
+ *
+ * The files and directories are nodes of a tree kept in the kernel heap. The contents
+ * of a regular file is stored in pages of PAGE_SIZE bytes referenced by a table indexed
+ * by the page number in the file; a missing page is a hole read as zeros. The table
+ * grows by doubling so that appending to a file has a constant amortized cost.
+ *
+ * All operations are serialized by tmpfs_lock. A node which is removed while it is
+ * still open is released on the last close.
+ */
+
+#include <common.h>
+#include <errno.h>
+#include <heap.h>
+#include <limits.h>
+#include <list.h>
+#include <memory.h>
+#include <mutex.h>
+#include <slab.h>
+#include <string.h>
+#include <timer.h>
+#include <vfs.h>
+
+#include <tmpfs/tmpfs.h>
+
+/* Longest name of an entry */
+#define TMPFS_NAME_LEN 64
+
+/* Initial number of page slots of a regular file */
+#define TMPFS_MIN_SLOTS 4
+
+/* Largest size of a file, which also bounds the positions in a file */
+#if CONFIG_TMPFS_MAX_SIZE
+#define TMPFS_FILE_MAX ((u64) CONFIG_TMPFS_MAX_SIZE * SZ_1K)
+#else
+#define TMPFS_FILE_MAX ((u64) INT_MAX)
+#endif
+
+struct tmpfs_node {
+	char name[TMPFS_NAME_LEN];
+	bool dir;
+
+	struct tmpfs_node *parent;
+
+	/* Entries of a directory */
+	struct list_head children;
+	struct list_head sibling;
+
+	/* Contents of a regular file; a NULL page is a hole */
+	size_t size;
+	void **pages;
+	unsigned long nr_slots;
+
+	time_t mtime;
+
+	/* Number of open files on this node */
+	int opened;
+
+	/* The node has been removed from the tree */
+	bool unlinked;
+};
+
+/* Private data of an open file */
+struct tmpfs_file {
+	struct tmpfs_node *node;
+	off_t pos;
+
+	/* Index of the next directory entry to be read */
+	unsigned int dir_pos;
+	struct dirent dent;
+};
+
+static struct tmpfs_node root;
+
+static struct mutex tmpfs_lock;
+
+static kmem_cache_t *tmpfs_node_cache;
+static kmem_cache_t *tmpfs_file_cache;
+
+/* Number of pages used by the file contents */
+static unsigned long tmpfs_nr_pages;
+
+static time_t tmpfs_time(void)
+{
+	struct timespec ts;
+
+	do_get_time_of_day(&ts);
+
+	return ts.tv_sec;
+}
+
+/*
+ * Get the part of a path below the mount point, or NULL if the path is not in the tmpfs.
+ * The paths are relative to the root.
+ */
+static const char *tmpfs_rel_path(const char *path)
+{
+	const char *mnt = CONFIG_TMPFS_MOUNT_POINT;
+	size_t len;
+
+	while (*path == '/')
+		path++;
+	while (*mnt == '/')
+		mnt++;
+
+	len = strlen(mnt);
+
+	if (strncmp(path, mnt, len) || ((path[len] != '/') && path[len]))
+		return NULL;
+
+	return path + len;
+}
+
+/*
+ * Find the node of a path below the mount point. If <parent> is not NULL, it gets the
+ * directory which contains (or would contain) the last component and <name> gets this
+ * component, even if the node does not exist. On error, *parent is NULL and errno is set.
+ * tmpfs_lock must be held.
+ */
+static struct tmpfs_node *tmpfs_walk(const char *path, struct tmpfs_node **parent, char *name)
+{
+	struct tmpfs_node *node = &root, *child, *found;
+	char comp[TMPFS_NAME_LEN];
+	int len;
+
+	if (parent)
+		*parent = NULL;
+
+	path = tmpfs_rel_path(path);
+	if (!path) {
+		set_errno(ENOENT);
+		return NULL;
+	}
+
+	while (*path) {
+		while (*path == '/')
+			path++;
+
+		if (!*path)
+			break;
+
+		for (len = 0; path[len] && (path[len] != '/'); len++)
+			;
+
+		if (len >= TMPFS_NAME_LEN) {
+			set_errno(ENAMETOOLONG);
+			return NULL;
+		}
+
+		memcpy(comp, path, len);
+		comp[len] = '\0';
+		path += len;
+
+		if (!node->dir) {
+			set_errno(ENOTDIR);
+			return NULL;
+		}
+
+		if (!strcmp(comp, "."))
+			continue;
+
+		if (!strcmp(comp, "..")) {
+			node = node->parent;
+			continue;
+		}
+
+		found = NULL;
+		list_for_each_entry(child, &node->children, sibling) {
+			if (!strcmp(child->name, comp)) {
+				found = child;
+				break;
+			}
+		}
+
+		if (found) {
+			node = found;
+			continue;
+		}
+
+		/* Only the last component may be missing */
+		while (*path == '/')
+			path++;
+
+		if (*path) {
+			set_errno(ENOENT);
+			return NULL;
+		}
+
+		if (parent) {
+			*parent = node;
+			strcpy(name, comp);
+		}
+
+		return NULL;
+	}
+
+	if (parent && (node != &root)) {
+		*parent = node->parent;
+		strcpy(name, node->name);
+	}
+
+	return node;
+}
+
+static struct tmpfs_node *tmpfs_new_node(struct tmpfs_node *parent, const char *name, bool dir)
+{
+	struct tmpfs_node *node;
+
+	node = kmem_cache_alloc(tmpfs_node_cache);
+	if (!node) {
+		set_errno(ENOMEM);
+		return NULL;
+	}
+
+	memset(node, 0, sizeof(struct tmpfs_node));
+
+	strcpy(node->name, name);
+	node->dir = dir;
+	node->parent = parent;
+	node->mtime = tmpfs_time();
+
+	INIT_LIST_HEAD(&node->children);
+
+	list_add_tail(&node->sibling, &parent->children);
+	parent->mtime = node->mtime;
+
+	return node;
+}
+
+/*
+ * Set the size of a regular file. The pages beyond the new end are released.
+ */
+static void tmpfs_truncate(struct tmpfs_node *node, size_t size)
+{
+	unsigned long i, first;
+	size_t offset;
+
+	if (size < node->size) {
+		first = ALIGN_UP(size, PAGE_SIZE) >> PAGE_SHIFT;
+
+		for (i = first; i < node->nr_slots; i++) {
+			if (node->pages[i]) {
+				free(node->pages[i]);
+				node->pages[i] = NULL;
+				tmpfs_nr_pages--;
+			}
+		}
+
+		/* The end of the last page must read as zeros if the file grows again */
+		offset = size & (PAGE_SIZE - 1);
+		if (offset && node->pages[size >> PAGE_SHIFT])
+			memset(node->pages[size >> PAGE_SHIFT] + offset, 0, PAGE_SIZE - offset);
+	}
+
+	node->size = size;
+	node->mtime = tmpfs_time();
+}
+
+static void tmpfs_free_node(struct tmpfs_node *node)
+{
+	if (!node->dir) {
+		tmpfs_truncate(node, 0);
+		free(node->pages);
+	}
+
+	kmem_cache_free(tmpfs_node_cache, node);
+}
+
+/*
+ * Make the page table of a file large enough for <nr> pages.
+ */
+static int tmpfs_grow_slots(struct tmpfs_node *node, unsigned long nr)
+{
+	unsigned long nr_slots;
+	void **pages;
+
+	if (nr <= node->nr_slots)
+		return 0;
+
+	nr_slots = max(nr, max(node->nr_slots * 2, (unsigned long) TMPFS_MIN_SLOTS));
+
+	pages = realloc(node->pages, nr_slots * sizeof(void *));
+	if (!pages)
+		return -1;
+
+	memset(pages + node->nr_slots, 0, (nr_slots - node->nr_slots) * sizeof(void *));
+
+	node->pages = pages;
+	node->nr_slots = nr_slots;
+
+	return 0;
+}
+
+static void *tmpfs_alloc_page(void)
+{
+	void *page;
+
+	if (CONFIG_TMPFS_MAX_SIZE && (tmpfs_nr_pages >= (CONFIG_TMPFS_MAX_SIZE * SZ_1K) / PAGE_SIZE))
+		return NULL;
+
+	page = malloc(PAGE_SIZE);
+	if (!page)
+		return NULL;
+
+	memset(page, 0, PAGE_SIZE);
+	tmpfs_nr_pages++;
+
+	return page;
+}
+
+static int tmpfs_open(int fd, const char *path)
+{
+	uint32_t flags = vfs_get_open_mode(fd) | vfs_get_access_mode(fd) | vfs_get_operating_mode(fd);
+	struct tmpfs_node *node, *parent;
+	char name[TMPFS_NAME_LEN];
+	struct tmpfs_file *file;
+
+	mutex_lock(&tmpfs_lock);
+
+	node = tmpfs_walk(path, &parent, name);
+	if (!node) {
+		if (!parent)
+			goto err;
+
+		if (!(flags & O_CREAT) || (flags & O_DIRECTORY)) {
+			set_errno(ENOENT);
+			goto err;
+		}
+
+		node = tmpfs_new_node(parent, name, false);
+		if (!node)
+			goto err;
+
+	} else if ((flags & O_CREAT) && (flags & O_EXCL)) {
+		set_errno(EEXIST);
+		goto err;
+	}
+
+	if ((flags & O_DIRECTORY) && !node->dir) {
+		set_errno(ENOTDIR);
+		goto err;
+	}
+
+	if (!(flags & O_DIRECTORY) && node->dir) {
+		set_errno(EISDIR);
+		goto err;
+	}
+
+	file = kmem_cache_alloc(tmpfs_file_cache);
+	if (!file) {
+		set_errno(ENOMEM);
+		goto err;
+	}
+
+	if (!node->dir && (flags & O_TRUNC))
+		tmpfs_truncate(node, 0);
+
+	file->node = node;
+	file->pos = 0;
+	file->dir_pos = 0;
+
+	node->opened++;
+
+	mutex_unlock(&tmpfs_lock);
+
+	vfs_set_priv(fd, file);
+
+	return 0;
+
+err:
+	mutex_unlock(&tmpfs_lock);
+
+	return -1;
+}
+
+static int tmpfs_close(int fd)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *) vfs_get_priv(fd);
+	struct tmpfs_node *node = file->node;
+
+	mutex_lock(&tmpfs_lock);
+
+	if (!--node->opened && node->unlinked)
+		tmpfs_free_node(node);
+
+	mutex_unlock(&tmpfs_lock);
+
+	kmem_cache_free(tmpfs_file_cache, file);
+
+	return 0;
+}
+
+static int tmpfs_read(int fd, void *buffer, int count)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *) vfs_get_priv(fd);
+	struct tmpfs_node *node = file->node;
+	size_t offset, len, done = 0;
+	void *page;
+
+	if (node->dir) {
+		set_errno(EISDIR);
+		return -1;
+	}
+
+	mutex_lock(&tmpfs_lock);
+
+	if (file->pos < node->size)
+		count = min((size_t) count, node->size - file->pos);
+	else
+		count = 0;
+
+	while (done < count) {
+		offset = file->pos & (PAGE_SIZE - 1);
+		len = min(count - done, PAGE_SIZE - offset);
+
+		page = node->pages[file->pos >> PAGE_SHIFT];
+		if (page)
+			memcpy(buffer + done, page + offset, len);
+		else
+			memset(buffer + done, 0, len);
+
+		file->pos += len;
+		done += len;
+	}
+
+	mutex_unlock(&tmpfs_lock);
+
+	return done;
+}
+
+static int tmpfs_write(int fd, const void *buffer, int count)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *) vfs_get_priv(fd);
+	struct tmpfs_node *node = file->node;
+	size_t offset, len, done = 0;
+	void **page;
+
+	if (node->dir) {
+		set_errno(EISDIR);
+		return -1;
+	}
+
+	mutex_lock(&tmpfs_lock);
+
+	if (vfs_get_open_mode(fd) & O_APPEND)
+		file->pos = node->size;
+
+	/* Computed on 64 bits so that it cannot wrap */
+	if ((count < 0) || ((u64) file->pos + count > TMPFS_FILE_MAX)) {
+		mutex_unlock(&tmpfs_lock);
+		set_errno(EFBIG);
+		return -1;
+	}
+
+	if (tmpfs_grow_slots(node, ALIGN_UP(file->pos + count, PAGE_SIZE) >> PAGE_SHIFT)) {
+		mutex_unlock(&tmpfs_lock);
+		set_errno(ENOMEM);
+		return -1;
+	}
+
+	while (done < count) {
+		offset = file->pos & (PAGE_SIZE - 1);
+		len = min(count - done, PAGE_SIZE - offset);
+
+		page = &node->pages[file->pos >> PAGE_SHIFT];
+		if (!*page) {
+			*page = tmpfs_alloc_page();
+			if (!*page)
+				break;
+		}
+
+		memcpy(*page + offset, buffer + done, len);
+
+		file->pos += len;
+		done += len;
+	}
+
+	if (file->pos > node->size)
+		node->size = file->pos;
+
+	if (done)
+		node->mtime = tmpfs_time();
+
+	mutex_unlock(&tmpfs_lock);
+
+	if (!done && count) {
+		set_errno(ENOSPC);
+		return -1;
+	}
+
+	return done;
+}
+
+/* lseek() is called with the local fd */
+static off_t tmpfs_lseek(int fd, off_t off, int whence)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *) vfs_get_priv(vfs_get_gfd(fd));
+	s64 pos;
+
+	if (file->node->dir) {
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	mutex_lock(&tmpfs_lock);
+
+	/* A relative offset may be negative */
+	switch (whence) {
+	case SEEK_SET:
+		pos = off;
+		break;
+
+	case SEEK_CUR:
+		pos = (s64) file->pos + (int32_t) off;
+		break;
+
+	case SEEK_END:
+		pos = (s64) file->node->size + (int32_t) off;
+		break;
+
+	default:
+		pos = -1;
+	}
+
+	if ((pos < 0) || (pos > TMPFS_FILE_MAX)) {
+		mutex_unlock(&tmpfs_lock);
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	off = file->pos = pos;
+
+	mutex_unlock(&tmpfs_lock);
+
+	return off;
+}
+
+static struct dirent *tmpfs_readdir(int fd)
+{
+	struct tmpfs_file *file = (struct tmpfs_file *) vfs_get_priv(fd);
+	struct tmpfs_node *child;
+	struct dirent *dent = NULL;
+	unsigned int i = 0;
+
+	if (!file->node->dir)
+		return NULL;
+
+	mutex_lock(&tmpfs_lock);
+
+	list_for_each_entry(child, &file->node->children, sibling) {
+		if (i++ < file->dir_pos)
+			continue;
+
+		dent = &file->dent;
+		memset(dent, 0, sizeof(struct dirent));
+
+		strcpy(dent->d_name, child->name);
+		dent->d_type = child->dir ? DT_DIR : DT_REG;
+		dent->d_size = child->dir ? 0 : child->size;
+
+		file->dir_pos++;
+		break;
+	}
+
+	mutex_unlock(&tmpfs_lock);
+
+	return dent;
+}
+
+static int tmpfs_stat(const char *path, struct stat *st)
+{
+	struct tmpfs_node *node;
+
+	mutex_lock(&tmpfs_lock);
+
+	node = tmpfs_walk(path, NULL, NULL);
+	if (!node) {
+		mutex_unlock(&tmpfs_lock);
+		set_errno(ENOENT);
+		return -1;
+	}
+
+	memset(st, 0, sizeof(struct stat));
+
+	strncpy(st->st_name, path, FILENAME_SIZE - 1);
+	st->st_size = node->dir ? 0 : node->size;
+	st->st_mtim = node->mtime;
+
+	mutex_unlock(&tmpfs_lock);
+
+	return 0;
+}
+
+static int tmpfs_mkdir(const char *path)
+{
+	struct tmpfs_node *node, *parent;
+	char name[TMPFS_NAME_LEN];
+	int ret = -1;
+
+	mutex_lock(&tmpfs_lock);
+
+	node = tmpfs_walk(path, &parent, name);
+	if (node)
+		set_errno(EEXIST);
+	else if (parent && tmpfs_new_node(parent, name, true))
+		ret = 0;
+
+	mutex_unlock(&tmpfs_lock);
+
+	return ret;
+}
+
+/*
+ * Remove a file or an empty directory.
+ */
+static int tmpfs_unlink(const char *path)
+{
+	struct tmpfs_node *node;
+
+	mutex_lock(&tmpfs_lock);
+
+	node = tmpfs_walk(path, NULL, NULL);
+	if (!node) {
+		set_errno(ENOENT);
+		goto err;
+	}
+
+	if (node == &root) {
+		set_errno(EBUSY);
+		goto err;
+	}
+
+	if (node->dir && !list_empty(&node->children)) {
+		set_errno(ENOTEMPTY);
+		goto err;
+	}
+
+	list_del(&node->sibling);
+	node->parent->mtime = tmpfs_time();
+
+	node->unlinked = true;
+	if (!node->opened)
+		tmpfs_free_node(node);
+
+	mutex_unlock(&tmpfs_lock);
+
+	return 0;
+
+err:
+	mutex_unlock(&tmpfs_lock);
+
+	return -1;
+}
+
+static struct file_operations tmpfs_ops = {
+	.open = tmpfs_open,
+	.close = tmpfs_close,
+	.read = tmpfs_read,
+	.write = tmpfs_write,
+	.lseek = tmpfs_lseek,
+	.readdir = tmpfs_readdir,
+	.stat = tmpfs_stat,
+	.mkdir = tmpfs_mkdir,
+	.unlink = tmpfs_unlink,
+};
+
+/*
+ * Check if a path is located in the tmpfs, i.e. below its mount point.
+ */
+bool tmpfs_path(const char *path)
+{
+	return tmpfs_rel_path(path) != NULL;
+}
+
+struct file_operations *register_tmpfs(void)
+{
+	tmpfs_node_cache = kmem_cache_create("tmpfs_node", sizeof(struct tmpfs_node), 0);
+	tmpfs_file_cache = kmem_cache_create("tmpfs_file", sizeof(struct tmpfs_file), 0);
+	BUG_ON(!tmpfs_node_cache || !tmpfs_file_cache);
+
+	mutex_init(&tmpfs_lock);
+
+	root.dir = true;
+	root.parent = &root;
+	root.mtime = tmpfs_time();
+	INIT_LIST_HEAD(&root.children);
+
+	return &tmpfs_ops;
+}
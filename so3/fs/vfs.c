@@ -22,43 +22,148 @@
 #include <vfs.h>
 #include <process.h>
 #include <heap.h>
+#include <slab.h>
 #include <errno.h>
 #include <process.h>
 #include <mutex.h>
 #include <string.h>
 #include <dirent.h>
 #include <console.h>
+#include <limits.h>
+#include <pipe.h>
 
 #include <fat/fat.h>
 #include <devfs/devfs.h>
+#include <tmpfs/tmpfs.h>
 
 /* The VFS abstract subsystem manages a table of open file descriptors where indexes are known as gfd (global file descriptor).
  * Every process has its own file descriptor table. A local file descriptor (belonging to a process) must be linked to a global file descriptor
  * according to the fd type.
+ *
+ * An entry of the global table remains allocated as long as its ref_count is not zero. The ref_count counts the links
+ * from the process tables and the operations currently in progress, so that read/write/ioctl pin the entry with fd_lock
+ * only and do not need vfs_lock. The table of a process is modified under its fd_lock mutex (open, close, dup).
  */
 
 struct mutex vfs_lock;
 
+/* Protect the open_fds[] slots, the ref counts and the links from the process tables */
+static DEFINE_SPINLOCK(fd_lock);
+
 /* Available file descriptors. An entry is NULL when free */
 struct fd *open_fds[MAX_FDS];
 
-/* Registered file system operations - This is specific to a file system type. Currently, only FAT and pipe is used. */
+static kmem_cache_t *fd_cache;
+
+/* Registered file system operations - This is specific to a file system type (FAT, devfs and tmpfs). */
 /* Pipe has its own fops which is not put in this table. */
 struct file_operations *registered_fs_ops[MAX_FS_REGISTERED];
 
+/*
+ * Get the file system of a regular path (not in /dev), NULL if there is none.
+ */
+static struct file_operations *vfs_get_path_fs(const char *path)
+{
+#ifdef CONFIG_TMPFS
+	if (tmpfs_path(path))
+		return registered_fs_ops[FS_TMPFS];
+#endif
+
+	/* FIXME: Should find the mounted point regarding the path */
+	return registered_fs_ops[FS_FAT];
+}
+
 /*
  * Check the validity of a gfd
  */
 static bool vfs_is_valid_gfd(int gfd)
 {
-	ASSERT(mutex_is_locked(&vfs_lock));
-
-	if ((gfd < 0) || !open_fds[gfd])
+	if ((gfd < 0) || (gfd >= MAX_FDS) || !open_fds[gfd])
 		return false;
 
 	return true;
 }
 
+/*
+ * Free a gfd entry which is not referenced anymore.
+ */
+static void vfs_free_fd(int gfd)
+{
+	struct fd *fd = open_fds[gfd];
+	unsigned long flags;
+
+	if (fd->filename)
+		free(fd->filename);
+
+	flags = spin_lock_irqsave(&fd_lock);
+	open_fds[gfd] = NULL;
+	spin_unlock_irqrestore(&fd_lock, flags);
+
+	kmem_cache_free(fd_cache, fd);
+}
+
+/*
+ * Called when the last reference to a gfd is dropped. The close() callback of the sub-layer
+ * is called before the entry is freed.
+ */
+static void vfs_release_fd(int gfd)
+{
+	ASSERT(gfd > STDERR); /* Abnormal situation if we attempt to remove the std* file descriptors */
+
+	/* The close() callback operation in the sub-layers must NOT suspend. */
+	if (!open_fds[gfd]->open_failed && open_fds[gfd]->fops->close)
+		open_fds[gfd]->fops->close(gfd);
+
+	vfs_free_fd(gfd);
+}
+
+/*
+ * Get the entry linked to a local fd of the running process and take a reference on it.
+ * The entry remains valid until vfs_put_fd(), even if the fd is closed meanwhile.
+ * Returns NULL if the fd is not open.
+ */
+static struct fd *vfs_get_fd(int localfd, int *gfd)
+{
+	pcb_t *pcb = current()->pcb;
+	struct fd *fd = NULL;
+	unsigned long flags;
+
+	if ((localfd < 0) || (localfd >= FD_MAX))
+		return NULL;
+
+	flags = spin_lock_irqsave(&fd_lock);
+
+	*gfd = pcb->fd_array[localfd];
+
+	if (vfs_is_valid_gfd(*gfd) && open_fds[*gfd]->ref_count) {
+		fd = open_fds[*gfd];
+		fd->ref_count++;
+	}
+
+	spin_unlock_irqrestore(&fd_lock, flags);
+
+	return fd;
+}
+
+/*
+ * Drop a reference taken with vfs_get_fd() or by a link.
+ */
+static void vfs_put_fd(int gfd)
+{
+	unsigned long flags;
+	bool last;
+
+	flags = spin_lock_irqsave(&fd_lock);
+
+	ASSERT(open_fds[gfd]->ref_count > 0);
+	last = !--open_fds[gfd]->ref_count;
+
+	spin_unlock_irqrestore(&fd_lock, flags);
+
+	if (last)
+		vfs_release_fd(gfd);
+}
+
 /* @brief This function will retrieve the index in the
  *		opend_fds from a process file descriptor
  * @param localfd: The process file descriptor
@@ -68,22 +173,21 @@ static bool vfs_is_valid_gfd(int gfd)
 int vfs_get_gfd(int localfd)
 {
 	pcb_t *pcb = current()->pcb;
+	unsigned long flags;
 	int gfd;
 
 	/* Basic validation of fd */
-	if (localfd < 0)
+	if ((localfd < 0) || (localfd >= FD_MAX))
 		return -1;
 
-	mutex_lock(&vfs_lock);
+	flags = spin_lock_irqsave(&fd_lock);
 
 	gfd = pcb->fd_array[localfd];
 
-	if (!open_fds[gfd]) {
-		mutex_unlock(&vfs_lock);
-		return -1;
-	}
+	if (!vfs_is_valid_gfd(gfd))
+		gfd = -1;
 
-	mutex_unlock(&vfs_lock);
+	spin_unlock_irqrestore(&fd_lock, flags);
 
 	return gfd;
 }
@@ -94,45 +198,16 @@ int vfs_get_gfd(int localfd)
  */
 int vfs_refcount(int gfd)
 {
-	int ret;
-
-	mutex_lock(&vfs_lock);
-
-	if (!vfs_is_valid_gfd(gfd)) /* May already disappear */ {
-		mutex_unlock(&vfs_lock);
-		return 0;
-	}
-
-	ret = open_fds[gfd]->ref_count;
-
-	mutex_unlock(&vfs_lock);
-
-	return ret;
-}
-
-/**
- * This function will increment the global fd ref_count to keep track on how many instances
- * are using this global descriptor.
- *
- * @param gfd
- * @return
- */
-static int vfs_inc_ref(int gfd)
-{
-	int ret;
+	unsigned long flags;
+	int ret = 0;
 
-	mutex_lock(&vfs_lock);
+	flags = spin_lock_irqsave(&fd_lock);
 
-	if (!vfs_is_valid_gfd(gfd)) {
-		mutex_unlock(&vfs_lock);
-		return -1;
-	}
+	/* May already disappear */
+	if (vfs_is_valid_gfd(gfd))
+		ret = open_fds[gfd]->ref_count;
 
-	open_fds[gfd]->ref_count++;
-
-	ret = open_fds[gfd]->ref_count;
-
-	mutex_unlock(&vfs_lock);
+	spin_unlock_irqrestore(&fd_lock, flags);
 
 	return ret;
 }
@@ -178,8 +253,6 @@ char *vfs_get_filename(int gfd)
  */
 struct file_operations *vfs_get_fops(uint32_t gfd)
 {
-	ASSERT(mutex_is_locked(&vfs_lock));
-
 	if (!vfs_is_valid_gfd(gfd))
 		return NULL;
 
@@ -196,80 +269,85 @@ struct file_operations *vfs_get_fops(uint32_t gfd)
  */
 int vfs_open(const char *filename, struct file_operations *fops, uint32_t type)
 {
+	struct fd *newfd;
+	unsigned long flags;
 	int gfd, fd;
 
-	mutex_lock(&vfs_lock);
-
-	/* Find the first available file descriptor */
-	for (gfd = 0; gfd < MAX_FDS; gfd++) {
-		if (!open_fds[gfd])
-			break;
-	}
-
-	/* Reach max num */
-	if (gfd == MAX_FDS) {
-		set_errno(ENFILE);
-		goto vfs_open_failed;
-	}
-
-	open_fds[gfd] = (struct fd *) malloc(sizeof(struct fd));
+	newfd = (struct fd *) kmem_cache_alloc(fd_cache);
 
-	if (!open_fds[gfd]) {
+	if (!newfd) {
 		printk("%s: failed to allocate memory\n", __func__);
 		set_errno(ENOMEM);
-		goto vfs_open_failed;
+		return -1;
 	}
 
-	memset(open_fds[gfd], 0, sizeof(struct fd));
+	memset(newfd, 0, sizeof(struct fd));
 
 	/* Store the filename */
 	if (filename) {
-		open_fds[gfd]->filename = malloc(strlen(filename) + 1);
-		if (!open_fds[gfd]) {
+		newfd->filename = malloc(strlen(filename) + 1);
+		if (!newfd->filename) {
 			printk("%s: failed to allocate memory\n", __func__);
+			kmem_cache_free(fd_cache, newfd);
 			set_errno(ENOMEM);
-			goto vfs_open_failed;
+			return -1;
 		}
 
-		strcpy(open_fds[gfd]->filename, filename);
+		strcpy(newfd->filename, filename);
 	}
 
-	open_fds[gfd]->fops = fops;
-	open_fds[gfd]->type = type;
+	newfd->fops = fops;
+	newfd->type = type;
 
-	/* Increment open fd reference counter */
-	vfs_inc_ref(gfd);
+	/* The reference of the link from the process table */
+	newfd->ref_count = 1;
+
+	flags = spin_lock_irqsave(&fd_lock);
+
+	/* Find the first available file descriptor */
+	for (gfd = 0; gfd < MAX_FDS; gfd++) {
+		if (!open_fds[gfd])
+			break;
+	}
+
+	if (gfd < MAX_FDS)
+		open_fds[gfd] = newfd;
+
+	spin_unlock_irqrestore(&fd_lock, flags);
+
+	/* Reach max num */
+	if (gfd == MAX_FDS) {
+		set_errno(ENFILE);
+		goto vfs_open_failed;
+	}
 
 #ifdef CONFIG_PROC_ENV
+	mutex_lock(&current()->pcb->fd_lock);
 	fd = proc_register_fd(gfd);
+	mutex_unlock(&current()->pcb->fd_lock);
 
-	if (fd < 0)
-		goto fs_open_failed;
+	if (fd < 0) {
+		vfs_free_fd(gfd);
+		return -1;
+	}
 #else
 	fd = gfd;
 #endif
 
-	mutex_unlock(&vfs_lock);
-
 	return fd;
 
-#ifdef CONFIG_PROC_ENV
-fs_open_failed:
-#endif
+vfs_open_failed:
 
-	free(open_fds[gfd]);
-	open_fds[gfd] = NULL;
+	if (newfd->filename)
+		free(newfd->filename);
 
-vfs_open_failed:
+	kmem_cache_free(fd_cache, newfd);
 
-	mutex_unlock(&vfs_lock);
 	return -1;
 }
 
 uint32_t vfs_get_open_mode(int gfd)
 {
-	ASSERT(mutex_is_locked(&vfs_lock));
-
 	if (open_fds[gfd])
 		return open_fds[gfd]->flags_open;
 
@@ -278,71 +356,56 @@ uint32_t vfs_get_open_mode(int gfd)
 
 int vfs_set_open_mode(int gfd, uint32_t flags_open_mode)
 {
-	mutex_lock(&vfs_lock);
 	open_fds[gfd]->flags_open = flags_open_mode;
-	mutex_unlock(&vfs_lock);
 
 	return 0;
 }
 
 uint32_t vfs_get_access_mode(int gfd)
 {
-	uint32_t ret = 0;
-
-	mutex_lock(&vfs_lock);
-
 	if (open_fds[gfd])
-		ret = open_fds[gfd]->flags_access_mode;
+		return open_fds[gfd]->flags_access_mode;
 
-	mutex_unlock(&vfs_lock);
-
-	return ret;
+	return 0;
 }
 
 void vfs_set_access_mode(int gfd, uint32_t flags_access_mode)
 {
-	mutex_lock(&vfs_lock);
-
 	open_fds[gfd]->flags_access_mode = flags_access_mode;
-
-	mutex_unlock(&vfs_lock);
 }
 
 uint32_t vfs_get_operating_mode(int gfd)
 {
-	uint32_t ret = 0;
-	mutex_lock(&vfs_lock);
-
 	if (open_fds[gfd])
-		ret = open_fds[gfd]->flags_operating_mode;
+		return open_fds[gfd]->flags_operating_mode;
 
-	mutex_unlock(&vfs_lock);
-
-	return ret;
+	return 0;
 }
 
 int vfs_set_operating_mode(int gfd, uint32_t flags_operating_mode)
 {
-	mutex_lock(&vfs_lock);
-
 	open_fds[gfd]->flags_operating_mode = flags_operating_mode;
 
-	mutex_unlock(&vfs_lock);
-
 	return 0;
 }
 
 /*
  * @brief this function will link a process fd (localfd) with the table of global fd (fd).
  * In addition, the function will increment the ref_count.
+ * The fd_lock of the process must be held.
  */
 void vfs_link_fd(int fd, int gfd)
 {
-	ASSERT(mutex_is_locked(&vfs_lock));
+	unsigned long flags;
+
+	ASSERT(mutex_is_locked(&current()->pcb->fd_lock));
+
+	flags = spin_lock_irqsave(&fd_lock);
 
 	current()->pcb->fd_array[fd] = gfd;
+	open_fds[gfd]->ref_count++;
 
-	vfs_inc_ref(gfd);
+	spin_unlock_irqrestore(&fd_lock, flags);
 }
 
 /*
@@ -354,25 +417,26 @@ void vfs_link_fd(int fd, int gfd)
  */
 int vfs_clone_fd(int *fd_src, int *fd_dst)
 {
+	unsigned long flags;
 	unsigned i;
 
-	mutex_lock(&vfs_lock);
+	flags = spin_lock_irqsave(&fd_lock);
 
 	/* All file descriptors are duplicated at the process level.
 	 * However, the global descriptor remains the same in all cases.
 	 */
 	for (i = 0; i < FD_MAX; i++) {
 		/* If invalid fd */
-		if ((fd_src[i] < 0) || (open_fds[fd_src[i]] == NULL)) {
+		if (!vfs_is_valid_gfd(fd_src[i]) || !open_fds[fd_src[i]]->ref_count) {
 			fd_dst[i] = -1;
 			continue;
 		}
 
 		fd_dst[i] = fd_src[i];
-		vfs_inc_ref(fd_src[i]);
+		open_fds[fd_src[i]]->ref_count++;
 	}
 
-	mutex_unlock(&vfs_lock);
+	spin_unlock_irqrestore(&fd_lock, flags);
 
 	return 0;
 }
@@ -381,6 +445,7 @@ int vfs_clone_fd(int *fd_src, int *fd_dst)
 
 int do_read(int fd, void *buffer, int count)
 {
+	struct fd *file;
 	int gfd;
 	int ret;
 
@@ -391,35 +456,26 @@ int do_read(int fd, void *buffer, int count)
 		return -1;
 	}
 
-	mutex_lock(&vfs_lock);
-
-	gfd = vfs_get_gfd(fd);
+	file = vfs_get_fd(fd, &gfd);
+	if (!file) {
+		set_errno(EINVAL);
+		return -1;
+	}
 
 	/* FIXME: As for now the do_read/do_open only
 	 * support regular file VFS_TYPE_FILE, VFS_TYPE_IO and pipes
 	 */
-	if (open_fds[gfd]->type == VFS_TYPE_DIR) {
+	if (file->type == VFS_TYPE_DIR) {
 		set_errno(EISDIR);
-		mutex_unlock(&vfs_lock);
-		return -1;
-	}
-
-	if (!vfs_is_valid_gfd(gfd)) {
-		set_errno(EINVAL);
-		mutex_unlock(&vfs_lock);
-		return -1;
-	}
-
-	if (!open_fds[gfd]->fops->read) {
+		ret = -1;
+	} else if (!file->fops->read) {
 		LOG_ERROR("No fops read\n");
 		set_errno(EBADF);
-		mutex_unlock(&vfs_lock);
-		return -1;
-	}
-
-	mutex_unlock(&vfs_lock);
+		ret = -1;
+	} else
+		ret = file->fops->read(gfd, buffer, count);
 
-	ret = open_fds[gfd]->fops->read(gfd, buffer, count);
+	vfs_put_fd(gfd);
 
 	return ret;
 }
@@ -429,6 +485,7 @@ int do_read(int fd, void *buffer, int count)
  */
 int do_write(int fd, const void *buffer, int count)
 {
+	struct fd *file;
 	int gfd;
 	int ret;
 
@@ -439,34 +496,25 @@ int do_write(int fd, const void *buffer, int count)
 		return -1;
 	}
 
-	mutex_lock(&vfs_lock);
-
-	gfd = vfs_get_gfd(fd);
-
-	if (!vfs_is_valid_gfd(gfd)) {
+	file = vfs_get_fd(fd, &gfd);
+	if (!file) {
 		set_errno(EINVAL);
-		mutex_unlock(&vfs_lock);
 		return -1;
 	}
 
 	/* FIXME: As for now the do_read/do_open only
 	 * support regular file VFS_TYPE_FILE, VFS_TYPE_IO and pipes
 	 */
-	if (open_fds[gfd]->type == VFS_TYPE_DIR) {
+	if (file->type == VFS_TYPE_DIR) {
 		set_errno(EISDIR);
-		mutex_unlock(&vfs_lock);
-		return -1;
-	}
-
-	if (!open_fds[gfd]->fops->write) {
+		ret = -1;
+	} else if (!file->fops->write) {
 		set_errno(EBADF);
-		mutex_unlock(&vfs_lock);
-		return -1;
-	}
-
-	mutex_unlock(&vfs_lock);
+		ret = -1;
+	} else
+		ret = file->fops->write(gfd, buffer, count);
 
-	ret = open_fds[gfd]->fops->write(gfd, buffer, count);
+	vfs_put_fd(gfd);
 
 	return ret;
 }
@@ -477,6 +525,7 @@ int do_write(int fd, const void *buffer, int count)
 int do_open(const char *filename, int flags)
 {
 	int fd, gfd, ret = -1;
+	unsigned long irq_flags;
 	uint32_t type;
 	struct file_operations *fops;
 
@@ -494,8 +543,12 @@ int do_open(const char *filename, int flags)
 	} else if (!strcmp("dev", filename) || !strcmp("/dev", filename)) {
 		fops = registered_fs_ops[FS_DEV];
 	} else {
-		/* FIXME: Should find the mounted point regarding the path */
-		fops = registered_fs_ops[FS_FAT];
+		fops = vfs_get_path_fs(filename);
+		if (!fops) {
+			set_errno(ENOENT);
+			mutex_unlock(&vfs_lock);
+			return -1;
+		}
 	}
 
 	if (flags & O_DIRECTORY) {
@@ -531,8 +584,23 @@ int do_open(const char *filename, int flags)
 
 open_failed:
 
-	free(open_fds[gfd]);
-	open_fds[gfd] = NULL;
+	/* The sub-layer did not open anything, so close() must not be called. */
+	open_fds[gfd]->open_failed = true;
+
+	/*
+	 * Unlink the local fd. Another thread may have got the entry in the meanwhile,
+	 * hence it is released by the last reference.
+	 */
+	mutex_lock(&current()->pcb->fd_lock);
+
+	irq_flags = spin_lock_irqsave(&fd_lock);
+	current()->pcb->fd_array[fd] = -1;
+	spin_unlock_irqrestore(&fd_lock, irq_flags);
+
+	mutex_unlock(&current()->pcb->fd_lock);
+
+	vfs_put_fd(gfd);
+
 	mutex_unlock(&vfs_lock);
 
 	return ret;
@@ -545,42 +613,106 @@ open_failed:
 int do_readdir(int fd, char *buf, int len)
 {
 	struct dirent *dirent;
-	int gfd;
+	struct fd *file;
+	int gfd, ret = 0;
+
+	file = vfs_get_fd(fd, &gfd);
+	if (!file) {
+		set_errno(EBADF);
+		return 0;
+	}
+
+	if (file->type != VFS_TYPE_DIR) {
+		set_errno(ENOTDIR);
+		goto out;
+	}
+
+	if (!file->fops->readdir) {
+		set_errno(EBADF);
+		goto out;
+	}
 
 	mutex_lock(&vfs_lock);
 
-	gfd = vfs_get_gfd(fd);
+	dirent = file->fops->readdir(gfd);
+	if (dirent) {
+		dirent->d_reclen = sizeof(struct dirent);
+		memcpy(buf, dirent, dirent->d_reclen);
+
+		ret = sizeof(struct dirent);
+	}
+
+	mutex_unlock(&vfs_lock);
+
+out:
+	vfs_put_fd(gfd);
+
+	return ret;
+}
+
+/**
+ * Read as many directory entries as fit in <buf> (getdents64()).
+ * An entry is read only if the remaining space can hold any record, since it cannot be
+ * given back to the directory, hence <len> must be at least DIRENT_MAX_RECLEN.
+ *
+ * @return the number of bytes written in <buf>, 0 at the end of the directory, -1 on error
+ */
+int do_getdents64(int fd, char *buf, int len)
+{
+	struct dirent *dirent;
+	struct fd *file;
+	int gfd, namelen, reclen, pos = 0;
+
+	if (!buf || (len < DIRENT_MAX_RECLEN)) {
+		set_errno(EINVAL);
+		return -1;
+	}
 
-	if (!vfs_is_valid_gfd(gfd)) {
+	file = vfs_get_fd(fd, &gfd);
+	if (!file) {
 		set_errno(EBADF);
-		mutex_unlock(&vfs_lock);
-		return 0;
+		return -1;
 	}
 
-	if (open_fds[gfd]->type != VFS_TYPE_DIR) {
+	if (file->type != VFS_TYPE_DIR) {
 		set_errno(ENOTDIR);
-		mutex_unlock(&vfs_lock);
-		return 0;
+		pos = -1;
+		goto out;
 	}
 
-	if (!open_fds[gfd]->fops->readdir) {
+	if (!file->fops->readdir) {
 		set_errno(EBADF);
-		mutex_unlock(&vfs_lock);
-		return 0;
+		pos = -1;
+		goto out;
 	}
 
-	dirent = open_fds[gfd]->fops->readdir(gfd);
-	if (!dirent) {
-		mutex_unlock(&vfs_lock);
-		return 0;
-	}
+	mutex_lock(&vfs_lock);
 
-	dirent->d_reclen = sizeof(struct dirent);
-	memcpy(buf, dirent, dirent->d_reclen);
+	while (len - pos >= DIRENT_MAX_RECLEN) {
+		dirent = file->fops->readdir(gfd);
+		if (!dirent)
+			break;
+
+		namelen = strlen(dirent->d_name);
+		reclen = DIRENT_RECLEN(namelen);
+
+		dirent->d_reclen = reclen;
+
+		/* Only the name is copied, then the padding is cleared and the size ends the record */
+		memcpy(buf + pos, dirent, offsetof(struct dirent, d_name) + namelen + 1);
+		memset(buf + pos + offsetof(struct dirent, d_name) + namelen + 1, 0,
+		       reclen - sizeof(uint64_t) - offsetof(struct dirent, d_name) - namelen - 1);
+		memcpy(buf + pos + reclen - sizeof(uint64_t), &dirent->d_size, sizeof(uint64_t));
+
+		pos += reclen;
+	}
 
 	mutex_unlock(&vfs_lock);
 
-	return sizeof(struct dirent);
+out:
+	vfs_put_fd(gfd);
+
+	return pos;
 }
 
 /*
@@ -591,55 +723,37 @@ int do_readdir(int fd, char *buf, int len)
 void do_close(int fd)
 {
 	pcb_t *pcb = current()->pcb;
+	unsigned long flags;
 	int gfd;
 
-	if ((!pcb) || (fd < 0))
+	if ((!pcb) || (fd < 0) || (fd >= FD_MAX))
 		return;
 
-	mutex_lock(&vfs_lock);
+	mutex_lock(&pcb->fd_lock);
+
+	flags = spin_lock_irqsave(&fd_lock);
 
 	/* Get the global file descriptor */
 	gfd = pcb->fd_array[fd];
 
-	if (gfd < 0) {
+	if ((gfd < 0) || !open_fds[gfd]) {
 		LOG_DEBUG("Was already freed\n");
-		mutex_unlock(&vfs_lock);
-		return;
-	}
-
-	if (!open_fds[gfd]) {
-		mutex_unlock(&vfs_lock);
+		spin_unlock_irqrestore(&fd_lock, flags);
+		mutex_unlock(&pcb->fd_lock);
 		return;
 	}
 
-	/* Decrement reference counter to keep track of open fds */
-	ASSERT(open_fds[gfd]->ref_count > 0);
-	open_fds[gfd]->ref_count--;
-
-	ASSERT(open_fds[gfd]->ref_count >= 0);
-
 	/* Unreference the process fd's table to -1 */
 	pcb->fd_array[fd] = -1;
 
-	/* The following part of the code maintain the global file descriptor (open fds) table */
-	/* Free only when no one is using the file descriptor */
-
-	if (!open_fds[gfd]->ref_count) {
-		ASSERT(gfd > STDERR); /* Abnormal situation if we attempt to remove the std* file descriptors */
-
-		/* The close() callback operation in the sub-layers must NOT suspend. */
-		if (open_fds[gfd]->fops->close)
-			open_fds[gfd]->fops->close(gfd);
+	spin_unlock_irqrestore(&fd_lock, flags);
 
-		if (open_fds[gfd]->filename)
-			free(open_fds[gfd]->filename);
+	mutex_unlock(&pcb->fd_lock);
 
-		free(open_fds[gfd]);
-
-		open_fds[gfd] = NULL;
-	}
-
-	mutex_unlock(&vfs_lock);
+	/* Drop the reference of the link; the entry is released when no one is using it anymore,
+	 * possibly by a thread still running an operation on it.
+	 */
+	vfs_put_fd(gfd);
 }
 
 /**
@@ -648,27 +762,31 @@ void do_close(int fd)
  */
 int do_dup2(int oldfd, int newfd)
 {
-	if ((newfd < 0) || (newfd > MAX_FDS))
+	pcb_t *pcb = current()->pcb;
+	int gfd;
+
+	if ((newfd < 0) || (newfd >= FD_MAX))
 		return -EBADF;
 
-	if ((oldfd < 0) || (oldfd > MAX_FDS))
+	if ((oldfd < 0) || (oldfd >= FD_MAX))
 		return -EBADF;
 
-	mutex_lock(&vfs_lock);
+	mutex_lock(&pcb->fd_lock);
 
-	if (vfs_get_gfd(oldfd) < 0) {
+	gfd = vfs_get_gfd(oldfd);
+	if (gfd < 0) {
 		set_errno(EBADF);
-		mutex_unlock(&vfs_lock);
+		mutex_unlock(&pcb->fd_lock);
 
 		return -1;
 	}
 
-	if (vfs_get_gfd(oldfd) != vfs_get_gfd(newfd))
+	if (gfd != vfs_get_gfd(newfd))
 		do_close(newfd);
 
-	vfs_link_fd(newfd, vfs_get_gfd(oldfd));
+	vfs_link_fd(newfd, gfd);
 
-	mutex_unlock(&vfs_lock);
+	mutex_unlock(&pcb->fd_lock);
 
 	return newfd;
 }
@@ -683,24 +801,31 @@ int do_dup2(int oldfd, int newfd)
 int do_dup(int oldfd)
 {
 #ifdef CONFIG_PROC_ENV
-	int newfd;
+	pcb_t *pcb = current()->pcb;
+	int newfd, gfd;
 
-	if (oldfd < 0 || oldfd > MAX_FDS)
+	if (oldfd < 0 || oldfd >= FD_MAX)
 		return -EBADF;
 
-	mutex_lock(&vfs_lock);
+	mutex_lock(&pcb->fd_lock);
+
+	gfd = vfs_get_gfd(oldfd);
+	if (gfd < 0) {
+		mutex_unlock(&pcb->fd_lock);
+		return -EBADF;
+	}
 
 	/* Retrieve a unused process fd */
-	newfd = proc_new_fd(current()->pcb);
+	newfd = proc_new_fd(pcb);
 	if (newfd < 0) {
-		mutex_unlock(&vfs_lock);
+		mutex_unlock(&pcb->fd_lock);
 		return newfd;
 	}
 
 	/* Link it with the  */
-	vfs_link_fd(newfd, vfs_get_gfd(oldfd));
+	vfs_link_fd(newfd, gfd);
 
-	mutex_unlock(&vfs_lock);
+	mutex_unlock(&pcb->fd_lock);
 
 	return newfd;
 #else
@@ -710,24 +835,67 @@ int do_dup(int oldfd)
 
 int do_stat(const char *path, struct stat *st)
 {
+	struct file_operations *fops;
 	int ret;
 
 	mutex_lock(&vfs_lock);
 
-	/* FIXME Find the correct mount point with the path */
-	if (!registered_fs_ops[FS_FAT]) {
+	fops = vfs_get_path_fs(path);
+
+	if (!fops || !fops->stat) {
 		set_errno(ENOENT);
 		mutex_unlock(&vfs_lock);
 		return -1;
 	}
 
-	if (!registered_fs_ops[FS_FAT]->stat) {
-		set_errno(ENOENT);
+	ret = fops->stat(path, st);
+
+	mutex_unlock(&vfs_lock);
+
+	return ret;
+}
+
+int do_mkdir(const char *path)
+{
+	struct file_operations *fops;
+	int ret;
+
+	mutex_lock(&vfs_lock);
+
+	fops = vfs_get_path_fs(path);
+
+	if (!fops || !fops->mkdir) {
+		set_errno(EPERM);
+		mutex_unlock(&vfs_lock);
+		return -1;
+	}
+
+	ret = fops->mkdir(path);
+
+	mutex_unlock(&vfs_lock);
+
+	return ret;
+}
+
+/*
+ * Remove a file, or an empty directory.
+ */
+int do_unlink(const char *path)
+{
+	struct file_operations *fops;
+	int ret;
+
+	mutex_lock(&vfs_lock);
+
+	fops = vfs_get_path_fs(path);
+
+	if (!fops || !fops->unlink) {
+		set_errno(EPERM);
 		mutex_unlock(&vfs_lock);
 		return -1;
 	}
 
-	ret = registered_fs_ops[FS_FAT]->stat(path, st);
+	ret = fops->unlink(path);
 
 	mutex_unlock(&vfs_lock);
 
@@ -739,67 +907,86 @@ int do_stat(const char *path, struct stat *st)
  */
 void *do_mmap(addr_t start, size_t length, int prot, int fd, off_t offset)
 {
+	struct fd *file;
 	int gfd;
 	uint32_t page_count;
-	struct file_operations *fops;
+	void *ret;
 
 	/* Get the fops associated to the file descriptor. */
 
-	gfd = vfs_get_gfd(fd);
-	if (-1 == gfd) {
+	file = vfs_get_fd(fd, &gfd);
+	if (!file) {
 		printk("%s: could not get global fd.\n", __func__);
 		set_errno(EBADF);
 		return MAP_FAILED;
 	}
 
-	mutex_lock(&vfs_lock);
-	fops = vfs_get_fops(gfd);
-	if (!fops) {
-		printk("%s: could not get device fops.\n", __func__);
-		mutex_unlock(&vfs_lock);
-		set_errno(EBADF);
-		return MAP_FAILED;
-	}
-
-	mutex_unlock(&vfs_lock);
-
 	/* Page count to allocate to the current process to be able to map the desired region. */
 	page_count = length / PAGE_SIZE;
 	if (length % PAGE_SIZE != 0) {
 		page_count++;
 	}
 
-	if (!fops->mmap) {
+	if (!file->fops->mmap) {
 		printk("%s: device doesn't support mmap.\n", __func__);
 		set_errno(EACCES);
-		return MAP_FAILED;
+		ret = MAP_FAILED;
+	} else
+		/* Call the mmap fops that will do the actual mapping. */
+		ret = file->fops->mmap(fd, start, page_count, offset, prot);
+
+	vfs_put_fd(gfd);
+
+	return ret;
+}
+
+#ifdef CONFIG_FILE_MMAP
+
+/*
+ * Get the page cache of an open file, with a reference.
+ * Returns NULL if the file cannot be mapped.
+ */
+struct mapped_file *vfs_get_mapping(int fd)
+{
+	struct fd *file;
+	struct mapped_file *ret = NULL;
+	int gfd;
+
+	file = vfs_get_fd(fd, &gfd);
+	if (!file) {
+		set_errno(EBADF);
+		return NULL;
 	}
 
-	/* Call the mmap fops that will do the actual mapping. */
-	return fops->mmap(fd, start, page_count, offset);
+	if (file->fops->get_mapping)
+		ret = file->fops->get_mapping(fd);
+
+	vfs_put_fd(gfd);
+
+	return ret;
 }
 
+#endif /* CONFIG_FILE_MMAP */
+
 int do_ioctl(int fd, unsigned long cmd, unsigned long args)
 {
+	struct fd *file;
 	int rc, gfd;
-	mutex_lock(&vfs_lock);
 
-	gfd = vfs_get_gfd(fd);
-
-	if (!vfs_is_valid_gfd(gfd)) {
+	file = vfs_get_fd(fd, &gfd);
+	if (!file) {
 		set_errno(EINVAL);
-		mutex_unlock(&vfs_lock);
 		return -1;
 	}
 
-	if (open_fds[gfd]->fops->ioctl)
-		rc = open_fds[gfd]->fops->ioctl(fd, cmd, args);
+	if (file->fops->ioctl)
+		rc = file->fops->ioctl(fd, cmd, args);
 	else {
 		set_errno(EPERM);
 		rc = -1;
 	}
 
-	mutex_unlock(&vfs_lock);
+	vfs_put_fd(gfd);
 
 	return rc;
 }
@@ -810,23 +997,21 @@ int do_ioctl(int fd, unsigned long cmd, unsigned long args)
  */
 off_t do_lseek(int fd, off_t off, int whence)
 {
+	struct fd *file;
 	int rc, gfd;
-	mutex_lock(&vfs_lock);
-
-	gfd = vfs_get_gfd(fd);
 
-	if (!vfs_is_valid_gfd(gfd)) {
+	file = vfs_get_fd(fd, &gfd);
+	if (!file) {
 		set_errno(EINVAL);
-		mutex_unlock(&vfs_lock);
 		return -1;
 	}
 
-	if (open_fds[gfd]->fops->lseek)
-		rc = open_fds[gfd]->fops->lseek(fd, off, whence);
+	if (file->fops->lseek)
+		rc = file->fops->lseek(fd, off, whence);
 	else
 		rc = 0; /* Nothing if no specific callback found. */
 
-	mutex_unlock(&vfs_lock);
+	vfs_put_fd(gfd);
 
 	return rc;
 }
@@ -836,25 +1021,137 @@ off_t do_lseek(int fd, off_t off, int whence)
  */
 int do_fcntl(int fd, unsigned long cmd, unsigned long args)
 {
-	/* Not yet implemented */
+	struct fd *file;
+	int rc, gfd;
+
+	file = vfs_get_fd(fd, &gfd);
+	if (!file) {
+		set_errno(EBADF);
+		return -1;
+	}
+
+	/* fcntl() is called with the global fd */
+	if (file->fops->fcntl)
+		rc = file->fops->fcntl(gfd, cmd, args);
+	else
+		rc = 0; /* Not yet implemented */
+
+	vfs_put_fd(gfd);
+
+	return rc;
+}
+
+/*
+ * Position a file at *off before a splice, the current position is returned in *saved.
+ */
+static int splice_seek(struct fd *file, int fd, off_t *off, off_t *saved)
+{
+	if (!off)
+		return 0;
+
+	if ((file->type == VFS_TYPE_PIPE) || !file->fops->lseek) {
+		set_errno(ESPIPE);
+		return -1;
+	}
+
+	*saved = file->fops->lseek(fd, 0, SEEK_CUR);
+	if ((*saved == (off_t) -1) || (file->fops->lseek(fd, *off, SEEK_SET) == (off_t) -1))
+		return -1;
 
 	return 0;
 }
 
+/*
+ * Implementation of the splice syscall: move up to <len> bytes between a pipe and
+ * another file without copying them to the user space.
+ * The other file is accessed with the pipe locked; splicing between two pipes is not
+ * supported since two splices in opposite directions would lock the pipes in reverse order.
+ * If <off_in> (resp. <off_out>) is not NULL, the file is accessed from this offset which
+ * is updated, and the file position is left unchanged.
+ */
+int do_splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned int flags)
+{
+	struct fd *file_in, *file_out;
+	int gfd_in, gfd_out, ret = -1;
+	off_t saved_in, saved_out;
+	bool nonblock = !!(flags & SPLICE_F_NONBLOCK);
+
+	file_in = vfs_get_fd(fd_in, &gfd_in);
+	if (!file_in) {
+		set_errno(EBADF);
+		return -1;
+	}
+
+	file_out = vfs_get_fd(fd_out, &gfd_out);
+	if (!file_out) {
+		set_errno(EBADF);
+		vfs_put_fd(gfd_in);
+		return -1;
+	}
+
+	if (((file_in->type == VFS_TYPE_PIPE) == (file_out->type == VFS_TYPE_PIPE)) ||
+	    (file_in->type == VFS_TYPE_DIR) || (file_out->type == VFS_TYPE_DIR)) {
+		set_errno(EINVAL);
+		goto out;
+	}
+
+	if (((file_in->type == VFS_TYPE_PIPE) && (file_in->flags_access_mode != O_RDONLY)) ||
+	    ((file_out->type == VFS_TYPE_PIPE) && (file_out->flags_access_mode != O_WRONLY))) {
+		set_errno(EBADF);
+		goto out;
+	}
+
+	if (splice_seek(file_in, fd_in, off_in, &saved_in))
+		goto out;
+
+	if (splice_seek(file_out, fd_out, off_out, &saved_out))
+		goto restore_in;
+
+	len = min(len, (size_t) INT_MAX);
+
+	if (file_in->type == VFS_TYPE_PIPE)
+		ret = pipe_splice_read(gfd_in, file_out->fops, gfd_out, len, nonblock);
+	else
+		ret = pipe_splice_write(gfd_out, file_in->fops, gfd_in, len, nonblock);
+
+	if (off_out) {
+		if (ret > 0)
+			*off_out += ret;
+		file_out->fops->lseek(fd_out, saved_out, SEEK_SET);
+	}
+
+restore_in:
+	if (off_in) {
+		if (ret > 0)
+			*off_in += ret;
+		file_in->fops->lseek(fd_in, saved_in, SEEK_SET);
+	}
+
+out:
+	vfs_put_fd(gfd_out);
+	vfs_put_fd(gfd_in);
+
+	return ret;
+}
+
 static void vfs_gfd_init(void)
 {
 	memset(open_fds, 0, MAX_FDS * sizeof(struct fd *));
 
 	/* Basic file descriptors */
-	open_fds[STDIN] = (struct fd *) malloc(sizeof(struct fd));
-	open_fds[STDOUT] = (struct fd *) malloc(sizeof(struct fd));
-	open_fds[STDERR] = (struct fd *) malloc(sizeof(struct fd));
+	open_fds[STDIN] = (struct fd *) kmem_cache_alloc(fd_cache);
+	open_fds[STDOUT] = (struct fd *) kmem_cache_alloc(fd_cache);
+	open_fds[STDERR] = (struct fd *) kmem_cache_alloc(fd_cache);
 
 	if (!open_fds[STDIN] || !open_fds[STDOUT] || !open_fds[STDERR]) {
 		printk("%s: failed to allocate memory\n", __func__);
 		kernel_panic();
 	}
 
+	memset(open_fds[STDIN], 0, sizeof(struct fd));
+	memset(open_fds[STDOUT], 0, sizeof(struct fd));
+	memset(open_fds[STDERR], 0, sizeof(struct fd));
+
 	open_fds[STDIN]->val = STDIN;
 	open_fds[STDIN]->type = VFS_TYPE_IO;
 	open_fds[STDIN]->fops = &console_fops;
@@ -875,6 +1172,9 @@ static void vfs_gfd_init(void)
 
 void vfs_init(void)
 {
+	fd_cache = kmem_cache_create("fd", sizeof(struct fd), 0);
+	BUG_ON(!fd_cache);
+
 #ifdef CONFIG_FS_FAT
 	/* FIXME: Handle multiple mounting points  */
 	if (!registered_fs_ops[FS_FAT]) {
@@ -887,6 +1187,11 @@ void vfs_init(void)
 	if (!registered_fs_ops[FS_DEV]) {
 		registered_fs_ops[FS_DEV] = register_devfs();
 	}
+
+#ifdef CONFIG_TMPFS
+	if (!registered_fs_ops[FS_TMPFS])
+		registered_fs_ops[FS_TMPFS] = register_tmpfs();
+#endif
 	mutex_init(&vfs_lock);
 
 	vfs_gfd_init();
@@ -30,13 +30,13 @@
 
 #endif /* __ASSEMBLY__ */
 
-#ifdef CONFIG_AVZ
-
 /*
  * CPU #0 is the primary (non-RT) Agency CPU.
  * CPU #1 is the hard RT Agency CPU.
  * CPU #2 is the second (SMP) Agency CPU.
  * CPU #3 is the ME CPU.
+ *
+ * Without AVZ, the numbering only selects the boot stack of the secondary CPUs.
  */
 
 #define AGENCY_CPU 0
@@ -44,8 +44,6 @@
 
 #define ME_CPU 3
 
-#endif /* CONFIG_AVZ */
-
 #ifndef __ASSEMBLY__
 
 extern addr_t __end[];
@@ -29,6 +29,9 @@
 struct completion {
 	volatile uint32_t count;
 	struct list_head tcb_list;
+
+	/* Required when the waiter and the waker run on different CPUs */
+	spinlock_t lock;
 };
 typedef struct completion completion_t;
 
@@ -84,7 +84,13 @@ typedef struct irqdesc {
 
 } irqdesc_t;
 
+#ifdef CONFIG_SCHED_SMP
+/* Each CPU has its own interrupt call path */
+extern volatile bool __in_interrupt_cpu[CONFIG_NR_CPUS];
+#define __in_interrupt (__in_interrupt_cpu[smp_processor_id()])
+#else
 extern volatile bool __in_interrupt;
+#endif
 
 extern int arch_irq_init(void);
 extern void setup_arch(void);
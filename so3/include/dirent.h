@@ -24,12 +24,24 @@
 typedef uint64_t ino_t;
 typedef uint32_t off_t;
 
+/*
+ * Directory entry. getdents64() returns records of variable length (d_reclen):
+ * the name is padded to 8 bytes and followed by the size of the entry (SO3),
+ * which always lies in the last 8 bytes of the record.
+ */
 struct dirent {
 	ino_t d_ino;
 	off_t d_off;
 	unsigned short d_reclen;
 	unsigned char d_type;
 	char d_name[256];
+
+	/* Size of a regular file, stored after the name in the records */
+	uint64_t d_size;
 };
 
+/* Length of a record returned by getdents64() */
+#define DIRENT_RECLEN(namelen) (ALIGN_UP(offsetof(struct dirent, d_name) + (namelen) + 1, 8) + sizeof(uint64_t))
+#define DIRENT_MAX_RECLEN DIRENT_RECLEN(255)
+
 #endif /* DIRENT_H_ */
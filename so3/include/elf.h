@@ -24,37 +24,37 @@
 
 #define ELF_MAXSIZE (128 * SZ_1K)
 
-/* ELF Binary image related information */
+/*
+ * ELF Binary image related information
+ * The file remains open while the image is loaded; only the headers are
+ * kept in memory.
+ */
 #ifdef CONFIG_ARCH_ARM32
 
 struct elf_img_info {
+	int fd;
 	Elf32_Ehdr *header;
-	Elf32_Shdr *sections;
 	Elf32_Phdr *segments; /* program header */
-	char **section_names;
-	void *file_buffer;
 	uint32_t segment_page_count;
+	uint32_t shared_segments; /* Segments mapped from the cache of the file (bitmap) */
 };
 
 #else
 
 struct elf_img_info {
+	int fd;
 	Elf64_Ehdr *header;
-	Elf64_Shdr *sections;
 	Elf64_Phdr *segments; /* program header */
-	char **section_names;
-	void *file_buffer;
 	uint64_t segment_page_count;
+	uint32_t shared_segments; /* Segments mapped from the cache of the file (bitmap) */
 };
 
 #endif
 
 typedef struct elf_img_info elf_img_info_t;
 
-uint8_t *elf_load_buffer(const char *filename);
-
-void elf_load_sections(elf_img_info_t *elf_img_info);
-void elf_load_segments(elf_img_info_t *elf_img_info);
+int elf_open(const char *filename, elf_img_info_t *elf_img_info);
+int elf_load_segment(elf_img_info_t *elf_img_info, int i);
 
 void elf_clean_image(elf_img_info_t *elf_img_info);
 
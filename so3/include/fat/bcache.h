@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2025 Daniel Rossier <daniel.rossier@heig-vd.ch>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <part.h>
+
+int bcache_init(block_dev_desc_t *dev);
+
+int bcache_read(block_dev_desc_t *dev, void *buffer, lbaint_t start, lbaint_t blkcnt);
+int bcache_write(block_dev_desc_t *dev, const void *buffer, lbaint_t start, lbaint_t blkcnt);
+int bcache_sync(block_dev_desc_t *dev);
+
+void dump_bcache(void);
+
+#endif /* BCACHE_H */
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2025 Daniel Rossier <daniel.rossier@heig-vd.ch>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <fat/ff.h>
+
+/* Result of a lookup in the directory entry cache */
+#define DCACHE_MISS 0
+#define DCACHE_HIT 1
+#define DCACHE_NEGATIVE 2
+
+/* Metadata of a directory entry kept in the cache */
+struct dcache_info {
+	FSIZE_t size;
+	WORD fdate;
+	WORD ftime;
+	BYTE fattrib;
+};
+
+void dcache_init(void);
+
+int dcache_lookup(const char *path, struct dcache_info *info);
+unsigned long dcache_generation(void);
+void dcache_insert(const char *path, struct dcache_info *info, unsigned long gen);
+void dcache_invalidate(const char *path);
+void dcache_invalidate_file(const char *path);
+
+void dump_dcache(void);
+
+#endif /* DCACHE_H */
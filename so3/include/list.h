@@ -236,6 +236,21 @@ static inline void list_splice_init(struct list_head *list, struct list_head *he
 	}
 }
 
+/**
+ * list_splice_tail_init - join two lists at the tail and reinitialise the emptied list.
+ * @list: the new list to add.
+ * @head: the place to add it in the first list (entries are appended before @head).
+ *
+ * The list at @list is reinitialised
+ */
+static inline void list_splice_tail_init(struct list_head *list, struct list_head *head)
+{
+	if (!list_empty(list)) {
+		__list_splice(list, head->prev);
+		INIT_LIST_HEAD(list);
+	}
+}
+
 /**
  * list_first_entry - get the first element from a list
  * @ptr:	the list head to take the element from.
@@ -38,6 +38,9 @@
 #define PAGE_SIZE (1 << PAGE_SHIFT)
 #define PAGE_MASK (~(PAGE_SIZE - 1))
 
+/* The page allocator handles blocks up to 2^(MAX_ORDER - 1) pages */
+#define MAX_ORDER 12
+
 #ifndef __ASSEMBLY__
 
 extern struct list_head io_maplist;
@@ -71,10 +74,16 @@ struct page {
 	/* If the page is not mapped yet, and hence free. */
 	bool free;
 
+	/* Order of the free block starting at this page (buddy allocator) */
+	uint8_t order;
+
 	/* Number of reference to this page. If the process is fork'd,
 	 * the child will also have reference to the page.
 	 */
 	uint32_t refcount;
+
+	/* Free list of the block order if the page starts a free block */
+	struct list_head list;
 };
 typedef struct page page_t;
 
@@ -121,6 +130,12 @@ extern volatile addr_t pfn_start;
 #define page_to_phys(page) (pfn_to_phys(page_to_pfn(page)))
 #define phys_to_page(phys) (pfn_to_page(phys_to_pfn(phys)))
 
+/* The page frame is described by the frame table */
+#define pfn_valid(pfn) (((pfn) >= pfn_start) && ((pfn) < pfn_start + mem_info.avail_pages))
+
+/* The physical address belongs to the RAM (kernel region included) */
+#define phys_in_ram(phys) (((phys) >= mem_info.phys_base) && ((phys) - mem_info.phys_base < mem_info.size))
+
 void clear_bss(void);
 void init_mmu(void);
 void memory_init(void);
@@ -135,8 +150,10 @@ struct vcpu;
 int get_mem_info(const void *fdt, mem_info_t *info);
 
 void dump_frame_table(void);
+void dump_free_areas(void);
 
 addr_t get_free_page(void);
+int get_free_pages(addr_t *pages, uint32_t nrpages);
 void free_page(addr_t paddr);
 
 addr_t get_free_vpage(void);
@@ -165,6 +182,8 @@ uint32_t get_kernel_size(void);
 
 struct pcb;
 void duplicate_user_space(struct pcb *from, struct pcb *to);
+void copy_user_page(addr_t paddr, addr_t vaddr);
+void create_user_page_readonly(void *pgtable, addr_t vaddr, addr_t paddr);
 
 void init_io_mapping(void);
 addr_t io_map(addr_t phys, size_t size);
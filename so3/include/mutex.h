@@ -40,6 +40,11 @@ struct mutex {
 	uint32_t recursive_count;
 
 	struct list_head tcb_list;
+
+#ifdef CONFIG_SCHED_PRIO
+	/* Link in the list of mutexes held by the owner (priority inheritance) */
+	struct list_head held_list;
+#endif
 };
 typedef struct mutex mutex_t;
 
@@ -58,8 +63,4 @@ void mutex_lock(struct mutex *lock);
 void mutex_unlock(struct mutex *lock);
 void mutex_init(struct mutex *lock);
 
-int do_mutex_init(void);
-int do_mutex_lock(unsigned long number);
-int do_mutex_unlock(unsigned long number);
-
 #endif /* MUTEX_H */
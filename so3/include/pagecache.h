@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2025 Daniel Rossier <daniel.rossier@heig-vd.ch>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include <types.h>
+#include <list.h>
+#include <mutex.h>
+#include <memory.h>
+
+struct file_operations;
+
+/*
+ * Operations of the file system to fill the cache of a mapped file.
+ */
+struct pagecache_ops {
+	/* Read the page <index> of the file into <buf> (PAGE_SIZE bytes). Returns 0 on success. */
+	int (*readpage)(void *priv, unsigned long index, void *buf);
+
+	/* The file is not mapped anymore */
+	void (*release)(void *priv);
+};
+
+/*
+ * A file mapped in one or several address spaces. The pages of the file are
+ * read on the first access and shared by all its mappings.
+ */
+struct mapped_file {
+	/* Identification of the file within its file system */
+	struct file_operations *fops;
+	unsigned long ino;
+
+	size_t size;
+	unsigned long nr_pages;
+
+	/* Cached pages, NULL if not read yet */
+	page_t **pages;
+
+	struct pagecache_ops *ops;
+	void *priv;
+
+	/* Number of mappings (protected by the page cache lock) */
+	int refcount;
+
+	/* The file has been modified, new mappings must not use this copy anymore */
+	bool stale;
+
+	/* Serialize the reading of the pages */
+	struct mutex lock;
+
+	struct list_head list;
+};
+
+struct mapped_file *pagecache_find(struct file_operations *fops, unsigned long ino);
+struct mapped_file *pagecache_create(struct file_operations *fops, unsigned long ino, size_t size,
+				     struct pagecache_ops *ops, void *priv);
+void pagecache_get(struct mapped_file *file);
+void pagecache_put(struct mapped_file *file);
+void pagecache_keep(struct mapped_file *file);
+void pagecache_invalidate(struct file_operations *fops, unsigned long ino);
+
+page_t *pagecache_get_page(struct mapped_file *file, unsigned long index);
+
+#endif /* PAGECACHE_H */
@@ -26,23 +26,36 @@
 #define PIPE_READER 0
 #define PIPE_WRITER 0
 
+/* Default capacity of a pipe */
 #define PIPE_SIZE PAGE_SIZE
 
+/* Largest capacity which can be set with F_SETPIPE_SZ */
+#define PIPE_MAX_SIZE (16 * PAGE_SIZE)
+
+/* Flags of splice() */
+#define SPLICE_F_MOVE 1
+#define SPLICE_F_NONBLOCK 2
+#define SPLICE_F_MORE 4
+
 struct pipe_desc {
 	/* Mutex to access critical parts */
 	struct mutex lock;
 
-	/* Main buffer of this pipe */
+	/* Main buffer of this pipe, used as a ring of <size> bytes */
 	void *pipe_buf;
+	unsigned int size;
 
 	/* The two global FD for each extremity. A value of -1 indicate an invalid gfd (finished for example) */
 	int gfd[2];
 
 	/* Consumer */
-	int pos_read;
+	unsigned int pos_read;
 
 	/* Producer */
-	uint32_t pos_write;
+	unsigned int pos_write;
+
+	/* Number of bytes in the pipe */
+	unsigned int count;
 
 	/* Waiting queue for managing empty pipe */
 	completion_t wait_for_writer;
@@ -54,4 +67,9 @@ typedef struct pipe_desc pipe_desc_t;
 
 int do_pipe(int pipefd[2]);
 
+struct file_operations;
+
+int pipe_splice_read(int gfd, struct file_operations *fops_out, int gfd_out, int count, bool nonblock);
+int pipe_splice_write(int gfd, struct file_operations *fops_in, int gfd_in, int count, bool nonblock);
+
 #endif /* PIPE_H */
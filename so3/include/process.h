@@ -38,19 +38,44 @@
 #define PROC_STACK_SIZE (PROC_THREAD_MAX * THREAD_STACK_SIZE)
 
 #define FD_MAX 64
-#define N_MUTEX 5
 
 typedef enum { PROC_STATE_NEW, PROC_STATE_READY, PROC_STATE_RUNNING, PROC_STATE_WAITING, PROC_STATE_ZOMBIE } proc_state_t;
 typedef unsigned int thread_t;
 
 #define PROC_NAME_LEN 80
 
+/* Number of buckets of the table used to find the page mapped at a virtual address */
+#define PROC_PAGE_HASH_SIZE 64
+
 /* A page might be linked to several processes, hence this type */
 typedef struct {
 	struct list_head list;
+
+	/* Bucket of the process page table hashed by virtual address */
+	struct list_head hash_list;
+
 	page_t *page;
+
+	/* User space virtual address at which the page is mapped */
+	addr_t vaddr;
 } page_list_t;
 
+struct mapped_file;
+
+/* Area of the user space in which a file is mapped */
+typedef struct {
+	struct list_head list;
+
+	addr_t start;
+	size_t size;
+
+	/* Index of the first page of the file in the area */
+	unsigned long pgoff;
+
+	int prot;
+	struct mapped_file *file;
+} mmap_area_t;
+
 typedef struct {
 	bool tracee;
 	enum __ptrace_request req_in_progress;
@@ -81,9 +106,19 @@ struct pcb {
 	/* List of frames (physical pages) belonging to this process */
 	struct list_head page_list;
 
+	/* Same pages hashed by virtual address, for the copy-on-write faults */
+	struct list_head page_hash[PROC_PAGE_HASH_SIZE];
+
+	/* Areas of mapped files sorted by address, protected by mmap_lock */
+	struct list_head mmap_list;
+	struct mutex mmap_lock;
+
 	/* Process 1st-level page table */
 	void *pgtable;
 
+	/* Address space identifier (with its generation) tagging the user mappings in the TLBs */
+	uint64_t asid;
+
 	uint32_t exit_status;
 
 	/* Reference to the parent process */
@@ -101,6 +136,9 @@ struct pcb {
 	/* Local file descriptors belonging to the process */
 	int fd_array[FD_MAX];
 
+	/* Serialize the updates of fd_array (open, close, dup) between the threads of the process */
+	struct mutex fd_lock;
+
 	/* Used to integrate a global system list of all existing process (declared in schedule.c) */
 	struct list_head list;
 
@@ -118,9 +156,6 @@ struct pcb {
 
 	/* The process might be under a ptrace activity, and hence becoming a tracer (parent) or tracee (child) */
 	enum __ptrace_request ptrace_pending_req;
-
-	/* Mutex lock to be used in conjunction with the user space (very temporary) */
-	mutex_t *lock;
 };
 typedef struct pcb pcb_t;
 
@@ -129,8 +164,16 @@ extern struct list_head proc_list;
 int get_user_stack_slot(pcb_t *pcb);
 void free_user_stack_slot(pcb_t *pcb, int slotID);
 
-void add_page_to_proc(pcb_t *pcb, page_t *page);
+void add_page_to_proc(pcb_t *pcb, page_t *page, addr_t vaddr);
+void put_user_page(page_t *page);
+void fill_user_page(addr_t paddr, void *buf);
+int do_page_fault(addr_t vaddr);
+int do_cow_fault(addr_t vaddr);
+
+void *do_mmap_file(struct mapped_file *file, addr_t start, uint32_t page_count, uint32_t offset, int prot);
+int do_munmap(addr_t start, size_t length);
 
+void proc_init(void);
 void create_root_process(void);
 
 uint32_t do_getpid(void);
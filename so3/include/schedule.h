@@ -20,7 +20,11 @@
 #define SCHEDULE_H
 
 #include <list.h>
+#include <types.h>
 #include <thread.h>
+#include <spinlock.h>
+
+#include <asm/processor.h>
 
 /* SCHEDULE_FREQ is the scheduler tick expressed in ms */
 #define SCHEDULE_FREQ 10
@@ -32,10 +36,46 @@
 
 #endif /* CONFIG_SCHED_PRIO_DYN */
 
+/* Number of priority levels managed by the run queue (0 to 99) */
+#define SCHED_PRIO_LEVELS 100
+
+/*
+ * Run queue with one FIFO per priority level. A bit is set in @bitmap
+ * for each non-empty level so that the highest priority is found in O(1).
+ * Threads are linked through their tcb (sched_list), hence no allocation.
+ */
+struct runqueue {
+	spinlock_t lock;
+
+	struct list_head queue[SCHED_PRIO_LEVELS];
+	unsigned long bitmap[BITS_TO_LONGS(SCHED_PRIO_LEVELS)];
+
+	/* Number of ready threads */
+	unsigned int nr_ready;
+
+#ifdef CONFIG_SCHED_PRIO_DYN
+	/* Last time (ns) the buckets have been aged */
+	u64 last_aging;
+#endif
+};
+
 extern volatile u64 jiffies;
 extern volatile u64 jiffies_ref;
 
-extern struct tcb *tcb_idle;
+/*
+ * CPU whose scheduling state (current thread, run queue, idle thread) is used.
+ * Without SCHED_SMP, the threads are only scheduled on CPU #0.
+ */
+#ifdef CONFIG_SCHED_SMP
+#define sched_cpu() smp_processor_id()
+#else
+#define sched_cpu() 0
+#endif
+
+/* All CPUs allowed by default */
+#define CPU_AFFINITY_ALL (~0ul)
+
+extern struct tcb *tcb_idle[CONFIG_NR_CPUS];
 
 void scheduler_init(void);
 void scheduler_start(void);
@@ -47,6 +87,7 @@ void preempt_disable(void);
 
 void ready(struct tcb *tcb);
 void waiting(void);
+void cancel_wakeup(void);
 struct tcb *pick_waiting_thread(struct tcb *tcb);
 void zombie(void);
 
@@ -54,27 +95,36 @@ void remove_zombie(struct tcb *tcb);
 
 void wake_up(struct tcb *tcb);
 
+#ifdef CONFIG_SCHED_PRIO
+void sched_set_inherited_prio(struct tcb *tcb, uint32_t prio);
+#endif
+
 void dump_sched(void);
 
-extern struct tcb *current_thread;
+extern struct tcb *current_thread[CONFIG_NR_CPUS];
 
 static inline void set_current(struct tcb *tcb)
 {
-	current_thread = tcb;
+	current_thread[sched_cpu()] = tcb;
 }
 
 static inline struct tcb *current(void)
 {
-	return current_thread;
+	return current_thread[sched_cpu()];
 }
 
 struct tcb *current(void);
 
 static inline void reset_thread_timeout(void)
 {
-	current_thread->timeout = 0ull;
+	current()->timeout = 0ull;
 }
 
+#ifdef CONFIG_SCHED_SMP
+void sched_start_secondary(void);
+void thread_set_affinity(struct tcb *tcb, unsigned long cpu_mask);
+#endif
+
 void remove_ready(struct tcb *tcb);
 
 void dump_ready(void);
@@ -47,4 +47,6 @@ int sem_timeddown(sem_t *sem, uint64_t timeout);
 
 void sem_init(sem_t *sem);
 
+void sem_test(int rounds);
+
 #endif /* SEMAPHORE_H */
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2025 Daniel Rossier <daniel.rossier@heig-vd.ch>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <types.h>
+#include <list.h>
+#include <spinlock.h>
+
+#define KMEM_CACHE_NAME_LEN 24
+
+/* Number of objects kept by each CPU in a cache */
+#define KMEM_MAGAZINE_SIZE 16
+
+/*
+ * Objects freed on a CPU are kept in its magazine and re-used by the next
+ * allocations on this CPU without taking the cache lock.
+ */
+struct kmem_magazine {
+	unsigned int count;
+	void *objs[KMEM_MAGAZINE_SIZE];
+
+	/* Statistics */
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long hits;
+};
+
+/*
+ * A slab is a block of slab_size bytes starting with a struct slab followed by
+ * the objects. Each object is preceded by a pointer to its slab, so that the slab
+ * needs no particular alignment in the heap.
+ */
+struct slab {
+	struct kmem_cache *cache;
+
+	/* Linked list of free objects in this slab */
+	void *freelist;
+
+	/* Number of objects allocated out of this slab */
+	unsigned int inuse;
+
+	struct list_head list;
+};
+
+struct kmem_cache {
+	char name[KMEM_CACHE_NAME_LEN];
+
+	/* Size of an object including its alignment */
+	size_t size;
+	size_t align;
+
+	/* Distance between two objects of a slab (object and link to the slab) */
+	size_t stride;
+
+	size_t slab_size;
+	unsigned int objs_per_slab;
+
+	/* Protect the slab lists */
+	spinlock_t lock;
+
+	struct list_head slabs_full;
+	struct list_head slabs_partial;
+	struct list_head slabs_free;
+
+	unsigned int nr_slabs;
+	unsigned int nr_free_slabs;
+
+	struct kmem_magazine magazine[CONFIG_NR_CPUS];
+
+	/* Link in the list of all caches */
+	struct list_head list;
+};
+typedef struct kmem_cache kmem_cache_t;
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align);
+void kmem_cache_destroy(kmem_cache_t *cache);
+
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+void dump_kmem_caches(void);
+
+#endif /* SLAB_H */
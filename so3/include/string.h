@@ -26,12 +26,23 @@
 #include <stdarg.h>
 #include <types.h>
 
+#include <asm/string.h>
+
 void *memchr(const void *, int, size_t);
 int memcmp(const void *, const void *, size_t);
 void *memcpy(void *, const void *, size_t);
 void *memmove(void *, const void *, size_t);
 void *memset(void *, int, size_t);
 
+/* Byte-wise versions used when the architecture does not provide its own */
+void *generic_memcpy(void *, const void *, size_t);
+void *generic_memmove(void *, const void *, size_t);
+void *generic_memset(void *, int, size_t);
+
+#ifdef CONFIG_STRING_BENCH
+void string_bench(int size);
+#endif
+
 void downcase(char *str);
 
 void uppercase(char *str, int len);
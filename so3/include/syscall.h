@@ -26,6 +26,11 @@
 #define SYSINFO_TEST_MALLOC 2
 #define SYSINFO_PRINTK 3
 #define SYSINFO_DUMP_PROC 4
+#define SYSINFO_TEST_TIMER 5
+#define SYSINFO_TEST_STRING 6
+#define SYSINFO_DUMP_BCACHE 7
+#define SYSINFO_DUMP_DCACHE 8
+#define SYSINFO_TEST_SEM 9
 
 /*
  * Syscall number definition
@@ -39,6 +44,7 @@
 #define SYSCALL_FORK 7
 #define SYSCALL_PTRACE 8
 #define SYSCALL_READDIR 9
+#define SYSCALL_UNLINK 13
 #define SYSCALL_OPEN 14
 #define SYSCALL_CLOSE 15
 #define SYSCALL_THREAD_CREATE 16
@@ -75,9 +81,12 @@
 #define SYSCALL_SIGRETURN 48
 
 #define SYSCALL_LSEEK 50
+#define SYSCALL_MUNMAP 51
+#define SYSCALL_GETDENTS64 52
+#define SYSCALL_MKDIR 53
+#define SYSCALL_SPLICE 54
 
-#define SYSCALL_MUTEX_LOCK 60
-#define SYSCALL_MUTEX_UNLOCK 61
+#define SYSCALL_FUTEX 62
 
 #define SYSCALL_NANOSLEEP 70
 
@@ -52,6 +52,22 @@ typedef struct pcb pcb_t;
 
 typedef void *(*th_fn_t)(void *);
 
+/*
+ * Attributes of a user thread as passed by pthread_create() in the libc.
+ * A field set to 0 means the default value.
+ */
+typedef struct {
+	/* Address the thread routine returns to, typically a call to pthread_exit() */
+	addr_t exit_fn;
+
+	/* Stack allocated by the process itself (top and size), otherwise a stack slot is used */
+	addr_t stack_top;
+	size_t stack_size;
+
+	/* Priority of the thread, the priority of the main thread by default */
+	uint32_t prio;
+} thread_attr_t;
+
 /*
  * Task Control Block
  *
@@ -66,34 +82,65 @@ struct tcb {
 	 * the default priority is used. */
 	uint32_t prio;
 
+#ifdef CONFIG_SCHED_PRIO
+	/* Priority inherited from the threads waiting on the mutexes held by this thread, 0 if none */
+	uint32_t inherited_prio;
+
+	/* Mutex this thread is waiting for, if any */
+	struct mutex *blocked_on;
+
+	/* Mutexes held by this thread */
+	struct list_head held_mutexes;
+#endif
+
 	/* Timeout value to keep track of possible scheduling after a timeout. */
 	int64_t timeout;
 
 #ifdef CONFIG_SCHED_PRIO_DYN
 
-	/* Used by the adaptative priority algorithm */
+	/* Used by the adaptative priority algorithm. It is updated when the thread
+	 * leaves the run queue since aging moves whole priority buckets.
+	 */
 	uint32_t current_prio;
 
-	/* Store the last time that the current_prio field has been incremented (ns). */
-	u64 last_prio_inc_time;
-
 #endif /* CONFIG_SCHED_PRIO_DYN */
 
 	/* Threaded function */
 	th_fn_t th_fn;
 	void *th_arg;
 
+	/* Return address of th_fn in the user space (0 if th_fn never returns) */
+	addr_t th_exit;
+
 	thread_t state;
 	int stack_slotID; /* Thread kernel slot ID */
 
 	/* Reference to the process, if any - typically NULL for kernel threads */
 	pcb_t *pcb;
-	int pcb_stack_slotID; /* This is the user space stack slot ID (for user threads) */
+	int pcb_stack_slotID; /* This is the user space stack slot ID (for user threads), -1 if not in a slot */
+	addr_t user_stack_top; /* Initial user stack pointer (for user threads) */
 
 	int *exit_status;
 
 	struct list_head list; /* List of threads belonging to a process */
 
+	/* Intrusive node used by the scheduler (run queue or zombie list) */
+	struct list_head sched_list;
+
+#ifdef CONFIG_SCHED_SMP
+	/* CPU the thread is running on, or last ran on */
+	int cpu;
+
+	/* Bitmask of CPUs the thread is allowed to run on */
+	unsigned long cpu_affinity;
+
+	/* Set while the thread context is in use by a CPU (cleared by __switch_to) */
+	volatile int on_cpu;
+
+	/* Woken up by another CPU before it has reached waiting() */
+	bool wakeup_pending;
+#endif
+
 	/* Join queue to handle threads waiting on it */
 	struct list_head joinQueue;
 
@@ -101,6 +148,16 @@ struct tcb {
 };
 typedef struct tcb tcb_t;
 
+#ifdef CONFIG_SCHED_PRIO
+/*
+ * Priority of a thread for the scheduler, possibly raised by priority inheritance.
+ */
+static inline uint32_t thread_prio(tcb_t *tcb)
+{
+	return ((tcb->inherited_prio > tcb->prio) ? tcb->inherited_prio : tcb->prio);
+}
+#endif
+
 addr_t get_user_stack_top(pcb_t *pcb, uint32_t slotID);
 
 void threads_init(void);
@@ -110,7 +167,7 @@ int do_thread_join(uint32_t pthread_id, int **value_p);
 void do_thread_exit(int *exit_status);
 
 tcb_t *kernel_thread(th_fn_t start_routine, const char *name, void *arg, uint32_t prio);
-tcb_t *user_thread(th_fn_t start_routine, const char *name, void *arg, pcb_t *pcb);
+tcb_t *user_thread(th_fn_t start_routine, const char *name, void *arg, pcb_t *pcb, const thread_attr_t *attr);
 
 int *thread_join(tcb_t *tcb);
 void thread_exit(int *exit_status);
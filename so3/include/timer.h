@@ -36,7 +36,10 @@ struct timer {
 	/* System time expiry value (nanoseconds since boot). */
 	u64 expires;
 
-	/* Linked list. */
+	/* Position in the heap of the CPU (when in the heap) */
+	unsigned int heap_offset;
+
+	/* Linked list (when the heap is full). */
 	struct timer *list_next;
 
 	/* On expiry, '(*function)(data)' will be executed in softirq context. */
@@ -55,6 +58,7 @@ struct timer {
 #define TIMER_STATUS_inactive 0 /* Not in use; can be activated.    */
 #define TIMER_STATUS_killed 1 /* Not in use; canot be activated.  */
 #define TIMER_STATUS_in_list 2 /* In use; on overflow linked list. */
+#define TIMER_STATUS_in_heap 3 /* In use; on timer heap.            */
 
 	uint8_t status;
 };
@@ -65,13 +69,13 @@ typedef struct timer timer_t;
  */
 
 /*
- * Returns TRUE if the given timer is on a timer list.
+ * Returns TRUE if the given timer is on a timer heap or list.
  * The timer must *previously* have been initialised by init_timer(), or its
  * structure initialised to all-zeroes.
  */
 static inline int active_timer(struct timer *timer)
 {
-	return (timer->status == TIMER_STATUS_in_list);
+	return (timer->status >= TIMER_STATUS_in_list);
 }
 
 /*
@@ -130,6 +134,10 @@ int do_nanosleep(const struct timespec *req, struct timespec *rem);
 int do_get_time_of_day(struct timespec *tv);
 int do_get_clock_time(int clk_id, struct timespec *ts);
 
+#ifdef CONFIG_TIMER_BENCH
+void timer_bench(int count);
+#endif
+
 #ifdef CONFIG_AVZ
 
 struct domain;
@@ -68,6 +68,10 @@
 #define SEEK_HOLE 4 /* seek to the next hole */
 #define SEEK_MAX SEEK_HOLE
 
+/* Commands of fcntl() specific to pipes */
+#define F_SETPIPE_SZ 1031
+#define F_GETPIPE_SZ 1032
+
 /* Types of entry */
 #define VFS_TYPE_FILE 0
 #define VFS_TYPE_DIR 1
@@ -94,6 +98,10 @@
 /* Return error values */
 #define MAP_FAILED ((void *) -1) /* mmap fail */
 
+/* Protection of a mapping */
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+
 #ifndef __ASSEMBLY__
 
 #include <types.h>
@@ -102,6 +110,8 @@
 
 #include <device/device.h>
 
+struct mapped_file;
+
 struct file_operations {
 	int (*open)(int fd, const char *path);
 	int (*close)(int fd);
@@ -109,11 +119,13 @@ struct file_operations {
 	int (*write)(int fd, const void *buffer, int count);
 	off_t (*lseek)(int fd, off_t off, int whence);
 	int (*ioctl)(int fd, unsigned long cmd, unsigned long args);
+	int (*fcntl)(int fd, unsigned long cmd, unsigned long args);
 	struct dirent *(*readdir)(int fd);
-	int (*mkdir)(int fd, void *);
+	int (*mkdir)(const char *path);
 	int (*stat)(const char *path, struct stat *st);
-	void *(*mmap)(int fd, addr_t virt_addr, uint32_t page_count, off_t offset);
-	int (*unlink)(int fd, void *);
+	void *(*mmap)(int fd, addr_t virt_addr, uint32_t page_count, off_t offset, int prot);
+	struct mapped_file *(*get_mapping)(int fd);
+	int (*unlink)(const char *path);
 	int (*mount)(const char *);
 	int (*unmount)(const char *);
 	void (*clone)(int fd);
@@ -133,6 +145,9 @@ struct fd {
 	/* Reference counter to keep the object alive when greater than 0. */
 	uint32_t ref_count;
 
+	/* The open() callback of the sub-layer has failed, hence close() must not be called */
+	bool open_failed;
+
 	/* List of callbacks */
 	struct file_operations *fops;
 
@@ -144,6 +159,7 @@ typedef enum {
 
 	FS_FAT,
 	FS_DEV,
+	FS_TMPFS,
 	MAX_FS_REGISTERED,
 } filesystems_t;
 
@@ -153,13 +169,18 @@ int do_open(const char *filename, int flags);
 int do_read(int fd, void *buffer, int count);
 int do_write(int fd, const void *buffer, int count);
 int do_readdir(int fd, char *buf, int len);
+int do_getdents64(int fd, char *buf, int len);
 void do_close(int fd);
 int do_dup(int oldfd);
 int do_dup2(int oldfd, int newfd);
 int do_stat(const char *path, struct stat *st);
+int do_mkdir(const char *path);
+int do_unlink(const char *path);
 void *do_mmap(addr_t start, size_t length, int prot, int fd, off_t offset);
+struct mapped_file *vfs_get_mapping(int fd);
 int do_ioctl(int fd, unsigned long cmd, unsigned long args);
 int do_fcntl(int fd, unsigned long cmd, unsigned long args);
+int do_splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned int flags);
 off_t do_lseek(int fd, off_t off, int whence);
 
 /* VFS common interface */
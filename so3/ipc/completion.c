@@ -26,7 +26,8 @@
 
 /*
  * Wait for completion function.
- * IRQs are disabled to maintain a coherent state, especially along the waiting path (no schedule are allowed).
+ * IRQs are disabled and the completion lock is held to maintain a coherent state, especially along
+ * the waiting path (no schedule are allowed). The lock is released while the thread is waiting.
  * This function can *not* be called from an interrupt context.
  */
 void wait_for_completion(completion_t *completion)
@@ -37,19 +38,32 @@ void wait_for_completion(completion_t *completion)
 	ASSERT(!__in_interrupt);
 	ASSERT(local_irq_is_enabled());
 
-	flags = local_irq_save();
+	flags = spin_lock_irqsave(&completion->lock);
 
 	q_tcb.tcb = current();
+	INIT_LIST_HEAD(&q_tcb.list);
 
 	if (!completion->count) {
-		list_add_tail(&q_tcb.list, &completion->tcb_list);
+		while (!completion->count) {
+			/* Queue again if we were woken up but another thread took the completion */
+			if (list_empty(&q_tcb.list))
+				list_add_tail(&q_tcb.list, &completion->tcb_list);
 
-		while (!completion->count)
+			spin_unlock(&completion->lock);
 			waiting();
+			spin_lock(&completion->lock);
+		}
+
+		/* Resumed by a stale wake-up, the completion came meanwhile */
+		if (!list_empty(&q_tcb.list))
+			list_del(&q_tcb.list);
+
+		/* complete() may have woken us up while we were still running */
+		cancel_wakeup();
 	}
 	completion->count--;
 
-	local_irq_restore(flags);
+	spin_unlock_irqrestore(&completion->lock, flags);
 }
 
 /*
@@ -61,20 +75,20 @@ void complete(completion_t *completion)
 	queue_thread_t *curr;
 	unsigned long flags;
 
-	flags = local_irq_save();
+	flags = spin_lock_irqsave(&completion->lock);
 
 	completion->count++;
 
 	if (!list_empty(&completion->tcb_list)) {
 		curr = list_first_entry(&completion->tcb_list, queue_thread_t, list);
 		ready(curr->tcb);
-		list_del(&curr->list);
+		list_del_init(&curr->list);
 	}
 
 	/* Trigger a schedule to give a change to the waiter */
 	raise_softirq(SCHEDULE_SOFTIRQ);
 
-	local_irq_restore(flags);
+	spin_unlock_irqrestore(&completion->lock, flags);
 }
 
 /*
@@ -88,11 +102,11 @@ void complete_all(completion_t *completion)
 	queue_thread_t *curr, *tmp;
 	unsigned long flags;
 
-	flags = local_irq_save();
+	flags = spin_lock_irqsave(&completion->lock);
 
 	list_for_each_entry_safe(curr, tmp, &completion->tcb_list, list) {
 		ready(curr->tcb);
-		list_del(&curr->list);
+		list_del_init(&curr->list);
 	}
 
 	reinit_completion(completion);
@@ -100,7 +114,7 @@ void complete_all(completion_t *completion)
 	/* Trigger a schedule to give a change to the waiter */
 	raise_softirq(SCHEDULE_SOFTIRQ);
 
-	local_irq_restore(flags);
+	spin_unlock_irqrestore(&completion->lock, flags);
 }
 
 void init_completion(completion_t *completion)
@@ -108,6 +122,7 @@ void init_completion(completion_t *completion)
 	memset(completion, 0, sizeof(completion_t));
 
 	INIT_LIST_HEAD(&completion->tcb_list);
+	spin_lock_init(&completion->lock);
 
 	completion->count = 0;
 }
@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2025 Daniel Rossier <daniel.rossier@heig-vd.ch>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Fast user-space mutexes (futex)
+ *
+ * A thread waiting on a futex word is queued in a bucket of a hashed table. The key of
+ * a private futex is the address space (process) and the virtual address of the word
+ * while the key of a shared futex is the physical address of the word, so that it can
+ * be used by several processes through a shared mapping.
+ */
+
+#include <common.h>
+#include <delay.h>
+#include <errno.h>
+#include <futex.h>
+#include <list.h>
+#include <process.h>
+#include <schedule.h>
+#include <softirq.h>
+#include <spinlock.h>
+#include <timer.h>
+
+#include <asm/mmu.h>
+
+#define FUTEX_HASH_BITS 6
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+struct futex_key {
+	addr_t addr;
+
+	/* Process of a private futex, NULL for a shared futex */
+	pcb_t *pcb;
+};
+
+struct futex_bucket {
+	spinlock_t lock;
+	struct list_head waiters;
+};
+
+/* A waiter lives in the stack of the waiting thread */
+struct futex_waiter {
+	struct futex_key key;
+	tcb_t *tcb;
+
+	/* Bucket the waiter is queued in, which changes on a requeue */
+	struct futex_bucket *bucket;
+
+	/* Set when the waiter is dequeued by a wake-up */
+	bool woken;
+
+	struct list_head list;
+};
+
+static struct futex_bucket futex_table[FUTEX_HASH_SIZE];
+
+static int futex_get_key(uint32_t *uaddr, bool private, struct futex_key *key)
+{
+	addr_t addr = (addr_t) uaddr;
+
+	if (addr & (sizeof(uint32_t) - 1)) {
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	if (!user_page_mapped(addr)) {
+		set_errno(EFAULT);
+		return -1;
+	}
+
+	if (private) {
+		key->addr = addr;
+		key->pcb = current()->pcb;
+	} else {
+		key->addr = virt_to_phys_pt(addr);
+		key->pcb = NULL;
+	}
+
+	return 0;
+}
+
+static bool futex_match(struct futex_key *a, struct futex_key *b)
+{
+	return (a->addr == b->addr) && (a->pcb == b->pcb);
+}
+
+static struct futex_bucket *futex_hash(struct futex_key *key)
+{
+	unsigned long h = (key->addr >> 2) ^ ((unsigned long) key->pcb >> 4);
+
+	h ^= h >> FUTEX_HASH_BITS;
+	h ^= h >> (2 * FUTEX_HASH_BITS);
+
+	return &futex_table[h & (FUTEX_HASH_SIZE - 1)];
+}
+
+/*
+ * Lock the bucket a waiter is queued in. The bucket may change by a requeue until it is locked.
+ * IRQs are off.
+ */
+static struct futex_bucket *futex_lock_waiter(struct futex_waiter *waiter)
+{
+	struct futex_bucket *bucket;
+
+	for (;;) {
+		bucket = waiter->bucket;
+
+		spin_lock(&bucket->lock);
+
+		if (bucket == waiter->bucket)
+			return bucket;
+
+		spin_unlock(&bucket->lock);
+	}
+}
+
+/*
+ * Dequeue a waiter and make its thread ready. The bucket lock is held.
+ * The waiter must not be accessed afterwards since it may disappear as soon as the bucket lock is released.
+ */
+static void futex_wake_waiter(struct futex_waiter *waiter)
+{
+	list_del(&waiter->list);
+	waiter->woken = true;
+
+	ready(waiter->tcb);
+}
+
+/*
+ * Suspend the current thread as long as the word at <uaddr> contains <val>, until it is
+ * woken up by futex_wake(). With <has_timeout>, the thread is suspended <timeout> ns at most.
+ */
+static int futex_wait(uint32_t *uaddr, uint32_t val, u64 timeout, bool has_timeout, bool private)
+{
+	struct futex_waiter waiter;
+	struct futex_bucket *bucket;
+	unsigned long flags;
+
+	if (futex_get_key(uaddr, private, &waiter.key))
+		return -1;
+
+	bucket = futex_hash(&waiter.key);
+
+	flags = spin_lock_irqsave(&bucket->lock);
+
+	/* Checked with the bucket lock held, so that a wake-up issued after changing the word cannot be missed. */
+	if (*((volatile uint32_t *) uaddr) != val) {
+		spin_unlock_irqrestore(&bucket->lock, flags);
+		set_errno(EAGAIN);
+		return -1;
+	}
+
+	if (has_timeout && !timeout) {
+		spin_unlock_irqrestore(&bucket->lock, flags);
+		set_errno(ETIMEDOUT);
+		return -1;
+	}
+
+	waiter.tcb = current();
+	waiter.bucket = bucket;
+	waiter.woken = false;
+
+	list_add_tail(&waiter.list, &bucket->waiters);
+
+	/* IRQs remain off until the thread is suspended */
+	spin_unlock(&bucket->lock);
+
+	if (timeout)
+		sleep(timeout);
+	else
+		waiting();
+
+	bucket = futex_lock_waiter(&waiter);
+
+	if (waiter.woken) {
+		/*
+		 * After a timeout, the thread may already be running again when it is woken up,
+		 * and the wake-up is then left pending; it is consumed here.
+		 */
+		cancel_wakeup();
+
+		spin_unlock_irqrestore(&bucket->lock, flags);
+		return 0;
+	}
+
+	list_del(&waiter.list);
+
+	spin_unlock_irqrestore(&bucket->lock, flags);
+
+	set_errno(timeout ? ETIMEDOUT : EINTR);
+
+	return -1;
+}
+
+/*
+ * Wake up to <nr> threads waiting on <uaddr>.
+ * Returns the number of threads woken up.
+ */
+static int futex_wake(uint32_t *uaddr, int nr, bool private)
+{
+	struct futex_waiter *waiter, *tmp;
+	struct futex_bucket *bucket;
+	struct futex_key key;
+	unsigned long flags;
+	int count = 0;
+
+	if (futex_get_key(uaddr, private, &key))
+		return -1;
+
+	bucket = futex_hash(&key);
+
+	flags = spin_lock_irqsave(&bucket->lock);
+
+	list_for_each_entry_safe(waiter, tmp, &bucket->waiters, list) {
+		if (count >= nr)
+			break;
+
+		if (futex_match(&waiter->key, &key)) {
+			futex_wake_waiter(waiter);
+			count++;
+		}
+	}
+
+	spin_unlock_irqrestore(&bucket->lock, flags);
+
+	if (count)
+		raise_softirq(SCHEDULE_SOFTIRQ);
+
+	return count;
+}
+
+/*
+ * Wake up to <nr_wake> threads waiting on <uaddr> and move up to <nr_requeue> other
+ * waiters to <uaddr2>, without waking them up. With <cmp>, nothing is done unless
+ * <uaddr> contains <val>.
+ * Returns the number of threads woken up or requeued.
+ */
+static int futex_requeue(uint32_t *uaddr, int nr_wake, int nr_requeue, uint32_t *uaddr2, bool cmp, uint32_t val,
+			 bool private)
+{
+	struct futex_waiter *waiter, *tmp;
+	struct futex_bucket *bucket, *bucket2;
+	struct futex_key key, key2;
+	unsigned long flags;
+	int woken = 0, requeued = 0;
+
+	if (futex_get_key(uaddr, private, &key) || futex_get_key(uaddr2, private, &key2))
+		return -1;
+
+	bucket = futex_hash(&key);
+	bucket2 = futex_hash(&key2);
+
+	/* The buckets are always locked in the same order */
+	flags = local_irq_save();
+
+	if (bucket < bucket2) {
+		spin_lock(&bucket->lock);
+		spin_lock(&bucket2->lock);
+	} else {
+		spin_lock(&bucket2->lock);
+		if (bucket != bucket2)
+			spin_lock(&bucket->lock);
+	}
+
+	if (cmp && (*((volatile uint32_t *) uaddr) != val)) {
+		set_errno(EAGAIN);
+		woken = -1;
+		goto out;
+	}
+
+	list_for_each_entry_safe(waiter, tmp, &bucket->waiters, list) {
+		if (!futex_match(&waiter->key, &key))
+			continue;
+
+		if (woken < nr_wake) {
+			futex_wake_waiter(waiter);
+			woken++;
+
+		} else if (requeued < nr_requeue) {
+			waiter->key = key2;
+
+			if (bucket != bucket2) {
+				list_del(&waiter->list);
+				list_add_tail(&waiter->list, &bucket2->waiters);
+				waiter->bucket = bucket2;
+			}
+			requeued++;
+
+		} else
+			break;
+	}
+
+out:
+	if (bucket != bucket2)
+		spin_unlock(&bucket->lock);
+	spin_unlock(&bucket2->lock);
+
+	local_irq_restore(flags);
+
+	if (woken > 0)
+		raise_softirq(SCHEDULE_SOFTIRQ);
+
+	return (woken < 0) ? -1 : woken + requeued;
+}
+
+/*
+ * Implementation of the futex syscall. As with Linux, <val2> is a pointer to a relative
+ * timeout (struct timespec) for FUTEX_WAIT and the number of waiters to requeue for
+ * FUTEX_REQUEUE and FUTEX_CMP_REQUEUE.
+ */
+int do_futex(uint32_t *uaddr, int op, uint32_t val, unsigned long val2, uint32_t *uaddr2, uint32_t val3)
+{
+	bool private = !!(op & FUTEX_PRIVATE_FLAG);
+	struct timespec *ts;
+	u64 timeout = 0;
+
+	switch (op & FUTEX_CMD_MASK) {
+	case FUTEX_WAIT:
+		ts = (struct timespec *) val2;
+
+		if (ts) {
+			if (ts->tv_nsec >= NSECS) {
+				set_errno(EINVAL);
+				return -1;
+			}
+			timeout = SECONDS(ts->tv_sec) + ts->tv_nsec;
+		}
+
+		return futex_wait(uaddr, val, timeout, !!ts, private);
+
+	case FUTEX_WAKE:
+		return futex_wake(uaddr, val, private);
+
+	case FUTEX_REQUEUE:
+		return futex_requeue(uaddr, val, val2, uaddr2, false, 0, private);
+
+	case FUTEX_CMP_REQUEUE:
+		return futex_requeue(uaddr, val, val2, uaddr2, true, val3, private);
+
+	default:
+		set_errno(ENOSYS);
+		return -1;
+	}
+}
+
+void futex_init(void)
+{
+	int i;
+
+	for (i = 0; i < FUTEX_HASH_SIZE; i++) {
+		spin_lock_init(&futex_table[i].lock);
+		INIT_LIST_HEAD(&futex_table[i].waiters);
+	}
+}
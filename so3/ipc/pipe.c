@@ -17,6 +17,7 @@
  *
  */
 
+#include <common.h>
 #include <errno.h>
 #include <heap.h>
 #include <limits.h>
@@ -44,7 +45,7 @@ static int otherend(uint32_t gfd)
  */
 bool pipe_full(pipe_desc_t *pd)
 {
-	return (((pd->pos_write + 1) % PIPE_SIZE) == pd->pos_read);
+	return (pd->count == pd->size);
 }
 
 /*
@@ -52,22 +53,63 @@ bool pipe_full(pipe_desc_t *pd)
  */
 bool pipe_empty(pipe_desc_t *pd)
 {
-	return (pd->pos_write == pd->pos_read);
+	return !pd->count;
 }
 
 /*
- * Read some bytes from the pipe associated to @gfd
- * @suspend tells if the thread must be suspended if there is no data (actually,
- * it may be the case that the thread has already consumed some bytes, in this case
- * it will proceed with the available bytes).
+ * Number of bytes which can be read in one copy, i.e. up to the end of the buffer.
+ */
+static unsigned int pipe_read_span(pipe_desc_t *pd)
+{
+	return min(pd->count, pd->size - pd->pos_read);
+}
+
+/*
+ * Number of bytes which can be written in one copy, i.e. up to the end of the buffer.
+ */
+static unsigned int pipe_write_span(pipe_desc_t *pd)
+{
+	return min(pd->size - pd->count, pd->size - pd->pos_write);
+}
+
+/*
+ * Remove <len> bytes at the read position. Writers are woken up if the pipe was full.
+ */
+static void pipe_consume(pipe_desc_t *pd, unsigned int len)
+{
+	bool was_full = pipe_full(pd);
+
+	pd->pos_read = (pd->pos_read + len) % pd->size;
+	pd->count -= len;
+
+	if (was_full && len)
+		complete(&pd->wait_for_reader);
+}
+
+/*
+ * Add <len> bytes at the write position. Readers are woken up if the pipe was empty.
+ */
+static void pipe_produce(pipe_desc_t *pd, unsigned int len)
+{
+	bool was_empty = pipe_empty(pd);
+
+	pd->pos_write = (pd->pos_write + len) % pd->size;
+	pd->count += len;
+
+	if (was_empty && len)
+		complete(&pd->wait_for_writer);
+}
+
+/*
+ * Wait until some bytes are available in the pipe associated to @gfd.
+ * Returns false if the pipe is empty and has no writer anymore.
  * The pd->lock mutex is hold by the calling function.
  */
-static int pipe_read_byte(int gfd, char *value, bool suspend)
+static bool pipe_wait_data(int gfd, pipe_desc_t *pd)
 {
-	pipe_desc_t *pd = (pipe_desc_t *) vfs_get_priv(gfd);
+	bool waited = false;
 
-	/* While no data to read, place thread in waiting state */
-	while (suspend && pipe_empty(pd) && (otherend(gfd) != -1)) {
+	while (pipe_empty(pd) && (otherend(gfd) != -1)) {
 		/* Release the lock, we will wait for available bytes or a termination. */
 		mutex_unlock(&pd->lock);
 
@@ -76,25 +118,50 @@ static int pipe_read_byte(int gfd, char *value, bool suspend)
 		/* Re-acquiring the lock before proceeding. */
 		mutex_lock(&pd->lock);
 
-		if (pipe_empty(pd) && (otherend(gfd) == -1))
-			return -1;
+		waited = true;
 	}
 
-	if (pipe_empty(pd))
-		return 0;
+	/* Only one reader is woken up on a transition; pass it on to the next one. */
+	if (waited)
+		complete(&pd->wait_for_writer);
+
+	return !pipe_empty(pd);
+}
+
+/*
+ * Wait until some room is available in the pipe associated to @gfd.
+ * Returns false if the pipe is full and has no reader anymore.
+ * The pd->lock mutex is hold by the calling function.
+ */
+static bool pipe_wait_space(int gfd, pipe_desc_t *pd)
+{
+	bool waited = false;
+
+	while (pipe_full(pd) && (otherend(gfd) != -1)) {
+		mutex_unlock(&pd->lock);
 
-	value[0] = ((char *) pd->pipe_buf)[pd->pos_read]; /* Read value from buffer */
+		wait_for_completion(&pd->wait_for_reader);
+
+		mutex_lock(&pd->lock);
+
+		waited = true;
+	}
 
-	/* Update circular read index */
-	pd->pos_read = (pd->pos_read + 1) % PIPE_SIZE;
+	if (waited)
+		complete(&pd->wait_for_reader);
 
-	return 1; /* One byte read successfully */
+	return !pipe_full(pd);
 }
 
+/*
+ * Read some bytes from the pipe associated to @gfd. The thread is suspended
+ * until at least one byte is available, then the available bytes are copied
+ * (two copies at most, before and after the end of the ring).
+ */
 static int pipe_read(int gfd, void *buffer, int count)
 {
-	int pos, ret;
-	bool first;
+	unsigned int len;
+	int pos;
 	pipe_desc_t *pd = (pipe_desc_t *) vfs_get_priv(gfd);
 
 	/* Sanity checks*/
@@ -105,108 +172,257 @@ static int pipe_read(int gfd, void *buffer, int count)
 
 	mutex_lock(&pd->lock);
 
-	if ((otherend(gfd) == -1) && pipe_empty(pd)) {
+	if (!pipe_wait_data(gfd, pd)) {
 		/* No writers left, error */
 		set_errno(EPIPE);
 		mutex_unlock(&pd->lock);
 
+		/* According to Posix, read() will return 0 it the otherend is closed */
 		return 0;
 	}
 
-	first = true;
 	pos = 0;
-	do {
-		ret = pipe_read_byte(gfd, (char *) buffer + pos, first);
+	while ((pos < count) && !pipe_empty(pd)) {
+		len = min((unsigned int) (count - pos), pipe_read_span(pd));
+
+		memcpy((char *) buffer + pos, (char *) pd->pipe_buf + pd->pos_read, len);
+		pipe_consume(pd, len);
 
-		if (ret < 0) {
+		pos += len;
+	}
+
+	mutex_unlock(&pd->lock);
+
+	return pos; /* Effective number of read bytes */
+}
+
+/*
+ * Write some bytes into the pipe associated to @gfd. The thread is suspended
+ * as long as the pipe is full until all bytes have been written.
+ */
+static int pipe_write(int gfd, const void *buffer, int count)
+{
+	unsigned int len;
+	int pos;
+	pipe_desc_t *pd = (pipe_desc_t *) vfs_get_priv(gfd);
+
+	/* Do Sanity checks */
+	if (!buffer || (count <= 0)) {
+		set_errno(EPIPE);
+		return -1;
+	}
+
+	mutex_lock(&pd->lock);
+
+	pos = 0;
+	while (pos < count) {
+		if (!pipe_wait_space(gfd, pd)) {
+			/* No readers left, error no space left */
 			set_errno(EPIPE);
 			mutex_unlock(&pd->lock);
 
-			/* According to Posix, read() will return 0 it the otherend is closed */
-			return 0;
+			return -1;
 		}
 
-		first = false;
+		while ((pos < count) && !pipe_full(pd)) {
+			len = min((unsigned int) (count - pos), pipe_write_span(pd));
 
-		if (ret)
-			pos++;
+			memcpy((char *) pd->pipe_buf + pd->pos_write, (char *) buffer + pos, len);
+			pipe_produce(pd, len);
 
-	} while (ret && (pos < count));
-
-	complete(&pd->wait_for_reader);
+			pos += len;
+		}
+	}
 
 	mutex_unlock(&pd->lock);
 
-	return pos; /* Effective number of read bytes */
+	return pos; /* Effective number of written bytes */
 }
 
 /*
- * Write some bytes into the pipe associated to @gfd
- *
- * The pipe_desc lock is hold before at the entry of this function.
+ * Change the capacity of a pipe. The size is rounded up to a number of pages.
+ * The pd->lock mutex is hold by the calling function.
  */
-static int pipe_write_byte(pipe_desc_t *pd, char value)
+static int pipe_resize(pipe_desc_t *pd, unsigned long size)
 {
-	/* While no empty locations, place thread in waiting state */
-	while (pipe_full(pd)) {
-		/* FIXME : timeout  ?*/
-		mutex_unlock(&pd->lock);
+	bool was_full = pipe_full(pd);
+	unsigned int len;
+	void *buf;
 
-		wait_for_completion(&pd->wait_for_reader);
+	size = max((unsigned long) PIPE_SIZE, ALIGN_UP(size, PAGE_SIZE));
 
-		mutex_lock(&pd->lock);
+	if (size > PIPE_MAX_SIZE) {
+		set_errno(EPERM);
+		return -1;
+	}
 
-		/* FIXME signal or timeout */
-		if (pipe_full(pd))
-			/* No readers left, error */
-			return -1;
+	/* The bytes in the pipe must fit in the new buffer */
+	if (pd->count > size) {
+		set_errno(EBUSY);
+		return -1;
+	}
+
+	if (size == pd->size)
+		return size;
+
+	buf = malloc(size);
+	if (!buf) {
+		set_errno(ENOMEM);
+		return -1;
 	}
 
-	((char *) pd->pipe_buf)[pd->pos_write] = value; /* Set new buffer value */
+	/* The contents is moved at the beginning of the new buffer */
+	len = pipe_read_span(pd);
+	memcpy(buf, (char *) pd->pipe_buf + pd->pos_read, len);
+	memcpy((char *) buf + len, pd->pipe_buf, pd->count - len);
+
+	free(pd->pipe_buf);
+
+	pd->pipe_buf = buf;
+	pd->size = size;
+	pd->pos_read = 0;
+	pd->pos_write = pd->count % size;
 
-	/* Update circular write index */
-	pd->pos_write = (pd->pos_write + 1) % PIPE_SIZE;
+	if (was_full)
+		complete(&pd->wait_for_reader);
 
-	return 1; /* 1 bytes successfully written */
+	return size;
 }
 
-static int pipe_write(int gfd, const void *buffer, int count)
+static int pipe_fcntl(int gfd, unsigned long cmd, unsigned long args)
 {
+	pipe_desc_t *pd = (pipe_desc_t *) vfs_get_priv(gfd);
+	int ret;
+
+	mutex_lock(&pd->lock);
+
+	switch (cmd) {
+	case F_SETPIPE_SZ:
+		ret = pipe_resize(pd, args);
+		break;
+
+	case F_GETPIPE_SZ:
+		ret = pd->size;
+		break;
+
+	default:
+		/* Not yet implemented */
+		ret = 0;
+	}
+
+	mutex_unlock(&pd->lock);
+
+	return ret;
+}
+
+/*
+ * Move up to @count bytes from the pipe associated to @gfd to another file (splice).
+ * The bytes are given to the write operation of the file straight from the pipe buffer.
+ * Returns the number of bytes moved, 0 if the pipe is empty and has no writer anymore.
+ */
+int pipe_splice_read(int gfd, struct file_operations *fops_out, int gfd_out, int count, bool nonblock)
+{
+	unsigned int len;
 	int pos, ret;
 	pipe_desc_t *pd = (pipe_desc_t *) vfs_get_priv(gfd);
 
-	/* Do Sanity checks */
-	if (!buffer || (count <= 0)) {
-		set_errno(EPIPE);
+	if (!fops_out->write) {
+		set_errno(EINVAL);
 		return -1;
 	}
 
 	mutex_lock(&pd->lock);
 
-	if ((otherend(gfd) == -1) && pipe_full(pd)) {
-		/* No readers left, error no space left */
-		set_errno(EPIPE);
+	if (nonblock && pipe_empty(pd) && (otherend(gfd) != -1)) {
+		set_errno(EAGAIN);
 		mutex_unlock(&pd->lock);
 
 		return -1;
 	}
 
-	for (pos = 0; pos < count; pos++) {
-		ret = pipe_write_byte(pd, *((char *) buffer + pos));
-		if (ret < 0) {
-			set_errno(EPIPE);
-			mutex_unlock(&pd->lock);
+	if (!pipe_wait_data(gfd, pd)) {
+		mutex_unlock(&pd->lock);
+		return 0;
+	}
 
-			return -1;
+	pos = 0;
+	while ((pos < count) && !pipe_empty(pd)) {
+		len = min((unsigned int) (count - pos), pipe_read_span(pd));
+
+		ret = fops_out->write(gfd_out, (char *) pd->pipe_buf + pd->pos_read, len);
+		if (ret <= 0) {
+			if (!pos)
+				pos = ret;
+			break;
 		}
+
+		pipe_consume(pd, ret);
+		pos += ret;
+
+		if (ret < len)
+			break;
+	}
+
+	mutex_unlock(&pd->lock);
+
+	return pos;
+}
+
+/*
+ * Move up to @count bytes from a file to the pipe associated to @gfd (splice).
+ * The bytes are read by the read operation of the file straight into the pipe buffer.
+ * Returns the number of bytes moved.
+ */
+int pipe_splice_write(int gfd, struct file_operations *fops_in, int gfd_in, int count, bool nonblock)
+{
+	unsigned int len;
+	int pos, ret;
+	pipe_desc_t *pd = (pipe_desc_t *) vfs_get_priv(gfd);
+
+	if (!fops_in->read) {
+		set_errno(EINVAL);
+		return -1;
 	}
 
-	/* Waking up sleeping threads */
-	complete(&pd->wait_for_writer);
+	mutex_lock(&pd->lock);
+
+	if (nonblock && pipe_full(pd) && (otherend(gfd) != -1)) {
+		set_errno(EAGAIN);
+		mutex_unlock(&pd->lock);
+
+		return -1;
+	}
+
+	if (!pipe_wait_space(gfd, pd)) {
+		/* No readers left */
+		set_errno(EPIPE);
+		mutex_unlock(&pd->lock);
+
+		return -1;
+	}
+
+	pos = 0;
+	while ((pos < count) && !pipe_full(pd)) {
+		len = min((unsigned int) (count - pos), pipe_write_span(pd));
+
+		ret = fops_in->read(gfd_in, (char *) pd->pipe_buf + pd->pos_write, len);
+		if (ret <= 0) {
+			if (!pos)
+				pos = ret;
+			break;
+		}
+
+		pipe_produce(pd, ret);
+		pos += ret;
+
+		/* End of file or no more data for now */
+		if (ret < len)
+			break;
+	}
 
 	mutex_unlock(&pd->lock);
 
-	return pos; /* Effective number of written bytes */
+	return pos;
 }
 
 /* 
@@ -251,7 +467,7 @@ static int pipe_close(int gfd)
 /*
  * Pipe file operations
  */
-struct file_operations pipe_fops = { .read = pipe_read, .write = pipe_write, .close = pipe_close };
+struct file_operations pipe_fops = { .read = pipe_read, .write = pipe_write, .close = pipe_close, .fcntl = pipe_fcntl };
 
 /*
  * @brief This is the syscall interface
@@ -281,6 +497,7 @@ int do_pipe(int pipefd[2])
 		set_errno(ENOMEM);
 		return -1;
 	}
+	pd->size = PIPE_SIZE;
 
 	init_completion(&pd->wait_for_reader);
 	init_completion(&pd->wait_for_writer);
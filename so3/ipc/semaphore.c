@@ -21,6 +21,8 @@
 #include <string.h>
 #include <schedule.h>
 #include <delay.h>
+#include <thread.h>
+#include <completion.h>
 
 /*
  * Sempahore down operation - Prepare to enter a critical section
@@ -32,7 +34,9 @@
 int sem_timeddown(sem_t *sem, uint64_t timeout)
 {
 	queue_thread_t q_tcb;
-	struct list_head *pos;
+	bool waited = false;
+
+	INIT_LIST_HEAD(&q_tcb.list);
 
 	for (;;) {
 		mutex_lock(&sem->lock);
@@ -46,12 +50,16 @@ int sem_timeddown(sem_t *sem, uint64_t timeout)
 			if ((atomic_read(&sem->count) >= 0) && (atomic_xchg(&sem->count, -1) == 1))
 				break;
 
-			/* Add waiting tasks to the end of the waitqueue (FIFO) */
-			q_tcb.tcb = current();
-			list_add_tail(&q_tcb.list, &sem->tcb_list);
+			/* Add waiting tasks to the end of the waitqueue (FIFO), unless a stale wake-up
+			 * resumed us while we were still queued.
+			 */
+			if (list_empty(&q_tcb.list))
+				list_add_tail(&q_tcb.list, &sem->tcb_list);
 
 			mutex_unlock(&sem->lock);
 
+			waited = true;
+
 			if (!timeout)
 				waiting();
 			else {
@@ -68,15 +76,14 @@ int sem_timeddown(sem_t *sem, uint64_t timeout)
 					mutex_lock(&sem->lock);
 
 					/* Make sure the entry has not been deleted, right before the timeout... it might happen! */
-					list_for_each(pos, &sem->tcb_list)
-						if (pos == &q_tcb.list)
-							break;
-
-					if (pos == &q_tcb.list)
+					if (!list_empty(&q_tcb.list))
 						list_del(&q_tcb.list);
 
 					mutex_unlock(&sem->lock);
 
+					/* sem_up() may have woken us up after the deadline; forget it. */
+					cancel_wakeup();
+
 					/* This is possible only if we were woken up by the timer deadline. */
 					return -1;
 				}
@@ -89,7 +96,15 @@ int sem_timeddown(sem_t *sem, uint64_t timeout)
 
 			sem->val--;
 
+			/* We may have been resumed by a stale wake-up and got the semaphore meanwhile */
+			if (!list_empty(&q_tcb.list))
+				list_del_init(&q_tcb.list);
+
 			mutex_unlock(&sem->lock);
+
+			/* sem_up() may have woken us up once more while we were running */
+			if (waited)
+				cancel_wakeup();
 			break;
 		}
 	}
@@ -121,7 +136,7 @@ void sem_up(sem_t *sem)
 		curr = list_first_entry(&sem->tcb_list, queue_thread_t, list);
 		need_resched = true;
 
-		list_del(&curr->list);
+		list_del_init(&curr->list);
 
 		wake_up(curr->tcb);
 	}
@@ -146,3 +161,98 @@ void sem_init(sem_t *sem)
 
 	mutex_init(&sem->lock);
 }
+
+#ifdef CONFIG_SEM_TEST
+
+/* Timeout of the semaphore wait and span of the post times around it (us) */
+#define SEM_TEST_TIMEOUT_US 1000
+#define SEM_TEST_SWEEP_US 200
+
+/* Time the helper keeps the mutex after posting the semaphore (us) */
+#define SEM_TEST_HOLD_US 500
+
+static sem_t test_sem;
+static struct mutex test_lock;
+static completion_t test_go, test_done;
+static volatile bool test_stop;
+static int test_delay;
+
+static void *sem_test_helper(void *arg)
+{
+	for (;;) {
+		wait_for_completion(&test_go);
+		if (test_stop)
+			break;
+
+		mutex_lock(&test_lock);
+
+		/* Post the semaphore around the deadline of the waiter */
+		udelay(test_delay);
+		sem_up(&test_sem);
+
+		/* Keep the mutex so that the waiter really has to wait for it */
+		udelay(SEM_TEST_HOLD_US);
+		mutex_unlock(&test_lock);
+
+		complete(&test_done);
+	}
+
+	return NULL;
+}
+
+/*
+ * Wait on a semaphore with a timeout while another thread posts it around the
+ * deadline, then wait on a mutex held by that thread. A wake-up from sem_up()
+ * arriving after the timeout must not cut the mutex wait short nor corrupt
+ * its wait queue.
+ */
+void sem_test(int rounds)
+{
+	tcb_t *helper;
+	int i, timeouts = 0, errors = 0;
+
+	if (rounds <= 0)
+		rounds = 1000;
+
+	mutex_init(&test_lock);
+	init_completion(&test_go);
+	init_completion(&test_done);
+	test_stop = false;
+
+	helper = kernel_thread(sem_test_helper, "sem_test", NULL, THREAD_PRIO_DEFAULT);
+
+	for (i = 0; i < rounds; i++) {
+		/* The semaphore starts at 1 */
+		sem_init(&test_sem);
+		sem_down(&test_sem);
+
+		test_delay = SEM_TEST_TIMEOUT_US - SEM_TEST_SWEEP_US / 2 + (i % SEM_TEST_SWEEP_US);
+		complete(&test_go);
+
+		if (sem_timeddown(&test_sem, MICROSECS(SEM_TEST_TIMEOUT_US)) < 0)
+			timeouts++;
+
+		mutex_lock(&test_lock);
+
+		/* Once we own the mutex, we must no longer be queued on it */
+		if ((test_lock.owner != current()) || !list_empty(&test_lock.tcb_list))
+			errors++;
+
+		mutex_unlock(&test_lock);
+
+		wait_for_completion(&test_done);
+
+#ifdef CONFIG_SCHED_SMP
+		if (current()->wakeup_pending)
+			errors++;
+#endif
+	}
+
+	test_stop = true;
+	complete(&test_go);
+	thread_join(helper);
+
+	printk("Semaphore test (%d rounds): %d timeouts, %d errors\n", rounds, timeouts, errors);
+}
+
+#endif /* CONFIG_SEM_TEST */
@@ -40,17 +40,17 @@ void calibrate_delay(void)
 		return;
 	}
 
-#ifdef CONFIG_RTOS
-	oneshot_timer.set_delay(NSECS / HZ);
-#endif /* CONFIG_RTOS */
+#if defined(CONFIG_RTOS) || defined(CONFIG_NO_HZ)
+	oneshot_timer.set_delay(NSECS / CONFIG_HZ);
+#endif /* CONFIG_RTOS || CONFIG_NO_HZ */
 
 	while (jiffies == __jiffies)
 		;
 	__jiffies = jiffies;
 
-#ifdef CONFIG_RTOS
-	oneshot_timer.set_delay(NSECS / HZ);
-#endif /* CONFIG_RTOS */
+#if defined(CONFIG_RTOS) || defined(CONFIG_NO_HZ)
+	oneshot_timer.set_delay(NSECS / CONFIG_HZ);
+#endif /* CONFIG_RTOS || CONFIG_NO_HZ */
 
 	while (jiffies == __jiffies)
 		jiffies_ref++;
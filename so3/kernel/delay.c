@@ -82,7 +82,7 @@ static void __sleep(u64 ns)
 	set_timer(&__timer, current()->timeout);
 
 	/* Put the thread in waiting state *only* if the timer still makes sense. */
-	if (__timer.status == TIMER_STATUS_in_list) {
+	if (active_timer(&__timer)) {
 		waiting();
 
 		/* We are resumed, but not necessarly by the timer handler (in case of a semaphore timeout based synchronization
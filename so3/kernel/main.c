@@ -31,6 +31,9 @@
 #include <process.h>
 #include <timer.h>
 #include <banner.h>
+#include <percpu.h>
+#include <smp.h>
+#include <futex.h>
 
 #include <asm/atomic.h>
 #include <asm/setup.h>
@@ -75,6 +78,11 @@ void post_init(void)
 
 void *rest_init(void *dummy)
 {
+#ifdef CONFIG_SCHED_SMP
+	/* Bring up the secondary CPUs; they enter the scheduler right away. */
+	smp_init();
+#endif
+
 	post_init();
 
 	/* Start a first SO3 thread (main app thread) */
@@ -100,6 +108,10 @@ void *rest_init(void *dummy)
 
 void kernel_start(void)
 {
+#ifdef CONFIG_SCHED_SMP
+	int i;
+#endif
+
 	lprintk("%s", SO3_BANNER);
 
 	LOG_INFO("Now bootstraping the kernel ...");
@@ -107,6 +119,14 @@ void kernel_start(void)
 	/* Memory manager subsystem initialization */
 	memory_init();
 
+#ifdef CONFIG_SCHED_SMP
+	/* Per-CPU variables (timers, softirqs, ...) are used by all CPUs */
+	percpu_init_areas();
+
+	for (i = 0; i < CONFIG_NR_CPUS; i++)
+		init_percpu_area(i);
+#endif
+
 	devices_init();
 
 #if defined(CONFIG_SOO) && !defined(CONFIG_AVZ)
@@ -119,6 +139,10 @@ void kernel_start(void)
 
 	vfs_init();
 
+#ifdef CONFIG_IPC_FUTEX
+	futex_init();
+#endif
+
 	/* Scheduler init */
 	scheduler_init();
 
@@ -28,6 +28,104 @@
 #include <string.h>
 #include <process.h>
 
+#ifdef CONFIG_SCHED_PRIO
+
+/*
+ * Priority inheritance
+ *
+ * The waiters of a mutex are queued by priority and the owner inherits the
+ * priority of its highest waiter. If the owner is itself waiting for another
+ * mutex, the priority is propagated along the chain of owners.
+ *
+ * pi_lock protects the waiter queues, the owners and the mutexes held by the threads,
+ * so that a chain of mutexes can be followed without taking their wait_lock.
+ * It is taken after the wait_lock of a mutex.
+ */
+static DEFINE_SPINLOCK(pi_lock);
+
+/* Maximal length of a chain of mutexes followed to propagate a priority */
+#define PI_MAX_DEPTH 16
+
+/*
+ * Insert a waiter after the waiters of higher or equal priority.
+ */
+static void pi_enqueue_waiter(struct mutex *lock, queue_thread_t *q_tcb)
+{
+	queue_thread_t *cur;
+
+	list_for_each_entry(cur, &lock->tcb_list, list) {
+		if (thread_prio(cur->tcb) < thread_prio(q_tcb->tcb)) {
+			list_add_tail(&q_tcb->list, &cur->list);
+			return;
+		}
+	}
+
+	list_add_tail(&q_tcb->list, &lock->tcb_list);
+}
+
+/*
+ * Highest priority of the threads waiting on a mutex, 0 if none.
+ */
+static uint32_t pi_top_prio(struct mutex *lock)
+{
+	if (list_empty(&lock->tcb_list))
+		return 0;
+
+	return thread_prio(list_first_entry(&lock->tcb_list, queue_thread_t, list)->tcb);
+}
+
+/*
+ * Recompute the priority inherited by a thread from the waiters of the mutexes it holds.
+ */
+static void pi_update_owner(tcb_t *tcb)
+{
+	struct mutex *lock;
+	uint32_t prio = 0;
+
+	list_for_each_entry(lock, &tcb->held_mutexes, held_list)
+		prio = max(prio, pi_top_prio(lock));
+
+	if (prio != tcb->inherited_prio)
+		sched_set_inherited_prio(tcb, prio);
+}
+
+/*
+ * Boost the owner of a mutex which has a new waiter, then the owners of the mutexes
+ * this owner is waiting for, and so on.
+ */
+static void pi_propagate(struct mutex *lock)
+{
+	queue_thread_t *q_tcb;
+	tcb_t *owner;
+	uint32_t prio;
+	int depth;
+
+	for (depth = 0; lock && (depth < PI_MAX_DEPTH); depth++) {
+		owner = lock->owner;
+		prio = pi_top_prio(lock);
+
+		if (!owner || (prio <= thread_prio(owner)))
+			return;
+
+		sched_set_inherited_prio(owner, prio);
+
+		lock = owner->blocked_on;
+		if (!lock)
+			return;
+
+		/* The owner moves forward in the queue of the mutex it is waiting for */
+		list_for_each_entry(q_tcb, &lock->tcb_list, list) {
+			if (q_tcb->tcb == owner) {
+				list_del(&q_tcb->list);
+				pi_enqueue_waiter(lock, q_tcb);
+				break;
+			}
+		}
+	}
+}
+
+#endif /* CONFIG_SCHED_PRIO */
+
 void mutex_lock(struct mutex *lock)
 {
 	unsigned long flags;
@@ -38,6 +136,8 @@ void mutex_lock(struct mutex *lock)
 	 * may happen if a user signal handler is executed and does some syscall processing
 	 * which could require the same kernel locks than the current thread.
 	 */
+	INIT_LIST_HEAD(&q_tcb.list);
+
 	flags = spin_lock_irqsave(&lock->wait_lock);
 
 	/*
@@ -68,9 +168,28 @@ void mutex_lock(struct mutex *lock)
 		if ((atomic_read(&lock->count) >= 0) && (atomic_xchg(&lock->count, -1) == 1))
 			break;
 
-		/* Add waiting tasks to the end of the waitqueue (FIFO) */
-		q_tcb.tcb = current();
-		list_add_tail(&q_tcb.list, &lock->tcb_list);
+		/*
+		 * A stale wake-up (left by a wait given up before, e.g. a semaphore timeout)
+		 * may resume us while we are still queued; we then simply wait again.
+		 */
+		if (list_empty(&q_tcb.list)) {
+			q_tcb.tcb = current();
+
+#ifdef CONFIG_SCHED_PRIO
+			/* Wait in priority order and let the owner inherit our priority */
+			spin_lock(&pi_lock);
+
+			pi_enqueue_waiter(lock, &q_tcb);
+
+			current()->blocked_on = lock;
+			pi_propagate(lock);
+
+			spin_unlock(&pi_lock);
+#else
+			/* Add waiting tasks to the end of the waitqueue (FIFO) */
+			list_add_tail(&q_tcb.list, &lock->tcb_list);
+#endif
+		}
 
 		/* didn't get the lock, go to sleep. */
 		spin_unlock(&lock->wait_lock);
@@ -86,14 +205,47 @@ void mutex_lock(struct mutex *lock)
 		spin_lock(&lock->wait_lock);
 	}
 
+#ifdef CONFIG_SCHED_PRIO
+	spin_lock(&pi_lock);
+#endif
+
+	/* We got the lock while still queued after a stale wake-up */
+	if (!list_empty(&q_tcb.list)) {
+		list_del_init(&q_tcb.list);
+#ifdef CONFIG_SCHED_PRIO
+		current()->blocked_on = NULL;
+#endif
+	}
+
 	/* set it to 0 if there are no waiters left */
 	if (likely(list_empty(&lock->tcb_list)))
 		atomic_set(&lock->count, 0);
 
+#ifdef CONFIG_SCHED_PRIO
+	spin_unlock(&pi_lock);
+#endif
+
+	/* The unlocker may have woken us up while we were still running */
+	cancel_wakeup();
+
 skip_wait:
 
 	/* got the lock - cleanup and rejoice! */
+#ifdef CONFIG_SCHED_PRIO
+	if (!lock->recursive_count) {
+		spin_lock(&pi_lock);
+
+		lock->owner = current();
+
+		/* Inherit the priority of the remaining waiters */
+		list_add(&lock->held_list, &current()->held_mutexes);
+		pi_update_owner(current());
+
+		spin_unlock(&pi_lock);
+	}
+#else
 	lock->owner = current();
+#endif
 
 	spin_unlock_irqrestore(&lock->wait_lock, flags);
 }
@@ -113,6 +265,19 @@ void mutex_unlock(struct mutex *lock)
 		spin_unlock_irqrestore(&lock->wait_lock, flags);
 		return;
 	}
+
+#ifdef CONFIG_SCHED_PRIO
+	spin_lock(&pi_lock);
+
+	lock->owner = NULL;
+
+	/* Give up the priority inherited from the waiters of this mutex */
+	list_del(&lock->held_list);
+	pi_update_owner(current());
+
+	spin_unlock(&pi_lock);
+#endif
+
 	spin_unlock_irqrestore(&lock->wait_lock, flags);
 
 	/*
@@ -131,44 +296,33 @@ void mutex_unlock(struct mutex *lock)
 
 	flags = spin_lock_irqsave(&lock->wait_lock);
 
+#ifdef CONFIG_SCHED_PRIO
+	spin_lock(&pi_lock);
+#endif
+
 	if (!list_empty(&lock->tcb_list)) {
-		/* Get the waiting the first entry of this associated waitqueue */
+		/* Get the waiting the first entry of this associated waitqueue (the highest priority with SCHED_PRIO) */
 		curr = list_first_entry(&lock->tcb_list, queue_thread_t, list);
 		need_resched = true;
 
-		list_del(&curr->list);
+		list_del_init(&curr->list);
+
+#ifdef CONFIG_SCHED_PRIO
+		curr->tcb->blocked_on = NULL;
+#endif
 
 		ready(curr->tcb);
 	}
 
+#ifdef CONFIG_SCHED_PRIO
+	spin_unlock(&pi_lock);
+#endif
+
 	spin_unlock_irqrestore(&lock->wait_lock, flags);
 	if (need_resched)
 		schedule();
 }
 
-/*
- * The following syscall implementation are a first attempt, mainly used for debugging kernel mutexes.
- */
-int do_mutex_lock(unsigned long number)
-{
-	if (number >= N_MUTEX) {
-		set_errno(EINVAL);
-		return -1;
-	}
-	mutex_lock(&current()->pcb->lock[number]);
-	return 0;
-}
-
-int do_mutex_unlock(unsigned long number)
-{
-	if (number >= N_MUTEX) {
-		set_errno(EINVAL);
-		return -1;
-	}
-	mutex_unlock(&current()->pcb->lock[number]);
-	return 0;
-}
-
 void mutex_init(struct mutex *lock)
 {
 	memset(lock, 0, sizeof(struct mutex));
@@ -21,10 +21,12 @@
 #include <elf.h>
 #include <heap.h>
 #include <memory.h>
+#include <pagecache.h>
 #include <process.h>
 #include <ptrace.h>
 #include <schedule.h>
 #include <signal.h>
+#include <slab.h>
 #include <softirq.h>
 #include <string.h>
 #include <syscall.h>
@@ -43,6 +45,14 @@
 #include <asm/semihosting.h>
 #endif
 
+static kmem_cache_t *page_list_cache;
+
+/*
+ * Serialize the page faults and the updates of the reference counter of pages
+ * which may be shared between processes (copy-on-write after a fork).
+ */
+static DEFINE_SPINLOCK(page_fault_lock);
+
 static char *proc_state_strings[5] = {
 	[PROC_STATE_NEW] = "NEW",	  [PROC_STATE_READY] = "READY",	  [PROC_STATE_RUNNING] = "RUNNING",
 	[PROC_STATE_WAITING] = "WAITING", [PROC_STATE_ZOMBIE] = "ZOMBIE",
@@ -64,12 +74,6 @@ static pcb_t *root_process = NULL; /* root process */
 /* Used to update regs during fork */
 extern void __save_context(tcb_t *newproc, addr_t stack_addr);
 
-/* only the following sections are supported */
-#define SUPPORTED_SECTION_COUNT 6
-static const char *supported_section_names[SUPPORTED_SECTION_COUNT] = {
-	".text", ".rodata", ".data", ".sbss", ".bss", ".scommon",
-};
-
 /*
  * Find a process (pcb_t) from its pid.
  * Return NULL if no process has been found.
@@ -165,6 +169,15 @@ void remove_proc(pcb_t *pcb)
 	}
 }
 
+/*
+ * Initialization of the process management.
+ */
+void proc_init(void)
+{
+	page_list_cache = kmem_cache_create("page_list", sizeof(page_list_t), 0);
+	BUG_ON(!page_list_cache);
+}
+
 /*
  * Create a new process with its PCB and basic contents.
  */
@@ -187,21 +200,15 @@ pcb_t *new_process(void)
 	/* Reset the ptrace request indicator */
 	pcb->ptrace_pending_req = PTRACE_NO_REQUEST;
 
-	/* The spinlock inside the mutex must aligned in aarch64 */
-	pcb->lock = memalign(N_MUTEX * sizeof(mutex_t), 8);
+	mutex_init(&pcb->fd_lock);
 
-	if (!pcb->lock) {
-		LOG_CRITICAL("%s: failed to allocate memory for process mutex\n",
-		       __func__);
-		kernel_panic();
-	}
-
-	/* Initialize the mutex belonging to this process */
-	for (i = 0; i < N_MUTEX; i++) {
-		mutex_init(&pcb->lock[i]);
-	}
 	/* Init the list of pages */
 	INIT_LIST_HEAD(&pcb->page_list);
+	for (i = 0; i < PROC_PAGE_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&pcb->page_hash[i]);
+
+	INIT_LIST_HEAD(&pcb->mmap_list);
+	mutex_init(&pcb->mmap_lock);
 
 	pcb->pid = pid_current++;
 
@@ -263,22 +270,53 @@ void dump_proc_pages(pcb_t *pcb)
 	LOG_INFO("\n");
 }
 
-void add_page_to_proc(pcb_t *pcb, page_t *page)
+void add_page_to_proc(pcb_t *pcb, page_t *page, addr_t vaddr)
 {
 	page_list_t *page_list_entry;
 
-	page_list_entry = malloc(sizeof(page_list_t));
+	page_list_entry = kmem_cache_alloc(page_list_cache);
 	if (page_list_entry == NULL) {
 		LOG_CRITICAL("%s: failed to allocate memory!\n", __func__);
 		kernel_panic();
 	}
 
 	page_list_entry->page = page;
+	page_list_entry->vaddr = vaddr;
 
 	page->refcount++;
 
 	/* Insert our page at the end of the list */
 	list_add_tail(&page_list_entry->list, &pcb->page_list);
+	list_add(&page_list_entry->hash_list, &pcb->page_hash[(vaddr >> PAGE_SHIFT) % PROC_PAGE_HASH_SIZE]);
+}
+
+/*
+ * Drop a reference to a page which is not owned by a process (page cache).
+ */
+void put_user_page(page_t *page)
+{
+	unsigned long flags;
+
+	flags = spin_lock_irqsave(&page_fault_lock);
+
+	page->refcount--;
+	if (!page->refcount)
+		free_page(page_to_phys(page));
+
+	spin_unlock_irqrestore(&page_fault_lock, flags);
+}
+
+/*
+ * Copy a kernel buffer into a page which is not mapped yet.
+ */
+void fill_user_page(addr_t paddr, void *buf)
+{
+	unsigned long flags;
+
+	/* The fixmap area is shared with the copy-on-write */
+	flags = spin_lock_irqsave(&page_fault_lock);
+	copy_user_page(paddr, (addr_t) buf);
+	spin_unlock_irqrestore(&page_fault_lock, flags);
 }
 
 /*
@@ -287,20 +325,416 @@ void add_page_to_proc(pcb_t *pcb, page_t *page)
 static void allocate_page(pcb_t *pcb, addr_t virt_addr, int nr_pages, bool usr)
 {
 	int i;
-	addr_t page;
+	addr_t *pages;
+
+	pages = malloc(nr_pages * sizeof(addr_t));
+	BUG_ON(!pages);
+
+	/* All frames are taken at once */
+	BUG_ON(get_free_pages(pages, nr_pages));
 
 	/* Perform the mapping of a new physical memory region at the region
          * started at @virt_addr  */
 	for (i = 0; i < nr_pages; i++) {
-		page = get_free_page();
-		BUG_ON(!page);
+		create_mapping(pcb->pgtable, virt_addr + (i * PAGE_SIZE), pages[i], PAGE_SIZE, false);
+
+		add_page_to_proc(pcb, phys_to_page(pages[i]), virt_addr + (i * PAGE_SIZE));
+	}
+
+	free(pages);
+}
+
+/*
+ * Check if a user space address belongs to an area of the process whose
+ * pages are mapped on demand, i.e. the stack (including all thread stacks)
+ * or the heap up to the current break.
+ */
+static bool demand_paged_vaddr(pcb_t *pcb, addr_t vaddr)
+{
+	if ((vaddr >= pcb->stack_top - PROC_STACK_SIZE) && (vaddr < pcb->stack_top))
+		return true;
+
+	if ((vaddr >= pcb->heap_base) && (vaddr < ALIGN_UP(pcb->heap_pointer, PAGE_SIZE)))
+		return true;
+
+	return false;
+}
+
+#ifdef CONFIG_FILE_MMAP
+
+/*
+ * Find the area of a mapped file containing a user space address.
+ * pcb->mmap_lock must be held.
+ */
+static mmap_area_t *find_mmap_area(pcb_t *pcb, addr_t vaddr)
+{
+	mmap_area_t *area;
+
+	list_for_each_entry(area, &pcb->mmap_list, list)
+		if ((vaddr >= area->start) && (vaddr < area->start + area->size))
+			return area;
+
+	return NULL;
+}
+
+/*
+ * Map the page of a mapped file at a faulting address. The page is read from
+ * the page cache, which may suspend the running thread while the file is read.
+ * The page is mapped read-only; a write to it gives the process its own copy
+ * (see do_cow_fault()) if the area is writable.
+ */
+static int do_file_fault(pcb_t *pcb, addr_t vaddr)
+{
+	mmap_area_t *area;
+	unsigned long flags;
+	page_t *page;
+
+	mutex_lock(&pcb->mmap_lock);
+
+	area = find_mmap_area(pcb, vaddr);
+	if (!area) {
+		mutex_unlock(&pcb->mmap_lock);
+		return -1;
+	}
+
+	page = pagecache_get_page(area->file, area->pgoff + ((vaddr - area->start) >> PAGE_SHIFT));
+	if (!page) {
+		mutex_unlock(&pcb->mmap_lock);
+		return -1;
+	}
+
+	flags = spin_lock_irqsave(&page_fault_lock);
+
+	/* Another thread of the process may have faulted on the same page */
+	if (!user_page_mapped(vaddr)) {
+		create_user_page_readonly(pcb->pgtable, vaddr, page_to_phys(page));
+
+		add_page_to_proc(pcb, page, vaddr);
+	}
+
+	spin_unlock_irqrestore(&page_fault_lock, flags);
+
+	mutex_unlock(&pcb->mmap_lock);
+
+	return 0;
+}
+
+#endif /* CONFIG_FILE_MMAP */
+
+/**
+ * Handle a translation fault on a user space address of the current process.
+ * If the address belongs to the stack or the heap, a zeroed page is mapped
+ * so that the faulting access can be restarted. If it belongs to a mapped file,
+ * the corresponding page of the file is mapped.
+ *
+ * @param vaddr	Faulting virtual address
+ * @return	0 if the fault has been resolved, -1 otherwise
+ */
+int do_page_fault(addr_t vaddr)
+{
+	pcb_t *pcb = current()->pcb;
+	unsigned long flags;
+	addr_t paddr;
+
+	if (!pcb)
+		return -1;
 
-		create_mapping(pcb->pgtable, virt_addr + (i * PAGE_SIZE), page, PAGE_SIZE, false);
+	vaddr &= PAGE_MASK;
 
-		add_page_to_proc(pcb, phys_to_page(page));
+	if (!demand_paged_vaddr(pcb, vaddr)) {
+#ifdef CONFIG_FILE_MMAP
+		return do_file_fault(pcb, vaddr);
+#else
+		return -1;
+#endif
 	}
+
+	flags = spin_lock_irqsave(&page_fault_lock);
+
+	/* Another thread of the process may have faulted on the same page */
+	if (user_page_mapped(vaddr)) {
+		spin_unlock_irqrestore(&page_fault_lock, flags);
+		return 0;
+	}
+
+	paddr = get_free_page();
+	if (!paddr) {
+		spin_unlock_irqrestore(&page_fault_lock, flags);
+		LOG_ERROR("%s: no more free page for process %d\n", __func__, pcb->pid);
+		return -1;
+	}
+
+	create_mapping(pcb->pgtable, vaddr, paddr, PAGE_SIZE, false);
+
+	add_page_to_proc(pcb, phys_to_page(paddr), vaddr);
+
+	/* The page is reachable through the user mapping from now on */
+	memset((void *) vaddr, 0, PAGE_SIZE);
+
+	spin_unlock_irqrestore(&page_fault_lock, flags);
+
+	return 0;
+}
+
+/*
+ * Find the page of the process mapped at a given virtual address.
+ */
+static page_list_t *find_proc_page(pcb_t *pcb, addr_t vaddr)
+{
+	page_list_t *cur;
+
+	list_for_each_entry(cur, &pcb->page_hash[(vaddr >> PAGE_SHIFT) % PROC_PAGE_HASH_SIZE], hash_list)
+		if (cur->vaddr == vaddr)
+			return cur;
+
+	return NULL;
 }
 
+/**
+ * Handle a write access to a user page of the current process which is
+ * shared read-only with other processes since a fork (copy-on-write).
+ * The page is copied unless the current process is its last user,
+ * and is mapped writable again.
+ *
+ * @param vaddr	Faulting virtual address
+ * @return	0 if the fault has been resolved, -1 otherwise
+ */
+int do_cow_fault(addr_t vaddr)
+{
+	pcb_t *pcb = current()->pcb;
+#ifdef CONFIG_FILE_MMAP
+	mmap_area_t *area;
+#endif
+	page_list_t *entry;
+	unsigned long flags;
+	addr_t paddr;
+
+	if (!pcb)
+		return -1;
+
+	vaddr &= PAGE_MASK;
+
+#ifdef CONFIG_FILE_MMAP
+	/* Pages of a file mapped without PROT_WRITE remain read-only */
+	mutex_lock(&pcb->mmap_lock);
+	area = find_mmap_area(pcb, vaddr);
+	if (area && !(area->prot & PROT_WRITE)) {
+		mutex_unlock(&pcb->mmap_lock);
+		return -1;
+	}
+	mutex_unlock(&pcb->mmap_lock);
+#endif
+
+	flags = spin_lock_irqsave(&page_fault_lock);
+
+	entry = find_proc_page(pcb, vaddr);
+	if (!entry) {
+		spin_unlock_irqrestore(&page_fault_lock, flags);
+		return -1;
+	}
+
+	if (entry->page->refcount > 1) {
+		paddr = get_free_page();
+		if (!paddr) {
+			spin_unlock_irqrestore(&page_fault_lock, flags);
+			LOG_ERROR("%s: no more free page for process %d\n", __func__, pcb->pid);
+			return -1;
+		}
+
+		copy_user_page(paddr, vaddr);
+
+		entry->page->refcount--;
+
+		entry->page = phys_to_page(paddr);
+		entry->page->refcount++;
+	} else
+		paddr = page_to_phys(entry->page);
+
+	/* The mapping gets the default (writable) permissions again */
+	create_mapping(pcb->pgtable, vaddr, paddr, PAGE_SIZE, false);
+
+	spin_unlock_irqrestore(&page_fault_lock, flags);
+
+	return 0;
+}
+
+/*
+ * Release the pages of the process mapped in the range [start, end[.
+ */
+static void release_proc_range(pcb_t *pcb, addr_t start, addr_t end)
+{
+	page_list_t *cur, *tmp;
+
+	list_for_each_entry_safe(cur, tmp, &pcb->page_list, list) {
+		if ((cur->vaddr < start) || (cur->vaddr >= end))
+			continue;
+
+		release_mapping(pcb->pgtable, cur->vaddr, PAGE_SIZE);
+
+		list_del(&cur->list);
+		list_del(&cur->hash_list);
+
+		cur->page->refcount--;
+		if (!cur->page->refcount)
+			free_page(page_to_phys(cur->page));
+
+		kmem_cache_free(page_list_cache, cur);
+	}
+}
+
+#ifdef CONFIG_FILE_MMAP
+
+/**
+ * Map <page_count> pages of a file starting at <offset> in the user space of the
+ * current process. The pages are mapped on the first access. The area is placed at
+ * <start> if it is free, or at the first free address after it (above the heap).
+ * The reference to <file> is given to the mapping.
+ *
+ * @return the address of the mapping, MAP_FAILED otherwise
+ */
+void *do_mmap_file(struct mapped_file *file, addr_t start, uint32_t page_count, uint32_t offset, int prot)
+{
+	pcb_t *pcb = current()->pcb;
+	mmap_area_t *area, *cur;
+	size_t size = page_count * PAGE_SIZE;
+	struct list_head *pos;
+	addr_t limit;
+
+	if (!page_count || (offset & ~PAGE_MASK)) {
+		pagecache_put(file);
+		set_errno(EINVAL);
+		return MAP_FAILED;
+	}
+
+	area = malloc(sizeof(mmap_area_t));
+	if (!area) {
+		pagecache_put(file);
+		set_errno(ENOMEM);
+		return MAP_FAILED;
+	}
+
+	/* The mappings are placed between the heap and the stack */
+	start = ALIGN_UP(start, PAGE_SIZE);
+	if (start < pcb->heap_base + HEAP_SIZE)
+		start = pcb->heap_base + HEAP_SIZE;
+
+	limit = pcb->stack_top - PROC_STACK_SIZE;
+
+	mutex_lock(&pcb->mmap_lock);
+
+	/* First fit in the sorted list of areas */
+	list_for_each(pos, &pcb->mmap_list) {
+		cur = list_entry(pos, mmap_area_t, list);
+
+		if (start + size <= cur->start)
+			break;
+
+		if (start < cur->start + cur->size)
+			start = cur->start + cur->size;
+	}
+
+	if ((start + size > limit) || (start + size < start)) {
+		mutex_unlock(&pcb->mmap_lock);
+		pagecache_put(file);
+		free(area);
+		set_errno(ENOMEM);
+		return MAP_FAILED;
+	}
+
+	area->start = start;
+	area->size = size;
+	area->pgoff = offset >> PAGE_SHIFT;
+	area->prot = prot;
+	area->file = file;
+
+	/* Insert before the first area located after the new one */
+	list_add_tail(&area->list, pos);
+
+	mutex_unlock(&pcb->mmap_lock);
+
+	return (void *) start;
+}
+
+/**
+ * Remove the mappings of files located in [start, start + length[.
+ * An area is always removed as a whole.
+ *
+ * @return 0 on success, -1 if no mapping was found
+ */
+int do_munmap(addr_t start, size_t length)
+{
+	pcb_t *pcb = current()->pcb;
+	mmap_area_t *area, *tmp;
+	unsigned long flags;
+	int ret = -1;
+
+	mutex_lock(&pcb->mmap_lock);
+
+	list_for_each_entry_safe(area, tmp, &pcb->mmap_list, list) {
+		if ((area->start + area->size <= start) || (area->start >= start + length))
+			continue;
+
+		list_del(&area->list);
+
+		flags = spin_lock_irqsave(&page_fault_lock);
+		release_proc_range(pcb, area->start, area->start + area->size);
+		spin_unlock_irqrestore(&page_fault_lock, flags);
+
+		pagecache_put(area->file);
+		free(area);
+
+		ret = 0;
+	}
+
+	mutex_unlock(&pcb->mmap_lock);
+
+	if (ret)
+		set_errno(EINVAL);
+
+	return ret;
+}
+
+/*
+ * The child of a fork inherits the mappings of its parent. The pages already
+ * mapped are shared along with the other pages of the process.
+ */
+static void duplicate_proc_mmaps(pcb_t *from, pcb_t *to)
+{
+	mmap_area_t *area, *new;
+
+	list_for_each_entry(area, &from->mmap_list, list) {
+		new = malloc(sizeof(mmap_area_t));
+		BUG_ON(!new);
+
+		*new = *area;
+
+		pagecache_get(new->file);
+
+		list_add_tail(&new->list, &to->mmap_list);
+	}
+}
+
+/*
+ * Drop the mappings of files of a process whose pages are released anyway.
+ */
+static void release_proc_mmaps(pcb_t *pcb)
+{
+	mmap_area_t *area, *tmp;
+
+	mutex_lock(&pcb->mmap_lock);
+
+	list_for_each_entry_safe(area, tmp, &pcb->mmap_list, list) {
+		list_del(&area->list);
+
+		pagecache_put(area->file);
+		free(area);
+	}
+
+	mutex_unlock(&pcb->mmap_lock);
+}
+
+#endif /* CONFIG_FILE_MMAP */
+
 /**
  *
  * Create a process from scratch, without fork'd. Typically used by the kernel
@@ -322,13 +756,8 @@ void create_root_process(void)
 
 	reset_process_stack(pcb);
 
-	/* We map the initial user space process stack here, and fork() will
-         * inherit from this mapping */
-
-	allocate_page(pcb, pcb->stack_top - (pcb->page_count * PAGE_SIZE), pcb->page_count, true);
-
-	LOG_DEBUG("Stack mapped at 0x%08x (size: %d bytes)\n",
-	    pcb->stack_top - (pcb->page_count * PAGE_SIZE), PROC_STACK_SIZE);
+	/* The pages of the user space process stack are mapped on demand
+	 * (see do_page_fault()), and fork() will inherit from this mapping */
 
 	/* First map the code in the user space so that
          * the initial code can run normally in user mode.
@@ -338,7 +767,7 @@ void create_root_process(void)
 
 	/* Start main thread <args> of the thread is not used in this context.
          */
-	pcb->main_thread = user_thread((th_fn_t) USER_SPACE_VADDR, "root_proc", NULL, pcb);
+	pcb->main_thread = user_thread((th_fn_t) USER_SPACE_VADDR, "root_proc", NULL, pcb, NULL);
 
 	/* init process? */
 	if (!root_process)
@@ -370,18 +799,25 @@ static void release_proc_pages(pcb_t *pcb)
 {
 	struct list_head *pos, *q;
 	page_list_t *cur;
+	unsigned long flags;
+
+	/* Some pages may still be shared with other processes */
+	flags = spin_lock_irqsave(&page_fault_lock);
 
 	list_for_each_safe(pos, q, &pcb->page_list) {
 		cur = list_entry(pos, page_list_t, list);
 
 		list_del(pos);
+		list_del(&cur->hash_list);
 
 		cur->page->refcount--;
 		if (!cur->page->refcount)
 			free_page(page_to_phys(cur->page));
 
-		free(cur);
+		kmem_cache_free(page_list_cache, cur);
 	}
+
+	spin_unlock_irqrestore(&page_fault_lock, flags);
 }
 
 /*
@@ -539,6 +975,150 @@ void post_setup_image(void *args_env)
 		__args[i] = ((addr_t) __args[i] - (addr_t) args_env) + args_base;
 }
 
+#ifdef CONFIG_EXEC_SHARED_TEXT
+
+/*
+ * A segment can be mapped from the cache of the executable if it is read-only,
+ * entirely stored in the file at the same offset within the page as in memory,
+ * and if it does not share a page with another segment.
+ */
+static bool shareable_segment(elf_img_info_t *elf_img_info, int i)
+{
+	addr_t start, end;
+	int j;
+
+	if ((i >= 32) || (elf_img_info->segments[i].p_type != PT_LOAD) || (elf_img_info->segments[i].p_flags & PF_W))
+		return false;
+
+	if (!elf_img_info->segments[i].p_filesz ||
+	    (elf_img_info->segments[i].p_filesz != elf_img_info->segments[i].p_memsz))
+		return false;
+
+	if ((elf_img_info->segments[i].p_vaddr ^ elf_img_info->segments[i].p_offset) & ~PAGE_MASK)
+		return false;
+
+	start = ALIGN_DOWN(elf_img_info->segments[i].p_vaddr, PAGE_SIZE);
+	end = ALIGN_UP(elf_img_info->segments[i].p_vaddr + elf_img_info->segments[i].p_memsz, PAGE_SIZE);
+
+	for (j = 0; j < elf_img_info->header->e_phnum; j++) {
+		if ((j == i) || (elf_img_info->segments[j].p_type != PT_LOAD))
+			continue;
+
+		if ((ALIGN_DOWN(elf_img_info->segments[j].p_vaddr, PAGE_SIZE) < end) &&
+		    (elf_img_info->segments[j].p_vaddr + elf_img_info->segments[j].p_memsz > start))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Map the pages of a read-only segment from the cache of the executable. The pages
+ * are shared by all processes running the same image, and an area holds a reference
+ * to the cache until the process terminates or replaces its image.
+ */
+static int map_shared_segment(pcb_t *pcb, struct mapped_file *file, addr_t vaddr, size_t size, unsigned long pgoff)
+{
+	mmap_area_t *area, *cur;
+	addr_t start, end;
+	unsigned long flags;
+	page_t *page;
+
+	start = ALIGN_DOWN(vaddr, PAGE_SIZE);
+	end = ALIGN_UP(vaddr + size, PAGE_SIZE);
+
+	area = malloc(sizeof(mmap_area_t));
+	if (!area)
+		return -1;
+
+	for (vaddr = start; vaddr < end; vaddr += PAGE_SIZE) {
+		/* The page is read from the file unless another process already did it */
+		page = pagecache_get_page(file, pgoff + ((vaddr - start) >> PAGE_SHIFT));
+		if (!page) {
+			flags = spin_lock_irqsave(&page_fault_lock);
+			release_proc_range(pcb, start, vaddr);
+			spin_unlock_irqrestore(&page_fault_lock, flags);
+
+			free(area);
+
+			return -1;
+		}
+
+		flags = spin_lock_irqsave(&page_fault_lock);
+
+		create_user_page_readonly(pcb->pgtable, vaddr, page_to_phys(page));
+
+		add_page_to_proc(pcb, page, vaddr);
+
+		spin_unlock_irqrestore(&page_fault_lock, flags);
+	}
+
+	area->start = start;
+	area->size = end - start;
+	area->pgoff = pgoff;
+	area->prot = PROT_READ;
+	area->file = file;
+
+	pagecache_get(file);
+
+	mutex_lock(&pcb->mmap_lock);
+
+	/* Keep the list sorted */
+	list_for_each_entry(cur, &pcb->mmap_list, list)
+		if (cur->start > start)
+			break;
+
+	list_add_tail(&area->list, &cur->list);
+
+	mutex_unlock(&pcb->mmap_lock);
+
+	return 0;
+}
+
+#endif /* CONFIG_EXEC_SHARED_TEXT */
+
+/*
+ * Map the pages of the loadable segments of a new image in the current process.
+ * The read-only segments are taken from the cache of the executable if possible;
+ * the other ones get private pages which are filled by load_process().
+ */
+static void map_image_segments(pcb_t *pcb, elf_img_info_t *elf_img_info)
+{
+	addr_t vaddr, end;
+	int i;
+#ifdef CONFIG_EXEC_SHARED_TEXT
+	struct mapped_file *file;
+
+	file = vfs_get_mapping(elf_img_info->fd);
+	if (file) {
+		for (i = 0; i < elf_img_info->header->e_phnum; i++)
+			if (shareable_segment(elf_img_info, i) &&
+			    !map_shared_segment(pcb, file, elf_img_info->segments[i].p_vaddr,
+						elf_img_info->segments[i].p_memsz,
+						elf_img_info->segments[i].p_offset >> PAGE_SHIFT))
+				elf_img_info->shared_segments |= 1 << i;
+
+		/* The next exec() of this image does not need to read it again */
+		if (elf_img_info->shared_segments)
+			pagecache_keep(file);
+
+		pagecache_put(file);
+	}
+#endif
+
+	for (i = 0; i < elf_img_info->header->e_phnum; i++) {
+		if ((elf_img_info->segments[i].p_type != PT_LOAD) || (elf_img_info->shared_segments & (1 << i)))
+			continue;
+
+		end = ALIGN_UP(elf_img_info->segments[i].p_vaddr + elf_img_info->segments[i].p_memsz, PAGE_SIZE);
+
+		/* A page may be shared by two segments */
+		for (vaddr = ALIGN_DOWN(elf_img_info->segments[i].p_vaddr, PAGE_SIZE); vaddr < end; vaddr += PAGE_SIZE)
+			if (!user_page_mapped(vaddr))
+				allocate_page(pcb, vaddr, 1, true);
+	}
+}
+
 /*
  * Set up the PCB fields related to the binary image to be loaded.
  */
@@ -574,15 +1154,17 @@ int setup_proc_image_replace(elf_img_info_t *elf_img_info, pcb_t *pcb, int argc,
          */
 	reset_root_pgtable(pcb->pgtable, false);
 
+#ifdef CONFIG_FILE_MMAP
+	release_proc_mmaps(pcb);
+#endif
+
 	/* Release all allocated pages for user space. */
 	release_proc_pages(pcb);
 
-	/* We re-init the user space process stack here, and fork() will inherit
-         * from this mapping */
-
-	allocate_page(pcb, pcb->stack_top - (pcb->page_count * PAGE_SIZE), pcb->page_count, true);
+	/* The pages of the user space process stack are mapped on demand
+	 * when they are touched for the first time (see do_page_fault()). */
 
-	LOG_DEBUG("stack mapped at 0x%08x (size: %d bytes)\n",
+	LOG_DEBUG("stack at 0x%08x (size: %d bytes)\n",
 	    pcb->stack_top - (pcb->page_count * PAGE_SIZE), PROC_STACK_SIZE);
 
 	/* Initialize the pc register */
@@ -597,7 +1179,7 @@ int setup_proc_image_replace(elf_img_info_t *elf_img_info, pcb_t *pcb, int argc,
 	pcb->page_count += elf_img_info->segment_page_count;
 
 	/* Map the elementary sections (text, data, bss) */
-	allocate_page(pcb, (uint32_t) elf_img_info->header->e_entry, elf_img_info->segment_page_count, true);
+	map_image_segments(pcb, elf_img_info);
 
 	LOG_DEBUG("entry point: 0x%08x\n", elf_img_info->header->e_entry);
 	LOG_DEBUG("page count: 0x%08x\n", pcb->page_count);
@@ -608,9 +1190,9 @@ int setup_proc_image_replace(elf_img_info_t *elf_img_info, pcb_t *pcb, int argc,
 	pcb->heap_pointer = pcb->heap_base;
 	pcb->page_count += page_count;
 
-	allocate_page(pcb, pcb->heap_base, page_count, true);
+	/* As for the stack, heap pages are mapped on demand. */
 
-	LOG_DEBUG("heap mapped at 0x%08x (size: %d bytes)\n", pcb->heap_base,
+	LOG_DEBUG("heap at 0x%08x (size: %d bytes)\n", pcb->heap_base,
 	    HEAP_SIZE);
 
 	/* arguments (& env) will be stored in one more page */
@@ -627,77 +1209,36 @@ int setup_proc_image_replace(elf_img_info_t *elf_img_info, pcb_t *pcb, int argc,
 	return 0;
 }
 
-/* load sections from each loadable segment into the process' virtual pages */
-void load_process(elf_img_info_t *elf_img_info)
+/*
+ * Load each loadable segment into the process' virtual pages.
+ * The segments are read straight from the file into the (already mapped) pages.
+ */
+int load_process(elf_img_info_t *elf_img_info)
 {
-	unsigned long section_start, section_end;
-	unsigned long segment_start, segment_end;
-	int i, j, k, l;
-	bool section_supported;
-	char section_base_name[16];
-	int section_name_dots;
-
-	/* Loading the different segments */
+	int i;
+
 	for (i = 0; i < elf_img_info->header->e_phnum; i++) {
 		if (elf_img_info->segments[i].p_type != PT_LOAD)
 			/* Skip unloadable segments */
 			continue;
 
-		segment_start = elf_img_info->segments[i].p_offset;
-		segment_end = segment_start + elf_img_info->segments[i].p_memsz;
-
-		/* Sections */
-		for (j = 0; j < elf_img_info->header->e_shnum; j++) {
-			section_start = elf_img_info->sections[j].sh_offset;
-			section_end = section_start + elf_img_info->sections[j].sh_size;
-
-			/* Verify if the section is part of this segment */
-			if ((section_start < segment_start) || (section_end > segment_end))
-				continue;
-
-			/* Copy only base name of the section */
-			l = 0;
-			section_name_dots = 0;
-			do {
-				section_base_name[l] = elf_img_info->section_names[j][l];
-				if (section_base_name[l] == '.' && section_name_dots++)
-					break; // Base name stops at second '.'
-			} while (section_base_name[l++] != '\0');
-
-			/* Terminate string correctly (replace second '.' if stopped by it) */
-			section_base_name[l] = '\0';
-
-			/* Not all sections are supported */
-			section_supported = false;
-			for (k = 0; k < SUPPORTED_SECTION_COUNT; k++) {
-				if (!strcmp(section_base_name, supported_section_names[k])) {
-					section_supported = true;
-					break;
-				}
-			}
-
-			if (!section_supported) {
-				LOG_DEBUG("Section %s not loaded: unsupported name\n",
-				    elf_img_info->section_names[j]);
-				continue;
-			}
+		if (elf_img_info->shared_segments & (1 << i))
+			/* Already mapped from the cache of the file */
+			continue;
 
-			/* Load this section into the process' virtual memory */
-			if (elf_img_info->sections[j].sh_type == SHT_NOBITS)
-				/* unless it were not stored in the file (.bss)
-                                 */
-				continue;
-
-			/* Real load of contents in the user space memory of the
-                         * process */
-			memcpy((void *) elf_img_info->sections[j].sh_addr,
-			       (void *) (elf_img_info->file_buffer + elf_img_info->sections[j].sh_offset),
-			       elf_img_info->sections[j].sh_size);
+		if (elf_load_segment(elf_img_info, i)) {
+			LOG_ERROR("%s: failed to load segment %d\n", __func__, i);
+			return -1;
 		}
 	}
 
 	/* Make sure all data are flushed for future context switch. */
 	flush_dcache_all();
+
+	/* The new code must not be fetched from stale instruction cache lines */
+	invalidate_icache_all();
+
+	return 0;
 }
 
 int do_execve(const char *filename, char **argv, char **envp)
@@ -726,26 +1267,26 @@ int do_execve(const char *filename, char **argv, char **envp)
 	/* Keep the filename as process name */
 	strcpy(pcb->name, filename);
 
-	/* ELF parsing */
-	elf_img_info.file_buffer = elf_load_buffer(filename);
-	if (elf_img_info.file_buffer == NULL) {
+	/* ELF parsing (headers only) */
+	if (elf_open(filename, &elf_img_info)) {
 		local_irq_restore(flags);
 		set_errno(ENOENT);
 
 		return -1;
 	}
 
-	elf_load_sections(&elf_img_info);
-	elf_load_segments(&elf_img_info);
-
 	/*
          * If it is not the root process and the initial thread,
          * replace the binary image of the process. - Prepare the page frames
          * and mapped then in the virtual address space.
          */
 	ret = setup_proc_image_replace(&elf_img_info, pcb, argc, argv, envp);
-	if (ret < 0)
+	if (ret < 0) {
+		elf_clean_image(&elf_img_info);
+		local_irq_restore(flags);
+
 		return ret;
+	}
 
 	/* process execution */
 #warning do_exec() must be completed...
@@ -753,18 +1294,24 @@ int do_execve(const char *filename, char **argv, char **envp)
          * keep all, end of process will terminate fds */
 
 	/* Load the contents of ELF into the virtual memory space */
-	load_process(&elf_img_info);
+	ret = load_process(&elf_img_info);
 
-	/* Release the kernel buffer used to store the ELF binary image */
+	/* Close the ELF file and release its headers */
 	elf_clean_image(&elf_img_info);
 
+	/* The previous image is gone, there is nothing to return to. */
+	if (ret < 0) {
+		local_irq_restore(flags);
+		do_exit(-1);
+	}
+
 	/* Now, we need to create the main user thread associated to this binary
          * image. */
 	/* start main thread */
 	start_routine = (th_fn_t) pcb->bin_image_entry;
 
 	/* We start the new thread */
-	pcb->main_thread = user_thread(start_routine, pcb->name, (void *) arch_get_args_base(), pcb);
+	pcb->main_thread = user_thread(start_routine, pcb->name, (void *) arch_get_args_base(), pcb, NULL);
 
 	/* Transfer the waiting thread if any */
 
@@ -856,8 +1403,15 @@ int do_fork(void)
 	/* Duplicate the elements of the parent process into the child */
 	newp = duplicate_process(parent);
 
-	/* Copy the user space area of the parent process */
+	/* The user space area of the parent process is shared with the child
+	 * (copy-on-write). */
+	spin_lock(&page_fault_lock);
 	duplicate_user_space(parent, newp);
+	spin_unlock(&page_fault_lock);
+
+#ifdef CONFIG_FILE_MMAP
+	duplicate_proc_mmaps(parent, newp);
+#endif
 
 	/* At the moment, we spawn the main_thread only in the child. In the
          * future, we will have to create a thread for each existing threads in
@@ -865,7 +1419,7 @@ int do_fork(void)
          */
 	sprintf(newp->name, "%s_child_%d", parent->name, newp->pid);
 
-	newp->main_thread = user_thread(NULL, newp->name, (void *) arch_get_args_base(), newp);
+	newp->main_thread = user_thread(NULL, newp->name, (void *) arch_get_args_base(), newp, NULL);
 
 	/* Copy the kernel stack of the main thread */
 	memcpy((void *) get_kernel_stack_top(newp->main_thread->stack_slotID) - THREAD_STACK_SIZE,
@@ -936,6 +1490,10 @@ void do_exit(int exit_status)
 	for (i = 0; i < FD_MAX; i++)
 		do_close(i);
 
+#ifdef CONFIG_FILE_MMAP
+	release_proc_mmaps(pcb);
+#endif
+
 	local_irq_disable();
 
 	/* Now, set the process state to zombie, before definitively die... */
@@ -1084,11 +1642,12 @@ int do_waitpid(int pid, uint32_t *wstatus, uint32_t options)
 	return pid;
 }
 
-/* @brief Currently this function does not allocate pages.
- *		page are already allocated. this function will only
- *		increase the heap_pointer and make sure it does not
- *		overflow the heap. If there is no memory left it will
- *		set the errno to ENONMEM and return -1;
+/* @brief This function does not allocate pages since the heap pages are
+ *		mapped on demand. It will increase the heap_pointer and make
+ *		sure it does not overflow the heap. When the heap shrinks, the
+ *		pages lying entirely above the new program break are given back.
+ *		If there is no memory left it will set the errno to ENONMEM and
+ *		return -1;
  * @param increment the amount of data to increase < decrease. If the value is 0
  *		function will return the current position of the program break
  *(end of heap);
@@ -1102,6 +1661,7 @@ int do_sbrk(int increment)
 	int ret_pointer;
 	int req_sz = 0;
 	int cur_sz;
+	unsigned long flags;
 
 	if (!pcb) {
 		/* case there is no pcb context */
@@ -1121,34 +1681,13 @@ int do_sbrk(int increment)
 		return -1;
 	}
 
-#if 0
-	/* This is the the code allocation will be done automatically*/
-	/* Case of the first page */
-	if (!cur_sz) {
-		if (req_sz) {
-			pcb->page_count += 1;
-			allocate_page(pcb, pcb->heap_base, page_count);
-			pcb->heap_pointer = pcb->heap_base + PAGE_SIZE;
-		} 
-		return -1;
-	}
-
-	int i;
-	int page_start;
-	req_nbr_pages = (int) (req_sz / PAGE_SIZE) - (int) (cur_sz / PAGE_SIZE);
-	/* Test if we need to allocate/free one more page on heap*/
-	pcb->page_count += req_nbr_pages;
-
-	if (req_nbr_pages < 0) {
-		page_start = pcb->heap_pointer / PAGE_SIZE + req_nbr_pages;
-		for (i = 0; i > req_nbr_pages; i++) {
-			release_page((page_start + i) * PAGE_SIZE);
-		}
-	} else if (req_nbr_pages > 0) {
-		page_start = pcb->heap_pointer / PAGE_SIZE + 1;
-		allocate_page(pcb, () (page_start * PAGE_SIZE), req_nbr_pages);
+	/* Give back the pages which are no longer part of the heap */
+	if (increment < 0) {
+		flags = spin_lock_irqsave(&page_fault_lock);
+		release_proc_range(pcb, ALIGN_UP(pcb->heap_pointer + increment, PAGE_SIZE),
+				   ALIGN_UP(pcb->heap_pointer, PAGE_SIZE));
+		spin_unlock_irqrestore(&page_fault_lock, flags);
 	}
-#endif
 
 	pcb->heap_pointer = pcb->heap_pointer + increment;
 	return ret_pointer;
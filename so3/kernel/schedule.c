@@ -28,110 +28,437 @@
 #include <softirq.h>
 #include <mutex.h>
 #include <timer.h>
+#include <string.h>
+#include <common.h>
 
 #include <device/irq.h>
 
 #include <asm/mmu.h>
 
-static struct list_head readyThreads;
+/* One run queue per CPU */
+static struct runqueue runqueues[CONFIG_NR_CPUS];
 static struct list_head zombieThreads;
 
 /* Global list of process */
 struct list_head proc_list;
-struct tcb *tcb_idle = NULL;
+struct tcb *tcb_idle[CONFIG_NR_CPUS];
 
-tcb_t *current_thread;
+tcb_t *current_thread[CONFIG_NR_CPUS];
 static sched_policy_t sched_policy;
 
+/*
+ * Protects the thread states and the zombie list.
+ * When both are needed, schedule_lock is acquired before a run queue lock.
+ */
 static spinlock_t schedule_lock;
 
 volatile u64 jiffies = 0ull;
 volatile u64 jiffies_ref = 0ull;
 
-static volatile bool __sched_preempt = false;
+/* Preemption can be disabled on each CPU (during timer processing for instance) */
+static volatile bool __sched_preempt[CONFIG_NR_CPUS];
+
+static timer_t schedule_timer[CONFIG_NR_CPUS];
+
+#ifdef CONFIG_SCHED_SMP
+/* CPUs which entered the scheduler */
+static volatile unsigned long sched_online_mask = 1ul;
+#endif
+
+#define this_rq() (&runqueues[sched_cpu()])
 
-static timer_t schedule_timer;
+#ifdef CONFIG_SCHED_SMP
+#define thread_cpu(tcb) ((tcb)->cpu)
+#else
+#define thread_cpu(tcb) 0
+#endif
 
 /*
  * The following code (normally disabled) is used for debugging purposes...
  */
 #if 0
 inline bool check_consistency_ready(void) {
-	queue_thread_t *cur;
 	tcb_t *_tcb;
-	struct list_head *pos;
-
-	list_for_each(pos, &readyThreads)
-	{
-		cur = list_entry(pos, queue_thread_t, list);
-		_tcb = cur->tcb;
-		if (_tcb->state != THREAD_STATE_READY) {
-			printk("### ERROR %d on tid %d with state: %s ###\n", __LINE__, _tcb->tid, print_state(_tcb));
-			return false;
+	int prio;
+
+	for (prio = 0; prio < SCHED_PRIO_LEVELS; prio++) {
+		list_for_each_entry(_tcb, &this_rq()->queue[prio], sched_list)
+		{
+			if (_tcb->state != THREAD_STATE_READY) {
+				printk("### ERROR %d on tid %d with state: %s ###\n", __LINE__, _tcb->tid, print_state(_tcb));
+				return false;
+			}
 		}
 	}
 	return true;
 }
 #endif /* 0 */
 
+/*
+ * Run queue management
+ *
+ * All functions below must be called with the lock of the run queue held.
+ */
+
+static inline bool rq_test_prio(struct runqueue *rq, int prio)
+{
+	return (rq->bitmap[prio / BITS_PER_LONG] & (1UL << (prio % BITS_PER_LONG))) != 0;
+}
+
+static inline void rq_set_prio(struct runqueue *rq, int prio)
+{
+	rq->bitmap[prio / BITS_PER_LONG] |= 1UL << (prio % BITS_PER_LONG);
+}
+
+static inline void rq_clear_prio(struct runqueue *rq, int prio)
+{
+	rq->bitmap[prio / BITS_PER_LONG] &= ~(1UL << (prio % BITS_PER_LONG));
+}
+
+/*
+ * Return the highest priority level strictly below @limit having at least one
+ * ready thread, or -1 if there is none.
+ */
+static inline int rq_highest_prio_below(struct runqueue *rq, int limit)
+{
+	unsigned long word;
+	int i;
+
+	if (limit <= 0)
+		return -1;
+
+	/* Highest candidate level */
+	limit--;
+
+	i = limit / BITS_PER_LONG;
+	word = rq->bitmap[i] & (~0ul >> (BITS_PER_LONG - 1 - (limit % BITS_PER_LONG)));
+
+	while (!word) {
+		if (--i < 0)
+			return -1;
+		word = rq->bitmap[i];
+	}
+
+	return i * BITS_PER_LONG + BITS_PER_LONG - 1 - __builtin_clzl(word);
+}
+
+/*
+ * Priority level (queue index) of a thread according to the scheduling policy.
+ */
+static inline int rq_prio(tcb_t *tcb)
+{
+#if defined(CONFIG_SCHED_PRIO_DYN)
+	return min_t(int, tcb->current_prio, SCHED_PRIO_LEVELS - 1);
+#elif defined(CONFIG_SCHED_PRIO)
+	return min_t(int, thread_prio(tcb), SCHED_PRIO_LEVELS - 1);
+#else
+	/* Round-Robin uses a single queue */
+	return 0;
+#endif
+}
+
+static void rq_enqueue(struct runqueue *rq, tcb_t *tcb)
+{
+	int prio = rq_prio(tcb);
+
+	list_add_tail(&tcb->sched_list, &rq->queue[prio]);
+	rq_set_prio(rq, prio);
+
+	rq->nr_ready++;
+}
+
+static void rq_dequeue(struct runqueue *rq, tcb_t *tcb)
+{
+	struct list_head *next = tcb->sched_list.next;
+
+	/* The node is left empty so that a dequeued thread can be recognised */
+	list_del_init(&tcb->sched_list);
+
+	/* If we were the last one of our level, the neighbour is now an empty queue head.
+	 * Checking this way does not require to know in which level the thread is,
+	 * which may change with the aging of PRIO_DYN.
+	 */
+	if ((next >= &rq->queue[0]) && (next < &rq->queue[SCHED_PRIO_LEVELS]) && list_empty(next))
+		rq_clear_prio(rq, next - &rq->queue[0]);
+
+	rq->nr_ready--;
+}
+
+static void rq_init(struct runqueue *rq)
+{
+	int i;
+
+	spin_lock_init(&rq->lock);
+
+	for (i = 0; i < SCHED_PRIO_LEVELS; i++)
+		INIT_LIST_HEAD(&rq->queue[i]);
+
+	memset(rq->bitmap, 0, sizeof(rq->bitmap));
+	rq->nr_ready = 0;
+
+#ifdef CONFIG_SCHED_PRIO_DYN
+	rq->last_aging = 0ull;
+#endif
+}
+
+/*
+ * Check if a ready thread can be picked up by a CPU.
+ */
+static inline bool thread_eligible(tcb_t *tcb, int cpu)
+{
+#ifdef CONFIG_SCHED_RR
+	if ((tcb->pcb != NULL) && (tcb->pcb->state != PROC_STATE_READY) && (tcb->pcb->state != PROC_STATE_RUNNING))
+		return false;
+#endif
+
+#ifdef CONFIG_SCHED_SMP
+	if (!(tcb->cpu_affinity & (1ul << cpu)))
+		return false;
+
+	/* Still being switched out by another CPU */
+	if (tcb->on_cpu && (tcb->cpu != cpu))
+		return false;
+#endif
+	return true;
+}
+
+/*
+ * Dequeue the first thread eligible on @cpu, starting from the highest
+ * priority level down to @min_prio. Return NULL if there is none.
+ */
+static tcb_t *rq_pick(struct runqueue *rq, int cpu, int min_prio)
+{
+	tcb_t *tcb;
+	int prio = SCHED_PRIO_LEVELS;
+
+	while ((prio = rq_highest_prio_below(rq, prio)) >= min_prio) {
+		list_for_each_entry(tcb, &rq->queue[prio], sched_list) {
+			if (!thread_eligible(tcb, cpu))
+				continue;
+
+			rq_dequeue(rq, tcb);
+
+#ifdef CONFIG_SCHED_PRIO_DYN
+			/* The queue may have been aged since the thread became ready */
+			tcb->current_prio = prio;
+#endif
+			return tcb;
+		}
+	}
+
+	return NULL;
+}
+
+#ifdef CONFIG_SCHED_SMP
+
+static inline bool cpu_is_idle(int cpu)
+{
+	return (current_thread[cpu] == tcb_idle[cpu]) && !runqueues[cpu].nr_ready;
+}
+
+/*
+ * Select the run queue of a thread being made ready.
+ * A thread which is still running (or being switched out) stays on its CPU.
+ * Otherwise, an idle CPU is preferred, starting with the last CPU the thread
+ * ran on, and the least loaded CPU is taken if none is idle.
+ */
+static int select_cpu(tcb_t *tcb)
+{
+	int cpu, best = -1;
+	unsigned long allowed = tcb->cpu_affinity & sched_online_mask;
+
+	if (tcb->on_cpu || !allowed)
+		return tcb->cpu;
+
+	if ((allowed & (1ul << tcb->cpu)) && cpu_is_idle(tcb->cpu))
+		return tcb->cpu;
+
+	for (cpu = 0; cpu < CONFIG_NR_CPUS; cpu++) {
+		if (!(allowed & (1ul << cpu)))
+			continue;
+
+		if (cpu_is_idle(cpu))
+			return cpu;
+
+		if ((best < 0) || (runqueues[cpu].nr_ready < runqueues[best].nr_ready))
+			best = cpu;
+	}
+
+	return best;
+}
+
+/*
+ * Check if a thread queued on a remote CPU requires this CPU to reschedule.
+ */
+static bool need_resched_cpu(tcb_t *tcb, int cpu)
+{
+	tcb_t *curr = current_thread[cpu];
+
+	/* The CPU is switching the thread out or is going idle */
+	if (tcb->on_cpu || (curr == NULL) || (curr == tcb_idle[cpu]))
+		return true;
+
+#if defined(CONFIG_SCHED_PRIO) || defined(CONFIG_SCHED_PRIO_DYN)
+	return rq_prio(tcb) > rq_prio(curr);
+#else
+	return false;
+#endif
+}
+
+/*
+ * Work stealing: a CPU without ready thread takes the highest priority
+ * eligible thread of the busiest run queue. Only one run queue lock is
+ * held at a time.
+ */
+static tcb_t *steal_thread(void)
+{
+	struct runqueue *rq;
+	tcb_t *tcb;
+	int cpu, victim = -1;
+	int self = smp_processor_id();
+
+	for (cpu = 0; cpu < CONFIG_NR_CPUS; cpu++) {
+		if ((cpu == self) || !runqueues[cpu].nr_ready)
+			continue;
+
+		if ((victim < 0) || (runqueues[cpu].nr_ready > runqueues[victim].nr_ready))
+			victim = cpu;
+	}
+
+	if (victim < 0)
+		return NULL;
+
+	rq = &runqueues[victim];
+
+	spin_lock(&rq->lock);
+
+	tcb = rq_pick(rq, self, 0);
+
+	/* Changed with the run queue locked (see rq_lock_thread()) */
+	if (tcb)
+		tcb->cpu = self;
+
+	spin_unlock(&rq->lock);
+
+	return tcb;
+}
+
+#endif /* CONFIG_SCHED_SMP */
+
+/*
+ * Lock the run queue of the CPU a ready thread belongs to. The CPU of a queued
+ * thread is only changed by steal_thread(), with its run queue locked.
+ */
+static struct runqueue *rq_lock_thread(tcb_t *tcb)
+{
+	struct runqueue *rq;
+
+	for (;;) {
+		rq = &runqueues[thread_cpu(tcb)];
+
+		spin_lock(&rq->lock);
+
+		if (rq == &runqueues[thread_cpu(tcb)])
+			return rq;
+
+		/* Stolen in the meanwhile */
+		spin_unlock(&rq->lock);
+	}
+}
+
 void preempt_disable(void)
 {
 	unsigned long flags;
 
-	flags = spin_lock_irqsave(&schedule_lock);
-	__sched_preempt = false;
-	spin_unlock_irqrestore(&schedule_lock, flags);
+	flags = local_irq_save();
+	__sched_preempt[sched_cpu()] = false;
+	local_irq_restore(flags);
 }
 
 void preempt_enable(void)
 {
 	unsigned long flags;
 
-	flags = spin_lock_irqsave(&schedule_lock);
-	__sched_preempt = true;
-	spin_unlock_irqrestore(&schedule_lock, flags);
+	flags = local_irq_save();
+	__sched_preempt[sched_cpu()] = true;
+	local_irq_restore(flags);
 }
 
+#if defined(CONFIG_NO_HZ) && defined(CONFIG_SCHED_FREQ_PREEMPTION)
 /*
- * Insert a new thread in the ready list.
+ * Without periodic tick, the time slice of a CPU is only armed when a thread
+ * is waiting in its run queue. An idle CPU arms it when it reschedules.
  */
-void ready(tcb_t *tcb)
+static void sched_arm_slice(int cpu)
 {
-	unsigned long flags;
-	queue_thread_t *cur;
-	bool already_locked;
+	if ((current_thread[cpu] == NULL) || (current_thread[cpu] == tcb_idle[cpu]))
+		return;
 
-	/* We check if we are in a call path where the lock was already acquired.
-	 * These are rare cases where consistency check is performed before calling
-	 * ready() like waking up threads (see wake_up()).
-	 */
-	already_locked = (spin_is_locked(&schedule_lock) ? true : false);
+	if (!active_timer(&schedule_timer[cpu]))
+		set_timer(&schedule_timer[cpu], NOW() + MILLISECS(SCHEDULE_FREQ));
+}
+#endif
 
-	if (!already_locked)
-		flags = spin_lock_irqsave(&schedule_lock);
+/*
+ * Insert a thread in a run queue and notify the CPU owning it if needed.
+ * The schedule_lock must be held.
+ */
+static void __ready(tcb_t *tcb)
+{
+	struct runqueue *rq;
+	int cpu = sched_cpu();
 
-	tcb->state = THREAD_STATE_READY;
+#ifdef CONFIG_SCHED_SMP
+	/* Already made ready by another CPU */
+	if (tcb->state == THREAD_STATE_READY)
+		return;
 
-	cur = (queue_thread_t *) malloc(sizeof(queue_thread_t));
-	BUG_ON(cur == NULL);
+	/* The thread runs on another CPU and has not reached waiting() yet. */
+	if ((tcb->state == THREAD_STATE_RUNNING) && (tcb != current())) {
+		tcb->wakeup_pending = true;
+		return;
+	}
 
-#ifdef CONFIG_SCHED_PRIO_DYN
+	cpu = select_cpu(tcb);
+	tcb->cpu = cpu;
+#endif
 
-	/* Reset priority increment timer */
-	tcb->last_prio_inc_time = NOW();
+	tcb->state = THREAD_STATE_READY;
+
+#ifdef CONFIG_SCHED_PRIO_DYN
 
 	if (tcb->current_prio > tcb->prio)
 		tcb->current_prio--;
 
 #endif /* CONFIG_SCHED_PRIO_DYN */
 
-	cur->tcb = tcb;
+	rq = &runqueues[cpu];
 
-	/* Insert the thread at the end of the list */
-	list_add_tail(&cur->list, &readyThreads);
+	/* Insert the thread at the end of its priority queue */
+	spin_lock(&rq->lock);
+	rq_enqueue(rq, tcb);
+	spin_unlock(&rq->lock);
 
-	if (!already_locked)
-		spin_unlock_irqrestore(&schedule_lock, flags);
+#if defined(CONFIG_NO_HZ) && defined(CONFIG_SCHED_FREQ_PREEMPTION)
+	sched_arm_slice(cpu);
+#endif
+
+#ifdef CONFIG_SCHED_SMP
+	if ((cpu != smp_processor_id()) && need_resched_cpu(tcb, cpu))
+		cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
+#endif
+}
+
+/*
+ * Insert a new thread in the ready list.
+ */
+void ready(tcb_t *tcb)
+{
+	unsigned long flags;
+
+	flags = spin_lock_irqsave(&schedule_lock);
+	__ready(tcb);
+	spin_unlock_irqrestore(&schedule_lock, flags);
 }
 
 /*
@@ -142,40 +469,61 @@ void waiting(void)
 {
 	unsigned long flags;
 
-	flags = local_irq_save();
+	flags = spin_lock_irqsave(&schedule_lock);
 
 	ASSERT(current()->state == THREAD_STATE_RUNNING);
 
+#ifdef CONFIG_SCHED_SMP
+	/* Woken up in the meanwhile by another CPU */
+	if (current()->wakeup_pending) {
+		current()->wakeup_pending = false;
+		spin_unlock_irqrestore(&schedule_lock, flags);
+		return;
+	}
+#endif
+
 	current()->state = THREAD_STATE_WAITING;
 
+	spin_unlock(&schedule_lock);
+
 	schedule();
 
 	local_irq_restore(flags);
 }
 
+/*
+ * Forget a wake-up which reached the current thread while it was running, once the
+ * event it waited for has been consumed or given up (timeout), so that its next waiting()
+ * really suspends it. It must be called once the thread has left the wait queue.
+ */
+void cancel_wakeup(void)
+{
+#ifdef CONFIG_SCHED_SMP
+	unsigned long flags;
+
+	flags = spin_lock_irqsave(&schedule_lock);
+	current()->wakeup_pending = false;
+	spin_unlock_irqrestore(&schedule_lock, flags);
+#endif
+}
+
 /*
  * Put a thread into the zombie queue.
  */
 void zombie(void)
 {
-	queue_thread_t *cur;
 	unsigned long flags;
 
 	ASSERT(current()->state == THREAD_STATE_RUNNING);
 
-	flags = local_irq_save();
+	flags = spin_lock_irqsave(&schedule_lock);
 
 	current()->state = THREAD_STATE_ZOMBIE;
 
-	cur = (queue_thread_t *) malloc(sizeof(queue_thread_t));
-	BUG_ON(cur == NULL);
-
-	cur->tcb = current();
-
 	/* Insert the thread at the end of the list */
-	list_add_tail(&cur->list, &zombieThreads);
+	list_add_tail(&current()->sched_list, &zombieThreads);
 
-	local_irq_restore(flags);
+	spin_unlock_irqrestore(&schedule_lock, flags);
 
 	schedule();
 }
@@ -185,31 +533,14 @@ void zombie(void)
  */
 void remove_zombie(struct tcb *tcb)
 {
-	queue_thread_t *cur;
-	tcb_t *_tcb;
-	struct list_head *pos, *q;
-
 	ASSERT(local_irq_is_disabled());
 
 	ASSERT(tcb != NULL);
 	ASSERT(tcb->state == THREAD_STATE_ZOMBIE);
 
-	list_for_each_safe(pos, q, &zombieThreads) {
-		cur = list_entry(pos, queue_thread_t, list);
-
-		_tcb = cur->tcb;
-
-		if (tcb == _tcb) {
-			list_del(pos);
-
-			free(cur);
-			return;
-		}
-	}
-
-	printk("%s: zombie thread %d not found.\n", __func__, tcb->tid);
-
-	BUG();
+	spin_lock(&schedule_lock);
+	list_del(&tcb->sched_list);
+	spin_unlock(&schedule_lock);
 }
 
 /*
@@ -223,7 +554,11 @@ void wake_up(struct tcb *tcb)
 	flags = spin_lock_irqsave(&schedule_lock);
 
 	if (tcb->state == THREAD_STATE_WAITING)
-		ready(tcb);
+		__ready(tcb);
+#ifdef CONFIG_SCHED_SMP
+	else if ((tcb->state == THREAD_STATE_RUNNING) && (tcb != current()))
+		tcb->wakeup_pending = true;
+#endif
 
 	spin_unlock_irqrestore(&schedule_lock, flags);
 }
@@ -233,9 +568,7 @@ void wake_up(struct tcb *tcb)
  */
 void remove_ready(struct tcb *tcb)
 {
-	queue_thread_t *cur;
-	tcb_t *_tcb;
-	struct list_head *pos, *q;
+	struct runqueue *rq;
 
 	ASSERT(local_irq_is_disabled());
 	ASSERT(tcb != NULL);
@@ -244,164 +577,144 @@ void remove_ready(struct tcb *tcb)
 
 	spin_lock(&schedule_lock);
 
-	list_for_each_safe(pos, q, &readyThreads) {
-		cur = list_entry(pos, queue_thread_t, list);
-		_tcb = cur->tcb;
+	/* A ready thread is queued on the run queue of its CPU */
+	rq = rq_lock_thread(tcb);
 
-		if (tcb == _tcb) {
-			list_del(pos);
+	/* It may have been picked up by a CPU and not be running yet */
+	if (!list_empty(&tcb->sched_list))
+		rq_dequeue(rq, tcb);
 
-			free(cur);
+	spin_unlock(&rq->lock);
 
-			spin_unlock(&schedule_lock);
-			return;
-		}
-	}
-
-	printk("%s: ready thread %d not found.\n", __func__, tcb->tid);
-
-	BUG();
+	spin_unlock(&schedule_lock);
 }
 
-#ifdef CONFIG_SCHED_PRIO_DYN
+#ifdef CONFIG_SCHED_PRIO
 /*
- * Pick up the next ready thread to be scheduled according
- * to the scheduling policy. Increment priority if the thread is in the ready
- * list for too long.
- * IRQs are off.
+ * Set the priority inherited by a thread through a mutex (see mutex.c).
+ * A ready thread is moved to the queue of its new priority.
  */
-static tcb_t *next_thread(void)
+void sched_set_inherited_prio(struct tcb *tcb, uint32_t prio)
 {
-	tcb_t *tcb, *__current;
-	queue_thread_t *entry;
-	struct list_head *pos, *q;
-	u64 current_time;
+	struct runqueue *rq;
+	unsigned long flags;
 
-	tcb_t *tcb_to_schedule = NULL;
-	__current = current();
+	flags = spin_lock_irqsave(&schedule_lock);
 
-	/* Check if the current thread is still in the running state, otherwise we skip it */
-	if ((__current != NULL) && (__current->state != THREAD_STATE_RUNNING))
-		__current = NULL;
+	if (tcb->state != THREAD_STATE_READY) {
+		tcb->inherited_prio = prio;
+		spin_unlock_irqrestore(&schedule_lock, flags);
+		return;
+	}
 
-	ASSERT(local_irq_is_disabled());
+	rq = rq_lock_thread(tcb);
 
-	spin_lock(&schedule_lock);
+	/* Not queued anymore if a CPU has just picked it up */
+	if (list_empty(&tcb->sched_list)) {
+		tcb->inherited_prio = prio;
+	} else {
+		rq_dequeue(rq, tcb);
+		tcb->inherited_prio = prio;
+		rq_enqueue(rq, tcb);
+	}
 
-	/* Increase priority for every ready threads left */
-	list_for_each_safe(pos, q, &readyThreads) {
-		entry = list_entry(pos, queue_thread_t, list);
-		tcb = entry->tcb;
+	spin_unlock(&rq->lock);
 
-		current_time = NOW();
-		if (tcb->last_prio_inc_time + MILLISECS(PRIO_MAX_DELAY) < current_time) {
-			if (tcb->current_prio < 99)
-				tcb->current_prio++;
+#ifdef CONFIG_SCHED_SMP
+	if ((thread_cpu(tcb) != smp_processor_id()) && need_resched_cpu(tcb, thread_cpu(tcb)))
+		cpu_raise_softirq(thread_cpu(tcb), SCHEDULE_SOFTIRQ);
+#endif
 
-			tcb->last_prio_inc_time = current_time;
-		}
-	}
+	spin_unlock_irqrestore(&schedule_lock, flags);
+}
 
-	tcb_to_schedule = __current;
-	list_for_each_safe(pos, q, &readyThreads) {
-		entry = list_entry(pos, queue_thread_t, list);
-		tcb = entry->tcb;
+#endif /* CONFIG_SCHED_PRIO */
 
-		/* First, compare with the running tcb if any... */
-		if (!tcb_to_schedule)
-			tcb_to_schedule = tcb;
-		else if (tcb->current_prio > tcb_to_schedule->current_prio)
-			tcb_to_schedule = tcb;
-	}
+#ifdef CONFIG_SCHED_PRIO_DYN
+/*
+ * Increase the priority of threads which are in the ready list for too long.
+ * Every PRIO_MAX_DELAY ms, each priority queue is moved one level up, as a whole,
+ * from the top to the bottom so that a queue is moved only once.
+ */
+static void rq_age(struct runqueue *rq)
+{
+	u64 current_time = NOW();
+	int prio;
 
-	spin_unlock(&schedule_lock);
+	if (rq->last_aging + MILLISECS(PRIO_MAX_DELAY) >= current_time)
+		return;
+
+	rq->last_aging = current_time;
 
-	if (tcb_to_schedule != __current)
-		remove_ready(tcb_to_schedule);
+	for (prio = SCHED_PRIO_LEVELS - 2; prio >= 0; prio--) {
+		if (!rq_test_prio(rq, prio))
+			continue;
 
-	return tcb_to_schedule;
+		list_splice_tail_init(&rq->queue[prio], &rq->queue[prio + 1]);
+
+		rq_clear_prio(rq, prio);
+		rq_set_prio(rq, prio + 1);
+	}
 }
+
 #endif /* CONFIG_SCHED_PRIO_DYN */
 
-#ifdef CONFIG_SCHED_PRIO
 /*
  * Pick up the next ready thread to be scheduled according
- * to the scheduling policy.
+ * to the scheduling policy. With priorities, the running thread is kept
+ * unless a thread of higher priority is ready.
  * IRQs are off.
  */
 static tcb_t *next_thread(void)
 {
+	struct runqueue *rq = this_rq();
 	tcb_t *tcb, *__current;
-	queue_thread_t *entry;
-	struct list_head *pos, *q;
 
-	tcb_t *tcb_to_schedule = NULL;
 	__current = current();
 
 	/* Check if the current thread is still in the running state, otherwise we skip it */
 	if ((__current != NULL) && (__current->state != THREAD_STATE_RUNNING))
 		__current = NULL;
 
-	ASSERT(local_irq_is_disabled());
-
-	spin_lock(&schedule_lock);
-
-	tcb_to_schedule = __current;
-	list_for_each_safe(pos, q, &readyThreads) {
-		entry = list_entry(pos, queue_thread_t, list);
-		tcb = entry->tcb;
-
-		/* First, compare with the running tcb if any... */
-		if (!tcb_to_schedule)
-			tcb_to_schedule = tcb;
-		else if (tcb->prio > tcb_to_schedule->prio)
-			tcb_to_schedule = tcb;
-	}
-
-	spin_unlock(&schedule_lock);
-
-	if (tcb_to_schedule != __current)
-		remove_ready(tcb_to_schedule);
+#ifdef CONFIG_SCHED_SMP
+	/* The current thread is no longer allowed on this CPU (see thread_set_affinity()) */
+	if ((__current != NULL) && !(__current->cpu_affinity & (1ul << smp_processor_id())))
+		__current = NULL;
+#endif
 
-	return tcb_to_schedule;
-}
-#endif /* CONFIG_SCHED_PRIO */
+	ASSERT(local_irq_is_disabled());
 
-#ifdef CONFIG_SCHED_RR
-/*
- * Pick up the next ready thread to be scheduled according
- * to the scheduling policy.
- * IRQs are off.
- */
-static tcb_t *next_thread(void)
-{
-	tcb_t *tcb;
-	queue_thread_t *entry;
-	struct list_head *pos, *q;
+	spin_lock(&rq->lock);
 
-	ASSERT(local_irq_is_disabled());
+#if defined(CONFIG_SCHED_PRIO) || defined(CONFIG_SCHED_PRIO_DYN)
 
-	spin_lock(&schedule_lock);
+#ifdef CONFIG_SCHED_PRIO_DYN
+	rq_age(rq);
+#endif
+	/* Compare with the running tcb if any... */
+	tcb = rq_pick(rq, sched_cpu(), (__current ? rq_prio(__current) + 1 : 0));
 
-	list_for_each_safe(pos, q, &readyThreads) {
-		entry = list_entry(pos, queue_thread_t, list);
-		tcb = entry->tcb;
+#else /* CONFIG_SCHED_RR */
 
-		if ((tcb->pcb == NULL) || (tcb->pcb->state == PROC_STATE_READY) || (tcb->pcb->state == PROC_STATE_RUNNING)) {
-			spin_unlock(&schedule_lock);
+	/* All threads are in the same queue; the first eligible one is normally the head. */
+	tcb = rq_pick(rq, sched_cpu(), 0);
 
-			/* Warning ! entry will be freed in remove_ready() */
-			remove_ready(tcb);
+#endif
 
-			return tcb;
-		}
-	}
+	spin_unlock(&rq->lock);
 
-	spin_unlock(&schedule_lock);
+#ifdef CONFIG_SCHED_SMP
+	/* Nothing to run on this CPU; take some work from a busy CPU */
+	if ((tcb == NULL) && (__current == NULL))
+		tcb = steal_thread();
+#endif
 
-	return NULL;
+#if defined(CONFIG_SCHED_PRIO) || defined(CONFIG_SCHED_PRIO_DYN)
+	return (tcb ? tcb : __current);
+#else
+	return tcb;
+#endif
 }
-#endif /* CONFIG_SCHED_RR */
 
 /*
  * Main scheduling function.
@@ -410,21 +723,27 @@ void schedule(void)
 {
 	tcb_t *prev, *next;
 	unsigned long flags;
-	static volatile bool __in_scheduling = false;
+	int cpu;
+	static volatile bool __in_scheduling[CONFIG_NR_CPUS];
 
 	if (unlikely(boot_stage < BOOT_STAGE_COMPLETED))
 		return;
 
-	BUG_ON(!__sched_preempt);
-	BUG_ON(!tcb_idle);
+	flags = local_irq_save();
+
+	cpu = sched_cpu();
+
+	BUG_ON(!__sched_preempt[cpu]);
+
+	BUG_ON(!tcb_idle[cpu]);
 
 	/* Already scheduling? May happen if set_timer leads to another softirq schedule */
-	if (__in_scheduling)
+	if (__in_scheduling[cpu]) {
+		local_irq_restore(flags);
 		return;
+	}
 
-	flags = local_irq_save();
-
-	__in_scheduling = true;
+	__in_scheduling[cpu] = true;
 
 	/* Scheduling policy: at the moment start the first ready thread */
 
@@ -432,12 +751,20 @@ void schedule(void)
 	next = next_thread();
 
 #ifdef CONFIG_SCHED_FREQ_PREEMPTION
-	set_timer(&schedule_timer, NOW() + MILLISECS(SCHEDULE_FREQ));
+#ifdef CONFIG_NO_HZ
+	/* The time slice only matters if another thread waits for this CPU (see sched_arm_slice()) */
+	if (this_rq()->nr_ready)
+		set_timer(&schedule_timer[cpu], NOW() + MILLISECS(SCHEDULE_FREQ));
+	else
+		stop_timer(&schedule_timer[cpu]);
+#else
+	set_timer(&schedule_timer[cpu], NOW() + MILLISECS(SCHEDULE_FREQ));
+#endif
 #endif
 
 	/* prev may be NULL at the very beginning (current is set to NULL at init). */
 	if ((next == NULL) && (!prev || prev->state != THREAD_STATE_RUNNING))
-		next = tcb_idle;
+		next = tcb_idle[cpu];
 
 	if (next && (next != prev)) {
 		LOG_DEBUG("Now scheduling thread ID: %d name: %s PID: %d prio: %d\n",
@@ -451,10 +778,16 @@ void schedule(void)
 		 * The current threads (here prev) can be in different states, not only running; it may be in *waiting* or *zombie*
 		 * depending on the thread activities. Hence, we put it in the ready state ONLY if the thread is in *running*.
 		 */
-		if ((prev != NULL) && (prev->state == THREAD_STATE_RUNNING) && (likely(prev != tcb_idle)))
+		if ((prev != NULL) && (prev->state == THREAD_STATE_RUNNING) && (likely(prev != tcb_idle[cpu])))
 			ready(prev);
 
 		next->state = THREAD_STATE_RUNNING;
+
+#ifdef CONFIG_SCHED_SMP
+		/* Cleared by __switch_to() once the context of prev is saved */
+		next->cpu = cpu;
+		next->on_cpu = true;
+#endif
 		set_current(next);
 
 #ifdef CONFIG_MMU
@@ -467,18 +800,28 @@ void schedule(void)
 			    (prev->pcb->state != PROC_STATE_WAITING))
 				prev->pcb->state = PROC_STATE_READY;
 
-			mmu_switch((void *) __pa(next->pcb->pgtable));
+			mmu_switch(next->pcb);
 			set_pgtable(next->pcb->pgtable);
 		}
+
+		/* The user space identifies the running thread with it (owner of a user mutex) */
+		if (next->pcb != NULL)
+			set_user_tid(next->tid);
 #endif /* CONFIG_MMU */
 
 		/* Authorized to leave the interrupt context here */
 		__in_interrupt = false;
-		__in_scheduling = false;
+		__in_scheduling[cpu] = false;
 
 		__switch_to(prev, next);
+
+	} else if (next) {
+		/* prev may have been woken up on this CPU before being switched out */
+		next->state = THREAD_STATE_RUNNING;
 	}
-	__in_scheduling = false;
+
+	/* We may have been resumed on another CPU */
+	__in_scheduling[sched_cpu()] = false;
 	__in_interrupt = false;
 
 	local_irq_restore(flags);
@@ -494,24 +837,35 @@ static inline void raise_schedule(void *__dummy)
  */
 void dump_ready(void)
 {
-	struct list_head *pos;
-	queue_thread_t *cur;
+	struct runqueue *rq;
+	tcb_t *tcb;
 	unsigned long flags;
+	int cpu, prio;
 
 	lprintk("Dumping the ready-threads queue: \n");
 
 	flags = local_irq_save();
 
-	if (list_empty(&readyThreads)) {
-		lprintk("  <empty>\n");
-		local_irq_restore(flags);
-		return;
-	}
+	for (cpu = 0; cpu < CONFIG_NR_CPUS; cpu++) {
+		rq = &runqueues[cpu];
+
+		if (CONFIG_NR_CPUS > 1)
+			lprintk(" CPU #%d:\n", cpu);
 
-	list_for_each(pos, &readyThreads) {
-		cur = list_entry(pos, queue_thread_t, list);
-		lprintk("  Thread ID: %d name: %s state: %d prio: %d\n", cur->tcb->tid, cur->tcb->name, cur->tcb->state,
-			cur->tcb->prio);
+		if (!rq->nr_ready) {
+			lprintk("  <empty>\n");
+			continue;
+		}
+
+		spin_lock(&rq->lock);
+
+		for (prio = SCHED_PRIO_LEVELS - 1; prio >= 0; prio--) {
+			list_for_each_entry(tcb, &rq->queue[prio], sched_list)
+				lprintk("  Thread ID: %d name: %s state: %d prio: %d\n", tcb->tid, tcb->name, tcb->state,
+					tcb->prio);
+		}
+
+		spin_unlock(&rq->lock);
 	}
 
 	local_irq_restore(flags);
@@ -522,8 +876,7 @@ void dump_ready(void)
  */
 void dump_zombie(void)
 {
-	struct list_head *pos;
-	queue_thread_t *cur;
+	tcb_t *tcb;
 	unsigned long flags;
 
 	printk("Dumping the zombie-threads queue: \n");
@@ -536,11 +889,9 @@ void dump_zombie(void)
 		return;
 	}
 
-	list_for_each(pos, &zombieThreads) {
-		cur = list_entry(pos, queue_thread_t, list);
-		printk("  Proc ID: %d Thread ID: %d state: %d\n", ((cur->tcb->pcb != NULL) ? cur->tcb->pcb->pid : 0),
-		       cur->tcb->tid, cur->tcb->state);
-	}
+	list_for_each_entry(tcb, &zombieThreads, sched_list)
+		printk("  Proc ID: %d Thread ID: %d state: %d\n", ((tcb->pcb != NULL) ? tcb->pcb->pid : 0), tcb->tid,
+		       tcb->state);
 
 	local_irq_restore(flags);
 }
@@ -556,6 +907,8 @@ void dump_sched(void)
 
 void scheduler_init(void)
 {
+	int cpu;
+
 	boot_stage = BOOT_STAGE_SCHED;
 
 	/* Low-level thread initialization */
@@ -571,12 +924,18 @@ void scheduler_init(void)
 #endif
 
 	/* Initialize the main queues addressed by the scheduler */
-	INIT_LIST_HEAD(&readyThreads);
+	for (cpu = 0; cpu < CONFIG_NR_CPUS; cpu++)
+		rq_init(&runqueues[cpu]);
+
 	INIT_LIST_HEAD(&zombieThreads);
 
 	/* Initialize the global list of processes */
 	INIT_LIST_HEAD(&proc_list);
 
+#ifdef CONFIG_MMU
+	proc_init();
+#endif
+
 	spin_lock_init(&schedule_lock);
 
 	/* Registering our softirq to activate the scheduler when necessary */
@@ -587,8 +946,17 @@ void scheduler_init(void)
 	 * their early execution.
 	 */
 
-	/* Start the idle thread with priority 1. */
-	tcb_idle = kernel_thread(thread_idle, "idle", NULL, 1);
+	/* Start the idle thread(s) with priority 1; each CPU has its own. */
+	for (cpu = 0; cpu < CONFIG_NR_CPUS; cpu++) {
+		tcb_idle[cpu] = kernel_thread(thread_idle, "idle", NULL, 1);
+#ifdef CONFIG_SCHED_SMP
+		tcb_idle[cpu]->cpu = cpu;
+		tcb_idle[cpu]->cpu_affinity = 1ul << cpu;
+#else
+		/* Only one CPU is used for scheduling */
+		break;
+#endif
+	}
 
 	/* We put the current thread as NULL. The scheduler will avoid
 	 * to preserve hazardous register for a running thread which
@@ -600,7 +968,55 @@ void scheduler_init(void)
 	preempt_enable();
 
 	/* Initiate a timer to trigger the schedule function */
-	init_timer(&schedule_timer, raise_schedule, NULL, smp_processor_id());
+	for (cpu = 0; cpu < CONFIG_NR_CPUS; cpu++)
+		init_timer(&schedule_timer[cpu], raise_schedule, NULL, cpu);
 
-	set_timer(&schedule_timer, NOW() + MILLISECS(SCHEDULE_FREQ));
+	set_timer(&schedule_timer[sched_cpu()], NOW() + MILLISECS(SCHEDULE_FREQ));
 }
+
+#ifdef CONFIG_SCHED_SMP
+
+/*
+ * Bind a thread to a set of CPUs. The thread is moved at its next scheduling
+ * if it runs or is queued on a CPU which is no longer allowed.
+ */
+void thread_set_affinity(struct tcb *tcb, unsigned long cpu_mask)
+{
+	unsigned long flags;
+
+	BUG_ON(!(cpu_mask & ((1ul << CONFIG_NR_CPUS) - 1)));
+
+	flags = spin_lock_irqsave(&schedule_lock);
+	tcb->cpu_affinity = cpu_mask;
+	spin_unlock_irqrestore(&schedule_lock, flags);
+
+	if ((tcb == current()) && !(cpu_mask & (1ul << smp_processor_id())))
+		schedule();
+}
+
+/*
+ * Entry of a secondary CPU in the scheduler.
+ * The boot stack is left as soon as the first thread (normally the idle thread)
+ * is switched in; there is no return from here.
+ */
+void sched_start_secondary(void)
+{
+	int cpu = smp_processor_id();
+	unsigned long flags;
+
+	set_current(NULL);
+
+	preempt_enable();
+
+	flags = spin_lock_irqsave(&schedule_lock);
+	sched_online_mask |= 1ul << cpu;
+	spin_unlock_irqrestore(&schedule_lock, flags);
+
+	set_timer(&schedule_timer[cpu], NOW() + MILLISECS(SCHEDULE_FREQ));
+
+	schedule();
+
+	BUG();
+}
+
+#endif /* CONFIG_SCHED_SMP */
@@ -22,6 +22,7 @@
 #include <sizes.h>
 #include <percpu.h>
 #include <memory.h>
+#include <schedule.h>
 
 #ifdef CONFIG_AVZ
 #include <avz/evtchn.h>
@@ -182,6 +183,11 @@ void secondary_start_kernel(void)
 	startup_cpu_idle_loop();
 #endif
 
+#ifdef CONFIG_SCHED_SMP
+	/* Start scheduling threads on this CPU */
+	sched_start_secondary();
+#endif
+
 	/* Never returned at this point ... */
 }
 
@@ -197,6 +203,12 @@ void cpu_up(unsigned int cpu)
 		secondary_data.stack = (void *) __cpu1_stack;
 		break;
 
+#ifdef CONFIG_SCHED_SMP
+	case 2:
+		secondary_data.stack = (void *) __cpu2_stack;
+		break;
+#endif
+
 	default:
 		secondary_data.stack = (void *) __cpu3_stack;
 	}
@@ -285,5 +297,17 @@ void smp_init(void)
 
 #endif /* !CONFIG_SOO */
 
+#elif defined(CONFIG_SCHED_SMP)
+
+	/* Temporary identity mapping so that the secondary CPUs can enable their MMU */
+	create_mapping(NULL, mem_info.phys_base, mem_info.phys_base, get_kernel_size(), false);
+
+	for (i = 1; i < CONFIG_NR_CPUS; i++)
+		cpu_up(i);
+
+	release_mapping(NULL, mem_info.phys_base, get_kernel_size());
+
+	flush_dcache_all();
+
 #endif /* CONFIG_AVZ */
 }
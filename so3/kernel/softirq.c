@@ -41,9 +41,10 @@ void do_softirq(void)
 
 	loopmax = 0;
 
-	cpu = smp_processor_id();
-
 	while (true) {
+		/* The thread may have been resumed on another CPU by a previous handler (schedule) */
+		cpu = smp_processor_id();
+
 		spin_lock(&softirq_pending_lock);
 
 		for (i = 0; i < NR_SOFTIRQS; i++)
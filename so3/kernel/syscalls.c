@@ -23,13 +23,19 @@
 #include <thread.h>
 #include <vfs.h>
 #include <pipe.h>
+#include <futex.h>
 #include <heap.h>
+#include <slab.h>
 #include <process.h>
 #include <signal.h>
 #include <timer.h>
 #include <net.h>
+#include <semaphore.h>
 #include <syscall.h>
 
+#include <fat/bcache.h>
+#include <fat/dcache.h>
+
 static uint32_t *errno_addr = NULL;
 
 extern void __get_syscall_args_ext(uint32_t *syscall_no, uint32_t **__errno_addr);
@@ -159,6 +165,25 @@ long syscall_handle(syscall_args_t *syscall_args)
 		result = do_readdir((int) syscall_args->args[0], (char *) syscall_args->args[1], syscall_args->args[2]);
 		break;
 
+	case SYSCALL_GETDENTS64:
+		result = do_getdents64((int) syscall_args->args[0], (char *) syscall_args->args[1],
+				       syscall_args->args[2]);
+		break;
+
+	case SYSCALL_MKDIR:
+		result = do_mkdir((const char *) syscall_args->args[0]);
+		break;
+
+	case SYSCALL_UNLINK:
+		result = do_unlink((const char *) syscall_args->args[0]);
+		break;
+
+	case SYSCALL_SPLICE:
+		result = do_splice((int) syscall_args->args[0], (off_t *) syscall_args->args[1], (int) syscall_args->args[2],
+				   (off_t *) syscall_args->args[3], (size_t) syscall_args->args[4],
+				   (unsigned int) syscall_args->args[5]);
+		break;
+
 	case SYSCALL_IOCTL:
 		result = do_ioctl((int) syscall_args->args[0], (unsigned long) syscall_args->args[1],
 				  (unsigned long) syscall_args->args[2]);
@@ -197,6 +222,12 @@ long syscall_handle(syscall_args_t *syscall_args)
 					(off_t) syscall_args->args[4]);
 		break;
 
+#ifdef CONFIG_FILE_MMAP
+	case SYSCALL_MUNMAP:
+		result = do_munmap((addr_t) syscall_args->args[0], (size_t) syscall_args->args[1]);
+		break;
+#endif
+
 	case SYSCALL_NANOSLEEP:
 		result = do_nanosleep((const struct timespec *) syscall_args->args[0],
 				      (struct timespec *) syscall_args->args[1]);
@@ -209,16 +240,13 @@ long syscall_handle(syscall_args_t *syscall_args)
 
 #endif /* CONFIG_PROC_ENV */
 
-		/* This is a first attempt of mutex syscall implementation.
-	 * Mainly used for debugging purposes (kernel mutex validation) at the moment ... */
-
-	case SYSCALL_MUTEX_LOCK:
-		result = do_mutex_lock(syscall_args->args[0]);
-		break;
-
-	case SYSCALL_MUTEX_UNLOCK:
-		result = do_mutex_unlock(syscall_args->args[0]);
+#ifdef CONFIG_IPC_FUTEX
+	case SYSCALL_FUTEX:
+		result = do_futex((uint32_t *) syscall_args->args[0], (int) syscall_args->args[1],
+				  (uint32_t) syscall_args->args[2], syscall_args->args[3], (uint32_t *) syscall_args->args[4],
+				  (uint32_t) syscall_args->args[5]);
 		break;
+#endif /* CONFIG_IPC_FUTEX */
 
 #ifdef CONFIG_MMU
 	case SYSCALL_PTRACE:
@@ -301,6 +329,10 @@ long syscall_handle(syscall_args_t *syscall_args)
 		switch (syscall_args->args[0]) {
 		case SYSINFO_DUMP_HEAP:
 			dump_heap("Heap info asked from user.\n");
+			dump_kmem_caches();
+#ifdef CONFIG_MMU
+			dump_free_areas();
+#endif
 			break;
 
 		case SYSINFO_DUMP_SCHED:
@@ -313,11 +345,41 @@ long syscall_handle(syscall_args_t *syscall_args)
 			break;
 #endif
 
+#ifdef CONFIG_FAT_BCACHE
+		case SYSINFO_DUMP_BCACHE:
+			dump_bcache();
+			break;
+#endif
+
+#ifdef CONFIG_FAT_DCACHE
+		case SYSINFO_DUMP_DCACHE:
+			dump_dcache();
+			break;
+#endif
+
 #ifdef CONFIG_APP_TEST_MALLOC
 		case SYSINFO_TEST_MALLOC:
 			test_malloc(a->args[1]);
 			break;
 #endif
+
+#ifdef CONFIG_TIMER_BENCH
+		case SYSINFO_TEST_TIMER:
+			timer_bench(syscall_args->args[1]);
+			break;
+#endif
+
+#ifdef CONFIG_STRING_BENCH
+		case SYSINFO_TEST_STRING:
+			string_bench(syscall_args->args[1]);
+			break;
+#endif
+
+#ifdef CONFIG_SEM_TEST
+		case SYSINFO_TEST_SEM:
+			sem_test(syscall_args->args[1]);
+			break;
+#endif
 		case SYSINFO_PRINTK:
 			printk("%s", (char *) syscall_args->args[1]);
 			break;
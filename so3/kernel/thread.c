@@ -21,6 +21,7 @@
 #include <process.h>
 #include <common.h>
 #include <heap.h>
+#include <slab.h>
 #include <errno.h>
 #include <completion.h>
 #include <schedule.h>
@@ -33,6 +34,9 @@
 
 static unsigned int tid_next = 0;
 
+static kmem_cache_t *tcb_cache;
+static kmem_cache_t *queue_thread_cache;
+
 char *state_str[] = { "NEW", "READY", "RUNNING", "WAITING", "ZOMBIE" };
 
 /*
@@ -220,7 +224,7 @@ void free_queue_thread(struct list_head *aList)
 		cur = list_entry(pos, queue_thread_t, list);
 
 		list_del(pos);
-		free(cur);
+		kmem_cache_free(queue_thread_cache, cur);
 	}
 }
 
@@ -309,19 +313,15 @@ void thread_exit(int *exit_status)
 }
 
 /*
- * The thread prologue starts its execution in USER mode.
+ * Entry point of kernel threads. User threads directly start in their
+ * function in the user space, which returns to the address given by the libc
+ * (see do_thread_create()).
  */
 void thread_prologue(void (*th_fn)(void *arg), void *arg)
 {
-	/* Call the function of the user space */
 	th_fn(arg);
 
-	/*
-	 * Following the execution of the thread, either the user thread
-	 * is calling pthread_exit() explicitly, or the pthread core function
- 	 * will do it.
- 	 * If we reach this point, it means that a kernel thread has finished its execution.
-	 */
+	/* The kernel thread has finished its execution. */
 
 	thread_exit(NULL);
 }
@@ -372,8 +372,10 @@ void set_thread_registers(tcb_t *thread, cpu_regs_t *regs)
  * @arg: pointer to possible args
  * @pcb: NULL means it is a pure kernel thread, otherwise is is a user thread.
  * @prio: 0 means the default priority, otherwise set to the thread to the corresponding priority
+ * @attr: attributes of a user thread (stack, return address), NULL for the default ones
  */
-tcb_t *thread_create(th_fn_t start_routine, const char *name, void *arg, pcb_t *pcb, uint32_t prio)
+tcb_t *thread_create(th_fn_t start_routine, const char *name, void *arg, pcb_t *pcb, uint32_t prio,
+		     const thread_attr_t *attr)
 {
 	tcb_t *tcb;
 	unsigned long flags;
@@ -382,13 +384,15 @@ tcb_t *thread_create(th_fn_t start_routine, const char *name, void *arg, pcb_t *
 
 	flags = local_irq_save();
 
-	tcb = (tcb_t *) malloc(sizeof(tcb_t));
+	tcb = (tcb_t *) kmem_cache_alloc(tcb_cache);
 
 	if (tcb == NULL) {
 		printk("%s: failed to alloc memory.\n", __func__);
 		kernel_panic();
 	}
 
+	memset(tcb, 0, sizeof(tcb_t));
+
 	tcb->tid = tid_next++;
 
 	/* We append the tid to the thread name */
@@ -402,6 +406,10 @@ tcb_t *thread_create(th_fn_t start_routine, const char *name, void *arg, pcb_t *
 	else
 		tcb->prio = THREAD_PRIO_DEFAULT;
 
+#ifdef CONFIG_SCHED_PRIO_DYN
+	tcb->current_prio = tcb->prio;
+#endif
+
 	tcb->state = THREAD_STATE_NEW;
 	tcb->pcb = pcb;
 
@@ -415,12 +423,21 @@ tcb_t *thread_create(th_fn_t start_routine, const char *name, void *arg, pcb_t *
 
 	/* Prepare the user stack if any related PCB */
 	if (tcb->pcb) {
-		/* Prepare the user stack */
-		tcb->pcb_stack_slotID = get_user_stack_slot(tcb->pcb);
-		if (tcb->pcb_stack_slotID < 0) {
-			printk("No available user stack for a new thread\n");
-			kernel_panic();
+		if (attr && attr->stack_top) {
+			/* The process has allocated the stack itself */
+			tcb->pcb_stack_slotID = -1;
+			tcb->user_stack_top = attr->stack_top;
+		} else {
+			tcb->pcb_stack_slotID = get_user_stack_slot(tcb->pcb);
+			if (tcb->pcb_stack_slotID < 0) {
+				printk("No available user stack for a new thread\n");
+				kernel_panic();
+			}
+			tcb->user_stack_top = get_user_stack_top(tcb->pcb, tcb->pcb_stack_slotID);
 		}
+
+		if (attr)
+			tcb->th_exit = attr->exit_fn;
 	}
 
 	/* Prepare registers for future restore in switch_context() */
@@ -437,6 +454,19 @@ tcb_t *thread_create(th_fn_t start_routine, const char *name, void *arg, pcb_t *
 	/* Initialize the join queue associated to this thread */
 	INIT_LIST_HEAD(&tcb->joinQueue);
 
+	INIT_LIST_HEAD(&tcb->sched_list);
+
+#ifdef CONFIG_SCHED_PRIO
+	INIT_LIST_HEAD(&tcb->held_mutexes);
+#endif
+
+#ifdef CONFIG_SCHED_SMP
+	tcb->cpu = smp_processor_id();
+	tcb->cpu_affinity = CPU_AFFINITY_ALL;
+	tcb->on_cpu = false;
+	tcb->wakeup_pending = false;
+#endif
+
 	/* We do not want to have the idle thread as a "ready" thread */
 	if (start_routine != thread_idle)
 		ready(tcb);
@@ -448,7 +478,7 @@ tcb_t *thread_create(th_fn_t start_routine, const char *name, void *arg, pcb_t *
 
 tcb_t *kernel_thread(th_fn_t start_routine, const char *name, void *arg, uint32_t prio)
 {
-	return thread_create(start_routine, name, arg, NULL, prio);
+	return thread_create(start_routine, name, arg, NULL, prio, NULL);
 }
 
 /**
@@ -459,11 +489,19 @@ tcb_t *kernel_thread(th_fn_t start_routine, const char *name, void *arg, uint32_
  * @param name		Name of the thread
  * @param arg		Argument of the thread
  * @param pcb		PCB which the thread belongs to
+ * @param attr		Attributes of the thread (NULL for the default ones)
  * @return		Address of the corresponding TCB
  */
-tcb_t *user_thread(th_fn_t start_routine, const char *name, void *arg, pcb_t *pcb)
+tcb_t *user_thread(th_fn_t start_routine, const char *name, void *arg, pcb_t *pcb, const thread_attr_t *attr)
 {
-	return thread_create(start_routine, name, arg, pcb, (pcb->main_thread ? pcb->main_thread->prio : 0));
+	uint32_t prio;
+
+	if (attr && attr->prio)
+		prio = attr->prio;
+	else
+		prio = (pcb->main_thread ? pcb->main_thread->prio : 0);
+
+	return thread_create(start_routine, name, arg, pcb, prio, attr);
 }
 
 /*
@@ -482,7 +520,7 @@ void clean_thread(tcb_t *tcb)
 		remove_zombie(tcb);
 
 	/* Finally, free the tcb struct */
-	free(tcb);
+	kmem_cache_free(tcb_cache, tcb);
 }
 
 /*
@@ -510,7 +548,7 @@ int *thread_join(tcb_t *tcb)
 	if (tcb->state != THREAD_STATE_ZOMBIE) {
 		/* Register us in the join queue attached to the target thread */
 
-		cur = (queue_thread_t *) malloc(sizeof(queue_thread_t));
+		cur = (queue_thread_t *) kmem_cache_alloc(queue_thread_cache);
 		if (cur == NULL) {
 			printk("%s: cannot allocate memory to register in join queue.\n", __func__);
 			BUG();
@@ -544,7 +582,7 @@ int *thread_join(tcb_t *tcb)
 
 			if (_tcb == current()) {
 				list_del(pos);
-				free(cur);
+				kmem_cache_free(queue_thread_cache, cur);
 				break;
 			}
 		}
@@ -588,19 +626,49 @@ int *thread_join(tcb_t *tcb)
  * do_thread_create is the syscall implementation behind the pthread_create() called in the libc.
  *
  * @pthread_p refers to the address of the resulting pthread_t id
- * @attr_p refers to the address of pthread attributes
+ * @attr_p refers to the thread attributes (thread_attr_t) prepared by the libc, may be 0
  * @thread_fn refers to the threaded function in the user space
  * @arg_p refers to the arguments passed to the threaded function
  *
+ * The thread starts directly in thread_fn with arg_p as argument; when thread_fn returns,
+ * it continues at the exit_fn address of the attributes with the returned value.
+ *
  * The function returns 0 if successful.
  */
 
 int do_thread_create(uint32_t *pthread_id, addr_t attr_p, addr_t thread_fn, addr_t arg_p)
 {
 	unsigned long flags;
+	thread_attr_t attr;
 	tcb_t *tcb;
 	char *name;
 
+	if (attr_p)
+		memcpy(&attr, (void *) attr_p, sizeof(thread_attr_t));
+	else
+		memset(&attr, 0, sizeof(thread_attr_t));
+
+	if (attr.stack_top) {
+		/* Full descending stack aligned as required by the ABI */
+		attr.stack_top &= ~0xfUL;
+
+		if (!attr.stack_size) {
+			set_errno(EINVAL);
+			return -1;
+		}
+
+	} else if (attr.stack_size > THREAD_STACK_SIZE) {
+		/* The stack slots have a fixed size */
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	/* The run queues have a fixed number of priority levels */
+	if (attr.prio >= SCHED_PRIO_LEVELS) {
+		set_errno(EINVAL);
+		return -1;
+	}
+
 	flags = local_irq_save();
 
 	/* Create a child thread for the running process */
@@ -613,7 +681,7 @@ int do_thread_create(uint32_t *pthread_id, addr_t attr_p, addr_t thread_fn, addr
 	}
 	snprintf(name, THREAD_NAME_LEN, "thread_p%d", current()->pcb->pid);
 
-	tcb = user_thread((th_fn_t) thread_fn, name, (void *) arg_p, current()->pcb);
+	tcb = user_thread((th_fn_t) thread_fn, name, (void *) arg_p, current()->pcb, &attr);
 
 	/* The name has been copied in thread creation */
 	free(name);
@@ -661,8 +729,8 @@ int do_thread_join(uint32_t pthread_id, int **value_p)
  */
 void do_thread_exit(int *exit_status)
 {
-	/* Unallocate the user space stack slot if it is not the main thread */
-	if (current() != current()->pcb->main_thread)
+	/* Unallocate the user space stack slot if it is not the main thread or a stack of the process */
+	if ((current() != current()->pcb->main_thread) && (current()->pcb_stack_slotID >= 0))
 		free_user_stack_slot(current()->pcb, current()->pcb_stack_slotID);
 
 	thread_exit(exit_status);
@@ -674,4 +742,9 @@ void threads_init(void)
 
 	for (i = 0; i < THREAD_MAX; i++)
 		kernel_stack_slot[i] = false; /* Unallocated stack */
+
+	tcb_cache = kmem_cache_create("tcb", sizeof(tcb_t), 0);
+	queue_thread_cache = kmem_cache_create("queue_thread", sizeof(queue_thread_t), 0);
+
+	BUG_ON(!tcb_cache || !queue_thread_cache);
 }
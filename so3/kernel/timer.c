@@ -43,16 +43,106 @@
 #warning set_errno
 #define set_errno(x)
 
+/* Initial number of timers in the heap of a CPU; the heap grows on demand. */
+#define TIMER_HEAP_INIT_SIZE 64
+
+/*
+ * Pending timers of a CPU are kept in a binary min-heap ordered by deadline
+ * (heap[1] expires first). The list only holds timers which could not be
+ * inserted because the heap was full, until the heap is grown.
+ */
 struct timers {
 	spinlock_t lock;
 	struct timer **heap;
+	unsigned int heap_size;
+	unsigned int heap_limit;
 	struct timer *list;
 	struct timer *running;
 
+#ifdef CONFIG_NO_HZ
+	/* Deadline programmed in the timer device (STIME_MAX if none) */
+	u64 next_deadline;
+#endif
+
 } __cacheline_aligned;
 
 static DEFINE_PER_CPU(struct timers, timers);
 
+/*
+ * Heap management. The timer keeps its position in the heap (heap_offset)
+ * so that it can be removed in O(log n).
+ */
+
+/* Sink down the element at position @pos. */
+static void down_heap(struct timers *ts, unsigned int pos)
+{
+	struct timer **heap = ts->heap;
+	struct timer *t = heap[pos];
+	unsigned int nxt;
+
+	while ((nxt = (pos << 1)) <= ts->heap_size) {
+		if ((nxt + 1 <= ts->heap_size) && (heap[nxt + 1]->expires < heap[nxt]->expires))
+			nxt++;
+
+		if (heap[nxt]->expires > t->expires)
+			break;
+
+		heap[pos] = heap[nxt];
+		heap[pos]->heap_offset = pos;
+		pos = nxt;
+	}
+
+	heap[pos] = t;
+	t->heap_offset = pos;
+}
+
+/* Float up the element at position @pos. */
+static void up_heap(struct timers *ts, unsigned int pos)
+{
+	struct timer **heap = ts->heap;
+	struct timer *t = heap[pos];
+
+	while ((pos > 1) && (t->expires < heap[pos >> 1]->expires)) {
+		heap[pos] = heap[pos >> 1];
+		heap[pos]->heap_offset = pos;
+		pos >>= 1;
+	}
+
+	heap[pos] = t;
+	t->heap_offset = pos;
+}
+
+static void remove_from_heap(struct timers *ts, struct timer *t)
+{
+	unsigned int pos = t->heap_offset;
+
+	if (unlikely(pos == ts->heap_size)) {
+		ts->heap_size--;
+		return;
+	}
+
+	/* Replace with the last element and restore the heap property */
+	ts->heap[pos] = ts->heap[ts->heap_size--];
+	ts->heap[pos]->heap_offset = pos;
+
+	if ((pos == 1) || (ts->heap[pos]->expires > ts->heap[pos >> 1]->expires))
+		down_heap(ts, pos);
+	else
+		up_heap(ts, pos);
+}
+
+/* Return false if the heap is full. */
+static bool add_to_heap(struct timers *ts, struct timer *t)
+{
+	if (ts->heap_size == ts->heap_limit)
+		return false;
+
+	ts->heap[++ts->heap_size] = t;
+	up_heap(ts, ts->heap_size);
+
+	return true;
+}
+
 static void remove_from_list(struct timer **list, struct timer *t)
 {
 	struct timer *curr, *prev;
@@ -154,6 +244,10 @@ static int remove_entry(struct timers *timers, struct timer *t)
 	int rc = 0;
 
 	switch (t->status) {
+	case TIMER_STATUS_in_heap:
+		remove_from_heap(timers, t);
+		break;
+
 	case TIMER_STATUS_in_list:
 		remove_from_list(&timers->list, t);
 		break;
@@ -173,11 +267,65 @@ static void add_entry(struct timers *timers, struct timer *t)
 {
 	ASSERT(t->status == TIMER_STATUS_inactive);
 
+	if (likely(add_to_heap(timers, t))) {
+		t->status = TIMER_STATUS_in_heap;
+		return;
+	}
+
+	/* The heap is full; it will be grown by the next timer softirq. */
 	t->status = TIMER_STATUS_in_list;
 
 	add_to_list(&timers->list, t);
 }
 
+/*
+ * Double the size of the heap and move the overflowed timers into it.
+ * Called without the timers lock.
+ */
+static void grow_heap(struct timers *ts)
+{
+	struct timer **heap, **old_heap;
+	struct timer *t;
+	unsigned int limit;
+	unsigned long flags;
+
+	limit = ts->heap_limit << 1;
+
+	heap = (struct timer **) malloc((limit + 1) * sizeof(struct timer *));
+	if (!heap) {
+		/* The timers remain on the list; they are still processed */
+		printk("%s: no memory to grow the timer heap\n", __func__);
+		return;
+	}
+
+	flags = spin_lock_irqsave(&ts->lock);
+
+	/* Grown in the meanwhile? */
+	if (ts->heap_limit >= limit) {
+		spin_unlock_irqrestore(&ts->lock, flags);
+		free(heap);
+		return;
+	}
+
+	memcpy(heap, ts->heap, (ts->heap_size + 1) * sizeof(struct timer *));
+
+	old_heap = ts->heap;
+
+	ts->heap = heap;
+	ts->heap_limit = limit;
+
+	while (((t = ts->list) != NULL) && (ts->heap_size < ts->heap_limit)) {
+		remove_from_list(&ts->list, t);
+
+		add_to_heap(ts, t);
+		t->status = TIMER_STATUS_in_heap;
+	}
+
+	spin_unlock_irqrestore(&ts->lock, flags);
+
+	free(old_heap);
+}
+
 static inline void add_timer(struct timer *timer)
 {
 	add_entry(&per_cpu(timers, timer->cpu), timer);
@@ -203,9 +351,14 @@ void apply_timer_offset(u64 offset)
 {
 	struct timer *curr;
 	struct timers *ts;
+	unsigned int i;
 
 	ts = &this_cpu(timers);
 
+	/* The same offset for all timers keeps the heap ordered */
+	for (i = 1; i <= ts->heap_size; i++)
+		ts->heap[i]->expires += offset;
+
 	curr = ts->list;
 	while (curr != NULL) {
 		curr->expires += offset;
@@ -224,6 +377,14 @@ void __stop_timer(struct timer *timer)
 
 void set_timer(struct timer *timer, u64 expires)
 {
+#ifdef CONFIG_NO_HZ
+	struct timers *ts = &per_cpu(timers, timer->cpu);
+	unsigned long flags;
+	bool program = false, grow;
+
+	flags = local_irq_save();
+#endif
+
 	timer_lock(timer);
 
 	/* Must have been initialized */
@@ -237,6 +398,40 @@ void set_timer(struct timer *timer, u64 expires)
 	if (likely(timer->status != TIMER_STATUS_killed))
 		add_timer(timer);
 
+#ifdef CONFIG_NO_HZ
+	/*
+	 * The timer device is only reprogrammed if the new deadline comes first.
+	 * There is no softirq processing here, so that set_timer() can be used
+	 * with other locks held (to arm the time slice from ready() for instance).
+	 */
+	if (active_timer(timer) && (expires < ts->next_deadline)) {
+		ts->next_deadline = expires;
+		program = true;
+	}
+
+	/* The heap is full; let the softirq grow it. */
+	grow = (timer->status == TIMER_STATUS_in_list);
+
+	timer_unlock(timer);
+
+	if (program || grow) {
+		if (timer->cpu == smp_processor_id()) {
+			/* An expired deadline is handled after the minimal delay */
+			if (program)
+				oneshot_timer.set_delay((expires > NOW()) ? expires - NOW() : 0);
+			if (grow)
+				raise_softirq(TIMER_SOFTIRQ);
+		}
+#ifdef CONFIG_SCHED_SMP
+		else
+			/* The timer device of another CPU is only reachable from this CPU. */
+			cpu_raise_softirq(timer->cpu, TIMER_SOFTIRQ);
+#endif
+	}
+
+	local_irq_restore(flags);
+#else /* CONFIG_NO_HZ */
+
 	timer_unlock(timer);
 
 	/* Since we add a new timer, the deadline can be earlier than the current
@@ -248,6 +443,8 @@ void set_timer(struct timer *timer, u64 expires)
 	/* Make sure than a possible call to schedule() can be performed */
 	if (!__in_interrupt)
 		do_softirq();
+
+#endif /* !CONFIG_NO_HZ */
 }
 
 void stop_timer(struct timer *timer)
@@ -290,13 +487,16 @@ static void execute_timer(struct timers *ts, struct timer *t)
  */
 static void timer_softirq_action(void)
 {
-	struct timer *cur, *t, *start;
+	struct timer *t, *start;
 	struct timers *ts;
 	u64 now;
-	u64 end = STIME_MAX;
 
 	ts = &this_cpu(timers);
 
+	/* Some timers could not be inserted in the heap */
+	if (unlikely(ts->list != NULL))
+		grow_heap(ts);
+
 	spin_lock(&ts->lock);
 
 	preempt_disable();
@@ -304,35 +504,40 @@ static void timer_softirq_action(void)
 again:
 	now = NOW();
 
-	/* Execute ready list timers. */
-	cur = ts->list;
+	/* Execute the expired timers, the earliest first. */
+	while ((ts->heap_size > 0) && (ts->heap[1]->expires <= now)) {
+		t = ts->heap[1];
 
-	/* Verify if some timers reached their deadline, remove them and execute them if any. */
-	while (cur != NULL) {
-		t = cur;
-		cur = cur->list_next;
+		LOG_DEBUG("### %s: NOW: %llu executing timer expires: %llu   ***  delta: %d\n",
+		    __func__, now, t->expires, t->expires - now);
 
-		if (t->expires <= now) {
-			LOG_DEBUG("### %s: NOW: %llu executing timer expires: %llu   ***  delta: %d\n",
-			    __func__, now, t->expires, t->expires - now);
+		remove_entry(ts, t);
+		execute_timer(ts, t);
+	}
 
+	/* Same for the overflowed timers; the list may change while a timer is executed. */
+	t = ts->list;
+	while (t != NULL) {
+		if (t->expires <= now) {
 			remove_entry(ts, t);
 			execute_timer(ts, t);
-		}
+
+			t = ts->list;
+		} else
+			t = t->list_next;
 	}
 
-	/* Examine the pending timers to get the earliest deadline */
-	start = NULL;
-	t = ts->list;
-	while (t != NULL) {
-		LOG_DEBUG("### %s: NOW: %llu pending expires: %llu   ***  delta: %d\n",
-		    __func__, now, t->expires, t->expires - now);
-		if (((start == NULL) && (t->expires < end)) ||
-		    (t->expires < start->expires))
+	/* The earliest deadline is on top of the heap (the list is normally empty) */
+	start = ((ts->heap_size > 0) ? ts->heap[1] : NULL);
+
+	for (t = ts->list; t != NULL; t = t->list_next)
+		if ((start == NULL) || (t->expires < start->expires))
 			start = t;
 
-		t = t->list_next;
-	}
+#ifdef CONFIG_NO_HZ
+	/* Nothing to program means no more interrupt (the tick is stopped) */
+	ts->next_deadline = (start != NULL) ? start->expires : STIME_MAX;
+#endif
 
 	if (start != NULL) {
 		if (timer_dev_set_deadline(start->expires))
@@ -367,7 +572,10 @@ static void dump_timerq(unsigned char key)
 
 	spin_lock(&ts->lock);
 
-	for (t = ts->list, j = 0; t != NULL; t = t->list_next, j++)
+	for (j = 1; j <= ts->heap_size; j++)
+		dump_timer(ts->heap[j], now);
+
+	for (t = ts->list; t != NULL; t = t->list_next)
 		dump_timer(t, now);
 
 	spin_unlock(&ts->lock);
@@ -385,9 +593,16 @@ void timer_init(void)
 	int i;
 
 	for (i = 0; i < CONFIG_NR_CPUS; i++) {
-		per_cpu(timers, i).heap = NULL;
+		per_cpu(timers, i).heap = (struct timer **) malloc((TIMER_HEAP_INIT_SIZE + 1) * sizeof(struct timer *));
+		BUG_ON(!per_cpu(timers, i).heap);
+
+		per_cpu(timers, i).heap_size = 0;
+		per_cpu(timers, i).heap_limit = TIMER_HEAP_INIT_SIZE;
 		per_cpu(timers, i).list = NULL;
 		per_cpu(timers, i).running = NULL;
+#ifdef CONFIG_NO_HZ
+		per_cpu(timers, i).next_deadline = STIME_MAX;
+#endif
 
 		spin_lock_init(&per_cpu(timers, i).lock);
 	}
@@ -451,3 +666,79 @@ int do_get_clock_time(int clk_id, struct timespec *ts)
 
 	return 0;
 }
+
+#ifdef CONFIG_TIMER_BENCH
+
+static volatile int bench_fired;
+static u64 bench_max_late;
+
+static void bench_handler(void *data)
+{
+	struct timer *t = (struct timer *) data;
+	u64 late = NOW() - t->expires;
+
+	if (late > bench_max_late)
+		bench_max_late = late;
+
+	bench_fired++;
+}
+
+/*
+ * Stress the timer queue of the running CPU: <count> timers are armed with
+ * deadlines spread over 100 ms, every other one is cancelled and the remaining
+ * ones are left to expire.
+ */
+void timer_bench(int count)
+{
+	struct timer *bench;
+	u64 now, t_arm, t_stop, t_expire;
+	u32 seed = 1;
+	int i, expected;
+
+	if (count <= 0)
+		count = 4096;
+
+	bench = malloc(count * sizeof(struct timer));
+	if (!bench) {
+		printk("%s: cannot allocate %d timers\n", __func__, count);
+		return;
+	}
+
+	bench_fired = 0;
+	bench_max_late = 0;
+
+	for (i = 0; i < count; i++)
+		init_timer(&bench[i], bench_handler, &bench[i], smp_processor_id());
+
+	now = NOW();
+	for (i = 0; i < count; i++) {
+		seed = seed * 1103515245 + 12345;
+		set_timer(&bench[i], now + MILLISECS(10) + MICROSECS((seed >> 8) % 100000));
+	}
+	t_arm = NOW() - now;
+
+	now = NOW();
+	for (i = 0; i < count; i += 2)
+		stop_timer(&bench[i]);
+	t_stop = NOW() - now;
+
+	expected = count / 2;
+
+	now = NOW();
+	while (bench_fired < expected)
+		msleep(10);
+	t_expire = NOW() - now;
+
+	for (i = 0; i < count; i++)
+		kill_timer(&bench[i]);
+
+	free(bench);
+
+	printk("Timer bench (%d timers):\n", count);
+	printk("  arm:    %llu ns total, %llu ns/timer\n", t_arm, t_arm / count);
+	printk("  cancel: %llu ns total, %llu ns/timer\n", t_stop, t_stop / (count - expected));
+	printk("  expiry: %d fired in %llu ms, max lateness %llu us\n", bench_fired, t_expire / 1000000ull,
+	       bench_max_late / 1000ull);
+}
+
+#endif /* CONFIG_TIMER_BENCH */
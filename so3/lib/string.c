@@ -76,7 +76,7 @@ int memcmp(const void *s1, const void *s2, size_t n)
 }
 
 /* http://clc-wiki.net/wiki/memcpy#Implementation */
-void *memcpy(void *dest, const void *src, size_t n)
+void *generic_memcpy(void *dest, const void *src, size_t n)
 {
 	char *dp = dest;
 	const char *sp = src;
@@ -85,11 +85,18 @@ void *memcpy(void *dest, const void *src, size_t n)
 	return dest;
 }
 
+#ifndef __HAVE_ARCH_MEMCPY
+void *memcpy(void *dest, const void *src, size_t n)
+{
+	return generic_memcpy(dest, src, n);
+}
+#endif
+
 /* http://clc-wiki.net/wiki/memmove#Implementation
  * using naive and non-portable '__np_anyptrlt' macro: see website for info */
 #define __np_anyptrlt(p1, p2) ((p1) < (p2))
 
-void *memmove(void *dest, const void *src, size_t n)
+void *generic_memmove(void *dest, const void *src, size_t n)
 {
 	unsigned char *pd = dest;
 	const unsigned char *ps = src;
@@ -102,8 +109,15 @@ void *memmove(void *dest, const void *src, size_t n)
 	return dest;
 }
 
+#ifndef __HAVE_ARCH_MEMMOVE
+void *memmove(void *dest, const void *src, size_t n)
+{
+	return generic_memmove(dest, src, n);
+}
+#endif
+
 /* http://clc-wiki.net/wiki/memset#Implementation */
-void *memset(void *s, int c, size_t n)
+void *generic_memset(void *s, int c, size_t n)
 {
 	unsigned char *p = s;
 	while (n--)
@@ -111,6 +125,13 @@ void *memset(void *s, int c, size_t n)
 	return s;
 }
 
+#ifndef __HAVE_ARCH_MEMSET
+void *memset(void *s, int c, size_t n)
+{
+	return generic_memset(s, c, n);
+}
+#endif
+
 /* http://clc-wiki.net/wiki/strcmp#Implementation */
 int strcmp(const char *s1, const char *s2)
 {
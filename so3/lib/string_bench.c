@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2025 Daniel Rossier <daniel.rossier@heig-vd.ch>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Self-test of the memcpy/memmove/memset implementations of the architecture.
+ * Their results are checked against the generic byte-wise versions for all
+ * small lengths and alignments, then the throughput of both is compared.
+ */
+
+#include <common.h>
+#include <heap.h>
+#include <string.h>
+#include <timer.h>
+#include <memory.h>
+
+/* Largest length used in the correctness checks */
+#define CHECK_LEN 160
+
+/* Amount of data moved for each measurement */
+#define BENCH_BYTES (4 * SZ_1M)
+
+typedef void *(*copy_fn_t)(void *, const void *, size_t);
+typedef void *(*set_fn_t)(void *, int, size_t);
+
+static void fill_pattern(u8 *buf, int len, u8 seed)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = seed + i * 7;
+}
+
+/*
+ * Returns the number of mismatches found between the architecture and
+ * the generic versions.
+ */
+static int string_check(u8 *src, u8 *ref, u8 *dst)
+{
+	int len, so, doff, errors = 0;
+	const int size = CHECK_LEN + 16;
+
+	for (len = 0; len <= CHECK_LEN; len++) {
+		for (so = 0; so < 8; so++) {
+			for (doff = 0; doff < 8; doff++) {
+				fill_pattern(src, size, len);
+
+				memset(ref, 0x5a, size);
+				memset(dst, 0x5a, size);
+				generic_memcpy(ref + doff, src + so, len);
+				memcpy(dst + doff, src + so, len);
+				if (memcmp(ref, dst, size)) {
+					printk("  memcpy failed (len %d, src +%d, dst +%d)\n", len, so, doff);
+					errors++;
+				}
+
+				generic_memset(ref + doff, 0x1a5, len);
+				memset(dst + doff, 0x1a5, len);
+				if (memcmp(ref, dst, size)) {
+					printk("  memset failed (len %d, dst +%d)\n", len, doff);
+					errors++;
+				}
+
+				/* Overlapping moves in both directions */
+				fill_pattern(ref, size, len);
+				fill_pattern(dst, size, len);
+				generic_memmove(ref + doff, ref + so, len);
+				memmove(dst + doff, dst + so, len);
+				if (memcmp(ref, dst, size)) {
+					printk("  memmove failed (len %d, src +%d, dst +%d)\n", len, so, doff);
+					errors++;
+				}
+			}
+		}
+	}
+
+	return errors;
+}
+
+/* Throughput in MB/s */
+static u64 bench_copy(copy_fn_t fn, void *dst, const void *src, size_t len)
+{
+	u64 start, delta;
+	int i, rounds = BENCH_BYTES / len;
+
+	start = NOW();
+	for (i = 0; i < rounds; i++)
+		fn(dst, src, len);
+	delta = NOW() - start;
+
+	return ((u64) rounds * len * 1000ull) / (delta ? delta : 1);
+}
+
+static u64 bench_set(set_fn_t fn, void *dst, size_t len)
+{
+	u64 start, delta;
+	int i, rounds = BENCH_BYTES / len;
+
+	start = NOW();
+	for (i = 0; i < rounds; i++)
+		fn(dst, i, len);
+	delta = NOW() - start;
+
+	return ((u64) rounds * len * 1000ull) / (delta ? delta : 1);
+}
+
+static void string_bench_size(u8 *src, u8 *dst, int len, int misalign)
+{
+	printk("  %6d bytes%s: memcpy %6llu / %6llu MB/s, memmove %6llu / %6llu MB/s, memset %6llu / %6llu MB/s\n",
+	       len, (misalign ? " (unaligned)" : "            "), bench_copy(memcpy, dst, src + misalign, len),
+	       bench_copy(generic_memcpy, dst, src + misalign, len), bench_copy(memmove, dst + 8, dst, len),
+	       bench_copy(generic_memmove, dst + 8, dst, len), bench_set(memset, dst + misalign, len),
+	       bench_set(generic_memset, dst + misalign, len));
+}
+
+/*
+ * Check the string functions and measure their throughput on buffers of
+ * up to <size> bytes.
+ */
+void string_bench(int size)
+{
+	u8 *src, *dst;
+	int errors;
+
+	if (size < PAGE_SIZE)
+		size = 16 * PAGE_SIZE;
+
+	if (size > BENCH_BYTES)
+		size = BENCH_BYTES;
+
+	src = memalign(size + 16, PAGE_SIZE);
+	dst = memalign(size + 16, PAGE_SIZE);
+	if (!src || !dst) {
+		printk("%s: cannot allocate the buffers\n", __func__);
+		goto out;
+	}
+
+	printk("String functions self-test:\n");
+
+	errors = string_check(src, dst, dst + CHECK_LEN + 16);
+	printk("  %d error(s)\n", errors);
+
+	printk("Throughput (arch / generic):\n");
+
+	fill_pattern(src, size + 16, 0);
+
+	string_bench_size(src, dst, 64, 0);
+	string_bench_size(src, dst, 512, 0);
+	string_bench_size(src, dst, PAGE_SIZE, 0);
+	string_bench_size(src, dst, size, 0);
+	string_bench_size(src, dst, size, 1);
+
+out:
+	if (src)
+		free(src);
+	if (dst)
+		free(dst);
+}
@@ -24,6 +24,7 @@
 #include <sizes.h>
 #include <process.h>
 #include <heap.h>
+#include <slab.h>
 #include <bitmap.h>
 #include <log.h>
 
@@ -54,6 +55,8 @@ static uint32_t kernel_size;
 /* Current available I/O range address */
 struct list_head io_maplist;
 
+static kmem_cache_t *io_map_cache;
+
 void early_memory_init(void *fdt_paddr)
 {
 	int offset;
@@ -74,37 +77,194 @@ uint32_t get_kernel_size(void)
 	return kernel_size;
 }
 
+/*
+ * Page frame allocator (buddy system)
+ *
+ * Free page frames are grouped in blocks of 2^order pages aligned on their size (in pfn).
+ * The first page of a free block is linked in the free list of its order. When a block
+ * is released, it is merged with its buddy (the other half of the block of order + 1) as
+ * long as the buddy is free and has the same order.
+ * All pages belonging to a free block are marked as free in the frame table.
+ */
+
+struct free_area {
+	struct list_head free_list;
+	uint32_t nr_free; /* Number of free blocks of this order */
+};
+
+static struct free_area free_area[MAX_ORDER];
+
+/* Total number of free pages */
+static uint32_t nr_free_pages;
+
+static void set_pages_free(page_t *page, uint32_t nrpages, bool free)
+{
+	uint32_t i;
+
+	for (i = 0; i < nrpages; i++)
+		page[i].free = free;
+}
+
+/*
+ * Release a block of 2^order pages and merge it with its buddies.
+ * The pages must be marked as free. ft_lock must be held.
+ */
+static void __free_block(addr_t pfn, unsigned int order)
+{
+	page_t *page, *buddy;
+	addr_t buddy_pfn;
+
+	while (order < MAX_ORDER - 1) {
+		buddy_pfn = pfn ^ (1ul << order);
+
+		if (!pfn_valid(buddy_pfn))
+			break;
+
+		buddy = pfn_to_page(buddy_pfn);
+
+		/* Only the first page of a free block has a relevant order */
+		if (!buddy->free || (buddy->order != order))
+			break;
+
+		list_del(&buddy->list);
+		free_area[order].nr_free--;
+
+		pfn &= ~(1ul << order);
+		order++;
+	}
+
+	page = pfn_to_page(pfn);
+	page->order = order;
+
+	list_add(&page->list, &free_area[order].free_list);
+	free_area[order].nr_free++;
+}
+
+/*
+ * Release a range of pages which is not necessarily aligned; the range
+ * is split into the largest aligned blocks. ft_lock must be held.
+ */
+static void __free_range(addr_t pfn, uint32_t nrpages)
+{
+	unsigned int order;
+
+	nr_free_pages += nrpages;
+
+	while (nrpages) {
+		order = 0;
+		while ((order < MAX_ORDER - 1) && !(pfn & (1ul << order)) && ((2ul << order) <= nrpages))
+			order++;
+
+		/* The following pages are not free yet, so that they cannot be taken as buddy */
+		set_pages_free(pfn_to_page(pfn), 1ul << order, true);
+		__free_block(pfn, order);
+
+		pfn += 1ul << order;
+		nrpages -= 1ul << order;
+	}
+}
+
+/*
+ * Get a block of 2^order pages, splitting a larger block if necessary.
+ * The pages are not marked as busy. ft_lock must be held.
+ */
+static page_t *__alloc_block(unsigned int order)
+{
+	unsigned int cur;
+	page_t *page, *buddy;
+
+	for (cur = order; cur < MAX_ORDER; cur++)
+		if (!list_empty(&free_area[cur].free_list))
+			break;
+
+	if (cur == MAX_ORDER)
+		return NULL;
+
+	page = list_first_entry(&free_area[cur].free_list, page_t, list);
+
+	list_del(&page->list);
+	free_area[cur].nr_free--;
+
+	/* Give back the upper halves */
+	while (cur > order) {
+		cur--;
+
+		buddy = page + (1ul << cur);
+		buddy->order = cur;
+
+		list_add(&buddy->list, &free_area[cur].free_list);
+		free_area[cur].nr_free++;
+	}
+
+	return page;
+}
+
 /*
  * Get a free page. Return the physical address of the page (or 0 if not available).
  */
 addr_t get_free_page(void)
 {
-	uint32_t loop_mark;
-	static uint32_t __next_free_page = 0;
+	page_t *page;
 
 	spin_lock(&ft_lock);
 
-	/* Used to detect a cycle meaning that there no free page. */
-	loop_mark = __next_free_page;
+	page = __alloc_block(0);
+	if (!page) {
+		spin_unlock(&ft_lock);
 
-	do {
-		if (frame_table[__next_free_page].free) {
-			frame_table[__next_free_page].free = false;
+		/* No available page */
+		return 0;
+	}
 
-			spin_unlock(&ft_lock);
+	page->free = false;
+	nr_free_pages--;
 
-			/* Found an available page */
-			return page_to_phys(&frame_table[__next_free_page]);
-		}
+	spin_unlock(&ft_lock);
+
+	return page_to_phys(page);
+}
+
+/*
+ * Get a number of pages which are not necessarily contiguous. The physical addresses
+ * are stored in <pages>. The pages are taken from the largest suitable blocks.
+ * Returns 0 on success, or -1 if there are not enough free pages (nothing is allocated).
+ */
+int get_free_pages(addr_t *pages, uint32_t nrpages)
+{
+	page_t *page;
+	unsigned int order;
+	uint32_t i, count = 0;
+
+	spin_lock(&ft_lock);
+
+	if (nr_free_pages < nrpages) {
+		spin_unlock(&ft_lock);
+		return -1;
+	}
+
+	while (count < nrpages) {
+		order = get_order_from_bytes((addr_t) (nrpages - count) << PAGE_SHIFT);
+
+		/* The largest block which is not greater than the remaining number of pages */
+		if ((order > 0) && ((1ul << order) > nrpages - count))
+			order--;
+		if (order > MAX_ORDER - 1)
+			order = MAX_ORDER - 1;
 
-		/* Prepare to be ready fo the next request (or increment if not available */
-		__next_free_page = (__next_free_page + 1) % mem_info.avail_pages;
+		/* There are enough free pages, so that an order-0 block at least is available */
+		while (!(page = __alloc_block(order)))
+			order--;
 
-	} while (__next_free_page != loop_mark);
+		set_pages_free(page, 1ul << order, false);
+
+		for (i = 0; i < (1ul << order); i++)
+			pages[count++] = page_to_phys(page + i);
+	}
+
+	nr_free_pages -= nrpages;
 
 	spin_unlock(&ft_lock);
 
-	/* No available page */
 	return 0;
 }
 
@@ -133,7 +293,9 @@ void free_page(addr_t paddr)
 	spin_lock(&ft_lock);
 
 	page = (page_t *) phys_to_page(paddr);
-	page->free = true;
+	ASSERT(!page->free);
+
+	__free_range(page_to_pfn(page), 1);
 
 	spin_unlock(&ft_lock);
 }
@@ -149,34 +311,38 @@ void free_vpage(addr_t vaddr)
 }
 
 /*
- * Search for a number of contiguous pages.
+ * Get a number of contiguous pages.
+ * The smallest suitable block is taken and the pages beyond <nrpages> are given back.
  * Returns 0 if not available.
  */
 addr_t get_contig_free_pages(uint32_t nrpages)
 {
-	uint32_t i, base = 0;
+	page_t *page;
+	unsigned int order;
+
+	order = get_order_from_bytes((addr_t) nrpages << PAGE_SHIFT);
+	if (order >= MAX_ORDER)
+		return 0;
 
 	spin_lock(&ft_lock);
 
-	for (i = 0; i < mem_info.avail_pages; i++) {
-		if (frame_table[i].free) {
-			if (i - base + 1 == nrpages) {
-				/* Set the page as busy */
-				for (i = 0; i < nrpages; i++)
-					frame_table[base + i].free = false;
+	page = __alloc_block(order);
+	if (!page) {
+		spin_unlock(&ft_lock);
+		return 0;
+	}
 
-				spin_unlock(&ft_lock);
+	/* The whole block is busy before its tail can be released */
+	set_pages_free(page, 1ul << order, false);
+	nr_free_pages -= 1ul << order;
 
-				/* Returns the block base */
-				return page_to_phys(&frame_table[base]);
-			}
-		} else
-			base = i + 1;
-	}
+	if (nrpages < (1ul << order))
+		__free_range(page_to_pfn(page) + nrpages, (1ul << order) - nrpages);
 
 	spin_unlock(&ft_lock);
 
-	return 0;
+	/* Returns the block base */
+	return page_to_phys(page);
 }
 
 /*
@@ -197,15 +363,13 @@ addr_t get_contig_free_vpages(uint32_t nrpages)
 
 void free_contig_pages(addr_t paddr, uint32_t nrpages)
 {
-	uint32_t i;
 	page_t *page;
 
 	spin_lock(&ft_lock);
 
 	page = (page_t *) phys_to_page(paddr);
 
-	for (i = 0; i < nrpages; i++)
-		(page + i)->free = true;
+	__free_range(page_to_pfn(page), nrpages);
 
 	spin_unlock(&ft_lock);
 }
@@ -231,6 +395,23 @@ void dump_frame_table(void)
 			  frame_table[i].free);
 }
 
+/*
+ * Dump the number of free blocks of each order.
+ */
+void dump_free_areas(void)
+{
+	int i;
+
+	spin_lock(&ft_lock);
+
+	LOG_INFO("** Free page frames: %d / %d **\n", nr_free_pages, mem_info.avail_pages);
+
+	for (i = 0; i < MAX_ORDER; i++)
+		LOG_INFO("  - order %2d (%6d KB): %d free blocks\n", i, (PAGE_SIZE << i) / SZ_1K, free_area[i].nr_free);
+
+	spin_unlock(&ft_lock);
+}
+
 /*
  * I/O address space management
  */
@@ -288,7 +469,7 @@ addr_t io_map(addr_t phys, size_t size)
 		}
 	}
 
-	io_map = (io_map_t *) malloc(sizeof(io_map_t));
+	io_map = (io_map_t *) kmem_cache_alloc(io_map_cache);
 	ASSERT(io_map != NULL);
 
 	io_map->vaddr = target;
@@ -356,7 +537,7 @@ void io_unmap(addr_t vaddr)
 
 	release_mapping(NULL, cur->vaddr, cur->size);
 
-	free(cur);
+	kmem_cache_free(io_map_cache, cur);
 }
 #endif /* CONFIG_MMU */
 
@@ -398,7 +579,7 @@ void frame_table_init(addr_t frame_table_start)
 	}
 
 	for (i = ft_pages; i < mem_info.avail_pages; i++) {
-		frame_table[i].free = true;
+		frame_table[i].free = false;
 		frame_table[i].refcount = 0;
 	}
 
@@ -418,6 +599,16 @@ void frame_table_init(addr_t frame_table_start)
 	LOG_DEBUG("  - Page frame number of the first available page: 0x%x", pfn_start);
 
 	spin_lock_init(&ft_lock);
+
+	for (i = 0; i < MAX_ORDER; i++) {
+		INIT_LIST_HEAD(&free_area[i].free_list);
+		free_area[i].nr_free = 0;
+	}
+
+	nr_free_pages = 0;
+
+	/* Populate the free lists with the pages following the frame table */
+	__free_range(pfn_start + ft_pages, mem_info.avail_pages - ft_pages);
 }
 
 /*
@@ -442,6 +633,11 @@ void memory_init(void)
 	/* Initialize the kernel heap */
 	heap_init();
 
+#ifdef CONFIG_MMU
+	io_map_cache = kmem_cache_create("io_map", sizeof(io_map_t), 0);
+	BUG_ON(!io_map_cache);
+#endif
+
 #ifdef CONFIG_MMU
 	LOG_DEBUG("Device tree virt addr: %lx", __fdt_addr);
 	LOG_DEBUG("Relocating the device tree from 0x%x to 0x%p (size of %d bytes)", __fdt_addr, __end,
@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2025 Daniel Rossier <daniel.rossier@heig-vd.ch>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Object caches
+ *
+ * A cache manages objects of a fixed size carved out of slabs taken from the kernel heap.
+ * Each CPU keeps a magazine of free objects so that most allocations and releases are
+ * performed with local IRQs disabled only, without taking the cache lock.
+ */
+
+#include <common.h>
+#include <heap.h>
+#include <slab.h>
+#include <memory.h>
+#include <string.h>
+#include <log.h>
+
+#include <asm/processor.h>
+
+/* Minimal number of objects in a slab */
+#define SLAB_MIN_OBJS 8
+
+/* Largest slab */
+#define SLAB_MAX_SIZE (PAGE_SIZE << 3)
+
+/* Number of empty slabs kept in a cache before they are given back to the heap */
+#define SLAB_MAX_FREE 1
+
+#ifdef CONFIG_SMP
+#define slab_cpu() smp_processor_id()
+#else
+#define slab_cpu() 0
+#endif
+
+static LIST_HEAD(kmem_caches);
+static DEFINE_SPINLOCK(kmem_caches_lock);
+
+/* Room taken before each object by the link to its slab */
+#define SLAB_LINK_SIZE(align) ALIGN_UP(sizeof(struct slab *), align)
+
+static struct slab *slab_of(void *obj)
+{
+	return *((struct slab **) obj - 1);
+}
+
+/*
+ * Allocate a new slab and build the list of its free objects.
+ * cache->lock must be held.
+ */
+static struct slab *grow_cache(kmem_cache_t *cache)
+{
+	struct slab *slab;
+	addr_t obj;
+	unsigned int i;
+
+	slab = memalign(cache->slab_size, cache->align);
+	if (!slab)
+		return NULL;
+
+	slab->cache = cache;
+	slab->inuse = 0;
+	slab->freelist = NULL;
+
+	/* Objects are placed after the slab descriptor, each one right after its link to the slab */
+	obj = (addr_t) slab + ALIGN_UP(sizeof(struct slab), cache->align) + SLAB_LINK_SIZE(cache->align);
+
+	for (i = 0; i < cache->objs_per_slab; i++, obj += cache->stride) {
+		*((struct slab **) obj - 1) = slab;
+
+		*((void **) obj) = slab->freelist;
+		slab->freelist = (void *) obj;
+	}
+
+	list_add(&slab->list, &cache->slabs_free);
+
+	cache->nr_slabs++;
+	cache->nr_free_slabs++;
+
+	return slab;
+}
+
+/*
+ * Take an object from the slabs. cache->lock must be held.
+ */
+static void *__slab_alloc(kmem_cache_t *cache)
+{
+	struct slab *slab;
+	void *obj;
+
+	if (!list_empty(&cache->slabs_partial))
+		slab = list_first_entry(&cache->slabs_partial, struct slab, list);
+
+	else if (!list_empty(&cache->slabs_free))
+		slab = list_first_entry(&cache->slabs_free, struct slab, list);
+
+	else {
+		slab = grow_cache(cache);
+		if (!slab)
+			return NULL;
+	}
+
+	obj = slab->freelist;
+	slab->freelist = *((void **) obj);
+
+	if (!slab->inuse++)
+		cache->nr_free_slabs--;
+
+	list_del(&slab->list);
+
+	if (slab->inuse == cache->objs_per_slab)
+		list_add(&slab->list, &cache->slabs_full);
+	else
+		list_add(&slab->list, &cache->slabs_partial);
+
+	return obj;
+}
+
+/*
+ * Give an object back to its slab. cache->lock must be held.
+ */
+static void __slab_free(kmem_cache_t *cache, void *obj)
+{
+	struct slab *slab = slab_of(obj);
+
+	BUG_ON(slab->cache != cache);
+
+	*((void **) obj) = slab->freelist;
+	slab->freelist = obj;
+
+	list_del(&slab->list);
+
+	if (--slab->inuse) {
+		list_add(&slab->list, &cache->slabs_partial);
+		return;
+	}
+
+	/* The slab is empty */
+	if (cache->nr_free_slabs == SLAB_MAX_FREE) {
+		cache->nr_slabs--;
+		free(slab);
+	} else {
+		list_add(&slab->list, &cache->slabs_free);
+		cache->nr_free_slabs++;
+	}
+}
+
+/*
+ * Create a cache of objects of <size> bytes aligned on <align> bytes (0 for the natural alignment).
+ * Returns NULL if the object is too large.
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align)
+{
+	kmem_cache_t *cache;
+	size_t avail;
+	unsigned long flags;
+
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+
+	/* An object must be able to store the link to the next free object */
+	if (size < sizeof(void *))
+		size = sizeof(void *);
+
+	size = ALIGN_UP(size, align);
+
+	cache = malloc(sizeof(kmem_cache_t));
+	if (!cache)
+		return NULL;
+
+	memset(cache, 0, sizeof(kmem_cache_t));
+
+	strncpy(cache->name, name, KMEM_CACHE_NAME_LEN - 1);
+
+	cache->size = size;
+	cache->align = align;
+	cache->stride = size + SLAB_LINK_SIZE(align);
+
+	/* Use the smallest slab holding enough objects */
+	for (cache->slab_size = PAGE_SIZE; cache->slab_size <= SLAB_MAX_SIZE; cache->slab_size <<= 1) {
+		avail = cache->slab_size - ALIGN_UP(sizeof(struct slab), align);
+		if (avail / cache->stride >= SLAB_MIN_OBJS)
+			break;
+	}
+
+	if (cache->slab_size > SLAB_MAX_SIZE) {
+		LOG_ERROR("%s: objects of %d bytes are too large for cache %s\n", __func__, size, name);
+		free(cache);
+		return NULL;
+	}
+
+	cache->objs_per_slab = avail / cache->stride;
+
+	spin_lock_init(&cache->lock);
+
+	INIT_LIST_HEAD(&cache->slabs_full);
+	INIT_LIST_HEAD(&cache->slabs_partial);
+	INIT_LIST_HEAD(&cache->slabs_free);
+
+	flags = spin_lock_irqsave(&kmem_caches_lock);
+	list_add_tail(&cache->list, &kmem_caches);
+	spin_unlock_irqrestore(&kmem_caches_lock, flags);
+
+	return cache;
+}
+
+/*
+ * Release a cache and all its slabs. The objects must have been freed.
+ */
+void kmem_cache_destroy(kmem_cache_t *cache)
+{
+	struct slab *slab, *tmp;
+	unsigned long flags;
+	int i;
+
+	flags = spin_lock_irqsave(&kmem_caches_lock);
+	list_del(&cache->list);
+	spin_unlock_irqrestore(&kmem_caches_lock, flags);
+
+	flags = spin_lock_irqsave(&cache->lock);
+
+	for (i = 0; i < CONFIG_NR_CPUS; i++)
+		while (cache->magazine[i].count)
+			__slab_free(cache, cache->magazine[i].objs[--cache->magazine[i].count]);
+
+	if (!list_empty(&cache->slabs_full) || !list_empty(&cache->slabs_partial))
+		LOG_WARNING("%s: cache %s still has objects in use\n", __func__, cache->name);
+
+	list_for_each_entry_safe(slab, tmp, &cache->slabs_free, list)
+		free(slab);
+
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	free(cache);
+}
+
+/*
+ * Allocate an object. Returns NULL if no memory is available.
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache)
+{
+	struct kmem_magazine *mag;
+	unsigned long flags;
+	void *obj;
+
+	flags = local_irq_save();
+
+	mag = &cache->magazine[slab_cpu()];
+
+	if (likely(mag->count)) {
+		mag->allocs++;
+		mag->hits++;
+		obj = mag->objs[--mag->count];
+
+		local_irq_restore(flags);
+
+		return obj;
+	}
+
+	/* Refill half of the magazine at once */
+	spin_lock(&cache->lock);
+
+	obj = __slab_alloc(cache);
+
+	while (obj && (mag->count < KMEM_MAGAZINE_SIZE / 2)) {
+		mag->objs[mag->count] = __slab_alloc(cache);
+		if (!mag->objs[mag->count])
+			break;
+		mag->count++;
+	}
+
+	spin_unlock(&cache->lock);
+
+	if (obj)
+		mag->allocs++;
+
+	local_irq_restore(flags);
+
+	return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj)
+{
+	struct kmem_magazine *mag;
+	unsigned long flags;
+
+	if (!obj)
+		return;
+
+	flags = local_irq_save();
+
+	mag = &cache->magazine[slab_cpu()];
+	mag->frees++;
+
+	if (unlikely(mag->count == KMEM_MAGAZINE_SIZE)) {
+		/* Give back half of the magazine to the slabs */
+		spin_lock(&cache->lock);
+
+		while (mag->count > KMEM_MAGAZINE_SIZE / 2)
+			__slab_free(cache, mag->objs[--mag->count]);
+
+		spin_unlock(&cache->lock);
+	}
+
+	mag->objs[mag->count++] = obj;
+
+	local_irq_restore(flags);
+}
+
+/*
+ * Dump the statistics of all caches.
+ */
+void dump_kmem_caches(void)
+{
+	kmem_cache_t *cache;
+	unsigned long allocs, frees, hits, flags;
+	int i;
+
+	LOG_INFO("** Object caches **\n");
+	LOG_INFO("  %-24s %6s %8s %8s %6s %10s %10s %10s\n", "name", "size", "active", "total", "slabs", "allocs", "frees",
+		 "hits");
+
+	flags = spin_lock_irqsave(&kmem_caches_lock);
+
+	list_for_each_entry(cache, &kmem_caches, list) {
+		allocs = frees = hits = 0;
+
+		for (i = 0; i < CONFIG_NR_CPUS; i++) {
+			allocs += cache->magazine[i].allocs;
+			frees += cache->magazine[i].frees;
+			hits += cache->magazine[i].hits;
+		}
+
+		LOG_INFO("  %-24s %6d %8d %8d %6d %10lu %10lu %10lu\n", cache->name, cache->size, allocs - frees,
+			 cache->nr_slabs * cache->objs_per_slab, cache->nr_slabs, allocs, frees, hits);
+	}
+
+	spin_unlock_irqrestore(&kmem_caches_lock, flags);
+}
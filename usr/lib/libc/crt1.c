@@ -32,7 +32,6 @@
  */
 extern char __bss_start[], __bss_end[];
 extern int main(int argc, char **argv);
-extern void mutex_init(void);
 
 void finish_child(int signum) {
 	int saved_errno;
@@ -5,5 +5,5 @@ struct __dirstream
 	int buf_pos;
 	int buf_end;
 	volatile int lock[2];
-	char buf[2048];
+	char buf[4096];
 };
@@ -1,12 +1,11 @@
 #include <dirent.h>
-#include "syscall.h"
-#include "libc.h"
+#include <syscall.h>
+#include <libc.h>
 
 int __getdents(int fd, struct dirent *buf, size_t len)
 {
-	return syscall(SYS_getdents, fd, buf, len);
+	return sys_getdents64(fd, (char *) buf, len);
 }
 
+/* getdents64() is an alias of getdents() in <dirent.h> */
 weak_alias(__getdents, getdents);
-
-LFS64(getdents);
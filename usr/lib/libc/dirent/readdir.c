@@ -12,7 +12,8 @@ struct dirent *readdir(DIR *dir)
 	
 	if (dir->buf_pos >= dir->buf_end) {
 
-		int len = sys_readdir(dir->fd, dir->buf, sizeof dir->buf);
+		/* Fill the buffer with as many entries as possible */
+		int len = sys_getdents64(dir->fd, dir->buf, sizeof dir->buf);
 
 #if 0
 		int len = __syscall(SYS_getdents, dir->fd, dir->buf, sizeof dir->buf);
@@ -23,10 +23,14 @@ struct dirent {
 	unsigned short d_reclen;
 	unsigned char d_type;
 	char d_name[256];
+	unsigned long long __d_size;	/* Room for the size ending the longest record (SO3) */
 };
 
 #define d_fileno d_ino
 
+/* Size of a regular file (SO3), stored by getdents64() in the last 8 bytes of the record */
+#define DIRENT_SIZE(de) (*(unsigned long long *)((char *)(de) + (de)->d_reclen - 8))
+
 int            closedir(DIR *);
 DIR           *fdopendir(int);
 DIR           *opendir(const char *);
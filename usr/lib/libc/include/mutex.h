@@ -1,10 +1,24 @@
-
-
 #ifndef MUTEX_H
 #define MUTEX_H
 
-void mutex_lock(int lock_idx);
-void mutex_unlock(int lock_idx);
+/*
+ * User space mutex, with no limit on their number.
+ * A mutex may be locked again by its owner and must then be unlocked as many times.
+ */
+typedef struct {
+	/* 0: unlocked, 1: locked, 2: locked with possible waiters in the kernel (futex) */
+	volatile int state;
+
+	/* Thread ID of the owner and number of nested locks */
+	int owner;
+	unsigned int count;
+} mutex_t;
+
+#define MUTEX_INITIALIZER { 0, 0, 0 }
 
+void mutex_init(mutex_t *m);
+void mutex_lock(mutex_t *m);
+int mutex_trylock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
 
 #endif /* MUTEX_H */
@@ -24,9 +24,27 @@
 
 typedef int pthread_t;
 
+struct sched_param {
+	int sched_priority;
+};
+
+typedef struct { unsigned __attr; } pthread_mutexattr_t;
+
+#define PTHREAD_MUTEX_INITIALIZER {{{0}}}
+
 /* Thread creation */
 int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg);
 
+/* Thread attributes */
+int pthread_attr_init(pthread_attr_t *attr);
+int pthread_attr_destroy(pthread_attr_t *attr);
+int pthread_attr_setstacksize(pthread_attr_t *attr, size_t size);
+int pthread_attr_getstacksize(const pthread_attr_t *attr, size_t *size);
+int pthread_attr_setstack(pthread_attr_t *attr, void *addr, size_t size);
+int pthread_attr_getstack(const pthread_attr_t *attr, void **addr, size_t *size);
+int pthread_attr_setschedparam(pthread_attr_t *attr, const struct sched_param *param);
+int pthread_attr_getschedparam(const pthread_attr_t *attr, struct sched_param *param);
+
 /* Thread join / synchronisation */
 int pthread_join(pthread_t thread, void **value_ptr);
 
@@ -39,6 +57,13 @@ void pthread_exit(void *value_ptr);
 /* Thread yield */
 int pthread_yield(void);
 
+/* Mutexes */
+int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr);
+int pthread_mutex_destroy(pthread_mutex_t *mutex);
+int pthread_mutex_lock(pthread_mutex_t *mutex);
+int pthread_mutex_trylock(pthread_mutex_t *mutex);
+int pthread_mutex_unlock(pthread_mutex_t *mutex);
+
 #ifdef TEST_LABO03
 void pthread_test_start(void);
 int pthread_test_verif(void);
@@ -56,6 +56,9 @@ struct _IO_FILE {
 	off_t shlim, shcnt;
 	FILE *prev_locked, *next_locked;
 	struct __locale_struct *locale;
+
+	/* SO3: lock of the stream */
+	mutex_t mutex;
 };
 
 size_t __stdio_read(FILE *, unsigned char *, size_t);
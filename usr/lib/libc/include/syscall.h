@@ -80,9 +80,12 @@
 #define syscallSigreturn         	48
 
 #define syscallLseek			50
+#define syscallMunmap			51
+#define syscallGetdents64		52
+#define syscallMkdir			53
+#define syscallSplice			54
 
-#define syscallMutexLock		60
-#define syscallMutexUnlock		61
+#define syscallFutex			62
 
 #define syscallPs                       63
 
@@ -98,6 +101,12 @@
 #define SYSINFO_DUMP_SCHED	1
 #define SYSINFO_TEST_MALLOC	2
 #define SYSINFO_PRINTK	 	3
+#define SYSINFO_DUMP_PROC	4
+#define SYSINFO_TEST_TIMER	5
+#define SYSINFO_TEST_STRING	6
+#define SYSINFO_DUMP_BCACHE	7
+#define SYSINFO_DUMP_DCACHE	8
+#define SYSINFO_TEST_SEM	9
 
 #ifndef __ASSEMBLY__
 
@@ -214,6 +223,15 @@ int sys_creat(const char *pathname, mode_t mode);
  */
 int sys_unlink(char *name);
 
+/**
+ * mkdir - create a directory
+ *
+ * The permission bits in <mode> are currently ignored.
+ *
+ * Returns 0 on success, or -1 if an error occurred (in which case, errno is set appropriately).
+ */
+int sys_mkdir(const char *pathname, int mode);
+
 /**
  * open - open and possibly create a file or device
  *
@@ -232,6 +250,14 @@ int sys_read(int fd, void *buf, size_t count);
 
 int sys_readdir(int fd, char *buf, int len);
 
+/**
+ * Read as many entries of a directory as fit in <buf> (records of d_reclen bytes).
+ * <len> must be able to hold a record with a name of 255 characters.
+ *
+ * Returns the number of bytes read, 0 at the end of the directory, or -1 on error.
+ */
+int sys_getdents64(int fd, char *buf, int len);
+
 /**
  * Close a file descriptor, so that it no longer refers to any file or stream and may be
  * reused.
@@ -277,6 +303,16 @@ int sys_ioctl(int fd, int cmd, void *val);
  */
 int sys_fcntl(int fd, int cmd, void *val);
 
+/**
+ * splice - move up to <len> bytes between a pipe and another file descriptor without
+ * copying them through the user space. Exactly one of <fd_in> and <fd_out> must be a pipe.
+ * If <off_in> (resp. <off_out>) is not NULL, the file is accessed from this offset which
+ * is updated, and the file position is left unchanged.
+ *
+ * Returns the number of bytes moved, 0 if the input pipe has no writer anymore, or -1 on error.
+ */
+int sys_splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned int flags);
+
 /*
  *  lseek() repositions the file offset of the open file description associated with the file descriptor fd to the argument offset
  *  according to the directive whence as follows:
@@ -311,16 +347,29 @@ off_t sys_lseek(int fd, off_t offset, int whence);
  */
 #define IOR_NETWORK_ADDRESS 2
 
+/*
+ * Attributes of a new thread as expected by the kernel.
+ * A field set to 0 means the default value.
+ */
+struct thread_attr {
+	/* Address start_routine returns to, with its return value as argument */
+	unsigned long exit_fn;
+
+	/* Stack allocated by the process, otherwise the kernel uses one of its stack slots */
+	unsigned long stack_top;
+	size_t stack_size;
+
+	/* Priority, the priority of the main thread by default */
+	unsigned int prio;
+};
+
 /**
- * Clone a thread.
+ * Create a thread running start_routine(arg) directly.
  *
- * Returns the thread ID on success to the parent and 0 to the child, or
+ * Returns 0 on success and stores the thread ID in *thread, or
  * -1 on error and set errno.
-
- * entryState=true: first invocation by the parent (routine and args has to be passed)
- * entryState=false: second invocation by the child (which retrieved routine and args from the kernel)
  */
-int sys_thread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg);
+int sys_thread_create(pthread_t *thread, const struct thread_attr *attr, void *(*start_routine)(void *), void *arg);
 
 /**
  * The thread_join() function waits for the thread specified by thread to
@@ -488,6 +537,11 @@ int sys_setsockopt(int fd, int level, int optname, const void *optval, socklen_t
  */
 void *sys_mmap(uint32_t start, size_t length, int prot, int fd, off_t offset);
 
+/**
+ * Remove the mappings of files located in the range [start, start + length[.
+ */
+int sys_munmap(uint32_t start, size_t length);
+
 /**
  * The ptrace() system call provides a means by which one process (the "tracer")
  * may observe and control the execution of another process (the "tracee"), and
@@ -540,12 +594,15 @@ int sys_clock_gettime(clockid_t clk, struct timespec *ts);
 void *sys_sbrk(int increment);
 
 /*
- * First attempt of mutex implementation in the user space. Mainly used, at the moment,
- * for debugging kernel mutexes.
+ * futex syscall (see futex.h for the operations).
+ * FUTEX_WAIT suspends the thread as long as *uaddr equals <val>, <timeout> being a relative
+ * delay (struct timespec *) or NULL. FUTEX_WAKE wakes up to <val> threads waiting on <uaddr>.
+ * FUTEX_(CMP_)REQUEUE wakes up to <val> threads and moves up to <timeout> (a number) other
+ * waiters to <uaddr2>, provided that *uaddr equals <val3> for FUTEX_CMP_REQUEUE.
+ *
+ * Returns 0 or the number of threads woken up/requeued, or -1 if an error occurred.
  */
-
-void sys_mutex_lock(int lock_idx);
-void sys_mutex_unlock(int lock_idx);
+int sys_futex(volatile int *uaddr, int op, int val, void *timeout, volatile int *uaddr2, int val3);
 
 
 /*
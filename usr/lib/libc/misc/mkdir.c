@@ -0,0 +1,7 @@
+#include <sys/stat.h>
+#include <syscall.h>
+
+int mkdir(const char *pathname, mode_t mode)
+{
+	return sys_mkdir(pathname, mode);
+}
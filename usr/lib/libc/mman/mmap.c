@@ -17,7 +17,9 @@ weak_alias(dummy, __vm_wait);
 void *__mmap(void *start, size_t len, int prot, int flags, int fd, off_t off)
 {
 
-	if (start || flags) {
+	/* Files are always mapped as MAP_SHARED: a write to a page of a file mapped
+	 * with PROT_WRITE gives a private copy to the process (as with MAP_PRIVATE). */
+	if (start || (flags & ~(MAP_SHARED | MAP_PRIVATE))) {
 		/* Issue warning for unsupported parameters. */
 		printf("%s: start and flags parameters are not supported.\n", __func__);
 	}
@@ -1,14 +1,20 @@
 #include <sys/mman.h>
-#include "syscall.h"
-#include "libc.h"
+#include <syscall.h>
+#include <libc.h>
 
+#if 0 /* original musl implementation */
 static void dummy(void) { }
 weak_alias(dummy, __vm_wait);
+#endif
 
 int __munmap(void *start, size_t len)
 {
+	return sys_munmap((unsigned long) start, len);
+
+#if 0 /* original musl implementation */
 	__vm_wait();
 	return syscall(SYS_munmap, start, len);
+#endif
 }
 
 weak_alias(__munmap, munmap);
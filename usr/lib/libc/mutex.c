@@ -1,12 +1,82 @@
-
+#include <stddef.h>
 #include <syscall.h>
+#include <mutex.h>
+#include <futex.h>
+#include <atomic.h>
+
+/*
+ * An uncontended lock or unlock is a single atomic operation on the lock word;
+ * the kernel is entered only to sleep on a locked mutex or to wake up a waiter.
+ */
+
+/* The kernel keeps the ID of the running thread in the user read-only thread ID register */
+static inline int thread_id(void) {
+	unsigned long tid;
+
+#ifdef __aarch64__
+	__asm__ __volatile__ ("mrs %0, tpidrro_el0" : "=r"(tid));
+#else
+	__asm__ __volatile__ ("mrc p15, 0, %0, c13, c0, 3" : "=r"(tid));
+#endif
+
+	return tid;
+}
+
+void mutex_init(mutex_t *m) {
+	m->state = 0;
+	m->owner = 0;
+	m->count = 0;
+}
+
+void mutex_lock(mutex_t *m) {
+	int c, self = thread_id();
 
-void mutex_lock(int lock_idx) {
-	sys_mutex_lock(lock_idx);
+	/* The owner is only set by the thread holding the mutex */
+	if (m->state && (m->owner == self)) {
+		m->count++;
+		return;
+	}
+
+	c = a_cas(&m->state, 0, 1);
+	if (c) {
+		/* Announce a waiter, then sleep as long as the mutex is held */
+		if (c != 2)
+			c = a_swap(&m->state, 2);
+
+		while (c) {
+			sys_futex(&m->state, FUTEX_WAIT | FUTEX_PRIVATE, 2, NULL, NULL, 0);
+			c = a_swap(&m->state, 2);
+		}
+	}
+
+	m->owner = self;
 }
 
-void mutex_unlock(int lock_idx) {
-	sys_mutex_unlock(lock_idx);
+/* Returns 0 if the mutex has been acquired, -1 if it is held by another thread */
+int mutex_trylock(mutex_t *m) {
+	int self = thread_id();
+
+	if (m->state && (m->owner == self)) {
+		m->count++;
+		return 0;
+	}
+
+	if (a_cas(&m->state, 0, 1))
+		return -1;
+
+	m->owner = self;
+
+	return 0;
 }
 
+void mutex_unlock(mutex_t *m) {
+	if (m->count) {
+		m->count--;
+		return;
+	}
 
+	m->owner = 0;
+
+	if (a_swap(&m->state, 0) == 2)
+		sys_futex(&m->state, FUTEX_WAKE | FUTEX_PRIVATE, 1, NULL, NULL, 0);
+}
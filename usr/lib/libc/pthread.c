@@ -20,26 +20,19 @@
 #include <syscall.h>
 #include <stdlib.h>
 #include <stddef.h>
-#include <assert.h>
+#include <limits.h>
+#include <errno.h>
+#include <mutex.h>
 
-void *(*__thread_fn)(void *) = NULL;
+/* Layout of pthread_attr_t, as in musl */
+#define __SU (sizeof(size_t) / sizeof(int))
 
-void *__thread_routine(void *args) {
-	void *(*____thread_fn)(void *);
+#define _a_stacksize __u.__s[0]
+#define _a_stackaddr __u.__s[2]
+#define _a_prio __u.__i[3 * __SU + 3]
 
-	____thread_fn = __thread_fn;
-	__thread_fn = NULL;
-
-	____thread_fn(args);
-
-	sys_thread_exit(NULL);
-
-	/* We should never be here ... */
-
-	assert(0);
-
-	return NULL;
-}
+/* Priority levels of the kernel run queues (0 to 99) */
+#define SCHED_PRIO_LEVELS 100
 
 /* Yield to another thread */
 int pthread_yield(void) {
@@ -48,17 +41,27 @@ int pthread_yield(void) {
 	return 0;
 }
 
-/* Thread creation */
+/*
+ * Thread creation
+ *
+ * The kernel starts the thread in start_routine directly. Returning from
+ * start_routine leads to pthread_exit() with the returned value.
+ */
 int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg) {
-	int ret;
+	struct thread_attr thread_attr = { 0 };
+
+	thread_attr.exit_fn = (unsigned long) pthread_exit;
 
-	while (__thread_fn != NULL)
-		pthread_yield();
+	if (attr) {
+		thread_attr.stack_top = attr->_a_stackaddr;
+		thread_attr.stack_size = attr->_a_stacksize;
+		thread_attr.prio = attr->_a_prio;
+	}
 
-	__thread_fn = start_routine;
-	ret = sys_thread_create(thread, attr, __thread_routine, arg);
+	if (sys_thread_create(thread, &thread_attr, start_routine, arg) < 0)
+		return errno;
 
-	return ret;
+	return 0;
 }
 
 /* Thread join / synchronisation */
@@ -77,10 +80,91 @@ void pthread_exit(void *value_ptr) {
 	sys_thread_exit(value_ptr);
 }
 
-void pthread_mutex_lock(void) {
-	sys_mutex_lock(2);
+/* Thread attributes */
+int pthread_attr_init(pthread_attr_t *attr) {
+	*attr = (pthread_attr_t) { 0 };
+
+	return 0;
+}
+
+int pthread_attr_destroy(pthread_attr_t *attr) {
+	return 0;
+}
+
+int pthread_attr_setstacksize(pthread_attr_t *attr, size_t size) {
+	if (size < PTHREAD_STACK_MIN)
+		return EINVAL;
+
+	attr->_a_stackaddr = 0;
+	attr->_a_stacksize = size;
+
+	return 0;
+}
+
+int pthread_attr_getstacksize(const pthread_attr_t *attr, size_t *size) {
+	*size = attr->_a_stacksize;
+
+	return 0;
+}
+
+int pthread_attr_setstack(pthread_attr_t *attr, void *addr, size_t size) {
+	if (size < PTHREAD_STACK_MIN)
+		return EINVAL;
+
+	attr->_a_stackaddr = (size_t) addr + size;
+	attr->_a_stacksize = size;
+
+	return 0;
 }
 
-void pthread_mutex_unlock(void) {
-	sys_mutex_unlock(2);
+int pthread_attr_getstack(const pthread_attr_t *attr, void **addr, size_t *size) {
+	if (!attr->_a_stackaddr)
+		return EINVAL;
+
+	*size = attr->_a_stacksize;
+	*addr = (void *) (attr->_a_stackaddr - *size);
+
+	return 0;
+}
+
+int pthread_attr_setschedparam(pthread_attr_t *attr, const struct sched_param *param) {
+	if ((param->sched_priority < 0) || (param->sched_priority >= SCHED_PRIO_LEVELS))
+		return EINVAL;
+
+	attr->_a_prio = param->sched_priority;
+
+	return 0;
+}
+
+int pthread_attr_getschedparam(const pthread_attr_t *attr, struct sched_param *param) {
+	param->sched_priority = attr->_a_prio;
+
+	return 0;
+}
+
+/* Mutexes, built on the user space mutexes of the libc */
+int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr) {
+	mutex_init((mutex_t *) mutex);
+
+	return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex) {
+	return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+	mutex_lock((mutex_t *) mutex);
+
+	return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+	return (mutex_trylock((mutex_t *) mutex) ? EBUSY : 0);
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) {
+	mutex_unlock((mutex_t *) mutex);
+
+	return 0;
 }
@@ -10,7 +10,7 @@ int __lockfile(FILE *f)
 	while ((owner = a_cas(&f->lock, 0, tid)))
 		__wait(&f->lock, &f->waiters, owner, 1);
 #endif
-	mutex_lock((f == stdin) ? 0 : 1);
+	mutex_lock(&f->mutex);
 
 	return 1;
 }
@@ -31,5 +31,5 @@ void __unlockfile(FILE *f)
 
 	if (f->waiters) __wake(&f->lock, 1, 1);
 #endif
-	mutex_unlock((f == stdin) ? 0 : 1);
+	mutex_unlock(&f->mutex);
 }
@@ -3,5 +3,9 @@
 
 int __futex(volatile int *addr, int op, int val, void *ts)
 {
+	return sys_futex(addr, op, val, ts, 0, 0);
+
+#if 0 /* so3 */
 	return syscall(SYS_futex, addr, op, val, ts);
+#endif
 }
@@ -1,12 +1,16 @@
 #include <unistd.h>
 #include <fcntl.h>
-#include "syscall.h"
+#include <syscall.h>
 
 int unlink(const char *path)
 {
+	return sys_unlink((char *) path);
+
+#if 0 /* so3 */
 #ifdef SYS_unlink
 	return syscall(SYS_unlink, path);
 #else
 	return syscall(SYS_unlinkat, AT_FDCWD, path, 0);
 #endif
+#endif
 }
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2025 André Costa <andre_miguel_costa@hotmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Measure the cost of a switch between two processes. A parent and its child
+ * exchange a byte through a pair of pipes, so that each round trip requires
+ * two process switches.
+ *
+ * Usage: ctx_bench [number of round trips]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long) ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char *argv[])
+{
+	int ping[2], pong[2];
+	int count = 10000;
+	unsigned long long start, delta;
+	pid_t pid;
+	char c = 0;
+	int i;
+
+	if (argc > 1)
+		count = atoi(argv[1]);
+
+	if (pipe(ping) || pipe(pong)) {
+		printf("ctx_bench: cannot create the pipes\n");
+		return 1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		printf("ctx_bench: fork failed\n");
+		return 1;
+	}
+
+	if (!pid) {
+		close(ping[1]);
+		close(pong[0]);
+
+		for (i = 0; i < count; i++) {
+			read(ping[0], &c, 1);
+			write(pong[1], &c, 1);
+		}
+
+		exit(0);
+	}
+
+	close(ping[0]);
+	close(pong[1]);
+
+	start = now_us();
+
+	for (i = 0; i < count; i++) {
+		write(ping[1], &c, 1);
+		read(pong[0], &c, 1);
+	}
+
+	delta = now_us() - start;
+
+	waitpid(pid, NULL, 0);
+
+	printf("%d round trips in %llu us: %llu ns per process switch\n", count, delta,
+	       (delta * 1000ull) / (2ull * count));
+
+	return 0;
+}
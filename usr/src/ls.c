@@ -26,22 +26,26 @@
 
 /*
  * Main function of ls application.
- * The ls application is very very short and does not support any options like -l -a etc.
- * It is only possible to give a subdir name to list the directory entries of this subdir.
+ * The ls application is very very short and only supports -l, which also shows the size
+ * of the regular files (provided with the directory entries, without stat()).
+ * It is possible to give a subdir name to list the directory entries of this subdir.
  */
 int main(int argc, char **argv)
 {
 	DIR *stream;
 	struct dirent *p_entry;
-	char *dir;
+	char *dir = ".";
+	int i, long_format = 0;
 
-	if (argc == 1)
-		dir = ".";
-	else if (argc == 2)
-		dir = argv[1];
-	else {
-		printf("Usage: ls [DIR]\n");
-		exit(1);
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-l"))
+			long_format = 1;
+		else if ((argv[i][0] != '-') && !strcmp(dir, "."))
+			dir = argv[i];
+		else {
+			printf("Usage: ls [-l] [DIR]\n");
+			exit(1);
+		}
 	}
 
 	stream = opendir(dir);
@@ -53,13 +57,26 @@ int main(int argc, char **argv)
 		switch (p_entry->d_type) {
 		/* Directory entry */
 		case DT_DIR:
-			printf("%s/\n", p_entry->d_name);
+			if (long_format)
+				printf("d %10s  %s/\n", "", p_entry->d_name);
+			else
+				printf("%s/\n", p_entry->d_name);
 			break;
 
 		/* Regular entry */
 		case DT_REG:
+			if (long_format)
+				printf("- %10llu  %s\n", DIRENT_SIZE(p_entry), p_entry->d_name);
+			else
+				printf("%s\n", p_entry->d_name);
+			break;
+
+		/* Device entry */
 		case DT_CHR:
-			printf("%s\n", p_entry->d_name);
+			if (long_format)
+				printf("c %10s  %s\n", "", p_entry->d_name);
+			else
+				printf("%s\n", p_entry->d_name);
 			break;
 
 		default:
@@ -139,6 +139,16 @@ void process_cmd(void)
 		return;
 	}
 
+	if (!strcmp(tokens[0], "dumpbcache")) {
+		sys_info(7, 0);
+		return;
+	}
+
+	if (!strcmp(tokens[0], "dumpdcache")) {
+		sys_info(8, 0);
+		return;
+	}
+
 	if (!strcmp(tokens[0], "exit")) {
 		if (getpid() == 1) {
 			printf("The shell root process can not be terminated...\n");
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2025 André Costa <andre_miguel_costa@hotmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Run the self-test of the kernel memcpy/memmove/memset. The kernel must be built
+ * with CONFIG_STRING_BENCH; results are printed on the kernel console.
+ *
+ * Usage: string_bench [largest buffer size in bytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <syscall.h>
+
+int main(int argc, char *argv[])
+{
+	int size = 0;
+
+	if (argc > 1)
+		size = atoi(argv[1]);
+
+	printf("Checking the kernel string functions...\n");
+
+	sys_info(SYSINFO_TEST_STRING, size);
+
+	return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2025 André Costa <andre_miguel_costa@hotmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Measure the cost of spawning a thread. Several creator threads run
+ * concurrently, each of them creating and joining threads in a loop.
+ * The spawned threads simply return their argument, which is checked at join time.
+ * The loop is run with the stacks of the kernel, then with stacks allocated
+ * by the process.
+ *
+ * Usage: thread_bench [number of threads per creator] [number of creators]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_CREATORS 8
+
+#define STACK_SIZE (16 * 1024)
+
+static int count = 1000;
+static int own_stack;
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long) ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static void *spawned(void *arg)
+{
+	return arg;
+}
+
+static void *creator(void *arg)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	void *stack = NULL;
+	void *ret;
+	long errors = 0;
+	long i;
+
+	pthread_attr_init(&attr);
+
+	if (own_stack) {
+		stack = malloc(STACK_SIZE);
+		if (!stack)
+			return (void *) (long) count;
+
+		pthread_attr_setstack(&attr, stack, STACK_SIZE);
+	}
+
+	for (i = 1; i <= count; i++) {
+		if (pthread_create(&thread, &attr, spawned, (void *) i)) {
+			errors++;
+			continue;
+		}
+
+		pthread_join(thread, &ret);
+
+		if (ret != (void *) i)
+			errors++;
+	}
+
+	pthread_attr_destroy(&attr);
+	free(stack);
+
+	return (void *) errors;
+}
+
+static void run(int creators)
+{
+	pthread_t threads[MAX_CREATORS];
+	unsigned long long start, delta;
+	long errors = 0;
+	void *ret;
+	int i;
+
+	start = now_us();
+
+	for (i = 0; i < creators; i++)
+		pthread_create(&threads[i], NULL, creator, NULL);
+
+	for (i = 0; i < creators; i++) {
+		pthread_join(threads[i], &ret);
+		errors += (long) ret;
+	}
+
+	delta = now_us() - start;
+
+	printf("%s stacks: %d threads by %d creators in %llu us: %llu ns per thread (%ld errors)\n",
+	       (own_stack ? "process" : "kernel"), count * creators, creators, delta,
+	       (delta * 1000ull) / ((unsigned long long) count * creators), errors);
+}
+
+int main(int argc, char *argv[])
+{
+	int creators = 4;
+
+	if (argc > 1)
+		count = atoi(argv[1]);
+
+	if (argc > 2)
+		creators = atoi(argv[2]);
+
+	if (count <= 0 || creators <= 0 || creators > MAX_CREATORS) {
+		printf("Usage: thread_bench [number of threads per creator] [number of creators (max %d)]\n",
+		       MAX_CREATORS);
+		return 1;
+	}
+
+	own_stack = 0;
+	run(creators);
+
+	own_stack = 1;
+	run(creators);
+
+	return 0;
+}
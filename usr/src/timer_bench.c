@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2025 André Costa <andre_miguel_costa@hotmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Stress the kernel timer queue. The kernel must be built with CONFIG_TIMER_BENCH;
+ * results are printed on the kernel console.
+ *
+ * Usage: timer_bench [number of timers]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <syscall.h>
+
+int main(int argc, char *argv[])
+{
+	int count = 4096;
+
+	if (argc > 1)
+		count = atoi(argv[1]);
+
+	printf("Arming %d timers...\n", count);
+
+	sys_info(SYSINFO_TEST_TIMER, count);
+
+	return 0;
+}
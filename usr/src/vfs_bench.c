@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2025 André Costa <andre_miguel_costa@hotmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Measure the aggregate throughput of several threads doing I/O on
+ * unrelated pipes. Each pair of threads (a writer and a reader) streams
+ * its own pipe, so that the only shared state is the VFS itself.
+ *
+ * Usage: vfs_bench [number of pairs] [KB per pair] [pipe size in KB]
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PAIRS 8
+#define CHUNK_SIZE 512
+
+static int pipes[MAX_PAIRS][2];
+static int bytes_per_pair;
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long) ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static void *writer(void *arg)
+{
+	int fd = pipes[(long) arg][1];
+	char buf[CHUNK_SIZE];
+	int done, ret;
+
+	for (done = 0; done < bytes_per_pair; done += ret) {
+		ret = write(fd, buf, CHUNK_SIZE);
+		if (ret <= 0)
+			break;
+	}
+
+	return NULL;
+}
+
+static void *reader(void *arg)
+{
+	int fd = pipes[(long) arg][0];
+	char buf[CHUNK_SIZE];
+	int done, ret;
+
+	for (done = 0; done < bytes_per_pair; done += ret) {
+		ret = read(fd, buf, CHUNK_SIZE);
+		if (ret <= 0)
+			break;
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t threads[2 * MAX_PAIRS];
+	unsigned long long start, delta;
+	int pairs = 2, kb = 1024, pipe_kb = 0;
+	long i;
+
+	if (argc > 1)
+		pairs = atoi(argv[1]);
+	if (argc > 2)
+		kb = atoi(argv[2]);
+	if (argc > 3)
+		pipe_kb = atoi(argv[3]);
+
+	if ((pairs < 1) || (pairs > MAX_PAIRS) || (kb < 1)) {
+		printf("vfs_bench: 1 to %d pairs of threads\n", MAX_PAIRS);
+		return 1;
+	}
+
+	bytes_per_pair = kb * 1024;
+
+	for (i = 0; i < pairs; i++) {
+		if (pipe(pipes[i])) {
+			printf("vfs_bench: cannot create the pipes\n");
+			return 1;
+		}
+
+		if ((pipe_kb > 0) && (sys_fcntl(pipes[i][1], F_SETPIPE_SZ, (void *) (long) (pipe_kb * 1024)) < 0)) {
+			printf("vfs_bench: cannot set the size of the pipes\n");
+			return 1;
+		}
+	}
+
+	start = now_us();
+
+	for (i = 0; i < pairs; i++) {
+		pthread_create(&threads[2 * i], NULL, writer, (void *) i);
+		pthread_create(&threads[2 * i + 1], NULL, reader, (void *) i);
+	}
+
+	for (i = 0; i < 2 * pairs; i++)
+		pthread_join(threads[i], NULL);
+
+	delta = now_us() - start;
+
+	for (i = 0; i < pairs; i++) {
+		close(pipes[i][0]);
+		close(pipes[i][1]);
+	}
+
+	if (!delta)
+		delta = 1;
+
+	printf("%d pairs x %d KB in %llu us: %llu KB/s\n", pairs, kb, delta,
+	       ((unsigned long long) pairs * kb * 1000000ull) / delta);
+
+	return 0;
+}